@@ -0,0 +1,211 @@
+#include <thread>
+
+#include <libnet/EventLoopThread.h>
+
+#include "bench/BenchClientStub.h"
+#include "bench/LoadGenerator.h"
+
+using namespace bench;
+
+namespace
+{
+
+// 开环时检查计划发送时间的周期, 到期的请求一次全部发出
+const net::Microsecond kTickInterval = 200us;
+
+int64_t nowNs()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t toNs(net::Millisecond ms)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(ms).count();
+}
+
+}
+
+const size_t LoadGenerator::kMaxInflight;
+constexpr net::Millisecond LoadGenerator::kDrainTime;
+
+struct LoadGenerator::Session
+{
+    Session(EventLoop* loop, const InetAddress& server)
+    : stub(loop, server)
+    {}
+
+    BenchClientStub stub;
+    size_t          inflight     = 0;
+    int64_t         nextIntended = 0; // 开环: 下一个请求计划的发送时间
+};
+
+struct LoadGenerator::Worker
+{
+    // sessions 在 loop 线程中创建和使用, 析构时 thread 先退出
+    std::vector<std::unique_ptr<Session>> sessions;
+    net::EventLoopThread                  thread;
+    EventLoop*                            loop = nullptr;
+    size_t                                index = 0;       // 在 workers_ 中的下标
+    size_t                                numSessions = 0;
+};
+
+LoadGenerator::LoadGenerator(const InetAddress& server, const LoadOptions& options)
+: server_(server),
+  options_(options),
+  payload_(options.payload, 'x'),
+  measureBegin_(0),
+  measureEnd_(0),
+  interval_(0),
+  sending_(false),
+  connected_(static_cast<int>(options.connections)),
+  requests_(0),
+  errors_(0),
+  dropped_(0),
+  pending_(0)
+{
+    assert(options_.connections > 0);
+    assert(options_.depth > 0);
+    assert(options_.rate > 0);
+
+    size_t threads = std::max<size_t>(1, std::min(options_.threads, options_.connections));
+    for (size_t i = 0; i < threads; i++) {
+        workers_.push_back(std::make_unique<Worker>());
+        workers_.back()->index = i;
+    }
+    for (size_t i = 0; i < options_.connections; i++)
+        workers_[i % threads]->numSessions++;
+
+    interval_ = static_cast<int64_t>(1e9 * static_cast<double>(options_.connections) / options_.rate);
+    interval_ = std::max<int64_t>(interval_, 1);
+}
+
+LoadGenerator::~LoadGenerator() = default;
+
+LoadResult LoadGenerator::run()
+{
+    for (auto& worker: workers_) {
+        Worker* w = worker.get();
+        w->loop = w->thread.startLoop();
+        w->loop->runInLoop([this, w]{ startSessions(*w); });
+    }
+    connected_.wait();
+
+    int64_t start = nowNs();
+    measureBegin_ = start + toNs(options_.warmup);
+    measureEnd_ = measureBegin_ + toNs(options_.duration);
+    sending_ = true;
+    for (auto& worker: workers_) {
+        Worker* w = worker.get();
+        w->loop->runInLoop([this, w]{ kickoff(*w); });
+    }
+
+    std::this_thread::sleep_for(std::chrono::nanoseconds(measureEnd_ - nowNs()));
+    sending_ = false;
+
+    int64_t drainEnd = nowNs() + toNs(kDrainTime);
+    while (pending_ > 0 && nowNs() < drainEnd)
+        std::this_thread::sleep_for(10ms);
+
+    LoadResult result;
+    result.requests = requests_;
+    // 没等到回应的请求也算错误
+    result.errors = errors_ + static_cast<uint64_t>(std::max<int64_t>(pending_, 0));
+    result.dropped = dropped_;
+    result.seconds = static_cast<double>(measureEnd_ - measureBegin_) / 1e9;
+    result.latency = latency_.snapshot();
+    return result;
+}
+
+void LoadGenerator::startSessions(Worker& worker)
+{
+    for (size_t i = 0; i < worker.numSessions; i++) {
+        worker.sessions.push_back(std::make_unique<Session>(worker.loop, server_));
+        auto& stub = worker.sessions.back()->stub;
+        stub.setTcpNoDelay(options_.noDelay);
+        stub.setConnectionCallback([this](const TcpConnectionPtr& conn) {
+            if (conn->connected())
+                connected_.count();
+            else if (sending_)
+                ERROR("connection to server lost during benchmark");
+        });
+        stub.start();
+    }
+}
+
+void LoadGenerator::kickoff(Worker& worker)
+{
+    int64_t now = nowNs();
+    if (!options_.openLoop) {
+        for (auto& session: worker.sessions)
+            for (size_t i = 0; i < options_.depth; i++)
+                send(*session, now);
+        return;
+    }
+
+    // 各个连接的第一个请求错开, 整体的发送间隔是 interval_ / connections
+    for (size_t i = 0; i < worker.sessions.size(); i++) {
+        auto index = static_cast<int64_t>(worker.index + i * workers_.size());
+        auto offset = interval_ * index / static_cast<int64_t>(options_.connections);
+        worker.sessions[i]->nextIntended = now + offset;
+    }
+    worker.loop->runEvery(kTickInterval, [this, &worker]{ tick(worker); });
+}
+
+void LoadGenerator::tick(Worker& worker)
+{
+    if (!sending_)
+        return;
+    int64_t now = nowNs();
+    for (auto& session: worker.sessions) {
+        while (session->nextIntended <= now) {
+            int64_t intended = session->nextIntended;
+            session->nextIntended += interval_;
+            if (session->inflight < kMaxInflight)
+                send(*session, intended);
+            else if (inWindow(intended))
+                dropped_++;
+        }
+    }
+}
+
+void LoadGenerator::send(Session& session, int64_t intended)
+{
+    session.inflight++;
+    if (inWindow(intended))
+        pending_++;
+
+    auto cb = [this, &session, intended](json::Value& response, bool isError, bool) {
+        onResponse(session, intended, response, isError);
+    };
+    if (options_.pool && options_.stealing)
+        session.stub.EchoSteal(payload_, cb);
+    else if (options_.pool)
+        session.stub.EchoPool(payload_, cb);
+    else
+        session.stub.Echo(payload_, cb);
+}
+
+void LoadGenerator::onResponse(Session& session, int64_t intended, json::Value& response, bool isError)
+{
+    int64_t now = nowNs();
+    session.inflight--;
+
+    if (inWindow(intended)) {
+        pending_--;
+        bool ok = !isError &&
+                  response.isString() &&
+                  response.getStringView().size() == options_.payload;
+        if (ok) {
+            requests_++;
+            latency_.record(static_cast<uint64_t>(now - intended));
+        }
+        else {
+            errors_++;
+        }
+    }
+
+    // 闭环: 收到一个回应就补上一个请求, 延迟从实际发送时开始算
+    if (!options_.openLoop && sending_)
+        send(session, now);
+}
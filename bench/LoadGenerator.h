@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <libnet/Histogram.h>
+
+#include <jrpc/util.h>
+
+namespace bench
+{
+
+using namespace jrpc;
+
+struct LoadOptions
+{
+    bool             openLoop    = false;
+    size_t           connections = 1;
+    size_t           depth       = 1;     // 闭环: 每个连接同时在途的请求数
+    double           rate        = 1000;  // 开环: 所有连接合计每秒发出的请求数
+    size_t           payload     = 16;    // 请求和回应里字符串的字节数
+    bool             pool        = false; // 调用 EchoPool (在服务器的线程池里执行) 而不是 Echo
+    bool             stealing    = false; // pool 为 true 时调用 EchoSteal (在 WorkStealingPool 里执行)
+    size_t           threads     = 1;     // 客户端的 IO 线程数
+    bool             noDelay     = true;  // 客户端连接的 TCP_NODELAY
+    net::Millisecond warmup      = 1000ms;
+    net::Millisecond duration    = 5000ms;
+};
+
+struct LoadResult
+{
+    uint64_t               requests = 0; // 测量窗口内发出并且成功回应的请求
+    uint64_t               errors   = 0; // 错误的回应, 以及结束时还没有回应的请求
+    uint64_t               dropped  = 0; // 开环: 在途请求太多, 没有发出的请求
+    double                 seconds  = 0; // 测量窗口的长度
+    net::HistogramSnapshot latency;      // ns
+};
+
+/// @brief: 对 Bench 服务的负载生成器, 连接平均分配在 threads 个 IO 线程上
+///
+///         闭环 (closed loop): 每个连接保持 depth 个在途请求, 收到回应之后立即发出下一个,
+///         延迟是从发出到收到回应的时间. 服务器变慢时发送也会变慢, 适合测最大吞吐
+///
+///         开环 (open loop): 按固定的速率发出请求, 和回应是否到达无关.
+///         每个请求有一个计划的发出时间, 延迟从计划时间开始算, 而不是实际发出的时间,
+///         这样客户端自己的排队 (比如 IO 线程忙) 也算在延迟里, 修正了 coordinated omission;
+///         单个连接的在途请求超过 kMaxInflight 时不再发出, 记为 dropped, 说明服务器已经饱和
+///
+///         先预热 warmup, 再测量 duration; 只统计计划发出时间落在测量窗口里的请求,
+///         窗口结束之后最多再等待 kDrainTime 收齐这些请求的回应
+class LoadGenerator: noncopyable
+{
+public:
+    static const size_t kMaxInflight = 4096;
+    static constexpr net::Millisecond kDrainTime = 2000ms;
+
+    LoadGenerator(const InetAddress& server, const LoadOptions& options);
+    ~LoadGenerator();
+
+    // 阻塞直到测量结束, 只能调用一次.
+    // 连接不会被关闭, 调用之后进程应该直接退出
+    LoadResult run();
+
+private:
+    struct Session;
+    struct Worker;
+
+    void startSessions(Worker& worker);
+    void kickoff(Worker& worker);
+    void tick(Worker& worker);
+    void send(Session& session, int64_t intended);
+    void onResponse(Session& session, int64_t intended, json::Value& response, bool isError);
+    bool inWindow(int64_t intended) const { return intended >= measureBegin_ && intended < measureEnd_; }
+
+    InetAddress                          server_;
+    LoadOptions                          options_;
+    std::string                          payload_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    int64_t                              measureBegin_; // steady clock, ns
+    int64_t                              measureEnd_;
+    int64_t                              interval_;     // 开环: 每个连接两次请求的间隔, ns
+    std::atomic<bool>                    sending_;
+
+    net::CountDownLatch                  connected_;
+    std::atomic<uint64_t>                requests_;
+    std::atomic<uint64_t>                errors_;
+    std::atomic<uint64_t>                dropped_;
+    std::atomic<int64_t>                 pending_;      // 测量窗口里还没有回应的请求
+    net::Histogram                       latency_;
+};
+
+}
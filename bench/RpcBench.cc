@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cppJson/StringWriteStream.h>
+#include <cppJson/Writer.h>
+
+#include "bench/BenchServiceStub.h"
+#include "bench/LoadGenerator.h"
+
+using namespace jrpc;
+
+class BenchService: public BenchServiceStub<BenchService>
+{
+public:
+    explicit
+    BenchService(RpcServer& server)
+    : BenchServiceStub(server)
+    {}
+
+    void Echo(std::string payload, const UserDoneCallback& done)
+    {
+        done(json::Value(payload));
+    }
+
+    void EchoPool(std::string payload, const UserDoneCallback& done)
+    {
+        done(json::Value(payload));
+    }
+
+    void EchoSteal(std::string payload, const UserDoneCallback& done)
+    {
+        done(json::Value(payload));
+    }
+};
+
+namespace
+{
+
+struct Config
+{
+    std::vector<size_t> payloads    = {16};
+    std::vector<size_t> depths      = {1};
+    std::vector<size_t> conns       = {1};
+    std::vector<size_t> ioThreads   = {1};
+    std::vector<size_t> poolThreads = {0};
+    std::vector<bool>   stealing    = {false};
+    std::vector<bool>   openLoops   = {false};
+    double              rate        = 10000;
+    double              warmup      = 1;
+    double              duration    = 5;
+    size_t              clientThreads = 1;
+    bool                noDelay     = true;
+    uint16_t            port        = 9900;
+    std::string         connect;      // 非空时压测外部的服务器, 不启动 Bench 服务
+    bool                serve       = false;
+};
+
+// 客户端子进程通过管道交给父进程的结果, 时间单位都是 ns
+struct Summary
+{
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t dropped;
+    double   seconds;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  列表参数用逗号分隔, 对所有组合各跑一次, 每次输出一行 JSON\n"
+            "  --payload=N,...       请求和回应的字符串字节数      (16)\n"
+            "  --depth=N,...         闭环: 每个连接的在途请求数    (1)\n"
+            "  --conns=N,...         连接数                        (1)\n"
+            "  --io-threads=N,...    服务器的 IO 线程数            (1)\n"
+            "  --pool-threads=N,...  服务器的线程池线程数, >0 时调用 EchoPool (0: 调用 Echo)\n"
+            "  --pool=thread,stealing  线程池的类型, stealing 调用 EchoSteal (thread)\n"
+            "  --mode=closed,open    闭环和/或开环                 (closed)\n"
+            "  --rate=R              开环: 所有连接合计的请求/秒   (10000)\n"
+            "  --warmup=S            预热秒数                      (1)\n"
+            "  --duration=S          测量秒数                      (5)\n"
+            "  --client-threads=N    客户端的 IO 线程数            (1)\n"
+            "  --nodelay=on|off      服务器和客户端连接的 TCP_NODELAY (on)\n"
+            "  --port=P              Bench 服务的端口              (9900)\n"
+            "  --connect=HOST:PORT   压测已经在运行的服务器\n"
+            "  --serve               只启动 Bench 服务 (第一组线程参数)\n",
+            prog);
+    exit(1);
+}
+
+std::vector<size_t> parseList(const char* arg)
+{
+    std::vector<size_t> result;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        result.push_back(std::stoul(item));
+    return result;
+}
+
+Config parseArgs(int argc, char** argv)
+{
+    static const option options[] = {
+            {"payload",        required_argument, nullptr, 'p'},
+            {"depth",          required_argument, nullptr, 'd'},
+            {"conns",          required_argument, nullptr, 'c'},
+            {"io-threads",     required_argument, nullptr, 'i'},
+            {"pool-threads",   required_argument, nullptr, 't'},
+            {"pool",           required_argument, nullptr, 'k'},
+            {"mode",           required_argument, nullptr, 'm'},
+            {"rate",           required_argument, nullptr, 'r'},
+            {"warmup",         required_argument, nullptr, 'w'},
+            {"duration",       required_argument, nullptr, 'D'},
+            {"client-threads", required_argument, nullptr, 'T'},
+            {"nodelay",        required_argument, nullptr, 'n'},
+            {"port",           required_argument, nullptr, 'P'},
+            {"connect",        required_argument, nullptr, 'C'},
+            {"serve",          no_argument,       nullptr, 's'},
+            {nullptr,          0,                 nullptr, 0},
+    };
+
+    Config config;
+    int opt;
+    try {
+        while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+            switch (opt) {
+                case 'p': config.payloads = parseList(optarg); break;
+                case 'd': config.depths = parseList(optarg); break;
+                case 'c': config.conns = parseList(optarg); break;
+                case 'i': config.ioThreads = parseList(optarg); break;
+                case 't': config.poolThreads = parseList(optarg); break;
+                case 'r': config.rate = std::stod(optarg); break;
+                case 'w': config.warmup = std::stod(optarg); break;
+                case 'D': config.duration = std::stod(optarg); break;
+                case 'T': config.clientThreads = std::stoul(optarg); break;
+                case 'P': config.port = static_cast<uint16_t>(std::stoul(optarg)); break;
+                case 'C': config.connect = optarg; break;
+                case 'n': {
+                    std::string on(optarg);
+                    if (on != "on" && on != "off")
+                        usage(argv[0]);
+                    config.noDelay = on == "on";
+                    break;
+                }
+                case 's': config.serve = true; break;
+                case 'k': {
+                    config.stealing.clear();
+                    std::stringstream ss(optarg);
+                    std::string kind;
+                    while (std::getline(ss, kind, ',')) {
+                        if (kind != "thread" && kind != "stealing")
+                            usage(argv[0]);
+                        config.stealing.push_back(kind == "stealing");
+                    }
+                    break;
+                }
+                case 'm': {
+                    config.openLoops.clear();
+                    std::stringstream ss(optarg);
+                    std::string mode;
+                    while (std::getline(ss, mode, ',')) {
+                        if (mode != "closed" && mode != "open")
+                            usage(argv[0]);
+                        config.openLoops.push_back(mode == "open");
+                    }
+                    break;
+                }
+                default: usage(argv[0]);
+            }
+        }
+    }
+    catch (std::exception&) {
+        usage(argv[0]);
+    }
+    if (optind != argc || config.payloads.empty() || config.depths.empty() ||
+        config.conns.empty() || config.ioThreads.empty() || config.poolThreads.empty() ||
+        config.stealing.empty() || config.openLoops.empty() || config.rate <= 0 || config.duration <= 0 ||
+        std::count(config.ioThreads.begin(), config.ioThreads.end(), 0) > 0)
+        usage(argv[0]);
+    return config;
+}
+
+void runServer(uint16_t port, size_t ioThreads, size_t poolThreads, bool noDelay)
+{
+    EventLoop loop;
+    RpcServer server(&loop, InetAddress(port));
+    server.setNumThread(ioThreads);
+    server.setTcpNoDelay(noDelay);
+    // 线程池要在注册服务之前创建, 服务的 stub 会取 workerPool() 和 stealingPool(),
+    // 两个线程池的线程数相同, 没有被调用的那个线程池的线程都睡着
+    if (poolThreads > 0)
+        server.setWorkerThreads(poolThreads);
+    BenchService service(server);
+    server.start();
+    loop.loop();
+}
+
+pid_t forkServer(uint16_t port, size_t ioThreads, size_t poolThreads, bool noDelay)
+{
+    pid_t pid = ::fork();
+    if (pid < 0)
+        SYSFATAL("fork()");
+    if (pid == 0) {
+        runServer(port, ioThreads, poolThreads, noDelay);
+        _exit(0);
+    }
+
+    // 等到端口可以连上
+    InetAddress addr(port, true);
+    for (int i = 0; i < 500; i++) {
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int ret = ::connect(fd, addr.getSockaddr(), addr.getSocklen());
+        ::close(fd);
+        if (ret == 0)
+            return pid;
+        std::this_thread::sleep_for(10ms);
+    }
+    FATAL("bench server did not start listening on port %u", port);
+    return pid;
+}
+
+// 进程的 CPU 时间 (用户态 + 内核态), 秒
+double cpuSeconds(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/stat", pid);
+    FILE* fp = ::fopen(path, "r");
+    if (fp == nullptr)
+        return 0;
+    unsigned long utime = 0, stime = 0;
+    // 第 14, 15 个字段, 进程名里可能有空格, 从 ')' 之后开始数
+    char buf[1024];
+    size_t n = ::fread(buf, 1, sizeof buf - 1, fp);
+    ::fclose(fp);
+    buf[n] = '\0';
+    const char* p = ::strrchr(buf, ')');
+    if (p == nullptr ||
+        ::sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return 0;
+    return static_cast<double>(utime + stime) / static_cast<double>(::sysconf(_SC_CLK_TCK));
+}
+
+// 在子进程中运行 LoadGenerator, 子进程直接退出, 不用拆掉还连着的客户端
+bool runClient(const InetAddress& server, const bench::LoadOptions& options, Summary& summary)
+{
+    int fds[2];
+    if (::pipe(fds) < 0)
+        SYSFATAL("pipe()");
+
+    pid_t pid = ::fork();
+    if (pid < 0)
+        SYSFATAL("fork()");
+    if (pid == 0) {
+        ::close(fds[0]);
+        bench::LoadGenerator generator(server, options);
+        auto result = generator.run();
+        auto& latency = result.latency;
+        Summary s = {result.requests, result.errors, result.dropped, result.seconds,
+                     static_cast<uint64_t>(latency.mean()),
+                     latency.percentile(50), latency.percentile(90), latency.percentile(99),
+                     latency.percentile(99.9), latency.max};
+        ssize_t n = ::write(fds[1], &s, sizeof s);
+        _exit(n == sizeof s ? 0 : 1);
+    }
+
+    ::close(fds[1]);
+    ssize_t n = ::read(fds[0], &summary, sizeof summary);
+    ::close(fds[0]);
+    int status;
+    ::waitpid(pid, &status, 0);
+    return n == sizeof summary;
+}
+
+int64_t toInt(uint64_t value)
+{
+    return static_cast<int64_t>(value);
+}
+
+// 一次测量输出一行 JSON, 时间单位 us, 为了避免浮点数的长尾数字都取整数
+void report(const bench::LoadOptions& options,
+            size_t ioThreads,
+            size_t poolThreads,
+            bool stealing,
+            const Summary& s,
+            double serverCpu)
+{
+    json::Value line(json::TYPE_OBJECT);
+    line.addMember("mode", options.openLoop ? "open" : "closed");
+    line.addMember("io_threads", toInt(ioThreads));
+    line.addMember("pool_threads", toInt(poolThreads));
+    line.addMember("pool", poolThreads == 0 ? "inline" : stealing ? "stealing" : "thread");
+    line.addMember("connections", toInt(options.connections));
+    line.addMember("depth", toInt(options.openLoop ? 0 : options.depth));
+    line.addMember("rate", toInt(options.openLoop ? static_cast<uint64_t>(options.rate) : 0));
+    line.addMember("payload", toInt(options.payload));
+    line.addMember("nodelay", options.noDelay);
+    line.addMember("requests", toInt(s.requests));
+    line.addMember("errors", toInt(s.errors));
+    line.addMember("dropped", toInt(s.dropped));
+    line.addMember("qps", static_cast<int64_t>(static_cast<double>(s.requests) / s.seconds));
+    line.addMember("mean_us", toInt(s.mean / 1000));
+    line.addMember("p50_us", toInt(s.p50 / 1000));
+    line.addMember("p90_us", toInt(s.p90 / 1000));
+    line.addMember("p99_us", toInt(s.p99 / 1000));
+    line.addMember("p999_us", toInt(s.p999 / 1000));
+    line.addMember("max_us", toInt(s.max / 1000));
+    // 服务器占用的 CPU, 100 表示一个核, 包括预热的时间
+    line.addMember("server_cpu_pct", static_cast<int64_t>(serverCpu * 100));
+
+    json::StringWriteStream os;
+    json::Writer writer(os);
+    line.writeTo(writer);
+    std::cout << os.get() << std::endl;
+}
+
+void sweep(const Config& config, const InetAddress& server, pid_t serverPid,
+           size_t ioThreads, size_t poolThreads)
+{
+    for (bool stealing: config.stealing)
+    for (bool openLoop: config.openLoops)
+    for (size_t payload: config.payloads)
+    for (size_t conns: config.conns)
+    for (size_t depth: config.depths) {
+        // 开环时 depth 没有意义, 只跑一次; 不用线程池时线程池的类型没有意义
+        if (openLoop && depth != config.depths.front())
+            continue;
+        if (poolThreads == 0 && stealing != config.stealing.front())
+            continue;
+
+        bench::LoadOptions options;
+        options.openLoop = openLoop;
+        options.connections = conns;
+        options.depth = depth;
+        options.rate = config.rate;
+        options.payload = payload;
+        options.pool = poolThreads > 0;
+        options.stealing = stealing;
+        options.threads = config.clientThreads;
+        options.noDelay = config.noDelay;
+        options.warmup = net::Millisecond(static_cast<int64_t>(config.warmup * 1000));
+        options.duration = net::Millisecond(static_cast<int64_t>(config.duration * 1000));
+
+        Summary summary;
+        double cpuBegin = serverPid > 0 ? cpuSeconds(serverPid) : 0;
+        auto begin = std::chrono::steady_clock::now();
+        if (!runClient(server, options, summary)) {
+            ERROR("load generator failed");
+            continue;
+        }
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - begin;
+        double cpu = serverPid > 0 ? (cpuSeconds(serverPid) - cpuBegin) / wall.count() : 0;
+        report(options, ioThreads, poolThreads, stealing, summary, cpu);
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Config config = parseArgs(argc, argv);
+    ::signal(SIGPIPE, SIG_IGN);
+    setLogLevel(LOG_LEVEL_WARN);
+
+    if (config.serve) {
+        runServer(config.port, config.ioThreads.front(), config.poolThreads.front(), config.noDelay);
+        return 0;
+    }
+
+    if (!config.connect.empty()) {
+        auto colon = config.connect.rfind(':');
+        if (colon == std::string::npos)
+            usage(argv[0]);
+        InetAddress server(config.connect.substr(0, colon),
+                           static_cast<uint16_t>(std::stoul(config.connect.substr(colon + 1))));
+        for (size_t pool: config.poolThreads)
+            sweep(config, server, -1, config.ioThreads.front(), pool);
+        return 0;
+    }
+
+    // 每组服务器参数启动一个新的服务器进程, 测完就杀掉
+    InetAddress server(config.port, true);
+    for (size_t io: config.ioThreads)
+    for (size_t pool: config.poolThreads) {
+        pid_t pid = forkServer(config.port, io, pool, config.noDelay);
+        sweep(config, server, pid, io, pool);
+        ::kill(pid, SIGKILL);
+        ::waitpid(pid, nullptr, 0);
+    }
+}
@@ -40,6 +40,7 @@ int main()
     EventLoop loop;
     InetAddress addr(9877);
     ArithmeticClientStub client(&loop, addr);
+    client.setTimeout(100ms);
 
     client.setConnectionCallback([&](const TcpConnectionPtr& conn) 
                                 {
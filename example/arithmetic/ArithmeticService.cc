@@ -1,3 +1,5 @@
+#include <libnet/CpuAffinity.h>
+
 #include <example/arithmetic/ArithmeticServiceStub.h>
 
 using namespace jrpc;
@@ -7,52 +9,51 @@ class ArithmeticService: public ArithmeticServiceStub<ArithmeticService>
 public:
     explicit
     ArithmeticService(RpcServer& server)
-    : ArithmeticServiceStub(server),
-      pool_(4)
+    : ArithmeticServiceStub(server)
     { }
 
+    // spec.json 里声明了每个方法在哪里执行, 线程池的切换和出队时的超时检查都由 stub 完成
+    // Add 在共享的 ThreadPool 里按优先级执行, Mul 在共享的 WorkStealingPool 里执行,
+    // Div 在独占的 WorkStealingPool 里执行
     void Add(double lhs, double rhs, const UserDoneCallback& cb)
     {
-        pool_.runTask([=]
-                     {
-                        cb(json::Value(lhs + rhs));
-                     });
+        cb(json::Value(lhs + rhs));
     }
 
+    // Sub 直接在 IO 线程上执行, 没有线程切换
     void Sub(double lhs, double rhs, const UserDoneCallback& cb)
     {
-        pool_.runTask([=]
-                     {
-                        cb(json::Value(lhs - rhs));
-                     });
+        cb(json::Value(lhs - rhs));
     }
 
     void Mul(double lhs, double rhs, const UserDoneCallback& cb)
     {
-        pool_.runTask([=]
-                     {
-                        cb(json::Value(lhs * rhs));
-                     });
+        cb(json::Value(lhs * rhs));
     }
 
     void Div(double lhs, double rhs, const UserDoneCallback& cb)
     {
-        pool_.runTask([=]
-                     {
-                      cb(json::Value(lhs / rhs));
-                     });
+        cb(json::Value(lhs / rhs));
     }
-
-private:
-    ThreadPool pool_;
 };
 
-int main()
+// usage: arithmetic_server [cpu list]
+// e.g. "arithmetic_server 0-7" 把 IO 线程和计算线程都放在 0-7 号 CPU 上
+int main(int argc, char* argv[])
 {
+    std::vector<int> cpus;
+    if (argc > 1)
+        cpus = net::parseCpuList(argv[1]);
+
     EventLoop loop;
     InetAddress addr(9877);
 
     RpcServer rpcServer(&loop, addr);
+    rpcServer.setCpuAffinity(cpus);
+    // 多个 NUMA 节点时 worker 按节点分组并绑定, 请求在连接的 IO 线程所在的节点上处理;
+    // 只有一个节点时把 worker 绑定在和 IO 线程同样的 CPU 上
+    rpcServer.setNumaLocalWorkers(true);
+    rpcServer.setWorkerThreads(4, net::numNumaNodes() > 1 ? nullptr : net::pinToCpus(cpus));
     ArithmeticService service(rpcServer);
 
     rpcServer.start();
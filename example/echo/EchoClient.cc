@@ -23,6 +23,46 @@ void run(EchoClientStub& client)
                       << response["data"].getStringView() << "\n";
         }
     });
+
+    if (counter % 10 != 0)
+        return;
+
+    client.Repeat(str, 3,
+                  [](json::Value chunk) {
+                      std::cout << "chunk: " << chunk.getStringView() << "\n";
+                  },
+                  [](json::Value response, bool isError, bool timeout) {
+                      if (!isError) {
+                          std::cout << "repeat done: " << response.getInt32() << " chunks\n";
+                      }
+                      else if (timeout) {
+                          std::cout << "timeout\n";
+                      }
+                      else {
+                          std::cout << "response: "
+                                    << response["message"].getStringView() << ": "
+                                    << response["data"].getStringView() << "\n";
+                      }
+                  });
+
+    auto writer = client.Gather(" ",
+                                [](json::Value response, bool isError, bool timeout) {
+                                    if (!isError) {
+                                        std::cout << "gather: " << response.getStringView() << "\n";
+                                    }
+                                    else if (timeout) {
+                                        std::cout << "timeout\n";
+                                    }
+                                    else {
+                                        std::cout << "response: "
+                                                  << response["message"].getStringView() << ": "
+                                                  << response["data"].getStringView() << "\n";
+                                    }
+                                });
+    writer->write(json::Value("hello"));
+    writer->write(json::Value("RpcServer"));
+    writer->write(json::Value("+" + std::to_string(counter) + "s"));
+    writer->end();
 }
 
 int main()
@@ -30,6 +70,8 @@ int main()
     EventLoop loop;
     InetAddress serverAddr(9877);
     EchoClientStub client(&loop, serverAddr);
+    // EchoService 和客户端同一个版本, Repeat 的大回应可以分帧交错发送
+    client.setMultiplexing(true);
 
     client.setConnectionCallback([&](const TcpConnectionPtr& conn) {
         if (conn->disconnected()) {
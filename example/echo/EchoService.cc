@@ -2,6 +2,34 @@
 
 using namespace jrpc;
 
+// 把 message 分块发送 times 次, 连接到达高水位时暂停, 等 resume 再继续
+class RepeatWriter: public std::enable_shared_from_this<RepeatWriter>
+{
+public:
+    RepeatWriter(std::string message, int32_t times, const UserStreamCallback& stream)
+    : message_(std::move(message)),
+      times_(times),
+      sent_(0),
+      stream_(stream)
+    {}
+
+    void run()
+    {
+        while (sent_ < times_) {
+            sent_++;
+            if (!stream_.write(json::Value(message_), [self = shared_from_this()]{ self->run(); }))
+                return;
+        }
+        stream_(json::Value(times_));
+    }
+
+private:
+    std::string        message_;
+    int32_t            times_;
+    int32_t            sent_;
+    UserStreamCallback stream_;
+};
+
 class EchoService: public jrpc::EchoServiceStub<EchoService>
 {
 public:
@@ -14,6 +42,25 @@ public:
     {
         done(json::Value(message));
     }
+
+    void Repeat(std::string message, int32_t times, const UserStreamCallback& stream)
+    {
+        std::make_shared<RepeatWriter>(std::move(message), times, stream)->run();
+    }
+
+    // 把上传的字符串用 separator 拼接起来
+    void Gather(std::string separator, const UserUploadCallback& upload)
+    {
+        auto result = std::make_shared<std::string>();
+        upload.onUpload([=](json::Value& chunk) {
+                            if (!result->empty())
+                                result->append(separator);
+                            result->append(chunk.getStringView());
+                        },
+                        [=]() {
+                            upload(json::Value(*result));
+                        });
+    }
 };
 
 int main()
@@ -0,0 +1,209 @@
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <unordered_map>
+
+#include <cppJson/Allocator.h>
+
+using namespace json;
+
+namespace
+{
+
+const size_t kNumShards = 8;
+
+struct alignas(64) Shard
+{
+    std::atomic<int64_t>  bytes{0};
+    std::atomic<int64_t>  blocks{0};
+    std::atomic<uint64_t> allocations{0};
+};
+
+Shard shards[kNumShards];
+std::atomic<size_t> nextShard(0);
+
+Shard& shard()
+{
+    thread_local size_t index = nextShard.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+    return shards[index];
+}
+
+// 调试模式的记录, 全部由 mutex 保护
+const int kMaxFrames = 16;
+const int kSkipFrames = 2; // record() 和 detail::allocate()
+
+struct Site
+{
+    int64_t  bytes = 0;
+    int64_t  blocks = 0;
+    uint64_t allocations = 0;
+};
+
+struct Block
+{
+    Site*  site;
+    size_t bytes;
+};
+
+std::atomic<bool> tracking(false);
+std::mutex        trackMutex;
+std::unordered_map<std::string, Site> sites;  // 调用栈的地址 -> 统计
+std::unordered_map<void*, Block>      blocks;
+
+void record(void* p, size_t bytes)
+{
+    void* frames[kMaxFrames];
+    int depth = ::backtrace(frames, kMaxFrames);
+    std::string key;
+    if (depth > kSkipFrames)
+        key.assign(reinterpret_cast<const char*>(frames + kSkipFrames),
+                   static_cast<size_t>(depth - kSkipFrames) * sizeof(void*));
+
+    std::lock_guard<std::mutex> guard(trackMutex);
+    if (!tracking.load(std::memory_order_relaxed))
+        return;
+    auto& site = sites[key];
+    site.bytes += static_cast<int64_t>(bytes);
+    site.blocks++;
+    site.allocations++;
+    blocks[p] = { &site, bytes };
+}
+
+void forget(void* p)
+{
+    std::lock_guard<std::mutex> guard(trackMutex);
+    auto it = blocks.find(p);
+    // 打开调试模式之前分配的
+    if (it == blocks.end())
+        return;
+    it->second.site->bytes -= static_cast<int64_t>(it->second.bytes);
+    it->second.site->blocks--;
+    blocks.erase(it);
+}
+
+// "binary(_ZN4json5Value9addMemberEOS0_S1_+0x1a) [0x...]" -> "json::Value::addMember(json::Value&&, json::Value&&)"
+std::string functionName(const char* symbol)
+{
+    std::string line(symbol);
+    auto begin = line.find('(');
+    auto end = line.find_first_of("+)", begin);
+    if (begin == std::string::npos || end == std::string::npos || end == begin + 1)
+        return line;
+    std::string mangled = line.substr(begin + 1, end - begin - 1);
+    int status = 0;
+    char* name = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+    std::string result = status == 0 && name != nullptr ? name : mangled;
+    free(name);
+    return result;
+}
+
+// 分配器和容器内部的函数对找到分配点没有帮助; 模板函数的名字前面可能有返回类型
+bool isInternal(const std::string& name)
+{
+    auto internal = [](std::string_view str)
+    {
+        for (std::string_view prefix: { "std::", "__gnu_cxx::", "json::detail::", "json::Allocator<" })
+            if (str.substr(0, prefix.size()) == prefix)
+                return true;
+        return false;
+    };
+    std::string_view str(name);
+    auto space = str.find(' ');
+    return internal(str) || (space != std::string_view::npos && internal(str.substr(space + 1)));
+}
+
+}
+
+MemoryUsage json::memoryUsage()
+{
+    MemoryUsage usage;
+    for (auto& s: shards) {
+        usage.bytes += s.bytes.load(std::memory_order_relaxed);
+        usage.blocks += s.blocks.load(std::memory_order_relaxed);
+        usage.allocations += s.allocations.load(std::memory_order_relaxed);
+    }
+    return usage;
+}
+
+void json::setAllocationTracking(bool enabled)
+{
+    if (enabled) {
+        // backtrace() 第一次调用时会加载 libgcc
+        void* frames[1];
+        ::backtrace(frames, 1);
+    }
+    std::lock_guard<std::mutex> guard(trackMutex);
+    tracking.store(enabled, std::memory_order_relaxed);
+    if (!enabled) {
+        sites.clear();
+        blocks.clear();
+    }
+}
+
+bool json::allocationTracking()
+{
+    return tracking.load(std::memory_order_relaxed);
+}
+
+std::vector<AllocationSite> json::allocationSites(size_t limit)
+{
+    std::vector<std::pair<std::string, Site>> copy;
+    {
+        std::lock_guard<std::mutex> guard(trackMutex);
+        for (auto& [key, site]: sites)
+            if (site.blocks > 0)
+                copy.emplace_back(key, site);
+    }
+    std::sort(copy.begin(), copy.end(),
+              [](const auto& lhs, const auto& rhs) { return lhs.second.bytes > rhs.second.bytes; });
+    if (copy.size() > limit)
+        copy.resize(limit);
+
+    std::vector<AllocationSite> result;
+    for (auto& [key, site]: copy) {
+        std::vector<void*> frames(key.size() / sizeof(void*));
+        std::copy(key.begin(), key.end(), reinterpret_cast<char*>(frames.data()));
+
+        AllocationSite s;
+        s.bytes = site.bytes;
+        s.blocks = site.blocks;
+        s.allocations = site.allocations;
+        char** symbols = ::backtrace_symbols(frames.data(), static_cast<int>(frames.size()));
+        for (size_t i = 0; symbols != nullptr && i < frames.size(); i++) {
+            auto name = functionName(symbols[i]);
+            if (!isInternal(name))
+                s.stack.push_back(std::move(name));
+        }
+        free(symbols);
+        result.push_back(std::move(s));
+    }
+    return result;
+}
+
+void* detail::allocate(size_t bytes)
+{
+    void* p = ::operator new(bytes);
+    auto& s = shard();
+    s.bytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    s.blocks.fetch_add(1, std::memory_order_relaxed);
+    s.allocations.fetch_add(1, std::memory_order_relaxed);
+    if (tracking.load(std::memory_order_relaxed))
+        record(p, bytes);
+    return p;
+}
+
+void detail::deallocate(void* p, size_t bytes)
+{
+    if (tracking.load(std::memory_order_relaxed))
+        forget(p);
+    auto& s = shard();
+    s.bytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    s.blocks.fetch_sub(1, std::memory_order_relaxed);
+    ::operator delete(p);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace json
+{
+
+/// @brief: Value 的字符串, 数组, 对象节点和它们内部的 vector 都从这里分配, 所以 DOM 占用的内存可以随时读取
+///         计数按线程分片, 一直打开
+struct MemoryUsage
+{
+    int64_t  bytes       = 0; // 还没有释放的字节数
+    int64_t  blocks      = 0; // 还没有释放的分配次数
+    uint64_t allocations = 0; // 累计的分配次数
+};
+
+MemoryUsage memoryUsage();
+
+/// @brief: 调试模式, 记录每一次分配的调用栈, 按调用栈统计还没有释放的内存, 用来查找泄漏和膨胀
+///         每次分配和释放都要加锁并取调用栈, 很慢, 只在排查问题时打开; 关闭时丢弃已经记录的数据
+///         打开之前分配的内存不会出现在统计中
+void setAllocationTracking(bool enabled);
+bool allocationTracking();
+
+struct AllocationSite
+{
+    std::vector<std::string> stack;  // 从分配点开始向外, 已经去掉分配器和标准库内部的函数
+    int64_t                  bytes       = 0;
+    int64_t                  blocks      = 0;
+    uint64_t                 allocations = 0;
+};
+
+// 还没有释放的字节数最多的 limit 个分配点, 从多到少; 需要用 -rdynamic 链接才有函数名
+std::vector<AllocationSite> allocationSites(size_t limit);
+
+namespace detail
+{
+
+void* allocate(size_t bytes);
+void  deallocate(void* p, size_t bytes);
+
+}
+
+template <typename T>
+class Allocator
+{
+public:
+    using value_type = T;
+
+    Allocator() = default;
+
+    template <typename U>
+    Allocator(const Allocator<U>&)
+    { }
+
+    T* allocate(size_t n)
+    { return static_cast<T*>(detail::allocate(n * sizeof(T))); }
+
+    void deallocate(T* p, size_t n)
+    { detail::deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const Allocator<U>&) const
+    { return true; }
+
+    template <typename U>
+    bool operator!=(const Allocator<U>&) const
+    { return false; }
+};
+
+}
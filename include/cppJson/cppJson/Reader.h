@@ -1,11 +1,13 @@
 #pragma once
 
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
 
 #include <string>
 #include <vector>
 #include <variant>
+#include <stdexcept>
 #include <memory>
 
 #include <cppJson/Exception.h>
@@ -181,12 +183,19 @@ private:
         try {
             if (expectType == TYPE_DOUBLE) {
                 char* tail=nullptr;
+                errno = 0;
                 double d = ::strtod(&*start, &tail);
                 assert(tail == &*end);
+                // strtod/strtol 溢出时不抛异常, 只设置 ERANGE; 下溢 (结果接近 0) 不算错误
+                if (errno == ERANGE && (d == HUGE_VAL || d == -HUGE_VAL))
+                    throw std::out_of_range("double overflow");
                 CALL(handler.Double(d));
             }
             else {
+                errno = 0;
                 int64_t i64 = ::strtol(&*start, nullptr, 10);
+                if (errno == ERANGE)
+                    throw std::out_of_range("int64_t overflow");
                 if (expectType == TYPE_INT64)
                 {
                     CALL(handler.Int64(i64));
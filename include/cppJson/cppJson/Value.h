@@ -9,6 +9,7 @@
 #include <memory>
 #include <atomic>
 
+#include <cppJson/Allocator.h>
 #include <cppJson/noncopyable.h>
 
 namespace json
@@ -34,8 +35,8 @@ class Value
 {
     friend class Document;
 public:
-    using MemberIterator      = std::vector<Member>::iterator;
-    using ConstMemberIterator = std::vector<Member>::const_iterator;
+    using MemberIterator      = std::vector<Member, Allocator<Member>>::iterator;
+    using ConstMemberIterator = std::vector<Member, Allocator<Member>>::const_iterator;
 
 public:
     explicit Value(ValueType type = TYPE_NULL);
@@ -269,6 +270,13 @@ private:
         ~AddRefCount()
         { assert(refCount == 0); }
 
+        // 节点本身也计入 memoryUsage()
+        static void* operator new(size_t size)
+        { return detail::allocate(size); }
+
+        static void operator delete(void* p, size_t size)
+        { detail::deallocate(p, size); }
+
         int incrAndGet()
         {
             assert(refCount > 0);
@@ -285,9 +293,9 @@ private:
         T data;
     };
     
-    using SharedString = AddRefCount<std::vector<char>>;
-    using SharedArray  = AddRefCount<std::vector<Value>>;
-    using SharedObject = AddRefCount<std::vector<Member>>;
+    using SharedString = AddRefCount<std::vector<char,   Allocator<char>>>;
+    using SharedArray  = AddRefCount<std::vector<Value,  Allocator<Value>>>;
+    using SharedObject = AddRefCount<std::vector<Member, Allocator<Member>>>;
 
     union {
         bool           b_;
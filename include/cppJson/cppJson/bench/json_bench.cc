@@ -0,0 +1,556 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cppJson/Document.h>
+#include <cppJson/PrettyWriter.h>
+#include <cppJson/StringReadStream.h>
+#include <cppJson/StringWriteStream.h>
+#include <cppJson/Writer.h>
+
+using namespace json;
+
+/// 替换全局的 operator new/delete, 统计每个文档的分配次数和字节数; 只在单线程中使用
+namespace
+{
+
+size_t gNumAllocs = 0;
+size_t gAllocBytes = 0;
+
+}
+
+void* operator new(size_t size)
+{
+    gNumAllocs++;
+    gAllocBytes += size;
+    void* p = ::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    ::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    ::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    ::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    ::free(p);
+}
+
+namespace
+{
+
+/// @brief: 只接收事件不做任何事的 handler, 用来单独测 Reader 的解析速度
+struct NullHandler
+{
+    bool Null()                  { return true; }
+    bool Bool(bool)              { return true; }
+    bool Int32(int32_t)          { return true; }
+    bool Int64(int64_t)          { return true; }
+    bool Double(double)          { return true; }
+    bool String(std::string_view) { return true; }
+    bool StartObject()           { return true; }
+    bool Key(std::string_view)   { return true; }
+    bool EndObject()             { return true; }
+    bool StartArray()            { return true; }
+    bool EndArray()              { return true; }
+};
+
+struct Corpus
+{
+    std::string name;
+    std::string json;
+};
+
+/// 语料按固定的种子生成, 每次运行的内容都一样; 形状模仿 nativejson-benchmark 的几个标准文件:
+///   twitter:  大量短字符串 (含中文和转义字符), 对象嵌套, 少量数字
+///   canada:   GeoJSON, 几乎全是浮点数坐标的深层数组
+///   citm:     以整数为主的对象和数组, key 很短且重复
+///   rpc_*:    jrpc 收发的 JSON-RPC 请求和回应
+class Generator
+{
+public:
+    explicit Generator(uint64_t seed)
+    : rng_(seed)
+    {}
+
+    uint64_t next(uint64_t n) { return rng_() % n; }
+
+    double uniform(double lo, double hi)
+    {
+        return lo + (hi - lo) * static_cast<double>(rng_() >> 11) / static_cast<double>(1ull << 53);
+    }
+
+    std::string word()
+    {
+        static const char* const words[] = {
+                "hello", "world", "json", "rpc", "server", "latency", "parse", "buffer",
+                "你好", "世界", "性能", "测试", "\"quoted\"", "tab\there", "line\nbreak", "slash/",
+        };
+        return words[next(sizeof words / sizeof words[0])];
+    }
+
+    std::string sentence(size_t words)
+    {
+        std::string s;
+        for (size_t i = 0; i < words; i++) {
+            if (i > 0)
+                s += ' ';
+            s += word();
+        }
+        return s;
+    }
+
+private:
+    std::mt19937_64 rng_;
+};
+
+std::string serialize(const Value& value)
+{
+    StringWriteStream os;
+    Writer writer(os);
+    value.writeTo(writer);
+    return std::string(os.get());
+}
+
+std::string makeTwitter()
+{
+    Generator gen(1);
+    Value statuses(TYPE_ARRAY);
+    for (int i = 0; i < 600; i++) {
+        Value user(TYPE_OBJECT);
+        user.addMember("id", static_cast<int64_t>(1186275104 + gen.next(1u << 30)));
+        user.addMember("name", gen.sentence(2));
+        user.addMember("screen_name", gen.word());
+        user.addMember("location", gen.sentence(1));
+        user.addMember("description", gen.sentence(12));
+        user.addMember("url", Value(TYPE_NULL));
+        user.addMember("protected", false);
+        user.addMember("followers_count", static_cast<int32_t>(gen.next(100000)));
+        user.addMember("friends_count", static_cast<int32_t>(gen.next(5000)));
+        user.addMember("created_at", "Mon Apr 29 10:04:51 +0000 2013");
+        user.addMember("profile_background_color", "C0DEED");
+        user.addMember("profile_image_url", "http://a0.twimg.com/profile_images/3/normal.jpeg");
+        user.addMember("verified", gen.next(10) == 0);
+
+        Value hashtags(TYPE_ARRAY);
+        for (uint64_t j = gen.next(4); j > 0; j--) {
+            Value tag(TYPE_OBJECT);
+            tag.addMember("text", gen.word());
+            Value indices(TYPE_ARRAY);
+            indices.addValue(static_cast<int32_t>(gen.next(100)));
+            indices.addValue(static_cast<int32_t>(gen.next(140)));
+            tag.addMember("indices", std::move(indices));
+            hashtags.addValue(std::move(tag));
+        }
+        Value entities(TYPE_OBJECT);
+        entities.addMember("hashtags", std::move(hashtags));
+        entities.addMember("urls", Value(TYPE_ARRAY));
+        entities.addMember("user_mentions", Value(TYPE_ARRAY));
+
+        Value status(TYPE_OBJECT);
+        status.addMember("created_at", "Sun Aug 31 00:29:15 +0000 2014");
+        status.addMember("id", static_cast<int64_t>(505874924095815681 + i));
+        status.addMember("id_str", std::to_string(505874924095815681 + i));
+        status.addMember("text", gen.sentence(20));
+        status.addMember("source", "<a href=\"http://twitter.com/download/iphone\" rel=\"nofollow\">Twitter for iPhone</a>");
+        status.addMember("truncated", false);
+        status.addMember("in_reply_to_status_id", Value(TYPE_NULL));
+        status.addMember("user", std::move(user));
+        status.addMember("geo", Value(TYPE_NULL));
+        status.addMember("retweet_count", static_cast<int32_t>(gen.next(1000)));
+        status.addMember("favorite_count", static_cast<int32_t>(gen.next(1000)));
+        status.addMember("entities", std::move(entities));
+        status.addMember("favorited", false);
+        status.addMember("lang", "zh");
+        statuses.addValue(std::move(status));
+    }
+
+    Value metadata(TYPE_OBJECT);
+    metadata.addMember("completed_in", 0.087);
+    metadata.addMember("max_id", static_cast<int64_t>(505874924095815681));
+    metadata.addMember("query", "%E4%B8%80");
+    metadata.addMember("count", 600);
+
+    Value root(TYPE_OBJECT);
+    root.addMember("statuses", std::move(statuses));
+    root.addMember("search_metadata", std::move(metadata));
+    return serialize(root);
+}
+
+std::string makeCanada()
+{
+    Generator gen(2);
+    Value coordinates(TYPE_ARRAY);
+    for (int ring = 0; ring < 480; ring++) {
+        Value points(TYPE_ARRAY);
+        double lon = gen.uniform(-140, -55);
+        double lat = gen.uniform(42, 80);
+        for (int i = 0; i < 117; i++) {
+            lon += gen.uniform(-0.01, 0.01);
+            lat += gen.uniform(-0.01, 0.01);
+            Value point(TYPE_ARRAY);
+            point.addValue(lon);
+            point.addValue(lat);
+            points.addValue(std::move(point));
+        }
+        coordinates.addValue(std::move(points));
+    }
+
+    Value geometry(TYPE_OBJECT);
+    geometry.addMember("type", "Polygon");
+    geometry.addMember("coordinates", std::move(coordinates));
+    Value properties(TYPE_OBJECT);
+    properties.addMember("name", "Canada");
+    Value feature(TYPE_OBJECT);
+    feature.addMember("type", "Feature");
+    feature.addMember("properties", std::move(properties));
+    feature.addMember("geometry", std::move(geometry));
+    Value features(TYPE_ARRAY);
+    features.addValue(std::move(feature));
+
+    Value root(TYPE_OBJECT);
+    root.addMember("type", "FeatureCollection");
+    root.addMember("features", std::move(features));
+    return serialize(root);
+}
+
+std::string makeCitm()
+{
+    Generator gen(3);
+    auto id = [&]{ return static_cast<int32_t>(100000000 + gen.next(300000000)); };
+
+    Value areaNames(TYPE_OBJECT);
+    for (int i = 0; i < 20; i++)
+        areaNames.addMember(Value(std::to_string(205705993 + i)), Value(gen.sentence(2)));
+
+    Value events(TYPE_OBJECT);
+    for (int i = 0; i < 180; i++) {
+        Value event(TYPE_OBJECT);
+        event.addMember("description", Value(TYPE_NULL));
+        event.addMember("id", 138586341 + i);
+        event.addMember("logo", gen.next(2) ? Value("/images/UE0AAAAACEKo6QAAAAZDSVRN") : Value(TYPE_NULL));
+        event.addMember("name", gen.sentence(3));
+        Value subTopicIds(TYPE_ARRAY);
+        for (uint64_t j = 1 + gen.next(4); j > 0; j--)
+            subTopicIds.addValue(id());
+        event.addMember("subTopicIds", std::move(subTopicIds));
+        event.addMember("subjectCode", Value(TYPE_NULL));
+        event.addMember("subtitle", Value(TYPE_NULL));
+        Value topicIds(TYPE_ARRAY);
+        topicIds.addValue(id());
+        event.addMember("topicIds", std::move(topicIds));
+        events.addMember(Value(std::to_string(138586341 + i)), std::move(event));
+    }
+
+    Value performances(TYPE_ARRAY);
+    for (int i = 0; i < 2400; i++) {
+        Value prices(TYPE_ARRAY);
+        Value seatCategories(TYPE_ARRAY);
+        for (uint64_t j = 1 + gen.next(4); j > 0; j--) {
+            int32_t category = id();
+            Value price(TYPE_OBJECT);
+            price.addMember("amount", static_cast<int32_t>(gen.next(200000)));
+            price.addMember("audienceSubCategoryId", 337100890);
+            price.addMember("seatCategoryId", category);
+            prices.addValue(std::move(price));
+
+            Value areas(TYPE_ARRAY);
+            for (uint64_t k = 1 + gen.next(3); k > 0; k--) {
+                Value area(TYPE_OBJECT);
+                area.addMember("areaId", 205705993 + static_cast<int32_t>(gen.next(20)));
+                area.addMember("blockIds", Value(TYPE_ARRAY));
+                areas.addValue(std::move(area));
+            }
+            Value seatCategory(TYPE_OBJECT);
+            seatCategory.addMember("areas", std::move(areas));
+            seatCategory.addMember("seatCategoryId", category);
+            seatCategories.addValue(std::move(seatCategory));
+        }
+
+        Value performance(TYPE_OBJECT);
+        performance.addMember("eventId", 138586341 + static_cast<int32_t>(gen.next(180)));
+        performance.addMember("id", 339887544 + i);
+        performance.addMember("logo", Value(TYPE_NULL));
+        performance.addMember("name", Value(TYPE_NULL));
+        performance.addMember("prices", std::move(prices));
+        performance.addMember("seatCategories", std::move(seatCategories));
+        performance.addMember("seatMapImage", Value(TYPE_NULL));
+        performance.addMember("start", static_cast<int64_t>(1372701600000 + 86400000ll * i));
+        performance.addMember("venueCode", "PLEYEL_PLEYEL");
+        performances.addValue(std::move(performance));
+    }
+
+    Value root(TYPE_OBJECT);
+    root.addMember("areaNames", std::move(areaNames));
+    root.addMember("events", std::move(events));
+    root.addMember("performances", std::move(performances));
+    return serialize(root);
+}
+
+std::string makeRpcRequest()
+{
+    Value params(TYPE_OBJECT);
+    params.addMember("lhs", 10086.9527);
+    params.addMember("rhs", 42);
+    Value call(TYPE_OBJECT);
+    call.addMember("jsonrpc", "2.0");
+    call.addMember("method", "Arithmetic.Add");
+    call.addMember("params", std::move(params));
+    call.addMember("id", static_cast<int64_t>(1234567));
+    return serialize(call);
+}
+
+std::string makeRpcResponse(size_t payload)
+{
+    Value response(TYPE_OBJECT);
+    response.addMember("jsonrpc", "2.0");
+    response.addMember("result", std::string(payload, 'x'));
+    response.addMember("id", static_cast<int64_t>(1234567));
+    return serialize(response);
+}
+
+std::string makeRpcBatch()
+{
+    Value batch(TYPE_ARRAY);
+    for (int i = 0; i < 64; i++) {
+        Value params(TYPE_ARRAY);
+        params.addValue(i);
+        params.addValue("hello RpcServer");
+        Value call(TYPE_OBJECT);
+        call.addMember("jsonrpc", "2.0");
+        call.addMember("method", "Echo.Echo");
+        call.addMember("params", std::move(params));
+        call.addMember("id", i);
+        batch.addValue(std::move(call));
+    }
+    return serialize(batch);
+}
+
+/// 一个操作的测量结果, 按输入文档的大小算吞吐
+struct Result
+{
+    size_t iterations = 0;
+    double seconds    = 0;
+    size_t allocs     = 0;
+    size_t allocBytes = 0;
+};
+
+/// @brief: 只累计 start() 和 stop() 之间的时间和分配, 准备和清理的部分不计入
+class Stopwatch
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Stopwatch(Result& result)
+    : result_(result)
+    {}
+
+    void start()
+    {
+        allocs_ = gNumAllocs;
+        bytes_ = gAllocBytes;
+        begin_ = Clock::now();
+    }
+
+    void stop()
+    {
+        auto end = Clock::now();
+        result_.seconds += std::chrono::duration<double>(end - begin_).count();
+        result_.allocs += gNumAllocs - allocs_;
+        result_.allocBytes += gAllocBytes - bytes_;
+    }
+
+private:
+    Result&           result_;
+    Clock::time_point begin_;
+    size_t            allocs_ = 0;
+    size_t            bytes_  = 0;
+};
+
+/// @brief: 重复执行 op 直到计时超过 minSeconds, 至少执行 3 次
+template <typename Op>
+Result measure(double minSeconds, Op&& op)
+{
+    Result warmup;
+    Stopwatch ignored(warmup);
+    op(ignored);
+
+    Result result;
+    Stopwatch watch(result);
+    while (result.iterations < 3 || result.seconds < minSeconds) {
+        op(watch);
+        result.iterations++;
+    }
+    return result;
+}
+
+void report(const Corpus& corpus, const char* op, const Result& r)
+{
+    double mbps = static_cast<double>(corpus.json.size()) * static_cast<double>(r.iterations) /
+                  r.seconds / (1024 * 1024);
+    double us = r.seconds / static_cast<double>(r.iterations) * 1e6;
+    printf("%-14s %10zu  %-8s %10.2f %12.2f %12.1f %14.1f\n",
+           corpus.name.c_str(), corpus.json.size(), op, mbps, us,
+           static_cast<double>(r.allocs) / static_cast<double>(r.iterations),
+           static_cast<double>(r.allocBytes) / static_cast<double>(r.iterations));
+}
+
+// 解析再写出两次, 第二次的输出必须和第一次一样, 否则 Writer 和 Reader 之间有不一致
+bool roundtrip(const Corpus& corpus)
+{
+    Document doc;
+    if (doc.parse(corpus.json) != PARSE_OK) {
+        fprintf(stderr, "%s: parse error: %s\n", corpus.name.c_str(), parseErrorStr(doc.parse(corpus.json)));
+        return false;
+    }
+    std::string first = serialize(doc);
+    Document again;
+    if (again.parse(first) != PARSE_OK || serialize(again) != first) {
+        fprintf(stderr, "%s: roundtrip mismatch\n", corpus.name.c_str());
+        return false;
+    }
+    return true;
+}
+
+void run(const Corpus& corpus, double minSeconds)
+{
+    const std::string& json = corpus.json;
+    Document doc;
+    doc.parse(json);
+
+    report(corpus, "parse", measure(minSeconds, [&](Stopwatch& watch) {
+        watch.start();
+        StringReadStream is(json);
+        NullHandler handler;
+        Reader::parse(is, handler);
+        watch.stop();
+    }));
+
+    report(corpus, "build", measure(minSeconds, [&](Stopwatch& watch) {
+        Document d;
+        watch.start();
+        d.parse(json);
+        watch.stop();
+    }));
+
+    report(corpus, "write", measure(minSeconds, [&](Stopwatch& watch) {
+        watch.start();
+        StringWriteStream os;
+        Writer writer(os);
+        doc.writeTo(writer);
+        watch.stop();
+    }));
+
+    report(corpus, "pretty", measure(minSeconds, [&](Stopwatch& watch) {
+        watch.start();
+        StringWriteStream os;
+        PrettyWriter writer(os);
+        doc.writeTo(writer);
+        watch.stop();
+    }));
+
+    // Value 的拷贝构造只增加引用计数, 深拷贝要把事件重新喂给一个 Document
+    report(corpus, "copy", measure(minSeconds, [&](Stopwatch& watch) {
+        Document copy;
+        watch.start();
+        doc.writeTo(copy);
+        watch.stop();
+    }));
+
+    report(corpus, "destroy", measure(minSeconds, [&](Stopwatch& watch) {
+        auto tree = std::make_unique<Document>();
+        doc.writeTo(*tree);
+        watch.start();
+        tree.reset();
+        watch.stop();
+    }));
+}
+
+std::string readFile(const char* path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(1);
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t seconds] [-f filter] [file.json ...]\n"
+            "  -t  每个操作最少运行的秒数 (0.5)\n"
+            "  -f  只测名字包含 filter 的语料\n"
+            "  file.json 额外的语料, 例如 nativejson-benchmark 的 data/*.json\n",
+            prog);
+    exit(1);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    double minSeconds = 0.5;
+    std::string filter;
+    std::vector<Corpus> corpora = {
+            {"twitter",     makeTwitter()},
+            {"canada",      makeCanada()},
+            {"citm",        makeCitm()},
+            {"rpc_request", makeRpcRequest()},
+            {"rpc_resp_4k", makeRpcResponse(4096)},
+            {"rpc_batch",   makeRpcBatch()},
+    };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            minSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (argv[i][0] == '-')
+            usage(argv[0]);
+        else {
+            std::string name = argv[i];
+            name = name.substr(name.find_last_of('/') + 1);
+            corpora.push_back({name, readFile(argv[i])});
+        }
+    }
+
+    printf("%-14s %10s  %-8s %10s %12s %12s %14s\n",
+           "corpus", "bytes", "op", "MB/s", "us/doc", "allocs/doc", "alloc B/doc");
+    for (auto& corpus: corpora) {
+        if (corpus.name.find(filter) == std::string::npos)
+            continue;
+        if (!roundtrip(corpus))
+            return 1;
+        run(corpus, minSeconds);
+    }
+}
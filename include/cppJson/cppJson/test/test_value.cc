@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <cppJson/Allocator.h>
 #include <cppJson/Document.h>
 
 using namespace json;
@@ -244,6 +245,23 @@ TEST(json_value, object)
     EXPECT_EQ(obj["3"].getInt32(), 3);
 }
 
+TEST(json_value, memory_usage)
+{
+    auto before = memoryUsage();
+    {
+        Document doc;
+        ParseError err = doc.parse("{\"s\":\"abc\",\"a\":[1,2,3]}");
+        EXPECT_EQ(err, PARSE_OK);
+        auto during = memoryUsage();
+        EXPECT_GT(during.bytes, before.bytes);
+        EXPECT_GT(during.blocks, before.blocks);
+        EXPECT_GT(during.allocations, before.allocations);
+    }
+    auto after = memoryUsage();
+    EXPECT_EQ(after.bytes, before.bytes);
+    EXPECT_EQ(after.blocks, before.blocks);
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -59,6 +59,14 @@ void Acceptor::listen()
 }
 
 
+void Acceptor::setIncomingCpu(int cpu)
+{
+  assert(!listening_);
+  int ret = ::setsockopt(listenFd_, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+  if (ret == -1)
+      SYSERR("Acceptor::setsockopt() SO_INCOMING_CPU %d", cpu);
+}
+
 Acceptor::~Acceptor()
 {
   assert(listening_);
@@ -18,6 +18,8 @@ public:
   ~Acceptor();
 
   void listen();  
+  // SO_INCOMING_CPU: 多个 SO_REUSEPORT 的监听 socket 中, 内核优先选择和网卡中断所在 CPU 相同的那个
+  void setIncomingCpu(int cpu);
   
   bool listening() const { return listening_; }
   
@@ -9,21 +9,117 @@
 
 
 #include <cerrno>
+#include <stdlib.h>
 #include <sys/uio.h>
 
+#include <libnet/Logger.h>
+#include <libnet/MemoryCounter.h>
+#include <libnet/SlabPool.h>
 #include <libnet/Buffer.h>
 
 // from muduo:Buffer
 
 using namespace net;
 
+namespace
+{
+
+// malloc 的缓冲区, slab 由 SlabPool 统计
+MemoryCounter bufferMemory("buffer");
+
+}
+
 const char Buffer::kCRLF[] = "\r\n";
 
 const size_t Buffer::kCheapPrepend;
 const size_t Buffer::kInitialSize;
 
+Buffer::Buffer(size_t initialSize)
+        : data_(static_cast<char *>(::malloc(kCheapPrepend + initialSize))),
+          capacity_(kCheapPrepend + initialSize),
+          pool_(nullptr),
+          pooled_(false),
+          readerIndex_(kCheapPrepend),
+          writerIndex_(kCheapPrepend)
+{
+    if (data_ == nullptr)
+        SYSFATAL("Buffer::malloc()");
+    bufferMemory.add(capacity_);
+    assert(readableBytes() == 0);
+    assert(writableBytes() == initialSize);
+    assert(prependableBytes() == kCheapPrepend);
+}
+
+Buffer::Buffer(SlabPool* pool)
+        : data_(nullptr),
+          capacity_(0),
+          pool_(pool),
+          pooled_(false),
+          readerIndex_(0),
+          writerIndex_(0)
+{
+}
+
+Buffer::~Buffer()
+{
+    freeStorage();
+}
+
+void Buffer::release()
+{
+    assert(readableBytes() == 0);
+    freeStorage();
+    data_ = nullptr;
+    capacity_ = 0;
+    readerIndex_ = 0;
+    writerIndex_ = 0;
+}
+
+void Buffer::freeStorage()
+{
+    if (pooled_) {
+        pool_->deallocate(data_);
+    }
+    else if (data_ != nullptr) {
+        ::free(data_);
+        bufferMemory.sub(capacity_);
+    }
+    pooled_ = false;
+}
+
+void Buffer::grow(size_t len)
+{
+    size_t readable = readableBytes();
+    size_t capacity = std::max(kCheapPrepend + readable + len, 2 * capacity_);
+    bool pooled = pool_ != nullptr && capacity <= SlabPool::kSlabSize;
+    char *data;
+    if (pooled) {
+        capacity = SlabPool::kSlabSize;
+        data = static_cast<char *>(pool_->allocate());
+    }
+    else {
+        data = static_cast<char *>(::malloc(capacity));
+        if (data == nullptr)
+            SYSFATAL("Buffer::malloc() %lu bytes", capacity);
+        bufferMemory.add(capacity);
+    }
+    if (readable > 0)
+        ::memcpy(data + kCheapPrepend, peek(), readable);
+
+    freeStorage();
+    data_ = data;
+    capacity_ = capacity;
+    pooled_ = pooled;
+    readerIndex_ = kCheapPrepend;
+    writerIndex_ = kCheapPrepend + readable;
+}
+
 ssize_t Buffer::readFd(int fd, int* savedErrno)
 {
+    // 空闲之后第一次读, 先拿一个 slab, 多数消息直接读进去, 不需要再从 extrabuf 复制
+    if (data_ == nullptr && pool_ != nullptr)
+        grow(0);
+
     char extrabuf[65536];
     struct iovec vec[2];
     const size_t writable = writableBytes();
@@ -41,7 +137,7 @@ ssize_t Buffer::readFd(int fd, int* savedErrno)
     else if (static_cast<size_t>(n) <= writable)
         writerIndex_ += n;
     else {
-        writerIndex_ = buffer_.size();
+        writerIndex_ = capacity_;
         append(extrabuf, n - writable);
     }
     return n;
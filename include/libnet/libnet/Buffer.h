@@ -18,42 +18,50 @@
 #define src_BUFFER_H
 
 #include <algorithm>
-#include <vector>
 #include <string>
+#include <string_view>
 #include <assert.h>
 #include <cstring>
 
+#include <libnet/noncopyable.h>
+
 namespace net
 {
 
-class Buffer
+class SlabPool;
+
+class Buffer: noncopyable
 {
 public:
     static const size_t kCheapPrepend = 8;
     static const size_t kInitialSize = 1024;
 
-    explicit Buffer(size_t initialSize = kInitialSize)
-            : buffer_(kCheapPrepend + initialSize),
-              readerIndex_(kCheapPrepend),
-              writerIndex_(kCheapPrepend)
-    {
-        assert(readableBytes() == 0);
-        assert(writableBytes() == initialSize);
-        assert(prependableBytes() == kCheapPrepend);
-    }
+    explicit Buffer(size_t initialSize = kInitialSize);
+
+    /// @brief: 存储来自 loop 的 SlabPool, 第一次写入时才分配一个 slab, 放不下时改用 malloc;
+    ///         数据取完之后调用 release() 把存储还回去, 空闲的连接不占用缓冲区.
+    ///         只能在 pool 所属的 loop 线程中使用
+    explicit Buffer(SlabPool* pool);
+    ~Buffer();
 
     void swap(Buffer &rhs)
     {
-        buffer_.swap(rhs.buffer_);
+        std::swap(data_, rhs.data_);
+        std::swap(capacity_, rhs.capacity_);
+        std::swap(pool_, rhs.pool_);
+        std::swap(pooled_, rhs.pooled_);
         std::swap(readerIndex_, rhs.readerIndex_);
         std::swap(writerIndex_, rhs.writerIndex_);
     }
 
+    // 没有可读的数据时, 把存储还给 pool (或者系统), 下一次写入时重新分配
+    void release();
+
     size_t readableBytes() const
     { return writerIndex_ - readerIndex_; }
 
     size_t writableBytes() const
-    { return buffer_.size() - writerIndex_; }
+    { return capacity_ - writerIndex_; }
 
     size_t prependableBytes() const
     { return readerIndex_; }
@@ -119,8 +127,9 @@ public:
 
     void retrieveAll()
     {
-        readerIndex_ = kCheapPrepend;
-        writerIndex_ = kCheapPrepend;
+        // 没有存储时 (release() 之后) 下标都是 0
+        readerIndex_ = data_ == nullptr ? 0 : kCheapPrepend;
+        writerIndex_ = readerIndex_;
     }
 
     std::string retrieveAllAsString()
@@ -165,6 +174,9 @@ public:
     char *beginWrite()
     { return begin() + writerIndex_; }
 
+    size_t capacity() const
+    { return capacity_; }
+
     const char *beginWrite() const
     { return begin() + writerIndex_; }
 
@@ -277,6 +289,8 @@ public:
 
     void prepend(const void *data, size_t len)
     {
+        if (data_ == nullptr)
+            makeSpace(0);
         assert(len <= prependableBytes());
         readerIndex_ -= len;
         auto d = static_cast<const char *>(data);
@@ -287,15 +301,15 @@ public:
 
 private:
     char *begin()
-    { return &*buffer_.begin(); }
+    { return data_; }
 
     const char *begin() const
-    { return &*buffer_.begin(); }
+    { return data_; }
 
     void makeSpace(size_t len)
     {
-        if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
-            buffer_.resize(writerIndex_ + len);
+        if (data_ == nullptr || writableBytes() + prependableBytes() < len + kCheapPrepend) {
+            grow(len);
         } else {
             assert(kCheapPrepend < readerIndex_);
             size_t readable = readableBytes();
@@ -308,8 +322,15 @@ private:
         }
     }
 
+    // 换一块至少能再写入 len 字节的存储, 可读的数据复制到新存储的开头
+    void grow(size_t len);
+    void freeStorage();
+
 private:
-    std::vector<char> buffer_;
+    char *data_;
+    size_t capacity_;
+    SlabPool *pool_;
+    bool pooled_;       // data_ 是 pool_ 的一个 slab
     size_t readerIndex_;
     size_t writerIndex_;
 
@@ -0,0 +1,255 @@
+#include <algorithm>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <libnet/ChainBuffer.h>
+
+using namespace net;
+
+namespace
+{
+
+// 一次 writev 最多写出的 slab 数, 64 * 16 KiB 足够填满 socket 的发送缓冲区
+const int kMaxIov = 64;
+
+}
+
+const uint32_t ChainBuffer::kDataBegin;
+const uint32_t ChainBuffer::kSlabSize;
+
+ChainBuffer::ChainBuffer(SlabPool* pool)
+: pool_(pool),
+  head_(0),
+  size_(0)
+{
+  assert(pool_ != nullptr);
+}
+
+ChainBuffer::ChainBuffer(ChainBuffer&& rhs) noexcept
+: pool_(rhs.pool_),
+  chunks_(std::move(rhs.chunks_)),
+  head_(rhs.head_),
+  size_(rhs.size_)
+{
+  rhs.chunks_.clear();
+  rhs.head_ = 0;
+  rhs.size_ = 0;
+}
+
+ChainBuffer::~ChainBuffer()
+{
+  retrieveAll();
+}
+
+size_t ChainBuffer::tailRoom() const
+{
+  if (numChunks() == 0)
+    return 0;
+  const Chunk& tail = chunks_.back();
+  SlabHeader* h = header(tail.slab);
+  // 共享的 slab 或者被切片截断的 chunk 不能原地追加, 否则会覆盖别人能看到的数据
+  if (h->refs != 1 || tail.end != h->used)
+    return 0;
+  return kSlabSize - tail.end;
+}
+
+void ChainBuffer::newChunk()
+{
+  auto slab = static_cast<char*>(pool_->allocate());
+  *header(slab) = SlabHeader{1, kDataBegin};
+  chunks_.push_back(Chunk{slab, kDataBegin, kDataBegin});
+}
+
+void ChainBuffer::unref(char* slab)
+{
+  if (--header(slab)->refs == 0)
+    pool_->deallocate(slab);
+}
+
+void ChainBuffer::append(const char* data, size_t len)
+{
+  while (len > 0) {
+    size_t room = tailRoom();
+    if (room == 0) {
+      newChunk();
+      room = kSlabSize - kDataBegin;
+    }
+    Chunk& tail = chunks_.back();
+    size_t n = std::min(room, len);
+    ::memcpy(tail.slab + tail.end, data, n);
+    tail.end += static_cast<uint32_t>(n);
+    header(tail.slab)->used = tail.end;
+    data += n;
+    len -= n;
+    size_ += n;
+  }
+}
+
+void ChainBuffer::append(ChainBuffer&& other)
+{
+  assert(&other != this);
+  assert(pool_ == other.pool_);
+  if (other.size_ == 0)
+    return;
+  chunks_.insert(chunks_.end(),
+                 other.chunks_.begin() + static_cast<ptrdiff_t>(other.head_),
+                 other.chunks_.end());
+  size_ += other.size_;
+  // 引用已经转移过来了, 不能再 unref
+  other.chunks_.clear();
+  other.head_ = 0;
+  other.size_ = 0;
+}
+
+ChainBuffer ChainBuffer::slice(size_t offset, size_t len) const
+{
+  assert(offset + len <= size_);
+  ChainBuffer result(pool_);
+  for (size_t i = head_; i < chunks_.size() && len > 0; i++) {
+    const Chunk& chunk = chunks_[i];
+    size_t bytes = chunk.end - chunk.begin;
+    if (offset >= bytes) {
+      offset -= bytes;
+      continue;
+    }
+    size_t n = std::min(bytes - offset, len);
+    auto begin = chunk.begin + static_cast<uint32_t>(offset);
+    header(chunk.slab)->refs++;
+    result.chunks_.push_back(Chunk{chunk.slab, begin, begin + static_cast<uint32_t>(n)});
+    result.size_ += n;
+    offset = 0;
+    len -= n;
+  }
+  return result;
+}
+
+char* ChainBuffer::beginWrite(size_t* room)
+{
+  size_t n = tailRoom();
+  if (n == 0) {
+    newChunk();
+    n = kSlabSize - kDataBegin;
+  }
+  *room = n;
+  return chunks_.back().slab + chunks_.back().end;
+}
+
+void ChainBuffer::hasWritten(size_t len)
+{
+  assert(len <= tailRoom());
+  Chunk& tail = chunks_.back();
+  tail.end += static_cast<uint32_t>(len);
+  header(tail.slab)->used = tail.end;
+  size_ += len;
+}
+
+size_t ChainBuffer::reserve(size_t len)
+{
+  assert(len <= kSlabSize - kDataBegin);
+  if (tailRoom() < len)
+    newChunk();
+  size_t offset = size_;
+  Chunk& tail = chunks_.back();
+  tail.end += static_cast<uint32_t>(len);
+  header(tail.slab)->used = tail.end;
+  size_ += len;
+  return offset;
+}
+
+void ChainBuffer::fillReserved(size_t offset, size_t reserved, std::string_view data, char pad)
+{
+  assert(data.size() <= reserved);
+  assert(offset + reserved <= size_);
+  size_t i = head_;
+  while (offset >= chunks_[i].end - chunks_[i].begin) {
+    offset -= chunks_[i].end - chunks_[i].begin;
+    i++;
+  }
+  Chunk& chunk = chunks_[i];
+  assert(offset + reserved <= chunk.end - chunk.begin);
+
+  char* p = chunk.slab + chunk.begin + offset;
+  size_t skip = reserved - data.size();
+  ::memcpy(p + skip, data.data(), data.size());
+  if (offset == 0) {
+    chunk.begin += static_cast<uint32_t>(skip);
+    size_ -= skip;
+  }
+  else {
+    ::memset(p, pad, skip);
+  }
+}
+
+void ChainBuffer::retrieve(size_t len)
+{
+  assert(len <= size_);
+  size_ -= len;
+  while (len > 0) {
+    Chunk& chunk = chunks_[head_];
+    size_t n = std::min(len, static_cast<size_t>(chunk.end - chunk.begin));
+    chunk.begin += static_cast<uint32_t>(n);
+    len -= n;
+    if (chunk.begin == chunk.end) {
+      unref(chunk.slab);
+      head_++;
+    }
+  }
+
+  if (head_ == chunks_.size()) {
+    chunks_.clear();
+    head_ = 0;
+  }
+  else if (head_ >= 16 && head_ * 2 >= chunks_.size()) {
+    // 取完的 chunk 占了一半以上时才移动, 均摊下来每个 chunk 只移动常数次
+    chunks_.erase(chunks_.begin(), chunks_.begin() + static_cast<ptrdiff_t>(head_));
+    head_ = 0;
+  }
+}
+
+void ChainBuffer::retrieveAll()
+{
+  for (size_t i = head_; i < chunks_.size(); i++)
+    unref(chunks_[i].slab);
+  chunks_.clear();
+  head_ = 0;
+  size_ = 0;
+}
+
+std::string ChainBuffer::toString(size_t len) const
+{
+  std::string result;
+  len = std::min(len, size_);
+  result.reserve(len);
+  for (size_t i = head_; i < chunks_.size() && result.size() < len; i++) {
+    const Chunk& chunk = chunks_[i];
+    size_t n = std::min(len - result.size(), static_cast<size_t>(chunk.end - chunk.begin));
+    result.append(chunk.slab + chunk.begin, n);
+  }
+  return result;
+}
+
+int ChainBuffer::peekIov(struct iovec* vec, int maxIov) const
+{
+  int iovcnt = 0;
+  for (size_t i = head_; i < chunks_.size() && iovcnt < maxIov; i++, iovcnt++) {
+    vec[iovcnt].iov_base = chunks_[i].slab + chunks_[i].begin;
+    vec[iovcnt].iov_len = chunks_[i].end - chunks_[i].begin;
+  }
+  return iovcnt;
+}
+
+ssize_t ChainBuffer::writeFd(int fd, int* savedErrno)
+{
+  struct iovec vec[kMaxIov];
+  int iovcnt = peekIov(vec, kMaxIov);
+
+  ssize_t n = ::writev(fd, vec, iovcnt);
+  if (n < 0)
+    *savedErrno = errno;
+  else
+    retrieve(static_cast<size_t>(n));
+  return n;
+}
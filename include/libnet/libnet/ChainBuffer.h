@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <libnet/noncopyable.h>
+#include <libnet/SlabPool.h>
+
+struct iovec;
+
+namespace net
+{
+
+/// @brief: 由 SlabPool 的 slab 串起来的缓冲区, 用作连接的输出缓冲区
+///         - 追加只写最后一个 slab 的剩余空间, 写满了再接一个新的, 不会 realloc 和整体复制
+///         - 取走数据只移动第一个 slab 的起点, 取完的 slab 立即还给 pool, 没有 memmove 压缩
+///         - slab 带引用计数, slice() 和 append(ChainBuffer&&) 只复制/移动 slab 的引用, 不复制数据
+///         - writeFd() 用 writev 一次写出多个 slab
+///         和 SlabPool 一样只能在 loop 线程中使用, 空的 ChainBuffer 不占用 slab
+class ChainBuffer: noncopyable
+{
+public:
+  explicit
+  ChainBuffer(SlabPool* pool);
+  ChainBuffer(ChainBuffer&& rhs) noexcept;
+  ~ChainBuffer();
+
+  size_t readableBytes() const { return size_; }
+  size_t numChunks()     const { return chunks_.size() - head_; }
+
+  void append(const char* data, size_t len);
+  void append(std::string_view data) { append(data.data(), data.size()); }
+  // 零拷贝: 把 other 的所有数据接在后面, other 变成空的. 两者必须来自同一个 pool
+  void append(ChainBuffer&& other);
+  // 零拷贝: 返回 [offset, offset + len) 的一个切片, 和当前缓冲区共享 slab
+  ChainBuffer slice(size_t offset, size_t len) const;
+
+  // 末尾可以直接写入的连续空间, 没有时接一个新的 slab, *room 是空间的大小;
+  // 写入 n 个字节之后调用 hasWritten(n), 逐字节的写入不用每次都走 append()
+  char* beginWrite(size_t* room);
+  void  hasWritten(size_t len);
+
+  // 在末尾预留 len 个连续的字节, 返回它们在可读数据中的位置, 之后由 fillReserved() 填入,
+  // 用于先写消息体、后写长度头. len 不能超过一个 slab
+  size_t reserve(size_t len);
+  // 把 data 右对齐填进 reserve() 预留的空间; 预留的空间在 chunk 开头时跳过没有用到的部分,
+  // 否则用 pad 填充. 预留之后到填入之前, 这些字节不能被发送或者切片
+  void fillReserved(size_t offset, size_t reserved, std::string_view data, char pad);
+
+  void retrieve(size_t len);
+  void retrieveAll();
+  // 复制出前 len 个字节, 用于调试和测试
+  std::string toString(size_t len) const;
+
+  // 写出尽可能多的数据, 写出的部分被取走, 返回值和 errno 的含义同 writev
+  ssize_t writeFd(int fd, int* savedErrno);
+  // 开头最多 maxIov 个 chunk 的数据, 返回 iovec 的个数; 不取走数据,
+  // 之后的 append 不会移动这些数据, 所以可以交给内核异步发送, 完成之后再 retrieve
+  int peekIov(struct iovec* vec, int maxIov) const;
+
+private:
+  // slab 开头的元数据, 之后是数据
+  struct SlabHeader
+  {
+    uint32_t refs; // 引用这个 slab 的 Chunk 的数量
+    uint32_t used; // 已经写过的位置, 只有引用计数为 1 时才能在这之后追加
+  };
+
+  struct Chunk
+  {
+    char*    slab;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  static const uint32_t kDataBegin = sizeof(SlabHeader);
+  static const uint32_t kSlabSize  = static_cast<uint32_t>(SlabPool::kSlabSize);
+
+  static SlabHeader* header(char* slab) { return reinterpret_cast<SlabHeader*>(slab); }
+  // 最后一个 chunk 可以原地追加的字节数
+  size_t tailRoom() const;
+  void   newChunk();
+  void   unref(char* slab);
+
+  SlabPool*          pool_;
+  std::vector<Chunk> chunks_;
+  size_t             head_; // 第一个还有数据的 chunk, 前面的已经取完
+  size_t             size_;
+};
+
+}
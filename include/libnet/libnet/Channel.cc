@@ -7,10 +7,13 @@ using namespace net;
 
 Channel::Channel(EventLoop* loop, int fd)
 : polling_(false),
+  pendingUpdate_(false),
   tied_(false),
   handlingEvents_(false),
+  completionIo_(false),
   fd_(fd),
   events_(0),
+  registeredEvents_(0),
   revents_(0),
   loop_(loop),
   readCallback_(nullptr),
@@ -20,7 +23,12 @@ Channel::Channel(EventLoop* loop, int fd)
 { }
 
 Channel::~Channel()
-{ assert(!handlingEvents_); }
+{
+  assert(!handlingEvents_);
+  // 还在 Poller 的待提交列表中, 要在析构之前拿出来
+  if (pendingUpdate_)
+    loop_->removeChannel(this);
+}
 
 void Channel::handleEvents()
 {
@@ -67,6 +75,17 @@ void Channel::handleEventsWithGuard()
   handlingEvents_ = false;
 }
 
+void Channel::setCompletionIo(const RecvCallback& recv,
+                              const PrepareSendCallback& prepareSend,
+                              const SendCompleteCallback& sendComplete)
+{
+  assert(!polling_);
+  completionIo_ = true;
+  recvCallback_ = recv;
+  prepareSendCallback_ = prepareSend;
+  sendCompleteCallback_ = sendComplete;
+}
+
 void Channel::tie(const std::shared_ptr<void>& obj)
 {
   tie_ = obj;
@@ -4,6 +4,10 @@
 #include <memory>
 
 #include <sys/epoll.h>
+#include <sys/types.h>
+#include <assert.h>
+
+struct iovec;
 
 #include <libnet/noncopyable.h>
 
@@ -19,6 +23,14 @@ public:
   using CloseCallback = std::function<void()> ;
   using ErrorCallback = std::function<void()> ;
 
+  // 完成式 IO 的回调, 在 Poller::poll() 中调用, 只应该做缓冲, 不调用用户代码
+  // recv: 收到的数据, n == 0 表示对端关闭, n < 0 是 -errno
+  // prepareSend: 提交发送之前取出要发送的数据, 返回 iovec 的个数, 0 表示没有数据
+  // sendComplete: 发送完成的字节数, n < 0 是 -errno
+  using RecvCallback         = std::function<void(const char* data, ssize_t n)>;
+  using PrepareSendCallback  = std::function<int(struct iovec* iov, int maxIov)>;
+  using SendCompleteCallback = std::function<void(ssize_t n)>;
+
   Channel(EventLoop* loop, int fd);
   ~Channel();
 
@@ -27,21 +39,46 @@ public:
   void setCloseCallback(const CloseCallback& cb){ closeCallback_ = cb; }
   void setErrorCallback(const ErrorCallback& cb){ errorCallback_ = cb; }
 
+  // 完成式 IO, 只有 EventLoop::completionIo() 为 true 时可以使用, 需要在注册之前设置
+  // 关注 EPOLLIN 时 Poller 持续接收, 数据通过 recv 回调交给使用者, 之后和就绪式一样调用 readCallback;
+  // 关注 EPOLLOUT 时 Poller 在下一次提交之前通过 prepareSend 取出数据, 同时只有一个发送,
+  // 完成时调用 sendComplete, 不会调用 writeCallback. 发送期间 Poller 持有 tie 的对象
+  void setCompletionIo(const RecvCallback& recv,
+                       const PrepareSendCallback& prepareSend,
+                       const SendCompleteCallback& sendComplete);
+  bool completionIo() const { return completionIo_; }
+
+  void recv(const char* data, ssize_t n)       { recvCallback_(data, n); }
+  int  prepareSend(struct iovec* iov, int max) { return prepareSendCallback_(iov, max); }
+  void sendComplete(ssize_t n)                 { sendCompleteCallback_(n); }
+  // tie 的对象, 没有 tie 或者已经析构时返回 nullptr
+  std::shared_ptr<void> tiedObject() const     { return tie_.lock(); }
+
   void setRevents(uint32_t revents) { revents_ = revents; }
   void setPollingState(bool state)  { polling_ = state;   }
+  void setRegisteredEvents(uint32_t events) { registeredEvents_ = events; }
+  void setPendingUpdate(bool pending)       { pendingUpdate_ = pending;   }
+
+  int      fd()               const { return fd_;                          }
+  uint32_t events()           const { return events_;                      }
+  uint32_t revents()          const { return revents_;                     }
+  uint32_t registeredEvents() const { return registeredEvents_;            }
+  bool     polling()          const { return polling_;                     }
+  bool     pendingUpdate()    const { return pendingUpdate_;               }
+  bool     isNoneEvents()     const { return (events_ & ~EPOLLET) == 0;    }
+  bool     isReading()        const { return events_ & EPOLLIN;            }
+  bool     isWriting()        const { return events_ & EPOLLOUT;           }
+  bool     edgeTriggered()    const { return events_ & EPOLLET;            }
 
-  int      fd()           const { return fd_;                }
-  uint32_t events()       const { return events_;            }
-  bool     polling()      const { return polling_;           }
-  bool     isNoneEvents() const { return events_ == 0;       }
-  bool     isReading()    const { return events_ & EPOLLIN;  }
-  bool     isWriting()    const { return events_ & EPOLLOUT; }
+  // 边沿触发, 需要在注册之前设置, 使用者负责读写到 EAGAIN
+  void setEdgeTriggered(bool on)
+  { assert(!polling_); events_ = on ? (events_ | EPOLLET) : (events_ & ~EPOLLET); }
 
   void enableRead()  { events_ |= EPOLLIN | EPOLLPRI;  update();}
   void enableWrite() { events_ |= EPOLLOUT;            update();}
   void disableRead() { events_ &= ~EPOLLIN;            update();}
   void disableWrite(){ events_ &= ~EPOLLOUT;           update();}
-  void disableAll()  { events_ = 0;                    update();}
+  void disableAll()  { events_ &= EPOLLET;             update();}
 
   void remove();
   void tie(const std::shared_ptr<void>& obj);
@@ -50,11 +87,14 @@ private:
   void update();
   void handleEventsWithGuard();
 
-  bool                polling_;
+  bool                polling_;         // 已经注册到 epoll 中
+  bool                pendingUpdate_;   // 在 Poller 的待提交列表中
   bool                tied_;
   bool                handlingEvents_; 
+  bool                completionIo_;
   int                 fd_;
   uint32_t            events_;          // 关注的事件
+  uint32_t            registeredEvents_;// 已经提交给内核的事件
   uint32_t            revents_;         // 产生的事件
   EventLoop*          loop_;
   std::weak_ptr<void> tie_;             // 延长TcpConnection的生命周期
@@ -62,6 +102,9 @@ private:
   WriteCallback       writeCallback_;
   CloseCallback       closeCallback_;
   ErrorCallback       errorCallback_;
+  RecvCallback         recvCallback_;
+  PrepareSendCallback  prepareSendCallback_;
+  SendCompleteCallback sendCompleteCallback_;
 };
 
 }
@@ -0,0 +1,166 @@
+#include <fstream>
+
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <libnet/Logger.h>
+#include <libnet/CpuAffinity.h>
+
+using namespace net;
+
+namespace
+{
+
+// <numaif.h> 属于 libnuma, 这里只需要一个常量
+const int kMpolLocal = 4;
+
+std::string readLine(const std::string& path)
+{
+  std::ifstream in(path);
+  std::string line;
+  std::getline(in, line);
+  return line;
+}
+
+/// @brief: 节点 -> CPU 列表, 只在第一次使用时读 /sys, 之后拓扑不会变化
+const std::vector<std::vector<int>>& topology()
+{
+  static const std::vector<std::vector<int>> nodes = []
+  {
+    std::vector<std::vector<int>> result;
+    for (int node: parseCpuList(readLine("/sys/devices/system/node/online"))) {
+      if (result.size() <= static_cast<size_t>(node))
+        result.resize(static_cast<size_t>(node) + 1);
+      result[static_cast<size_t>(node)] = parseCpuList(readLine(
+              "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+    }
+    if (result.empty())
+      result.push_back(availableCpus());
+    return result;
+  }();
+  return nodes;
+}
+
+}
+
+namespace net
+{
+
+std::vector<int> parseCpuList(const std::string& list)
+{
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos)
+      end = list.size();
+    std::string range = list.substr(pos, end - pos);
+    pos = end + 1;
+    if (range.empty())
+      continue;
+
+    int first, last;
+    char trailing;
+    int n = sscanf(range.c_str(), "%d-%d%c", &first, &last, &trailing);
+    if (n == 1)
+      last = first;
+    else if (n != 2 || first > last || first < 0)
+      return {};
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<int> availableCpus()
+{
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+    SYSERR("sched_getaffinity()");
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set))
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+int numNumaNodes()
+{
+  return static_cast<int>(topology().size());
+}
+
+std::vector<int> cpusOfNode(int node)
+{
+  auto& nodes = topology();
+  if (node < 0 || static_cast<size_t>(node) >= nodes.size())
+    return {};
+  return nodes[static_cast<size_t>(node)];
+}
+
+int numaNodeOfCpu(int cpu)
+{
+  auto& nodes = topology();
+  for (size_t node = 0; node < nodes.size(); node++) {
+    for (int c: nodes[node]) {
+      if (c == cpu)
+        return static_cast<int>(node);
+    }
+  }
+  return 0;
+}
+
+int currentNumaNode()
+{
+  int cpu = sched_getcpu();
+  return cpu < 0 ? 0 : numaNodeOfCpu(cpu);
+}
+
+bool pinThisThread(int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    errno = err;
+    SYSERR("pthread_setaffinity_np() cpu %d", cpu);
+    return false;
+  }
+  return setLocalMemoryPolicy();
+}
+
+bool setLocalMemoryPolicy()
+{
+  if (numNumaNodes() <= 1)
+    return true;
+  if (syscall(SYS_set_mempolicy, kMpolLocal, nullptr, 0) == -1) {
+    SYSERR("set_mempolicy(MPOL_LOCAL)");
+    return false;
+  }
+  return true;
+}
+
+ThreadInitCallback pinToCpus(const std::vector<int>& cpus,
+                             const ThreadInitCallback& next)
+{
+  return [cpus, next](size_t index)
+  {
+    if (!cpus.empty()) {
+      int cpu = cpus[index % cpus.size()];
+      if (pinThisThread(cpu))
+        DEBUG("thread #%lu pinned to cpu %d", index, cpu);
+    }
+    if (next)
+      next(index);
+  };
+}
+
+}
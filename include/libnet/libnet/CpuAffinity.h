@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <libnet/Callbacks.h>
+
+namespace net
+{
+
+/// @brief: CPU 亲和性和 NUMA 拓扑的辅助函数, 只依赖 /sys 和系统调用, 不需要 libnuma
+///
+///         典型的用法是按 NUMA 节点划分线程:
+///           server.setCpuAffinity(cpusOfNode(0));
+///           ThreadPool pool(4, 65536, pinToCpus(cpusOfNode(0)));
+///         或者每个节点一个线程池, IO 线程把请求提交给 pools[currentNumaNode()],
+///         请求的处理就和连接的 IO 在同一个 socket 上
+
+// 解析 "0-3,8,10-11" 形式的 CPU 列表 (和 /sys 里 cpulist 的格式一样), 格式错误时返回空
+std::vector<int> parseCpuList(const std::string& list);
+
+// 当前进程允许运行的 CPU
+std::vector<int> availableCpus();
+
+// NUMA 节点的数量, 不支持 NUMA 时返回 1
+int numNumaNodes();
+
+// 节点上的 CPU, 不支持 NUMA 时节点 0 包含所有的 CPU
+std::vector<int> cpusOfNode(int node);
+
+// CPU 所在的节点, 查询失败返回 0
+int numaNodeOfCpu(int cpu);
+
+// 当前线程正在运行的 CPU 所在的节点
+int currentNumaNode();
+
+// 把当前线程绑定到一个 CPU 上, 同时让之后分配的内存优先来自这个 CPU 所在的节点
+bool pinThisThread(int cpu);
+
+// 让当前线程之后分配的内存 (首次访问时) 来自当前运行的节点, 内核默认就是这样,
+// 这里显式设置是为了覆盖进程继承下来的 interleave 等策略
+bool setLocalMemoryPolicy();
+
+// 生成一个 ThreadInitCallback: 第 index 个线程绑定到 cpus[index % cpus.size()], 然后调用 next
+// cpus 为空时不绑定
+ThreadInitCallback pinToCpus(const std::vector<int>& cpus,
+                             const ThreadInitCallback& next = defaultThreadInitCallback);
+
+}
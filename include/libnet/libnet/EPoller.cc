@@ -2,8 +2,11 @@
 #include <unistd.h>
 #include <assert.h>
 
+#include <algorithm>
+
 #include <libnet/Logger.h>
 #include <libnet/EventLoop.h>
+#include <libnet/EPoller.h>
 
 using namespace net;
 
@@ -23,6 +26,7 @@ EPoller::~EPoller()
 void EPoller::poll(ChannelList& activeChannels, int timeout)
 {
   loop_->assertInLoopThread();
+  flushUpdates();
 
   int maxEvents = static_cast<int>(events_.size());
   int nEvents = ::epoll_wait(epollfd_, events_.data(), maxEvents, timeout);
@@ -46,26 +50,42 @@ void EPoller::updateChannel(Channel* channel)
 {
   loop_->assertInLoopThread();
   /**
-   * polling_ 
-   *  false ： ADD
-   *  true && 没有关注任何事件 ： MOD
-   *  true && 关注了事件，DEL
+   * 没有关注任何事件 : 如果已经注册了就立即 DEL, 并且丢弃没有提交的修改
+   * 否则            : 放进待提交列表, 提交时 polling_ 为 false 是 ADD, 否则是 MOD
   */
-  int op = 0;
-  if (!channel->polling()) {
-    assert(!channel->isNoneEvents());
-    op = EPOLL_CTL_ADD;
-    channel->setPollingState(true);
-  }
-  else if (!channel->isNoneEvents()) {
-    op = EPOLL_CTL_MOD;
+  if (channel->isNoneEvents()) {
+    if (channel->pendingUpdate()) {
+      channel->setPendingUpdate(false);
+      auto it = std::find(pendingUpdates_.begin(), pendingUpdates_.end(), channel);
+      assert(it != pendingUpdates_.end());
+      pendingUpdates_.erase(it);
+    }
+    if (channel->polling()) {
+      channel->setPollingState(false);
+      updateChannel(EPOLL_CTL_DEL, channel);
+    }
+    return;
   }
-  else {
-    op = EPOLL_CTL_DEL;
-    channel->setPollingState(false);
+
+  if (!channel->pendingUpdate()) {
+    channel->setPendingUpdate(true);
+    pendingUpdates_.push_back(channel);
   }
+}
 
-  updateChannel(op, channel);
+void EPoller::flushUpdates()
+{
+  for (Channel* channel: pendingUpdates_) {
+    channel->setPendingUpdate(false);
+    if (!channel->polling()) {
+      channel->setPollingState(true);
+      updateChannel(EPOLL_CTL_ADD, channel);
+    }
+    else if (channel->events() != channel->registeredEvents()) {
+      updateChannel(EPOLL_CTL_MOD, channel);
+    }
+  }
+  pendingUpdates_.clear();
 }
 
 void EPoller::updateChannel(int op, Channel* channel)
@@ -76,5 +96,6 @@ void EPoller::updateChannel(int op, Channel* channel)
   int ret = ::epoll_ctl(epollfd_, op, channel->fd(), &ee);
   if (ret == -1)
     SYSERR("EPoller::epoll_ctl()");
+  channel->setRegisteredEvents(op == EPOLL_CTL_DEL ? 0 : ee.events);
 }
 
@@ -2,7 +2,7 @@
 
 #include <vector>
 
-#include <libnet/noncopyable.h>
+#include <libnet/Poller.h>
 
 namespace net
 {
@@ -10,24 +10,29 @@ namespace net
 class EventLoop;
 class Channel;
 
-class EPoller: noncopyable
+class EPoller: public Poller
 {
 public:
-  using ChannelList = std::vector<Channel*>;
   using EventList   = std::vector<struct epoll_event>;
 
   explicit
   EPoller(EventLoop* loop);
-  ~EPoller();
+  ~EPoller() override;
 
-  void poll(ChannelList& activeChannels,int timeout=-1);
-  void updateChannel(Channel* channel);
+  void poll(ChannelList& activeChannels,int timeout=-1) override;
+  // ADD/MOD 先记下来, 在下一次 epoll_wait 之前一起提交, 同一个 channel 在一轮循环里
+  // 的多次修改 (比如 enableWrite 之后马上 disableWrite) 最多只有一次 epoll_ctl;
+  // DEL 立即执行, 因为之后 fd 可能被关闭和复用, channel 也可能被析构
+  void updateChannel(Channel* channel) override;
+  const char* name() const override { return "epoll"; }
 
 private:
+  void flushUpdates();
   void updateChannel(int op, Channel* channel);
 
-  EventLoop* loop_;
-  int        epollfd_;
-  EventList  events_; // 产生的事件
+  EventLoop*  loop_;
+  int         epollfd_;
+  EventList   events_;         // 产生的事件
+  ChannelList pendingUpdates_; // 等待提交的 ADD/MOD
 };
 }
\ No newline at end of file
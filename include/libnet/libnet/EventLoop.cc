@@ -9,6 +9,7 @@
 #include "Logger.h"
 #include "Channel.h"
 #include "EventLoop.h"
+#include "Profiler.h"
 
 using namespace net;
 
@@ -28,15 +29,31 @@ public:
 
 IgnoreSigPipe ignore;
 
+// 延迟统计使用单调时钟, ns
+int64_t steadyNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 } // unnamed-namespace
 
 EventLoop::EventLoop()
 : tid_(std::this_thread::get_id()),
+  pthreadId_(::pthread_self()),
   quit_(false),
+  spinning_(false),
   doingPendingTasks_(false),
+  busyPoll_(Microsecond::zero()),
   wakeupFd_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
-  poller_(std::make_unique<EPoller>(this)),
+  poller_(Poller::newDefaultPoller(this)),
   wakeupChannel_(std::make_unique<Channel>(this, wakeupFd_)),
+  queuedAt_(0),
+  instrumented_(false),
+  numIterations_(0),
+  numTasks_(0),
+  pendingTasksHighWater_(0),
+  callbackStartedAt_(0),
   timerQueue_(std::make_unique<TimerQueue>(this))
 {
   assert(wakeupFd_ >0 && "EventLoop::eventfd() fail to create.");
@@ -46,26 +63,93 @@ EventLoop::EventLoop()
 
   assert(t_Eventloop == nullptr && "EventLoop has been created.");
   t_Eventloop = this;
+  Profiler::instance().registerThread();
 }
 
 EventLoop::~EventLoop()
 {
   assert(t_Eventloop == this);
   t_Eventloop = nullptr;
+  Profiler::instance().unregisterThread();
 }
 
 void EventLoop::loop()
 {
   assertInLoopThread();
   quit_ = false;
+  int64_t spinUntil = 0;
   while (!quit_) {
     activeChannels_.clear();
-    int timeout = getNextTimeout();
+    // 两个都关闭时一轮循环不读时钟
+    bool instrumented = instrumented_.load(std::memory_order_relaxed);
+    bool busyPoll = busyPoll_ > Microsecond::zero();
+    int timeout = 0;
+    if (busyPoll && steadyNow() < spinUntil) {
+      spinning_.store(true, std::memory_order_relaxed);
+    }
+    else {
+      // 先声明不再轮询, 再检查任务队列; 和 queueInLoop() 配合, 不会丢失唤醒
+      spinning_.store(false);
+      timeout = getNextTimeout();
+    }
+    int64_t pollBegin = instrumented ? steadyNow() : 0;
     poller_->poll(activeChannels_, timeout);
-    for (auto channel: activeChannels_)
-        channel->handleEvents();
-    doPendingTasks();
+
+    if (instrumented) {
+      int64_t begin = steadyNow();
+      pollLatency_.record(static_cast<uint64_t>(begin - pollBegin));
+      numIterations_.fetch_add(1, std::memory_order_relaxed);
+      handleEventsInstrumented(begin);
+      bool hasTasks = doPendingTasks();
+      if (hasTasks || !activeChannels_.empty()) {
+        int64_t end = steadyNow();
+        iterationLatency_.record(static_cast<uint64_t>(end - begin));
+        spinUntil = end + std::chrono::duration_cast<std::chrono::nanoseconds>(busyPoll_).count();
+      }
+    }
+    else {
+      handleEvents();
+      bool hasTasks = doPendingTasks();
+      if (busyPoll && (hasTasks || !activeChannels_.empty()))
+        spinUntil = steadyNow() + std::chrono::duration_cast<std::chrono::nanoseconds>(busyPoll_).count();
+    }
   }
+  spinning_ = false;
+}
+
+void EventLoop::handleEvents()
+{
+  for (auto channel: activeChannels_)
+    channel->handleEvents();
+}
+
+/// @brief: 每个 channel 的回调都记录开始时间, 定时器的 channel 单独计时
+void EventLoop::handleEventsInstrumented(int64_t begin)
+{
+  if (activeChannels_.empty())
+    return;
+  int64_t start = begin;
+  int64_t timers = -1;
+  for (auto channel: activeChannels_) {
+    callbackStartedAt_.store(start, std::memory_order_relaxed);
+    channel->handleEvents();
+    int64_t end = steadyNow();
+    if (channel->fd() == timerQueue_->fd())
+      timers = end - start;
+    start = end;
+  }
+  callbackStartedAt_.store(0, std::memory_order_relaxed);
+
+  if (timers >= 0)
+    timersLatency_.record(static_cast<uint64_t>(timers));
+  if (timers < 0 || activeChannels_.size() > 1)
+    eventsLatency_.record(static_cast<uint64_t>(start - begin - std::max<int64_t>(timers, 0)));
+}
+
+void EventLoop::setInstrumented(bool on)
+{
+  assertInLoopThread();
+  instrumented_.store(on, std::memory_order_relaxed);
 }
 
 void EventLoop::quit()
@@ -108,9 +192,12 @@ void EventLoop::queueInLoop(const Task& task)
 {
   {
     std::lock_guard<std::mutex> guard(mutex_);
+    if (queuedAt_ == 0 && instrumented_.load(std::memory_order_relaxed) && !isInLoopThread())
+      queuedAt_ = steadyNow();
     pendingTasks_.push_back(task);
+    notePendingTasks(pendingTasks_.size());
   }
-  if (!isInLoopThread() || doingPendingTasks_)
+  if (needWakeup())
     wakeup();
 }
 
@@ -118,12 +205,32 @@ void EventLoop::queueInLoop(Task&& task)
 {
   {
     std::lock_guard<std::mutex> guard(mutex_);
+    if (queuedAt_ == 0 && instrumented_.load(std::memory_order_relaxed) && !isInLoopThread())
+      queuedAt_ = steadyNow();
     pendingTasks_.push_back(std::move(task));
+    notePendingTasks(pendingTasks_.size());
   }
-  if (!isInLoopThread() || doingPendingTasks_)
+  if (needWakeup())
     wakeup();
 }
 
+/// @brief: 持有 mutex_ 时调用, 所有的写入都在锁内, 所以不需要 CAS
+void EventLoop::notePendingTasks(size_t n)
+{
+  if (n > pendingTasksHighWater_.load(std::memory_order_relaxed))
+    pendingTasksHighWater_.store(n, std::memory_order_relaxed);
+}
+
+/// @brief: 放入任务之后调用. loop 正在忙轮询时不需要唤醒, 它在这一轮的最后就会执行任务;
+///         loop 在睡眠之前先把 spinning_ 置为 false 再加锁检查任务队列,
+///         这里是先放入任务再读 spinning_, 两边至少有一方能看到对方的写入
+bool EventLoop::needWakeup() const
+{
+  if (isInLoopThread() && !doingPendingTasks_)
+    return false;
+  return !spinning_.load();
+}
+
 Timer* EventLoop::runAt(Timestamp when, TimerCallback callback)
 {
   return timerQueue_->addTimer(std::move(callback), when, Millisecond::zero());
@@ -146,6 +253,11 @@ void EventLoop::cancelTimer(Timer* timer)
     timerQueue_->cancelTimer(timer);
 }
 
+size_t EventLoop::numTimers() const
+{
+  return timerQueue_->numTimers();
+}
+
 
 void EventLoop::wakeup()
 {
@@ -156,6 +268,12 @@ void EventLoop::wakeup()
 }
 
 
+void EventLoop::setBusyPoll(Microsecond budget)
+{
+  assertInLoopThread();
+  busyPoll_ = budget;
+}
+
 void EventLoop::updateChannel(Channel* channel)
 {
   assertInLoopThread();
@@ -178,27 +296,62 @@ void EventLoop::assertNotInLoopThread()
   assert(!isInLoopThread());
 }
 
-bool EventLoop::isInLoopThread()
+bool EventLoop::isInLoopThread() const
 {
   return tid_ == std::this_thread::get_id();
 }
 
-void EventLoop::doPendingTasks()
+int EventLoop::getNextTimeout()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!pendingTasks_.empty())
+      return 0;
+  }
+  // 获取最早的超时时间
+  return static_cast<int>(timerQueue_->nextTimeout());
+}
+
+/// @brief: 返回是否执行了任务
+bool EventLoop::doPendingTasks()
 {
   assertInLoopThread();
   // 使用局部变量，来减少锁的阻塞时间
   std::vector<Task> tasks;
+  int64_t queuedAt;
   {
     std::lock_guard<std::mutex> guard(mutex_);
     tasks.swap(pendingTasks_);
+    queuedAt = queuedAt_;
+    queuedAt_ = 0;
   }
+  if (tasks.empty())
+    return false;
+  if (queuedAt != 0)
+    wakeupLatency_.record(static_cast<uint64_t>(steadyNow() - queuedAt));
 
   doingPendingTasks_ = true;
-  for (Task& task: tasks)
-  {
-    task();
+  if (instrumented_.load(std::memory_order_relaxed)) {
+    int64_t begin = steadyNow();
+    int64_t start = begin;
+    for (Task& task: tasks)
+    {
+      callbackStartedAt_.store(start, std::memory_order_relaxed);
+      task();
+      start = steadyNow();
+    }
+    callbackStartedAt_.store(0, std::memory_order_relaxed);
+    tasksLatency_.record(static_cast<uint64_t>(start - begin));
+    numTasks_.fetch_add(tasks.size(), std::memory_order_relaxed);
+  }
+  else {
+    for (Task& task: tasks)
+    {
+      task();
+    }
   }
   doingPendingTasks_ = false;
+  return true;
 }
 
 void EventLoop::handleRead()
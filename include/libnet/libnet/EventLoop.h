@@ -6,9 +6,12 @@
 #include <vector>
 
 #include <sys/types.h>
+#include <pthread.h>
 
 #include <libnet/Timer.h>
-#include <libnet/EPoller.h>
+#include <libnet/Poller.h>
+#include <libnet/Histogram.h>
+#include <libnet/SlabPool.h>
 #include <libnet/TimerQueue.h>
 
 namespace net
@@ -32,39 +35,97 @@ public:
   Timer* runAfter(Microsecond interval, TimerCallback callback);
   Timer* runEvery(Microsecond interval, TimerCallback callback);
   void   cancelTimer(Timer* timer);
+  // 当前的定时器数, 任意线程都可以读
+  size_t numTimers() const;
 
   void wakeup();
 
   void updateChannel(Channel* channel);
   void removeChannel(Channel* channel);
 
+  // "epoll" or "io_uring"
+  const char* pollerName() const { return poller_->name(); }
+  // 后端支持完成式 IO 时, 连接由后端直接收发数据, 见 Channel::setCompletionIo()
+  bool completionIo() const { return poller_->completionIo(); }
+
+  // 忙轮询: 处理完事件或任务之后的 budget 时间内, 用 0 超时轮询而不是睡眠, 用 CPU 换延迟;
+  // 轮询期间其他线程 queueInLoop() 不需要写 eventfd 唤醒. 0 表示关闭 (默认), 在 loop 线程中调用
+  void setBusyPoll(Microsecond budget);
+  Microsecond busyPoll() const { return busyPoll_; }
+
+  // 循环的延迟统计, 单位 ns, 任意线程都可以读; 和下面分阶段的统计一样, setInstrumented(true) 时才有
+  // iteration: 有事件或任务的一轮循环里, 从 poll 返回到处理完事件和任务的时间
+  // wakeup:    其他线程 queueInLoop() 到任务开始执行的时间, 从任务队列由空变为非空时开始算
+  const Histogram& iterationLatency() const { return iterationLatency_; }
+  const Histogram& wakeupLatency()    const { return wakeupLatency_; }
+
+  // 分阶段的统计, 默认关闭, 打开后每个回调前后各读一次时钟, 在 loop 线程中调用
+  // 关闭时 (也没有忙轮询) 循环和 queueInLoop() 都不读时钟
+  // poll:   阻塞在 poll 中的时间 (包括空闲)
+  // events: 一轮中处理 IO 事件的时间, 不包括定时器
+  // timers: 一轮中处理到期定时器的时间
+  // tasks:  一轮中执行 pendingTasks_ 的时间
+  void setInstrumented(bool on);
+  bool instrumented() const { return instrumented_.load(std::memory_order_relaxed); }
+  const Histogram& pollLatency()   const { return pollLatency_; }
+  const Histogram& eventsLatency() const { return eventsLatency_; }
+  const Histogram& timersLatency() const { return timersLatency_; }
+  const Histogram& tasksLatency()  const { return tasksLatency_; }
+  uint64_t numIterations() const { return numIterations_.load(std::memory_order_relaxed); }
+  uint64_t numTasks()      const { return numTasks_.load(std::memory_order_relaxed); }
+
+  // pendingTasks_ 出现过的最大长度, 一直统计, 任意线程都可以读
+  size_t pendingTasksHighWater() const { return pendingTasksHighWater_.load(std::memory_order_relaxed); }
+
+  // 打开统计时, 正在执行的回调 (事件, 定时器或者任务) 开始的时间 (steady_clock, ns),
+  // 0 表示没有回调在执行. 给 Watchdog 检测阻塞 loop 的回调
+  int64_t callbackStartedAt() const { return callbackStartedAt_.load(std::memory_order_relaxed); }
+  pthread_t pthreadId() const { return pthreadId_; }
+
+  // 这个 loop 上的连接的缓冲区使用的 slab, 只能在 loop 线程中分配和归还
+  SlabPool* slabPool() { return &slabPool_; }
+
   void assertInLoopThread();
   void assertNotInLoopThread();
-  bool isInLoopThread();
+  bool isInLoopThread() const;
 
 private:
-  void doPendingTasks();
+  bool doPendingTasks();
+  void handleEvents();
+  void handleEventsInstrumented(int64_t begin);
+  void notePendingTasks(size_t n);
   void handleRead();
-  int  getNextTimeout() { 
-    if(!pendingTasks_.empty()) { 
-      return 0;
-    } 
-    // 获取最早的超时时间
-    return static_cast<int>(timerQueue_->nextTimeout());
-  }
+  int  getNextTimeout();
+  bool needWakeup() const;
 
   using ChannelList = std::vector<Channel*>;
   using TaskList    = std::vector<Task>;
 
   std::thread::id               tid_;
+  pthread_t                     pthreadId_;
+  SlabPool                      slabPool_;
   std::atomic<bool>             quit_;
+  std::atomic<bool>             spinning_;  // 正在忙轮询, 不需要 wakeup()
   bool                          doingPendingTasks_;
+  Microsecond                   busyPoll_;
   int                           wakeupFd_;
-  std::unique_ptr<EPoller>      poller_;
+  std::unique_ptr<Poller>       poller_;
   std::unique_ptr<Channel>      wakeupChannel_;
   ChannelList                   activeChannels_;
   TaskList                      pendingTasks_;
+  int64_t                       queuedAt_;  // 其他线程放入第一个任务的时间, 0 表示没有, mutex_ 保护
   std::mutex                    mutex_;
+  Histogram                     iterationLatency_;
+  Histogram                     wakeupLatency_;
+  std::atomic<bool>             instrumented_; // queueInLoop() 在其他线程中读
+  Histogram                     pollLatency_;
+  Histogram                     eventsLatency_;
+  Histogram                     timersLatency_;
+  Histogram                     tasksLatency_;
+  std::atomic<uint64_t>         numIterations_;
+  std::atomic<uint64_t>         numTasks_;
+  std::atomic<size_t>           pendingTasksHighWater_;
+  std::atomic<int64_t>          callbackStartedAt_;
   std::unique_ptr<TimerQueue>   timerQueue_;
 };
 
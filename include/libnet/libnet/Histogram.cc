@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cmath>
+
+#include <stdio.h>
+
+#include <libnet/Histogram.h>
+
+using namespace net;
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other)
+{
+  if (buckets.size() < other.buckets.size())
+    buckets.resize(other.buckets.size());
+  for (size_t i = 0; i < other.buckets.size(); i++)
+    buckets[i] += other.buckets[i];
+  count += other.count;
+  sum += other.sum;
+  max = std::max(max, other.max);
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+  if (count == 0)
+    return 0;
+  p = std::min(std::max(p, 0.0), 100.0);
+  auto rank = static_cast<uint64_t>(std::ceil(p / 100 * static_cast<double>(count)));
+  rank = std::max<uint64_t>(rank, 1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    seen += buckets[i];
+    if (seen >= rank)
+      return std::min(Histogram::bucketUpperBound(static_cast<int>(i)), max);
+  }
+  return max;
+}
+
+std::string HistogramSnapshot::toString() const
+{
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "count=%lu mean=%.1f p50=%lu p90=%lu p99=%lu p999=%lu max=%lu",
+           count, mean(), percentile(50), percentile(90),
+           percentile(99), percentile(99.9), max);
+  return buf;
+}
+
+HistogramSnapshot Histogram::snapshot() const
+{
+  HistogramSnapshot snap;
+  snap.buckets.resize(kNumBuckets);
+  for (int i = 0; i < kNumBuckets; i++)
+    snap.buckets[static_cast<size_t>(i)] = buckets_[i].load(std::memory_order_relaxed);
+  snap.count = count_.load(std::memory_order_relaxed);
+  snap.sum = sum_.load(std::memory_order_relaxed);
+  snap.max = max_.load(std::memory_order_relaxed);
+  return snap;
+}
+
+void Histogram::reset()
+{
+  for (auto& bucket: buckets_)
+    bucket.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::bucketUpperBound(int index)
+{
+  if (index < kSubBuckets)
+    return static_cast<uint64_t>(index);
+  int shift = index / kSubBuckets - 1;
+  uint64_t sub = static_cast<uint64_t>(index % kSubBuckets);
+  uint64_t lower = (kSubBuckets + sub) << shift;
+  // 最后一个桶的上界是 UINT64_MAX, 先减一避免溢出
+  return lower + ((uint64_t(1) << shift) - 1);
+}
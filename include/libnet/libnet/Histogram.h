@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <libnet/noncopyable.h>
+
+namespace net
+{
+
+/// @brief: Histogram 在某一时刻的拷贝, 可以合并多个 (比如所有 loop 的), 再计算分位数
+struct HistogramSnapshot
+{
+  std::vector<uint64_t> buckets;
+  uint64_t              count = 0;
+  uint64_t              sum   = 0;
+  uint64_t              max   = 0;
+
+  void merge(const HistogramSnapshot& other);
+  // p 在 [0, 100] 之间, 返回所在桶的上界, 误差不超过 1/8
+  uint64_t percentile(double p) const;
+  double mean() const { return count == 0 ? 0 : static_cast<double>(sum) / static_cast<double>(count); }
+  // "count=.. mean=.. p50=.. p90=.. p99=.. p999=.. max=.."
+  std::string toString() const;
+};
+
+/// @brief: 对数-线性的直方图: 小于 8 的值每个值一个桶, 之后每个 [2^k, 2^(k+1)) 再线性地分成 8 个桶
+///         496 个桶覆盖整个 uint64_t, 相对误差不超过 1/8
+///         record() 只有几次 relaxed 的原子操作, 任意线程都可以记录和读取;
+///         snapshot() 不是原子的, 读取期间的记录可能只有一部分被看到, 用于统计足够了
+class Histogram: noncopyable
+{
+public:
+  static const int kSubBucketBits = 3;
+  static const int kSubBuckets    = 1 << kSubBucketBits;
+  static const int kNumBuckets    = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  Histogram() { reset(); }
+
+  void record(uint64_t value)
+  {
+    buckets_[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max &&
+           !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+      ;
+  }
+
+  HistogramSnapshot snapshot() const;
+  void reset();
+
+  static int bucketOf(uint64_t value)
+  {
+    if (value < kSubBuckets)
+      return static_cast<int>(value);
+    int exp = 63 - __builtin_clzll(value);
+    int sub = static_cast<int>((value >> (exp - kSubBucketBits)) & (kSubBuckets - 1));
+    return (exp - kSubBucketBits + 1) * kSubBuckets + sub;
+  }
+  // 桶里最大的值
+  static uint64_t bucketUpperBound(int index);
+
+private:
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+}
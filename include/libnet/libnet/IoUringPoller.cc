@@ -0,0 +1,579 @@
+#include <algorithm>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <libnet/Logger.h>
+#include <libnet/Channel.h>
+#include <libnet/EventLoop.h>
+#include <libnet/MemoryCounter.h>
+#include <libnet/IoUringPoller.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define LIBNET_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#endif
+
+using namespace net;
+
+namespace
+{
+
+// POLL_REMOVE 请求的 user_data, 它们的完成事件直接丢弃
+const uint64_t kIgnoredId = 0;
+
+// 完成式接收的缓冲区: 每个 loop 128 个 16KB, 一轮里所有连接收到的数据都要放得下,
+// 放不下时 recv 返回 ENOBUFS, 下一轮重新提交
+const uint16_t kBufferGroup    = 0;
+const unsigned kRecvBuffers    = 128;
+const size_t   kRecvBufferSize = 16 * 1024;
+
+MemoryCounter recvBufferMemory("io_uring_recv_buffer");
+
+template <typename T>
+T* ringField(void* base, uint32_t offset)
+{
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+}
+
+IoUringPoller::IoUringPoller(EventLoop* loop, unsigned entries)
+: loop_(loop),
+  ringFd_(-1),
+  ringPtr_(nullptr),
+  ringSize_(0),
+  sqes_(nullptr),
+  sqesSize_(0),
+  sqHead_(nullptr),
+  sqTail_(nullptr),
+  sqMask_(nullptr),
+  sqArray_(nullptr),
+  sqEntries_(0),
+  cqHead_(nullptr),
+  cqTail_(nullptr),
+  cqMask_(nullptr),
+  cqes_(nullptr),
+  toSubmit_(0),
+  recvBuffers_(nullptr),
+  nextId_(kIgnoredId + 1),
+  round_(1)
+{
+  if (setup(entries) && !setupRecvBuffers())
+    INFO("IoUringPoller: completion IO is not available, connections use POLL_ADD");
+}
+
+IoUringPoller::~IoUringPoller()
+{
+  if (sqes_ != nullptr)
+    ::munmap(sqes_, sqesSize_);
+  if (ringPtr_ != nullptr)
+    ::munmap(ringPtr_, ringSize_);
+  // 关闭 ring 之后内核不再访问提供的缓冲区
+  if (ringFd_ >= 0)
+    ::close(ringFd_);
+  if (recvBuffers_ != nullptr) {
+    ::munmap(recvBuffers_, kRecvBuffers * kRecvBufferSize);
+    recvBufferMemory.sub(kRecvBuffers * kRecvBufferSize);
+  }
+}
+
+#ifdef LIBNET_HAVE_IO_URING
+
+bool IoUringPoller::setup(unsigned entries)
+{
+  struct io_uring_params params;
+  ::memset(&params, 0, sizeof(params));
+  int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+  if (fd < 0) {
+    SYSERR("IoUringPoller::io_uring_setup()");
+    return false;
+  }
+
+  // EXT_ARG 用于 io_uring_enter 的超时, RSRC_TAGS 和 multishot poll 都是 5.13 加入的
+  const uint32_t required = IORING_FEAT_SINGLE_MMAP |
+                            IORING_FEAT_NODROP |
+                            IORING_FEAT_EXT_ARG |
+                            IORING_FEAT_RSRC_TAGS;
+  if ((params.features & required) != required) {
+    WARN("IoUringPoller: kernel lacks required features 0x%x",
+         required & ~params.features);
+    ::close(fd);
+    return false;
+  }
+
+  size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ringSize_ = std::max(sqSize, cqSize);
+  void* ring = ::mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED) {
+    SYSERR("IoUringPoller::mmap() ring");
+    ::close(fd);
+    return false;
+  }
+  sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    SYSERR("IoUringPoller::mmap() sqes");
+    ::munmap(ring, ringSize_);
+    ::close(fd);
+    return false;
+  }
+
+  ringPtr_   = ring;
+  sqes_      = static_cast<io_uring_sqe*>(sqes);
+  sqHead_    = ringField<unsigned>(ring, params.sq_off.head);
+  sqTail_    = ringField<unsigned>(ring, params.sq_off.tail);
+  sqMask_    = ringField<unsigned>(ring, params.sq_off.ring_mask);
+  sqArray_   = ringField<unsigned>(ring, params.sq_off.array);
+  sqEntries_ = params.sq_entries;
+  cqHead_    = ringField<unsigned>(ring, params.cq_off.head);
+  cqTail_    = ringField<unsigned>(ring, params.cq_off.tail);
+  cqMask_    = ringField<unsigned>(ring, params.cq_off.ring_mask);
+  cqes_      = ringField<io_uring_cqe>(ring, params.cq_off.cqes);
+  ringFd_    = fd;
+  TRACE("IoUringPoller() sq entries %u, cq entries %u",
+        params.sq_entries, params.cq_entries);
+  return true;
+}
+
+/// @brief: 把接收缓冲区提供给内核, 失败时不使用完成式 IO
+///         用 IORING_OP_PROVIDE_BUFFERS 而不是 provided buffer ring (IORING_REGISTER_PBUF_RING):
+///         有的内核 (比如一些沙箱) 注册 buffer ring 成功, 但是 recv 一直返回 ENOBUFS
+bool IoUringPoller::setupRecvBuffers()
+{
+#ifdef IORING_RECV_MULTISHOT
+  // multishot recv 没有单独的特性位, 和它同时 (6.0) 加入的 IORING_OP_SEND_ZC 作为标志
+  std::vector<char> probeStorage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+  auto probe = reinterpret_cast<io_uring_probe*>(probeStorage.data());
+  if (::syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PROBE, probe, 256) < 0)
+    return false;
+  if (probe->last_op < IORING_OP_SEND_ZC ||
+      !(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED))
+    return false;
+
+  size_t buffersSize = kRecvBuffers * kRecvBufferSize;
+  void* buffers = ::mmap(nullptr, buffersSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED) {
+    SYSERR("IoUringPoller::mmap() recv buffers");
+    return false;
+  }
+  recvBuffers_ = static_cast<char*>(buffers);
+
+  // 同步等待结果, 这时候完成队列里不会有别的事件
+  provideBuffers(0, kRecvBuffers);
+  int res = -1;
+  if (enter(1, -1) >= 0) {
+    unsigned head = *cqHead_;
+    if (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+      res = cqes_[head & *cqMask_].res;
+      __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+    }
+  }
+  if (res < 0) {
+    WARN("IoUringPoller: PROVIDE_BUFFERS failed: %s", strerror(-res));
+    ::munmap(buffers, buffersSize);
+    recvBuffers_ = nullptr;
+    return false;
+  }
+  recvBufferMemory.add(buffersSize);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void IoUringPoller::poll(ChannelList& activeChannels, int timeout)
+{
+  loop_->assertInLoopThread();
+  flushUpdates();
+
+  // 完成队列里已经有事件时不需要等待, 只提交
+  bool ready = *cqHead_ != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  enter(ready || timeout == 0 ? 0 : 1, timeout);
+  reapCompletions(activeChannels);
+}
+
+void IoUringPoller::updateChannel(Channel* channel)
+{
+  loop_->assertInLoopThread();
+  // 和 EPoller 一样, 删除立即处理 (POLL_REMOVE 按 user_data 删除, 不涉及 fd),
+  // 其他修改在下一次 io_uring_enter 之前统一处理
+  if (channel->isNoneEvents()) {
+    if (channel->pendingUpdate()) {
+      channel->setPendingUpdate(false);
+      auto it = std::find(pendingUpdates_.begin(), pendingUpdates_.end(), channel);
+      assert(it != pendingUpdates_.end());
+      pendingUpdates_.erase(it);
+    }
+    auto it = entries_.find(channel);
+    if (it != entries_.end()) {
+      disarm(it->second);
+      // 进行中的 sendmsg 不取消 (内核可能已经发出了一部分), 完成时照常通知 channel,
+      // 发送期间 SendOp 持有 tie 的对象, channel 一定还在
+      if (it->second.recvId != kIgnoredId) {
+        cancel(it->second.recvId);
+        ops_.erase(it->second.recvId);
+      }
+      for (uint64_t id: it->second.pausedRecvIds)
+        ops_.erase(id);
+      entries_.erase(it);
+    }
+    channel->setPollingState(false);
+    channel->setRegisteredEvents(0);
+    return;
+  }
+
+  channel->setPollingState(true);
+  if (!channel->pendingUpdate()) {
+    channel->setPendingUpdate(true);
+    pendingUpdates_.push_back(channel);
+  }
+}
+
+void IoUringPoller::flushUpdates()
+{
+  for (Channel* channel: pendingUpdates_) {
+    channel->setPendingUpdate(false);
+    auto& entry = entries_.emplace(channel, Entry{kIgnoredId, 0, false, 0,
+                                                  kIgnoredId, kIgnoredId, false, {}}).first->second;
+    if (channel->completionIo()) {
+      flushCompletionIo(channel, entry);
+      channel->setRegisteredEvents(channel->events());
+      continue;
+    }
+    uint32_t mask = channel->events() & ~static_cast<uint32_t>(EPOLLET);
+    bool multishot = channel->edgeTriggered();
+    if (entry.id != kIgnoredId && (entry.mask != mask || entry.multishot != multishot))
+      disarm(entry);
+    if (entry.id == kIgnoredId) {
+      entry.mask = mask;
+      entry.multishot = multishot;
+      arm(channel, entry);
+    }
+    channel->setRegisteredEvents(channel->events());
+  }
+  pendingUpdates_.clear();
+}
+
+/// @brief: 完成式的 channel 不使用 poll, 关注 EPOLLIN 就保持一个 recv, 关注 EPOLLOUT 就提交一个发送
+///         prepareSend 不能修改 pendingUpdates_, 这时候正在遍历它
+void IoUringPoller::flushCompletionIo(Channel* channel, Entry& entry)
+{
+  bool wantRecv = channel->isReading() && !entry.recvDone;
+  if (wantRecv && entry.recvId == kIgnoredId) {
+    armRecv(channel, entry);
+  }
+  else if (!wantRecv && entry.recvId != kIgnoredId) {
+    // 暂停读: 取消生效之前收到的数据还会照常交给 channel, 所以不从 ops_ 中删除
+    cancel(entry.recvId);
+    entry.pausedRecvIds.push_back(entry.recvId);
+    entry.recvId = kIgnoredId;
+  }
+  if (channel->isWriting() && entry.sendId == kIgnoredId)
+    armSend(channel, entry);
+}
+
+void IoUringPoller::arm(Channel* channel, Entry& entry)
+{
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = channel->fd();
+  sqe->poll32_events = entry.mask;
+  sqe->len = entry.multishot ? IORING_POLL_ADD_MULTI : 0;
+  sqe->user_data = nextId_;
+
+  entry.id = nextId_++;
+  ops_[entry.id] = Op{kOpPoll, channel};
+}
+
+void IoUringPoller::armRecv(Channel* channel, Entry& entry)
+{
+#ifdef IORING_RECV_MULTISHOT
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = channel->fd();
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = nextId_;
+
+  entry.recvId = nextId_++;
+  ops_[entry.recvId] = Op{kOpRecv, channel};
+#else
+  assert(false && "multishot recv is not supported");
+#endif
+}
+
+void IoUringPoller::armSend(Channel* channel, Entry& entry)
+{
+  uint64_t id = nextId_;
+  SendOp& send = sends_[id];
+  int iovcnt = channel->prepareSend(send.iov, kMaxSendIov);
+  if (iovcnt == 0) {
+    sends_.erase(id);
+    return;
+  }
+  ::memset(&send.msg, 0, sizeof(send.msg));
+  send.msg.msg_iov = send.iov;
+  send.msg.msg_iovlen = static_cast<size_t>(iovcnt);
+  send.guard = channel->tiedObject();
+
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = channel->fd();
+  sqe->addr = reinterpret_cast<uint64_t>(&send.msg);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = id;
+
+  entry.sendId = nextId_++;
+  ops_[id] = Op{kOpSend, channel};
+}
+
+void IoUringPoller::disarm(Entry& entry)
+{
+  if (entry.id == kIgnoredId)
+    return;
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = entry.id;
+  sqe->user_data = kIgnoredId;
+
+  // 之后这个 poll 请求的完成事件都会被忽略
+  ops_.erase(entry.id);
+  entry.id = kIgnoredId;
+}
+
+void IoUringPoller::cancel(uint64_t id)
+{
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = id;
+  sqe->user_data = kIgnoredId;
+}
+
+/// @brief: 下一次 io_uring_enter 之前重新处理这个 channel
+void IoUringPoller::schedule(Channel* channel)
+{
+  if (!channel->pendingUpdate()) {
+    channel->setPendingUpdate(true);
+    pendingUpdates_.push_back(channel);
+  }
+}
+
+/// @brief: 同一批完成事件里一个 channel 可能出现多次, 只放进 activeChannels 一次
+void IoUringPoller::activate(Channel* channel, Entry& entry, uint32_t revents,
+                             ChannelList& activeChannels)
+{
+  if (entry.round != round_) {
+    entry.round = round_;
+    channel->setRevents(revents);
+    activeChannels.push_back(channel);
+  }
+  else {
+    channel->setRevents(revents | channel->revents());
+  }
+}
+
+/// @brief: 把 [bid, bid + count) 这些连续的缓冲区还给内核
+void IoUringPoller::provideBuffers(uint16_t bid, unsigned count)
+{
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = static_cast<int>(count);
+  sqe->addr = reinterpret_cast<uint64_t>(recvBuffers_ + bid * kRecvBufferSize);
+  sqe->len = static_cast<uint32_t>(kRecvBufferSize);
+  sqe->buf_group = kBufferGroup;
+  sqe->off = bid;
+  sqe->user_data = kIgnoredId;
+}
+
+/// @brief: 这一轮用完的缓冲区, 按编号排序后连续的一段用一个请求还给内核
+///         这些请求排在下一轮的 recv 之前, 内核按顺序处理, 重新提交的 recv 能拿到缓冲区
+void IoUringPoller::recycleBuffers()
+{
+  if (recycled_.empty())
+    return;
+  std::sort(recycled_.begin(), recycled_.end());
+  size_t first = 0;
+  for (size_t i = 1; i <= recycled_.size(); i++) {
+    if (i == recycled_.size() || recycled_[i] != recycled_[i - 1] + 1) {
+      provideBuffers(recycled_[first], static_cast<unsigned>(i - first));
+      first = i;
+    }
+  }
+  recycled_.clear();
+}
+
+io_uring_sqe* IoUringPoller::getSqe()
+{
+  unsigned tail = *sqTail_;
+  if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+    // 提交队列满了, 先提交一部分
+    enter(0, 0);
+    if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+      FATAL("IoUringPoller: submission queue is full");
+  }
+  unsigned index = tail & *sqMask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  ::memset(sqe, 0, sizeof(*sqe));
+  sqArray_[index] = index;
+  // 没有使用 SQPOLL, 内核只在 io_uring_enter 时读取提交队列, 所以可以先移动 tail 再填充
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+  toSubmit_++;
+  return sqe;
+}
+
+/// @brief: 提交所有的请求, minComplete > 0 时等待完成事件, timeout < 0 表示一直等待
+int IoUringPoller::enter(unsigned minComplete, int timeout)
+{
+  if (toSubmit_ == 0 && minComplete == 0)
+    return 0;
+
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  ::memset(&arg, 0, sizeof(arg));
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  if (minComplete > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeout >= 0) {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000LL;
+      arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+  }
+
+  long ret = ::syscall(__NR_io_uring_enter, ringFd_, toSubmit_, minComplete,
+                       flags, &arg, sizeof(arg));
+  if (ret < 0) {
+    if (errno != ETIME && errno != EINTR && errno != EBUSY)
+      SYSERR("IoUringPoller::io_uring_enter()");
+    return -1;
+  }
+  toSubmit_ -= static_cast<unsigned>(ret);
+  return static_cast<int>(ret);
+}
+
+void IoUringPoller::reapCompletions(ChannelList& activeChannels)
+{
+  unsigned head = *cqHead_;
+  unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    const io_uring_cqe& cqe = cqes_[head & *cqMask_];
+#ifdef IORING_RECV_MULTISHOT
+    bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+    auto bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+#else
+    bool hasBuffer = false;
+    uint16_t bid = 0;
+#endif
+    auto it = cqe.user_data == kIgnoredId ? ops_.end() : ops_.find(cqe.user_data);
+    if (it == ops_.end()) {
+      // 已经删除或者修改过的请求, 取消之前收到的数据也直接丢弃
+      if (hasBuffer)
+        recycled_.push_back(bid);
+      continue;
+    }
+    Channel* channel = it->second.channel;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    switch (it->second.type) {
+      case kOpPoll: {
+        Entry& entry = entries_[channel];
+        // 单次的 poll 或者被内核终止的 multishot poll, 在下一轮重新注册
+        if (!more) {
+          ops_.erase(it);
+          entry.id = kIgnoredId;
+          schedule(channel);
+        }
+        uint32_t revents = cqe.res < 0 ? static_cast<uint32_t>(EPOLLERR) :
+                                         static_cast<uint32_t>(cqe.res);
+        activate(channel, entry, revents, activeChannels);
+        break;
+      }
+      case kOpRecv: {
+        Entry& entry = entries_[channel];
+        // 暂停读时取消的 recv 不是当前的 recv, 结束时不需要重新提交
+        bool current = entry.recvId == cqe.user_data;
+        if (!more) {
+          ops_.erase(it);
+          if (current)
+            entry.recvId = kIgnoredId;
+          else
+            entry.pausedRecvIds.erase(std::find(entry.pausedRecvIds.begin(),
+                                                entry.pausedRecvIds.end(),
+                                                cqe.user_data));
+        }
+        if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED) {
+          // 这一轮的缓冲区用完了, recv 被终止, 下一轮缓冲区还回来之后重新提交
+          if (current)
+            schedule(channel);
+        }
+        else {
+          if (cqe.res > 0) {
+            assert(hasBuffer);
+            channel->recv(recvBuffers_ + bid * kRecvBufferSize, cqe.res);
+          }
+          else {
+            entry.recvDone = true;
+            channel->recv(nullptr, cqe.res);
+          }
+          if (!more && current && !entry.recvDone)
+            schedule(channel);
+          activate(channel, entry, EPOLLIN, activeChannels);
+        }
+        if (hasBuffer)
+          recycled_.push_back(bid);
+        break;
+      }
+      case kOpSend: {
+        ops_.erase(it);
+        auto send = sends_.find(cqe.user_data);
+        assert(send != sends_.end());
+        // 连接可能已经关闭, 在 sendComplete 返回之前不能释放
+        auto guard = std::move(send->second.guard);
+        sends_.erase(send);
+        auto entry = entries_.find(channel);
+        if (entry != entries_.end())
+          entry->second.sendId = kIgnoredId;
+        channel->sendComplete(cqe.res);
+        break;
+      }
+    }
+  }
+  round_++;
+  __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+  recycleBuffers();
+}
+
+#else // LIBNET_HAVE_IO_URING
+
+bool IoUringPoller::setup(unsigned)
+{
+  return false;
+}
+
+bool IoUringPoller::setupRecvBuffers()
+{
+  return false;
+}
+
+void IoUringPoller::poll(ChannelList&, int)
+{ assert(false && "io_uring is not supported"); }
+
+void IoUringPoller::updateChannel(Channel*)
+{ assert(false && "io_uring is not supported"); }
+
+#endif // LIBNET_HAVE_IO_URING
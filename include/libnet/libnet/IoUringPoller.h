@@ -0,0 +1,132 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <libnet/Poller.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace net
+{
+
+/// @brief: 用 io_uring 的 IORING_OP_POLL_ADD 代替 epoll_ctl + epoll_wait
+///         一轮循环中所有 channel 的注册, 修改, 删除, 重新注册都先放在提交队列里,
+///         和等待事件一起在一次 io_uring_enter 中完成
+///         水平触发的 channel 使用单次的 poll, 处理完事件之后在下一轮重新注册 (效果和 LT 一样);
+///         EPOLLET 的 channel 使用 multishot poll, 只有内核终止它时才重新注册
+///         直接使用系统调用, 不依赖 liburing; 需要 5.13 以上的内核 (multishot poll, EXT_ARG)
+///
+///         完成式 IO (Channel::completionIo(), 连接使用): 数据直接由内核收发, 没有每个事件一次的 read/write
+///         - 接收: 每个连接一个 multishot recv, 数据写进 PROVIDE_BUFFERS 提供给内核的缓冲区,
+///           复制到连接的输入缓冲区之后在这一轮结束时还给内核; 缓冲区用完时 recv 被终止, 下一轮重新提交
+///         - 发送: 这一轮中的 send() 只追加到输出缓冲区, 下一次 io_uring_enter 之前每个有数据的连接
+///           准备一个 sendmsg (直接引用输出缓冲区的 slab), 所有连接的发送和等待在同一次系统调用中提交,
+///           每个连接同时只有一个发送, 完成之后再提交剩下的数据
+///         需要 6.0 以上的内核 (multishot recv), 不支持时 completionIo() 为 false, 连接使用就绪式
+class IoUringPoller: public Poller
+{
+public:
+  explicit
+  IoUringPoller(EventLoop* loop, unsigned entries = 1024);
+  ~IoUringPoller() override;
+
+  // setup 或 mmap 失败, 或者内核缺少需要的特性时返回 false, 此时不能使用
+  bool valid() const { return ringFd_ >= 0; }
+
+  void poll(ChannelList& activeChannels, int timeout) override;
+  void updateChannel(Channel* channel) override;
+  const char* name() const override { return "io_uring"; }
+  bool completionIo() const override { return recvBuffers_ != nullptr; }
+
+private:
+  // 一个 channel 当前在内核中的请求, id 是请求的 user_data, 0 表示没有
+  struct Entry
+  {
+    uint64_t id;        // poll 请求
+    uint32_t mask;      // 注册的事件
+    bool     multishot;
+    uint64_t round;     // 最近一次产生事件的 poll() 轮次, 用来合并同一轮的多个完成事件
+    uint64_t recvId;    // 完成式: multishot recv
+    uint64_t sendId;    // 完成式: 进行中的 sendmsg
+    bool     recvDone;  // 完成式: 读到了 EOF 或者错误, 不再接收
+    std::vector<uint64_t> pausedRecvIds; // 完成式: 暂停读时取消的 recv, 取消生效之前收到的数据照常交给 channel
+  };
+
+  enum OpType
+  {
+    kOpPoll,
+    kOpRecv,
+    kOpSend,
+  };
+
+  struct Op
+  {
+    OpType   type;
+    Channel* channel;
+  };
+
+  // sendmsg 的参数, 内核在完成之前都可能读取
+  static const int kMaxSendIov = 16;
+  struct SendOp
+  {
+    struct msghdr         msg;
+    struct iovec          iov[kMaxSendIov];
+    std::shared_ptr<void> guard; // Channel 的 tie 对象, 发送完成之前输出缓冲区不能释放
+  };
+
+  bool setup(unsigned entries);
+  bool setupRecvBuffers();
+  void flushUpdates();
+  void flushCompletionIo(Channel* channel, Entry& entry);
+  void arm(Channel* channel, Entry& entry);
+  void disarm(Entry& entry);
+  void armRecv(Channel* channel, Entry& entry);
+  void armSend(Channel* channel, Entry& entry);
+  void cancel(uint64_t id);
+  void schedule(Channel* channel);
+  void activate(Channel* channel, Entry& entry, uint32_t revents, ChannelList& activeChannels);
+  void provideBuffers(uint16_t bid, unsigned count);
+  void recycleBuffers();
+  io_uring_sqe* getSqe();
+  int  enter(unsigned minComplete, int timeout);
+  void reapCompletions(ChannelList& activeChannels);
+
+  EventLoop* loop_;
+  int        ringFd_;
+
+  // 提交队列和完成队列, 都是和内核共享的内存
+  void*         ringPtr_;
+  size_t        ringSize_;
+  io_uring_sqe* sqes_;
+  size_t        sqesSize_;
+  unsigned*     sqHead_;
+  unsigned*     sqTail_;
+  unsigned*     sqMask_;
+  unsigned*     sqArray_;
+  unsigned      sqEntries_;
+  unsigned*     cqHead_;
+  unsigned*     cqTail_;
+  unsigned*     cqMask_;
+  io_uring_cqe* cqes_;
+  unsigned      toSubmit_;
+
+  // 完成式接收的缓冲区, 不支持完成式时为 nullptr
+  char*                 recvBuffers_;
+  std::vector<uint16_t> recycled_;    // 这一轮用完的缓冲区, 在 reapCompletions() 结束时还给内核
+
+  uint64_t                                nextId_;
+  uint64_t                                round_;
+  std::unordered_map<Channel*, Entry>     entries_;
+  std::unordered_map<uint64_t, Op>        ops_;            // 内核中的请求, 删除之后它的完成事件被忽略
+  std::unordered_map<uint64_t, SendOp>    sends_;          // 节点的地址不变, msghdr 可以直接交给内核
+  ChannelList                             pendingUpdates_; // 下一次 io_uring_enter 之前要处理的 channel
+};
+
+}
@@ -5,11 +5,21 @@
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <sys/time.h>
 
 #include <libnet/Logger.h>
 
 #define MAXLINE     256
+#define MAXSUFFIX   128     /* ": strerror - file:line\n" */
+
+#define DEFAULT_RING_SIZE   (64 * 1024)
+#define MIN_RING_SIZE       (4 * 1024)
+#define FLUSH_BATCH         (64 * 1024)
+#define FLUSH_PARK_MS       100
 
 #ifndef NDEBUG
 int logLevel = LOG_LEVEL_DEBUG;
@@ -17,16 +27,23 @@ int logLevel = LOG_LEVEL_DEBUG;
 int logLevel = LOG_LEVEL_INFO;
 #endif
 
+/* 前 6 个是 LOG_LEVEL_xxx, 后两个是 log_sys() 的 */
+#define LOG_KIND_SYSERR     6
+#define LOG_KIND_SYSFATAL   7
+
 static const char *log_level_str[] = {
         "[TRACE]",
         "[DEBUG]",
         "[INFO] ",
         "[WARN] ",
         "[ERROR]",
-        "[FATAL]"
+        "[FATAL]",
+        "[SYSER]",
+        "[SYSFA]"
 };
 
 static int log_fd = STDOUT_FILENO;
+static pid_t log_pid;
 
 static int timestamp(char *data, size_t len);
 
@@ -47,32 +64,682 @@ void setLogFd(int fd)
     log_fd = fd;
 }
 
+/*
+ * 异步日志
+ *
+ * 每个写日志的线程第一次写时分配一个单生产者单消费者的环形缓冲区, 挂到全局的链表上
+ * (只在表头 CAS 插入, 不删除). 线程退出时缓冲区标记为 RING_DEAD, 后台线程取完剩下的
+ * 数据后改为 RING_FREE, 之后新的线程可以复用, 所以缓冲区的个数不超过同时存在的线程数.
+ * 后台线程轮询所有缓冲区, 把数据拼成一批再 write(), 不同线程的日志之间不保证按时间排序.
+ * 所有缓冲区都空时后台线程在条件变量上睡眠, 生产者把缓冲区从空写成非空时唤醒它;
+ * 睡眠有 FLUSH_PARK_MS 的上限, 万一错过唤醒, 日志也只会晚这么久写出.
+ * 格式化仍然在调用者的线程中完成, 热路径上没有锁和系统调用.
+ */
+
+enum { RING_USED, RING_DEAD, RING_FREE };
+
+struct ring
+{
+    struct ring        *next;
+    atomic_int          state;
+    atomic_size_t       head;   /* 生产者写到的位置, 单调增加 */
+    atomic_size_t       tail;   /* 消费者读到的位置, 单调增加 */
+    size_t              size;   /* 2 的幂 */
+    char               *data;
+};
+
+static _Atomic(struct ring *) rings = NULL;
+static atomic_int       async_on = 0;
+static atomic_int       async_quit = 0;
+static int              async_policy = LOG_ASYNC_DROP;
+static size_t           ring_size = DEFAULT_RING_SIZE;
+static atomic_ulong     dropped = 0;
+static unsigned long    reported_dropped = 0;
+static pthread_t        flusher;
+static pthread_mutex_t  drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int       flusher_parked = 0;
+static pthread_mutex_t  park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   park_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t    ring_key;
+static pthread_once_t   ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_once_t   handlers_once = PTHREAD_ONCE_INIT;
+static char             batch[FLUSH_BATCH];
+
+static _Thread_local struct ring *t_ring = NULL;
+
+static void write_all(const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(log_fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "log failed");
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void ring_release(void *arg)
+{
+    struct ring *r = arg;
+    atomic_store_explicit(&r->state, RING_DEAD, memory_order_release);
+}
+
+static void make_ring_key(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static struct ring *thread_ring(void)
+{
+    if (t_ring != NULL)
+        return t_ring;
+
+    pthread_once(&ring_key_once, make_ring_key);
+
+    /* 先复用退出的线程留下的缓冲区 */
+    struct ring *r = atomic_load_explicit(&rings, memory_order_acquire);
+    for (; r != NULL; r = r->next) {
+        int expected = RING_FREE;
+        if (atomic_compare_exchange_strong(&r->state, &expected, RING_USED))
+            break;
+    }
+    if (r == NULL) {
+        r = calloc(1, sizeof(struct ring));
+        if (r == NULL)
+            return NULL;
+        r->size = ring_size;
+        r->data = malloc(r->size);
+        if (r->data == NULL) {
+            free(r);
+            return NULL;
+        }
+        atomic_init(&r->state, RING_USED);
+        struct ring *old = atomic_load_explicit(&rings, memory_order_relaxed);
+        do {
+            r->next = old;
+        } while (!atomic_compare_exchange_weak_explicit(&rings, &old, r,
+                                                        memory_order_release,
+                                                        memory_order_relaxed));
+    }
+    pthread_setspecific(ring_key, r);
+    t_ring = r;
+    return r;
+}
+
+/* 返回 0 表示没有空间, *was_empty 表示写之前缓冲区是空的 */
+static int ring_push(struct ring *r, const char *data, size_t len, int *was_empty)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (r->size - (head - tail) < len)
+        return 0;
+    *was_empty = head == tail;
+
+    size_t off = head & (r->size - 1);
+    size_t first = r->size - off < len ? r->size - off : len;
+    memcpy(r->data + off, data, first);
+    memcpy(r->data, data + first, len - first);
+    atomic_store_explicit(&r->head, head + len, memory_order_release);
+    return 1;
+}
+
+/* 持有 drain_lock 时调用, 把缓冲区中已经提交的数据追加到 batch, 返回取出的字节数 */
+static size_t ring_drain(struct ring *r, size_t *used)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    size_t total = 0;
+
+    while (tail != head) {
+        if (*used == FLUSH_BATCH) {
+            write_all(batch, *used);
+            *used = 0;
+        }
+        size_t off = tail & (r->size - 1);
+        size_t n = head - tail;
+        if (n > r->size - off)
+            n = r->size - off;
+        if (n > FLUSH_BATCH - *used)
+            n = FLUSH_BATCH - *used;
+        memcpy(batch + *used, r->data + off, n);
+        *used += n;
+        tail += n;
+        total += n;
+        /* 尽早归还空间, 阻塞的生产者可以继续 */
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+    }
+    return total;
+}
+
+/* 取出所有缓冲区的数据并写出, 返回取出的字节数 */
+static size_t drain_all(void)
+{
+    size_t used = 0;
+    size_t total = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    struct ring *r = atomic_load_explicit(&rings, memory_order_acquire);
+    for (; r != NULL; r = r->next) {
+        int dead = atomic_load_explicit(&r->state, memory_order_acquire) == RING_DEAD;
+        total += ring_drain(r, &used);
+        /* RING_DEAD 之后不会再有写入, 取完就可以复用 */
+        if (dead)
+            atomic_store_explicit(&r->state, RING_FREE, memory_order_release);
+    }
+
+    unsigned long n = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (n != reported_dropped) {
+        char line[96];
+        int len = snprintf(line, sizeof line, "[async log] %lu line(s) dropped, ring full\n",
+                           n - reported_dropped);
+        reported_dropped = n;
+        if (used + (size_t)len > FLUSH_BATCH) {
+            write_all(batch, used);
+            used = 0;
+        }
+        memcpy(batch + used, line, (size_t)len);
+        used += (size_t)len;
+    }
+
+    if (used > 0)
+        write_all(batch, used);
+    pthread_mutex_unlock(&drain_lock);
+    return total;
+}
+
+/* 生产者把缓冲区从空写成非空之后调用, 和 flush_thread() 中先设置 flusher_parked
+ * 再检查缓冲区的顺序配对, 两边至少有一边能看到对方 */
+static void wake_flusher(void)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&flusher_parked, memory_order_relaxed))
+        return;
+    pthread_mutex_lock(&park_lock);
+    atomic_store(&flusher_parked, 0);
+    pthread_cond_signal(&park_cond);
+    pthread_mutex_unlock(&park_lock);
+}
+
+static void park_flusher(void)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += FLUSH_PARK_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&park_lock);
+    while (atomic_load(&flusher_parked) && !atomic_load(&async_quit)) {
+        if (pthread_cond_timedwait(&park_cond, &park_lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&park_lock);
+}
+
+static void *flush_thread(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&async_quit)) {
+        if (drain_all() != 0)
+            continue;
+        /* 先声明要睡眠再检查一次, 这之后写入的生产者会看到 flusher_parked */
+        atomic_store(&flusher_parked, 1);
+        if (drain_all() == 0)
+            park_flusher();
+        atomic_store(&flusher_parked, 0);
+    }
+    drain_all();
+    return NULL;
+}
+
+static void atfork_child(void)
+{
+    log_pid = getpid();
+    /* 子进程里没有后台线程, 改回同步写; 父进程的后台线程会写出缓冲区里剩下的数据 */
+    atomic_store(&async_on, 0);
+    pthread_mutex_init(&drain_lock, NULL);
+    pthread_mutex_init(&park_lock, NULL);
+}
+
+static void register_handlers(void)
+{
+    pthread_atfork(NULL, NULL, atfork_child);
+    /* 正常退出时写出缓冲区里剩下的日志 */
+    atexit(stopAsyncLogging);
+}
+
+int startAsyncLogging(size_t ringSize, int fullPolicy)
+{
+    if (atomic_load(&async_on))
+        return 0;
+
+    if (ringSize == 0)
+        ringSize = DEFAULT_RING_SIZE;
+    if (ringSize < MIN_RING_SIZE)
+        ringSize = MIN_RING_SIZE;
+    /* 向上取整到 2 的幂 */
+    size_t size = MIN_RING_SIZE;
+    while (size < ringSize)
+        size <<= 1;
+
+    /* 已经存在的缓冲区保持原来的大小 */
+    ring_size = size;
+    async_policy = fullPolicy;
+    pthread_once(&handlers_once, register_handlers);
+
+    atomic_store(&async_quit, 0);
+    int err = pthread_create(&flusher, NULL, flush_thread, NULL);
+    if (err != 0)
+        return err;
+    atomic_store(&async_on, 1);
+    return 0;
+}
+
+void stopAsyncLogging(void)
+{
+    if (!atomic_exchange(&async_on, 0))
+        return;
+    atomic_store(&async_quit, 1);
+    pthread_mutex_lock(&park_lock);
+    pthread_cond_signal(&park_cond);
+    pthread_mutex_unlock(&park_lock);
+    pthread_join(flusher, NULL);
+}
+
+unsigned long asyncLogDropped(void)
+{
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+/* must != 0 时缓冲区满也等待, 用于二进制日志的格式定义, 丢了之后这个位置的日志都无法解码 */
+static void emit_record(const char *data, size_t len, int to_abort, int must)
+{
+    if (atomic_load_explicit(&async_on, memory_order_relaxed)) {
+        struct ring *r = thread_ring();
+        if (r != NULL) {
+            int was_empty = 0;
+            int pushed = ring_push(r, data, len, &was_empty);
+            while (!pushed && (must || async_policy == LOG_ASYNC_BLOCK) &&
+                   atomic_load_explicit(&async_on, memory_order_relaxed)) {
+                sched_yield();
+                pushed = ring_push(r, data, len, &was_empty);
+            }
+            if (!pushed)
+                atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            else if (was_empty)
+                wake_flusher();
+            /* abort() 之前一定要写出 */
+            if (to_abort)
+                drain_all();
+            return;
+        }
+    }
+    write_all(data, len);
+}
+
+static void emit(const char *data, size_t len, int to_abort)
+{
+    emit_record(data, len, to_abort, 0);
+}
+
+/*
+ * 二进制日志
+ *
+ * 不在调用者的线程中格式化, 只记录格式字符串的编号和原始的参数, 由 log_decode 离线还原成文本.
+ * 每个日志位置 (格式字符串, 文件, 行号) 第一次写日志时解析格式字符串得到参数的类型, 分配编号,
+ * 写一条定义记录; 之后只写数据记录. 所有整数按本机字节序, 解码要在相同的架构上进行.
+ *
+ *   定义: u8 1, u32 id, u8 kind, u32 line, u16 len, file, u16 len, fmt, u8 n, types[n]
+ *   数据: u8 2, u32 id, i32 pid, i64 微秒时间戳, u16 len, args[len]
+ *
+ * types 中每个字符对应一个参数: i int, u unsigned, l 8 字节整数, d double, D long double (按 double 保存),
+ * p 指针, s 字符串 (u16 长度 + 内容). log_sys() 的最后一个参数是错误信息字符串.
+ * 带精度的 %.5s, %.*s 只保存精度以内的部分, 参数可以不以 '\0' 结尾, 解码时再按原来的精度格式化.
+ * 不支持的格式 (%n, %ls 等) 或者位置表满时这一行按文本写出, log_decode 会原样输出文本行.
+ * 异步日志中不同线程的记录可能乱序, 定义可能出现在使用它的数据记录之后, 所以 log_decode 先读完所有定义.
+ */
+
+#define BINARY_DEF      1
+#define BINARY_LOG      2
+#define MAX_SITES       4096
+#define MAX_ARGS        32
+#define MAX_RECORD      1024
+
+/* struct site 的 limits, 其他非负值是格式中写明的精度 */
+#define NO_LIMIT        (-1)
+#define LIMIT_ARG       (-2)    /* %.*s, 精度是前一个参数 */
+
+struct site
+{
+    _Atomic(const char *) fmt;      /* NULL 表示空位 */
+    atomic_int          ready;
+    const char         *file;
+    int                 line;
+    int                 kind;
+    int                 text;       /* 格式不支持, 按文本写 */
+    uint32_t            id;
+    char                types[MAX_ARGS + 2];
+    int                 limits[MAX_ARGS + 2];   /* 每个 's' 最多读多少字节 */
+};
+
+static struct site      sites[MAX_SITES];
+static atomic_uint      next_site_id = 0;
+static atomic_int       binary_on = 0;
+
+void setLogBinary(int on)
+{
+    atomic_store(&binary_on, on != 0);
+}
+
+/* 返回参数个数, 不支持时返回 -1 */
+static int parse_types(const char *fmt, char *types, int *limits)
+{
+    int n = 0;
+    for (const char *p = fmt; *p != '\0'; p++) {
+        if (*p != '%')
+            continue;
+        p++;
+        if (*p == '%')
+            continue;
+        while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+            p++;
+        if (*p == '*') {
+            if (n == MAX_ARGS) return -1;
+            types[n++] = 'i';
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+        int precision = NO_LIMIT;
+        if (*p == '.') {
+            p++;
+            precision = 0;
+            if (*p == '*') {
+                if (n == MAX_ARGS) return -1;
+                types[n++] = 'i';
+                precision = LIMIT_ARG;
+                p++;
+            }
+            while (*p >= '0' && *p <= '9') {
+                if (precision < 65536)
+                    precision = precision * 10 + (*p - '0');
+                p++;
+            }
+        }
+        int wide = 0, ldouble = 0;
+        if (*p == 'h') {
+            p++;
+            if (*p == 'h') p++;
+        }
+        else if (*p == 'l') {
+            wide = 1;
+            p++;
+            if (*p == 'l') p++;
+        }
+        else if (*p == 'z' || *p == 'j' || *p == 't') {
+            wide = 1;
+            p++;
+        }
+        else if (*p == 'L') {
+            ldouble = 1;
+            p++;
+        }
+
+        char type;
+        switch (*p) {
+            case 'd': case 'i': case 'c':
+                type = wide ? 'l' : 'i';
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                type = wide ? 'l' : 'u';
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                type = ldouble ? 'D' : 'd';
+                break;
+            case 's':
+                if (wide) return -1;
+                type = 's';
+                break;
+            case 'p':
+                type = 'p';
+                break;
+            default:
+                return -1;
+        }
+        if (n == MAX_ARGS) return -1;
+        limits[n] = type == 's' ? precision : NO_LIMIT;
+        types[n++] = type;
+    }
+    types[n] = '\0';
+    return n;
+}
+
+/* 抢到空位之后填写, 其他线程等待 ready */
+static void init_site(struct site *s, const char *file, int line, int kind, const char *fmt)
+{
+    s->file = file;
+    s->line = line;
+    s->kind = kind;
+    int n = parse_types(fmt, s->types, s->limits);
+    s->text = n < 0;
+    if (!s->text && kind >= LOG_KIND_SYSERR) {
+        s->limits[n] = NO_LIMIT;
+        strcat(s->types, "s");
+    }
+    s->id = atomic_fetch_add(&next_site_id, 1);
+    atomic_store_explicit(&s->ready, 1, memory_order_release);
+}
+
+/* 找到或者创建日志位置, *created 表示由这次调用创建; 表满时返回 NULL */
+static struct site *find_site(const char *file, int line, int kind, const char *fmt, int *created)
+{
+    uintptr_t h = (uintptr_t)fmt * 31 + (uintptr_t)line;
+    h ^= h >> 17;
+    *created = 0;
+    for (size_t i = 0; i < MAX_SITES; i++) {
+        struct site *s = &sites[(h + i) & (MAX_SITES - 1)];
+        const char *cur = atomic_load_explicit(&s->fmt, memory_order_acquire);
+        if (cur == NULL) {
+            const char *expected = NULL;
+            if (atomic_compare_exchange_strong(&s->fmt, &expected, fmt)) {
+                init_site(s, file, line, kind, fmt);
+                *created = 1;
+                return s;
+            }
+            cur = expected;
+        }
+        if (cur != fmt)
+            continue;
+        while (!atomic_load_explicit(&s->ready, memory_order_acquire))
+            sched_yield();
+        if (s->line == line && s->kind == kind && s->file == file)
+            return s;
+    }
+    return NULL;
+}
+
+struct record
+{
+    char    data[MAX_RECORD];
+    size_t  len;
+    int     full;
+};
+
+static void put(struct record *r, const void *value, size_t n)
+{
+    if (r->len + n > sizeof r->data) {
+        r->full = 1;
+        return;
+    }
+    memcpy(r->data + r->len, value, n);
+    r->len += n;
+}
+
+static void put_u8(struct record *r, uint8_t v)   { put(r, &v, sizeof v); }
+static void put_u16(struct record *r, uint16_t v) { put(r, &v, sizeof v); }
+static void put_u32(struct record *r, uint32_t v) { put(r, &v, sizeof v); }
+
+/* 最多读 max 个字节, 超出记录大小的字符串被截断 */
+static void put_string(struct record *r, const char *str, size_t max)
+{
+    if (str == NULL)
+        str = "(null)";
+    size_t len = strnlen(str, max);
+    size_t room = sizeof r->data - r->len;
+    room = room > 2 ? room - 2 : 0;
+    if (len > room)
+        len = room;
+    if (len > UINT16_MAX)
+        len = UINT16_MAX;
+    put_u16(r, (uint16_t)len);
+    put(r, str, len);
+}
+
+static void emit_definition(const struct site *s, const char *fmt)
+{
+    struct record r = { .len = 0, .full = 0 };
+    put_u8(&r, BINARY_DEF);
+    put_u32(&r, s->id);
+    put_u8(&r, (uint8_t)s->kind);
+    put_u32(&r, (uint32_t)s->line);
+    put_string(&r, s->file, SIZE_MAX);
+    put_string(&r, fmt, SIZE_MAX);
+    put_u8(&r, (uint8_t)strlen(s->types));
+    put(&r, s->types, strlen(s->types));
+    /* 格式字符串太长装不下时退回文本 */
+    if (!r.full)
+        emit_record(r.data, r.len, 0, 1);
+}
+
+/* 返回 0 表示这一行需要按文本写 */
+static int log_binary(const char *file,
+                      int line,
+                      int kind,
+                      const char *err,
+                      int to_abort,
+                      const char *fmt,
+                      va_list ap)
+{
+    int created;
+    struct site *s = find_site(file, line, kind, fmt, &created);
+    if (s == NULL || s->text)
+        return 0;
+    if (created)
+        emit_definition(s, fmt);
+
+    if (log_pid == 0)
+        log_pid = getpid();
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t usec = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    struct record r = { .len = 0, .full = 0 };
+    put_u8(&r, BINARY_LOG);
+    put_u32(&r, s->id);
+    put(&r, &log_pid, sizeof(int32_t));
+    put(&r, &usec, sizeof usec);
+    size_t len_at = r.len;
+    put_u16(&r, 0);
+
+    int last = 0;   /* 最近的 int 参数, %.*s 的精度 */
+    for (const char *t = s->types; *t != '\0'; t++) {
+        switch (*t) {
+            case 'i': { int v = va_arg(ap, int); put(&r, &v, sizeof v); last = v; break; }
+            case 'u': { unsigned v = va_arg(ap, unsigned); put(&r, &v, sizeof v); break; }
+            case 'l': { long v = va_arg(ap, long); put(&r, &v, sizeof v); break; }
+            case 'd': { double v = va_arg(ap, double); put(&r, &v, sizeof v); break; }
+            case 'D': { double v = (double)va_arg(ap, long double); put(&r, &v, sizeof v); break; }
+            case 'p': { uint64_t v = (uint64_t)(uintptr_t)va_arg(ap, void *); put(&r, &v, sizeof v); break; }
+            case 's': {
+                /* 负的精度和没有精度一样 */
+                int limit = s->limits[t - s->types];
+                if (limit == LIMIT_ARG)
+                    limit = last;
+                size_t max = limit < 0 ? SIZE_MAX : (size_t)limit;
+                /* log_sys() 的错误信息不在参数列表里 */
+                if (t[1] == '\0' && kind >= LOG_KIND_SYSERR)
+                    put_string(&r, err, max);
+                else
+                    put_string(&r, va_arg(ap, const char *), max);
+                break;
+            }
+        }
+    }
+    uint16_t args = (uint16_t)(r.len - len_at - sizeof(uint16_t));
+    memcpy(r.data + len_at, &args, sizeof args);
+
+    emit(r.data, r.len, to_abort);
+    if (to_abort) {
+        abort();
+    }
+    return 1;
+}
+
+/* "20180102 03:04:05.123456 [pid] [LEVEL] " */
+static size_t prefix(char *data, size_t len, const char *level)
+{
+    if (log_pid == 0)
+        log_pid = getpid();
+    size_t i = (size_t)timestamp(data, len);
+    i += (size_t)snprintf(data + i, len - i, " [%d] %s ", log_pid, level);
+    return i;
+}
+
+static void log_line(const char *file,
+                     int line,
+                     int kind,
+                     const char *err,
+                     int to_abort,
+                     const char *fmt,
+                     va_list ap)
+{
+    if (atomic_load_explicit(&binary_on, memory_order_relaxed)) {
+        va_list copy;
+        va_copy(copy, ap);
+        int done = log_binary(file, line, kind, err, to_abort, fmt, copy);
+        va_end(copy);
+        if (done)
+            return;
+    }
+
+    char        data[MAXLINE + MAXSUFFIX];
+    size_t      i = prefix(data, MAXLINE, log_level_str[kind]);
+    int         n;
+
+    n = vsnprintf(data + i, MAXLINE - i, fmt, ap);
+    if (n > 0)
+        i += (size_t)n < MAXLINE - i ? (size_t)n : MAXLINE - i - 1;
+
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+    if (err != NULL)
+        n = snprintf(data + i, sizeof data - i, ": %s - %s:%d\n", err, base, line);
+    else
+        n = snprintf(data + i, sizeof data - i, " - %s:%d\n", base, line);
+    if (n > 0)
+        i += (size_t)n < sizeof data - i ? (size_t)n : sizeof data - i - 1;
+
+    emit(data, i, to_abort);
+    if (to_abort) {
+        abort();
+    }
+}
+
 void log_base(const char *file,
               int line,
               int level,
               int to_abort,
               const char *fmt, ...)
 {
-    char        data[MAXLINE];
-    size_t      i = 0;
     va_list     ap;
 
-    i += timestamp(data, 32);
-    i += sprintf(data + i, " [%d]", getpid());
-    i += sprintf(data + i, " %s ", log_level_str[level]);
-
     va_start(ap, fmt);
-    vsnprintf(data + i, MAXLINE - i, fmt, ap);
+    log_line(file, line, level, NULL, to_abort, fmt, ap);
     va_end(ap);
-
-    int err = dprintf(log_fd, "%s - %s:%d\n",
-                      data, strrchr(file, '/') + 1, line);
-    if (err == -1) {
-        fprintf(stderr, "log failed");
-    }
-    if (to_abort) {
-        abort();
-    }
 }
 
 void log_sys(const char *file,
@@ -80,38 +747,50 @@ void log_sys(const char *file,
              int to_abort,
              const char *fmt, ...)
 {
-    char        data[MAXLINE];
-    size_t      i = 0;
     va_list     ap;
+    char        err[64];
+    int         saved = errno;
 
-    i += timestamp(data, 32);
-    i += sprintf(data + i, " [%d]", getpid());
-    i += sprintf(data + i, " %s ", to_abort ? "[SYSFA]":"[SYSER]");
+    /* 格式化的过程可能改变 errno, 先取出错误信息 */
+    if (strerror_r(saved, err, sizeof err) != 0)
+        snprintf(err, sizeof err, "errno %d", saved);
 
     va_start(ap, fmt);
-    vsnprintf(data + i, MAXLINE - i, fmt, ap);
+    log_line(file, line, to_abort ? LOG_KIND_SYSFATAL : LOG_KIND_SYSERR, err, to_abort, fmt, ap);
     va_end(ap);
-
-    dprintf(log_fd, "%s: %s - %s:%d\n",
-            data, strerror(errno), strrchr(file, '/') + 1, line);
-
-    if (to_abort) {
-        abort();
-    }
 }
 
+/* 每个线程缓存当前这一秒的 "YYYYMMDD HH:MM:SS", 同一秒内只需要格式化微秒 */
 static int timestamp(char *data, size_t len)
 {
+    static _Thread_local time_t cached_seconds = -1;
+    static _Thread_local char   cached[72];
+
     struct timeval tv;
 
     gettimeofday(&tv, NULL);
     time_t seconds = tv.tv_sec;
 
-    struct tm tm_time;
+    if (seconds != cached_seconds) {
+        struct tm tm_time;
+
+        gmtime_r(&seconds, &tm_time);
+        snprintf(cached, sizeof cached, "%4d%02d%02d %02d:%02d:%02d",
+                 tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
+                 tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
+        cached_seconds = seconds;
+    }
 
-    gmtime_r(&seconds, &tm_time);
+    if (len < 25)
+        return snprintf(data, len, "%s", cached);
 
-    return snprintf(data, len, "%4d%02d%02d %02d:%02d:%02d.%06ld",
-                    tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-                    tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec, tv.tv_usec);
-}
\ No newline at end of file
+    memcpy(data, cached, 17);
+    data[17] = '.';
+    long us = tv.tv_usec;
+    for (int i = 23; i > 17; i--) {
+        data[i] = (char)('0' + us % 10);
+        us /= 10;
+    }
+    data[24] = '\0';
+    return 24;
+}
@@ -1,5 +1,7 @@
 #pragma once 
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -17,6 +19,27 @@ void setLogLevel(int level);
 
 void setLogFd(int fd);
 
+/* 缓冲区满时的处理方式 */
+#define LOG_ASYNC_DROP      0   /* 丢弃这一行, 计数并在之后的日志里报告 */
+#define LOG_ASYNC_BLOCK     1   /* 等待后台线程腾出空间 */
+
+/*
+ * 异步日志: 每个线程一个无锁的环形缓冲区 (ringSize 字节, 向上取整到 2 的幂, 0 为 64KB),
+ * 后台线程批量 write() 到 setLogFd() 的 fd. FATAL 在 abort() 之前同步写出所有缓冲区,
+ * 进程正常退出时也会写出. 返回 0 表示成功, 否则是 pthread_create() 的错误码
+ */
+int startAsyncLogging(size_t ringSize, int fullPolicy);
+/* 写出缓冲区里所有的日志并停止后台线程, 之后的日志同步写出 */
+void stopAsyncLogging(void);
+/* 因为缓冲区满而丢弃的行数 */
+unsigned long asyncLogDropped(void);
+
+/*
+ * 二进制日志: 只记录格式字符串的编号和原始参数, 不在写日志的线程中格式化,
+ * 用 log_decode 还原成文本. 在写第一条日志之前打开, 可以和异步日志一起用
+ */
+void setLogBinary(int on);
+
 /* private, do not use  */
 void log_base(const char *file,
               int line,
@@ -35,14 +58,22 @@ log_base(__FILE__, __LINE__, level, to_abort, fmt, ##__VA_ARGS__)
 #define LOG_SYS(to_abort, fmt, ...) \
 log_sys(__FILE__, __LINE__, to_abort, fmt, ##__VA_ARGS__)
 
+/*
+ * 编译期的最低级别, 低于它的日志连同参数的求值一起被编译器删除, 运行期的 logLevel 不能再打开,
+ * 例如 cmake -DLOG_COMPILE_LEVEL=LOG_LEVEL_INFO. ERROR 及以上总是保留
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL   LOG_LEVEL_TRACE
+#endif
+
 /* public  */
-#define TRACE(fmt, ...)     if(logLevel <= LOG_LEVEL_TRACE) \
+#define TRACE(fmt, ...)     if(LOG_COMPILE_LEVEL <= LOG_LEVEL_TRACE && logLevel <= LOG_LEVEL_TRACE) \
 LOG_BASE(LOG_LEVEL_TRACE, 0, fmt, ##__VA_ARGS__)
-#define DEBUG(fmt, ...)     if(logLevel <= LOG_LEVEL_DEBUG) \
+#define DEBUG(fmt, ...)     if(LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG && logLevel <= LOG_LEVEL_DEBUG) \
 LOG_BASE(LOG_LEVEL_DEBUG, 0, fmt, ##__VA_ARGS__)
-#define INFO(fmt, ...)      if(logLevel <= LOG_LEVEL_INFO) \
+#define INFO(fmt, ...)      if(LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO && logLevel <= LOG_LEVEL_INFO) \
 LOG_BASE(LOG_LEVEL_INFO, 0, fmt, ##__VA_ARGS__)
-#define WARN(fmt, ...)      if(logLevel <= LOG_LEVEL_WARN) \
+#define WARN(fmt, ...)      if(LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN && logLevel <= LOG_LEVEL_WARN) \
 LOG_BASE(LOG_LEVEL_WARN, 0, fmt, ##__VA_ARGS__)
 #define ERROR(fmt, ...)     LOG_BASE(LOG_LEVEL_ERROR, 0, fmt, ##__VA_ARGS__)
 #define FATAL(fmt, ...)     LOG_BASE(LOG_LEVEL_FATAL, 1, fmt, ##__VA_ARGS__)
@@ -0,0 +1,56 @@
+#include <libnet/MemoryCounter.h>
+
+using namespace net;
+
+namespace
+{
+
+// 常量初始化, 其他翻译单元的静态计数器构造时已经可用
+std::atomic<MemoryCounter*> head(nullptr);
+
+std::atomic<size_t> nextShard(0);
+
+size_t shardIndex()
+{
+  thread_local size_t index = nextShard.fetch_add(1, std::memory_order_relaxed) % MemoryCounter::kNumShards;
+  return index;
+}
+
+}
+
+const size_t MemoryCounter::kNumShards;
+
+MemoryCounter::MemoryCounter(const char* name)
+: name_(name),
+  next_(head.load(std::memory_order_relaxed))
+{
+  while (!head.compare_exchange_weak(next_, this, std::memory_order_release, std::memory_order_relaxed))
+    ;
+}
+
+MemoryCounter::Shard& MemoryCounter::shard()
+{
+  return shards_[shardIndex()];
+}
+
+int64_t MemoryCounter::bytes() const
+{
+  int64_t total = 0;
+  for (auto& shard: shards_)
+    total += shard.bytes.load(std::memory_order_relaxed);
+  return total;
+}
+
+int64_t MemoryCounter::objects() const
+{
+  int64_t total = 0;
+  for (auto& shard: shards_)
+    total += shard.objects.load(std::memory_order_relaxed);
+  return total;
+}
+
+void MemoryCounter::forEach(const std::function<void(const MemoryCounter&)>& func)
+{
+  for (auto counter = head.load(std::memory_order_acquire); counter != nullptr; counter = counter->next_)
+    func(*counter);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include <stdint.h>
+
+#include <libnet/noncopyable.h>
+
+namespace net
+{
+
+/// @brief: 一个子系统占用的内存: 对象数和字节数, 由子系统在分配和释放时更新
+///         计数器是静态对象, 构造时加入全局链表, 不会注销; forEach() 在任意线程中读取所有计数器
+///         热路径上只写当前线程对应的分片 (relaxed 原子操作), 读取时再合并, 所以可以一直打开
+///         字节数是子系统自己的估计 (例如不包括 std::function 捕获的状态), 用来看趋势和比例
+class MemoryCounter: noncopyable
+{
+public:
+  static const size_t kNumShards = 8;
+
+  explicit MemoryCounter(const char* name);
+
+  void add(size_t bytes, int64_t objects = 1)
+  {
+    auto& shard = this->shard();
+    shard.bytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    shard.objects.fetch_add(objects, std::memory_order_relaxed);
+  }
+
+  void sub(size_t bytes, int64_t objects = 1)
+  {
+    auto& shard = this->shard();
+    shard.bytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    shard.objects.fetch_sub(objects, std::memory_order_relaxed);
+  }
+
+  const char* name() const { return name_; }
+  int64_t bytes() const;
+  int64_t objects() const;
+
+  // 按注册的相反顺序
+  static void forEach(const std::function<void(const MemoryCounter&)>& func);
+
+private:
+  // 分配和释放可能在不同的线程, 单个分片可以是负数
+  struct alignas(64) Shard
+  {
+    std::atomic<int64_t> bytes{0};
+    std::atomic<int64_t> objects{0};
+  };
+
+  Shard& shard();
+
+  Shard          shards_[kNumShards];
+  const char*    name_;
+  MemoryCounter* next_;
+};
+
+}
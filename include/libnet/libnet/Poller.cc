@@ -0,0 +1,52 @@
+#include <atomic>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libnet/Logger.h>
+#include <libnet/EPoller.h>
+#include <libnet/IoUringPoller.h>
+#include <libnet/Poller.h>
+
+using namespace net;
+
+namespace
+{
+
+std::atomic<int> g_defaultPoller(kPollerEpoll);
+
+PollerType defaultPoller()
+{
+  const char* env = ::getenv("LIBNET_POLLER");
+  if (env != nullptr) {
+    if (::strcmp(env, "io_uring") == 0)
+      return kPollerIoUring;
+    if (::strcmp(env, "epoll") == 0)
+      return kPollerEpoll;
+    WARN("unknown LIBNET_POLLER=%s, ignored", env);
+  }
+  return static_cast<PollerType>(g_defaultPoller.load());
+}
+
+}
+
+namespace net
+{
+
+void setDefaultPoller(PollerType type)
+{
+  g_defaultPoller = type;
+}
+
+}
+
+std::unique_ptr<Poller> Poller::newDefaultPoller(EventLoop* loop)
+{
+  if (defaultPoller() == kPollerIoUring) {
+    auto poller = std::make_unique<IoUringPoller>(loop);
+    if (poller->valid())
+      return poller;
+    WARN("io_uring is not available, fall back to epoll");
+  }
+  return std::make_unique<EPoller>(loop);
+}
@@ -0,0 +1,45 @@
+#pragma once 
+
+#include <memory>
+#include <vector>
+
+#include <libnet/noncopyable.h>
+
+namespace net
+{
+
+class EventLoop;
+class Channel;
+
+enum PollerType
+{
+  kPollerEpoll,
+  kPollerIoUring,
+};
+
+// 之后创建的 EventLoop 使用的后端, 默认 epoll.
+// 环境变量 LIBNET_POLLER=epoll|io_uring 优先于这里的设置.
+// 内核不支持 io_uring (或者被 seccomp 禁止) 时自动退回 epoll
+void setDefaultPoller(PollerType type);
+
+/// @brief: EventLoop 的 IO 多路复用后端, 只在 loop 线程中使用
+///         语义和 epoll 一致: Channel::events() 是关注的事件 (可以带 EPOLLET),
+///         poll() 把产生的事件填到 Channel::revents 中
+class Poller: noncopyable
+{
+public:
+  using ChannelList = std::vector<Channel*>;
+
+  virtual ~Poller() = default;
+
+  virtual void poll(ChannelList& activeChannels, int timeout) = 0;
+  virtual void updateChannel(Channel* channel) = 0;
+  virtual const char* name() const = 0;
+
+  // 是否支持完成式 IO: 后端直接收发数据, 见 Channel::setCompletionIo()
+  virtual bool completionIo() const { return false; }
+
+  static std::unique_ptr<Poller> newDefaultPoller(EventLoop* loop);
+};
+
+}
@@ -0,0 +1,341 @@
+#include <assert.h>
+#include <cxxabi.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "Logger.h"
+#include "Profiler.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+using namespace net;
+
+namespace
+{
+
+const int    kMaxFrames = 64;
+const int    kSkipFrames = 2;    // 信号处理函数自己和信号的跳板
+const size_t kNumSlots = 4096;   // 100ms 合并一次, 足够 40k 样本/秒
+
+enum SlotState { kEmpty, kWriting, kFull };
+
+// 信号处理函数写, 合并线程读; 处理函数不能分配内存也不能加锁
+struct Slot
+{
+  std::atomic<int> state{kEmpty};
+  const char*      tag;
+  int              depth;
+  void*            frames[kMaxFrames];
+};
+
+Slot                  slots[kNumSlots];
+std::atomic<uint64_t> nextSlot(0);
+std::atomic<uint64_t> dropped(0);
+
+thread_local const char* t_tag = nullptr;
+
+void onProfile(int)
+{
+  int savedErrno = errno;
+  Slot& slot = slots[nextSlot.fetch_add(1, std::memory_order_relaxed) % kNumSlots];
+  int expected = kEmpty;
+  if (slot.state.compare_exchange_strong(expected, kWriting, std::memory_order_acquire)) {
+    slot.tag = t_tag;
+    slot.depth = ::backtrace(slot.frames, kMaxFrames);
+    slot.state.store(kFull, std::memory_order_release);
+  }
+  else {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+  errno = savedErrno;
+}
+
+// 装上之后不再卸载: 停止之后还可能有已经产生的 SIGPROF, 默认的处理是结束进程
+void installHandler()
+{
+  static std::once_flag once;
+  std::call_once(once, []
+  {
+    // backtrace() 第一次调用时会加载 libgcc, 不能发生在信号处理函数里
+    void* frames[1];
+    ::backtrace(frames, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = onProfile;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (::sigaction(SIGPROF, &sa, nullptr) == -1)
+      SYSERR("Profiler sigaction()");
+  });
+}
+
+pid_t currentTid()
+{
+  return static_cast<pid_t>(::syscall(SYS_gettid));
+}
+
+// "binary(_ZN3net...+0x1a) [0x...]" 中 demangle 之后的函数名, 没有符号时是模块名;
+// 不带偏移, 同一个函数的样本才能在火焰图中合并
+std::string frameName(const char* symbol)
+{
+  std::string line(symbol);
+  auto begin = line.find('(');
+  auto end = line.find_first_of("+)", begin);
+  std::string name;
+  if (begin != std::string::npos && end != std::string::npos && end > begin + 1) {
+    std::string mangled = line.substr(begin + 1, end - begin - 1);
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+    name = status == 0 && demangled != nullptr ? demangled : mangled;
+    free(demangled);
+  }
+  else {
+    auto module = line.substr(0, begin == std::string::npos ? line.find(' ') : begin);
+    auto slash = module.rfind('/');
+    name = "[" + (slash == std::string::npos ? module : module.substr(slash + 1)) + "]";
+  }
+  std::replace(name.begin(), name.end(), ';', ':');
+  return name;
+}
+
+} // unnamed-namespace
+
+/// @brief: 不析构, 注册的线程可能在静态对象析构之后才结束
+Profiler& Profiler::instance()
+{
+  static Profiler* profiler = new Profiler;
+  return *profiler;
+}
+
+Profiler::Profiler()
+: hz_(0),
+  quit_(false),
+  numSamples_(0)
+{}
+
+Profiler::~Profiler()
+{
+  stop();
+}
+
+const char* Profiler::swapTag(const char* tag)
+{
+  const char* saved = t_tag;
+  t_tag = tag;
+  // 只需要防止编译器重排, 信号处理函数在同一个线程中执行
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  return saved;
+}
+
+void Profiler::registerThread()
+{
+  pid_t tid = currentTid();
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = threads_.find(tid);
+  if (it != threads_.end()) {
+    it->second.refs++;
+    return;
+  }
+  auto& entry = threads_[tid];
+  entry = { ::pthread_self(), 1, timer_t(), false };
+  if (hz_ > 0)
+    arm(tid, entry);
+}
+
+void Profiler::unregisterThread()
+{
+  pid_t tid = currentTid();
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = threads_.find(tid);
+  assert(it != threads_.end());
+  if (--it->second.refs > 0)
+    return;
+  disarm(it->second);
+  threads_.erase(it);
+}
+
+bool Profiler::start(int hz)
+{
+  assert(hz > 0);
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (hz_ > 0)
+    return false;
+
+  installHandler();
+  hz_ = hz;
+  bool ok = true;
+  for (auto& [tid, entry]: threads_)
+    ok = arm(tid, entry) && ok;
+  if (!ok) {
+    for (auto& [tid, entry]: threads_)
+      disarm(entry);
+    hz_ = 0;
+    return false;
+  }
+  quit_ = false;
+  collector_ = std::thread([this]{ collect(); });
+  return true;
+}
+
+void Profiler::stop()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (hz_ == 0)
+      return;
+    for (auto& [tid, entry]: threads_)
+      disarm(entry);
+    hz_ = 0;
+    quit_ = true;
+  }
+  cond_.notify_one();
+  collector_.join();
+  drain();
+}
+
+bool Profiler::running() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hz_ > 0;
+}
+
+int Profiler::hz() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hz_;
+}
+
+/// @brief: 持有 mutex_ 时调用; 定时器按线程自己的 CPU 时间计时, 空闲的线程不产生样本
+bool Profiler::arm(pid_t tid, ThreadEntry& entry)
+{
+  clockid_t clock;
+  int err = ::pthread_getcpuclockid(entry.thread, &clock);
+  if (err != 0) {
+    errno = err;
+    SYSERR("Profiler pthread_getcpuclockid()");
+    return false;
+  }
+
+  struct sigevent sev;
+  memset(&sev, 0, sizeof sev);
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = tid;
+  if (::timer_create(clock, &sev, &entry.timer) == -1) {
+    SYSERR("Profiler timer_create()");
+    return false;
+  }
+
+  long interval = 1000000000L / hz_;
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval / 1000000000L;
+  spec.it_interval.tv_nsec = interval % 1000000000L;
+  spec.it_value = spec.it_interval;
+  if (::timer_settime(entry.timer, 0, &spec, nullptr) == -1) {
+    SYSERR("Profiler timer_settime()");
+    ::timer_delete(entry.timer);
+    return false;
+  }
+  entry.armed = true;
+  return true;
+}
+
+void Profiler::disarm(ThreadEntry& entry)
+{
+  if (!entry.armed)
+    return;
+  ::timer_delete(entry.timer);
+  entry.armed = false;
+}
+
+void Profiler::collect()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!quit_) {
+    cond_.wait_for(lock, std::chrono::milliseconds(100));
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
+
+/// @brief: 把写完的样本合并到 stacks_, 释放它们的位置
+void Profiler::drain()
+{
+  std::lock_guard<std::mutex> guard(mergeMutex_);
+  std::string key;
+  for (auto& slot: slots) {
+    if (slot.state.load(std::memory_order_acquire) != kFull)
+      continue;
+    key.assign(slot.tag != nullptr ? slot.tag : "[untagged]");
+    key.push_back('\0');
+    if (slot.depth > kSkipFrames)
+      key.append(reinterpret_cast<const char*>(slot.frames + kSkipFrames),
+                 static_cast<size_t>(slot.depth - kSkipFrames) * sizeof(void*));
+    slot.state.store(kEmpty, std::memory_order_release);
+    stacks_[key]++;
+    numSamples_++;
+  }
+}
+
+std::string Profiler::folded()
+{
+  drain();
+  std::unordered_map<std::string, uint64_t> stacks;
+  {
+    std::lock_guard<std::mutex> guard(mergeMutex_);
+    stacks = stacks_;
+  }
+
+  std::unordered_map<void*, std::string> names;
+  std::string result;
+  for (auto& [key, count]: stacks) {
+    auto sep = key.find('\0');
+    std::vector<void*> frames((key.size() - sep - 1) / sizeof(void*));
+    memcpy(frames.data(), key.data() + sep + 1, frames.size() * sizeof(void*));
+
+    result.append(key, 0, sep);
+    // 调用栈从叶子开始, 火焰图从根开始
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+      auto name = names.find(*it);
+      if (name == names.end()) {
+        char** symbols = ::backtrace_symbols(&*it, 1);
+        name = names.emplace(*it, symbols != nullptr ? frameName(symbols[0]) : "[unknown]").first;
+        free(symbols);
+      }
+      result.append(1, ';').append(name->second);
+    }
+    result.append(1, ' ').append(std::to_string(count)).append(1, '\n');
+  }
+  return result;
+}
+
+void Profiler::reset()
+{
+  drain();
+  std::lock_guard<std::mutex> guard(mergeMutex_);
+  stacks_.clear();
+  numSamples_ = 0;
+  dropped.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Profiler::numSamples() const
+{
+  std::lock_guard<std::mutex> guard(mergeMutex_);
+  return numSamples_;
+}
+
+uint64_t Profiler::numDropped() const
+{
+  return dropped.load(std::memory_order_relaxed);
+}
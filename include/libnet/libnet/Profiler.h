@@ -0,0 +1,97 @@
+#pragma once
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <libnet/noncopyable.h>
+
+namespace net
+{
+
+/// @brief: 进程内的采样 CPU profiler, 默认关闭
+///         每个注册的线程有一个按自己的 CPU 时间计时的定时器 (timer_create + SIGEV_THREAD_ID),
+///         到期时向这个线程发送 SIGPROF, 信号处理函数记录调用栈和线程当前的标签 (例如正在执行的 RPC 方法),
+///         后台线程把样本按 (标签, 调用栈) 合并, folded() 输出 flamegraph.pl 可以直接使用的格式
+///         EventLoop 和 ThreadPool/WorkStealingPool 的线程自动注册, 其他线程自己调用 registerThread()
+///         采样期间线程中的系统调用可能因为信号返回 EINTR; 函数名需要用 -rdynamic 链接
+class Profiler: noncopyable
+{
+public:
+  static Profiler& instance();
+
+  // 在线程自己中调用, 可以嵌套, 线程结束之前调用相同次数的 unregisterThread()
+  void registerThread();
+  void unregisterThread();
+
+  /// @brief: 开始以每秒 hz 次 (每个线程的 CPU 时间) 采样所有注册的线程,
+  ///         CPU 定时器在时钟中断时检查, 实际的频率不超过内核的 HZ
+  ///         已经在运行或者创建定时器失败时返回 false
+  bool start(int hz);
+  void stop();
+  bool running() const;
+  int hz() const;
+
+  /// @brief: 设置当前线程的标签, 返回原来的标签; 标签至少要在被采样之后的一次合并 (100ms) 之前有效,
+  ///         所以最好是字符串常量或者一直存在的方法名. 通常用 ProfileScope
+  static const char* swapTag(const char* tag);
+
+  /// @brief: 每行 "标签;根函数;...;叶子函数 样本数", 没有标签的样本以 "[untagged]" 开头
+  std::string folded();
+  void reset();
+
+  uint64_t numSamples() const;
+  uint64_t numDropped() const; // 缓冲区满丢掉的样本
+
+private:
+  struct ThreadEntry
+  {
+    pthread_t thread;
+    int       refs;
+    timer_t   timer;
+    bool      armed;
+  };
+
+  Profiler();
+  ~Profiler();
+
+  bool arm(pid_t tid, ThreadEntry& entry);
+  void disarm(ThreadEntry& entry);
+  void collect();
+  void drain();
+
+  mutable std::mutex                      mutex_;
+  std::unordered_map<pid_t, ThreadEntry>  threads_;
+  int                                     hz_;
+  bool                                    quit_;
+  std::condition_variable                 cond_;
+  std::thread                             collector_;
+
+  mutable std::mutex                        mergeMutex_;
+  std::unordered_map<std::string, uint64_t> stacks_;  // 标签 + '\0' + 调用栈的地址 -> 样本数
+  uint64_t                                  numSamples_;
+};
+
+/// @brief: 在作用域内设置当前线程的 profiler 标签
+class ProfileScope: noncopyable
+{
+public:
+  explicit ProfileScope(const char* tag)
+  : saved_(Profiler::swapTag(tag))
+  {}
+
+  ~ProfileScope()
+  { Profiler::swapTag(saved_); }
+
+private:
+  const char* saved_;
+};
+
+}
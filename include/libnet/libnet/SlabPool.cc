@@ -0,0 +1,80 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include <libnet/Logger.h>
+#include <libnet/MemoryCounter.h>
+#include <libnet/SlabPool.h>
+
+using namespace net;
+
+namespace
+{
+
+// 向系统申请的 slab, 包括缓存在空闲链表中的
+MemoryCounter slabMemory("slab");
+
+}
+
+const size_t SlabPool::kSlabSize;
+const size_t SlabPool::kDefaultMaxFree;
+
+SlabPool::SlabPool(size_t maxFree)
+: freeList_(nullptr),
+  maxFree_(maxFree),
+  numFree_(0),
+  numInUse_(0)
+{
+}
+
+SlabPool::~SlabPool()
+{
+  if (numInUse() > 0)
+    WARN("~SlabPool() %lu slabs still in use", numInUse());
+  trim();
+}
+
+void* SlabPool::allocate()
+{
+  void* slab;
+  if (freeList_ != nullptr) {
+    slab = freeList_;
+    freeList_ = freeList_->next;
+    numFree_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  else {
+    // 按 cache line 对齐, 和相邻的 slab 不共享 cache line
+    slab = ::aligned_alloc(64, kSlabSize);
+    if (slab == nullptr)
+      SYSFATAL("SlabPool::aligned_alloc()");
+    slabMemory.add(kSlabSize);
+  }
+  numInUse_.fetch_add(1, std::memory_order_relaxed);
+  return slab;
+}
+
+void SlabPool::deallocate(void* slab)
+{
+  assert(slab != nullptr);
+  assert(numInUse() > 0);
+  numInUse_.fetch_sub(1, std::memory_order_relaxed);
+  if (numFree() >= maxFree_) {
+    ::free(slab);
+    slabMemory.sub(kSlabSize);
+    return;
+  }
+  auto node = static_cast<FreeSlab*>(slab);
+  node->next = freeList_;
+  freeList_ = node;
+  numFree_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SlabPool::trim()
+{
+  while (freeList_ != nullptr) {
+    FreeSlab* next = freeList_->next;
+    ::free(freeList_);
+    slabMemory.sub(kSlabSize);
+    freeList_ = next;
+  }
+  numFree_.store(0, std::memory_order_relaxed);
+}
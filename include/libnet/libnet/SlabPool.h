@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+
+#include <stddef.h>
+
+#include <libnet/noncopyable.h>
+
+namespace net
+{
+
+/// @brief: 固定大小 (16 KiB) 的内存块的空闲链表, 每个 EventLoop 一个, 给连接的缓冲区使用
+///         连接空闲时缓冲区把 slab 还回来, 下一次读写直接从链表里取, 不经过 malloc;
+///         链表最多缓存 maxFree 个 slab, 多出来的还给系统, 大量空闲连接时内存不会一直涨
+///         不是线程安全的, 只能在所属的 loop 线程中分配和归还; 统计数字任意线程可读
+class SlabPool: noncopyable
+{
+public:
+  static const size_t kSlabSize = 16 * 1024;
+  static const size_t kDefaultMaxFree = 256;
+
+  explicit
+  SlabPool(size_t maxFree = kDefaultMaxFree);
+  // 还在使用的 slab 不会被释放, 使用者 (连接) 必须在 loop 退出之前关闭
+  ~SlabPool();
+
+  void* allocate();
+  void  deallocate(void* slab);
+  // 释放所有缓存的 slab
+  void  trim();
+
+  size_t numInUse() const { return numInUse_.load(std::memory_order_relaxed); }
+  size_t numFree()  const { return numFree_.load(std::memory_order_relaxed); }
+
+private:
+  struct FreeSlab
+  {
+    FreeSlab* next;
+  };
+
+  FreeSlab*           freeList_;
+  size_t              maxFree_;
+  std::atomic<size_t> numFree_;
+  std::atomic<size_t> numInUse_;
+};
+
+}
@@ -8,6 +8,7 @@ using namespace net;
 TcpClient::TcpClient(EventLoop* loop, const InetAddress& peer)
 : loop_(loop),
   connected_(false),
+  tcpNoDelay_(true),
   peer_(peer),
   retryTimer_(nullptr),
   connector_(new Connector(loop, peer)),
@@ -67,6 +68,8 @@ void TcpClient::newConnection(int connfd, const InetAddress& local, const InetAd
                           { 
                             this->closeConnection(connptr);
                           });
+    if (tcpNoDelay_)
+        conn->setTcpNoDelay(true);
     conn->connectEstablished();
     connectionCallback_(conn);
 }
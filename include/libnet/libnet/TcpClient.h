@@ -22,6 +22,9 @@ public:
     { writeCompleteCallback_ = cb; }
     void setErrorCallback(const ErrorCallback& cb)
     { connector_->setErrorCallback(cb); }
+    // 连接上之后设置 TCP_NODELAY, 默认打开, 见 TcpConnection::setTcpNoDelay()
+    void setTcpNoDelay(bool on)
+    { tcpNoDelay_ = on; }
 
 private:
     void retry();
@@ -32,6 +35,7 @@ private:
 
     EventLoop*            loop_;
     bool                  connected_;
+    bool                  tcpNoDelay_;
     InetAddress           peer_;
     Timer*                retryTimer_;
     ConnectorPtr          connector_;
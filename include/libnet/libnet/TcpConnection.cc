@@ -1,5 +1,9 @@
 #include <assert.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
 
 #include <libnet/Logger.h>
 #include <libnet/EventLoop.h>
@@ -7,6 +11,17 @@
 
 using namespace net;
 
+namespace
+{
+
+// 边沿触发时一次读事件最多读这么多, 之后让出给其他连接
+const size_t kEdgeReadBudget = 1024 * 1024;
+
+// handleRecv 收到 EOF 时 recvError_ 的值
+const int kRecvEof = -1;
+
+}
+
 namespace net
 {
 
@@ -44,14 +59,21 @@ TcpConnection::TcpConnection(EventLoop *loop,
   channel_(std::make_unique<Channel>(loop, cfd_)),
   local_(std::make_unique<InetAddress>(local)),
   peer_(std::make_unique<InetAddress>(peer)),
-  inputBuffer_(std::make_unique<Buffer>()),
-  outputBuffer_(std::make_unique<Buffer>()),
-  highWaterMark_(0)
+  inputBuffer_(loop->slabPool()),
+  outputBuffer_(loop->slabPool()),
+  highWaterMark_(0),
+  completionIo_(loop->completionIo()),
+  sendInFlight_(false),
+  recvError_(0)
 {
   channel_->setReadCallback ([this]{this->handleRead();});
   channel_->setWriteCallback([this]{this->handleWrite();});
   channel_->setCloseCallback([this]{this->handleClose();});
   channel_->setErrorCallback([this]{this->handleError();});
+  if (completionIo_)
+    channel_->setCompletionIo([this](const char* data, ssize_t n){this->handleRecv(data, n);},
+                              [this](struct iovec* iov, int maxIov){return this->prepareSend(iov, maxIov);},
+                              [this](ssize_t n){this->handleSendComplete(n);});
 
   TRACE("TcpConnection() %s fd=%d", name().c_str(), cfd);
 }
@@ -67,6 +89,36 @@ TcpConnection::~TcpConnection()
   TRACE("~TcpConnection() %s fd=%d", name().c_str(), cfd_);
 }
 
+void TcpConnection::setEdgeTriggered(bool on)
+{
+  assert(state_ == kConnecting);
+  // 完成式 IO 没有就绪事件, 边沿触发没有意义
+  if (!completionIo_)
+    channel_->setEdgeTriggered(on);
+}
+
+bool TcpConnection::setBusyPoll(Microsecond budget)
+{
+  int usec = static_cast<int>(budget.count());
+  int ret = ::setsockopt(cfd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+  if (ret == -1) {
+    SYSERR("TcpConnection::setsockopt() SO_BUSY_POLL %d", usec);
+    return false;
+  }
+  return true;
+}
+
+bool TcpConnection::setTcpNoDelay(bool on)
+{
+  int optval = on ? 1 : 0;
+  int ret = ::setsockopt(cfd_, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+  if (ret == -1) {
+    SYSERR("TcpConnection::setsockopt() TCP_NODELAY %d", optval);
+    return false;
+  }
+  return true;
+}
+
 void TcpConnection::connectEstablished()
 {
   assert(state_.exchange(kConnected) == kConnecting);
@@ -99,7 +151,8 @@ void TcpConnection::send(const char *data, size_t len)
   }
   else 
   {
-    loop_->queueInLoop([this, str = std::string(data, data+len)]
+    // 排队的任务都持有连接, 执行之前连接可能已经关闭并从服务器中移除
+    loop_->queueInLoop([this, self = shared_from_this(), str = std::string(data, data+len)]
                         { 
                           this->sendInLoop(str);
                         });
@@ -118,7 +171,8 @@ void TcpConnection::sendInLoop(const char *data, size_t len) {
   bool faultError = false;
 
   /// @brief: 如果没有注册可写事件，输出缓冲区中没有数据，则直接发
-  if (!channel_->isWriting() && outputBuffer_->readableBytes() == 0) {
+  ///         完成式 IO 不直接发, 数据进输出缓冲区, 下一次 io_uring_enter 时和其他连接的发送一起提交
+  if (!completionIo_ && !channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
     n = ::write(cfd_, data, len);
     if (n == -1) 
     {
@@ -133,9 +187,9 @@ void TcpConnection::sendInLoop(const char *data, size_t len) {
     {
       remain -= static_cast<size_t>(n);
       if (remain == 0 && writeCompleteCallback_) {
-        loop_->queueInLoop([this]
+        loop_->queueInLoop([this, self = shared_from_this()]
                           { 
-                            this->writeCompleteCallback_(this->shared_from_this()); 
+                            this->writeCompleteCallback_(self); 
                           });
       }
     }
@@ -143,17 +197,17 @@ void TcpConnection::sendInLoop(const char *data, size_t len) {
 
   if (!faultError && remain > 0) {
     if (highWaterMarkCallback_) {
-      size_t oldLen = outputBuffer_->readableBytes();
+      size_t oldLen = outputBuffer_.readableBytes();
       size_t newLen = oldLen + remain;
       if (oldLen < highWaterMark_ && newLen >= highWaterMark_)
-        loop_->queueInLoop([this, &newLen] 
+        loop_->queueInLoop([this, self = shared_from_this(), newLen] 
                            { 
-                            this->highWaterMarkCallback_(this->shared_from_this(), 
+                            this->highWaterMarkCallback_(self, 
                                                          newLen); 
                            });
     }
     /// 将剩余内容，添加到 outputBuffer_
-    outputBuffer_->append(data + n, remain);
+    outputBuffer_.append(data + n, remain);
 
     if(!channel_->isWriting()) 
     { 
@@ -181,13 +235,63 @@ void TcpConnection::send(Buffer& buffer)
   }
   else 
   {
-    loop_->queueInLoop([this, str = buffer.retrieveAllAsString()]
+    loop_->queueInLoop([this, self = shared_from_this(), str = buffer.retrieveAllAsString()]
                       { 
                         this->sendInLoop(str); 
                       });
   }
 }
 
+void TcpConnection::sendAppended(size_t len)
+{
+  loop_->assertInLoopThread();
+  assert(state_ == kConnected);
+  assert(len <= outputBuffer_.readableBytes());
+
+  size_t oldLen = outputBuffer_.readableBytes() - len;
+  size_t remain = len;
+
+  // 和 sendInLoop() 一样, 输出缓冲区原来是空的就直接写
+  if (!completionIo_ && !channel_->isWriting() && oldLen == 0) {
+    int savedErrno = 0;
+    ssize_t n = outputBuffer_.writeFd(cfd_, &savedErrno);
+    if (n == -1) {
+      if (savedErrno != EWOULDBLOCK && savedErrno != EINTR) {
+        errno = savedErrno;
+        SYSERR("TcpConnection::sendAppended()");
+        // 连接已经坏了, 丢弃这个消息, 之后由读事件关闭连接
+        if (savedErrno == EPIPE || savedErrno == ECONNRESET) {
+          outputBuffer_.retrieveAll();
+          return;
+        }
+      }
+    }
+    else {
+      remain -= static_cast<size_t>(n);
+      if (remain == 0 && writeCompleteCallback_) {
+        loop_->queueInLoop([this, self = shared_from_this()]
+                          {
+                            this->writeCompleteCallback_(self);
+                          });
+      }
+    }
+  }
+
+  if (remain > 0) {
+    if (highWaterMarkCallback_) {
+      size_t newLen = oldLen + remain;
+      if (oldLen < highWaterMark_ && newLen >= highWaterMark_)
+        loop_->queueInLoop([this, self = shared_from_this(), newLen]
+                           {
+                            this->highWaterMarkCallback_(self,
+                                                         newLen);
+                           });
+    }
+    if (!channel_->isWriting())
+      channel_->enableWrite();
+  }
+}
+
 void TcpConnection::shutdown()
 {
   assert(state_ <= kDisconnecting);
@@ -199,7 +303,7 @@ void TcpConnection::shutdown()
     }
     else 
     {
-      loop_->queueInLoop([this]
+      loop_->queueInLoop([this, self = shared_from_this()]
                          { 
                           this->shutdownInLoop();
                          });
@@ -223,7 +327,7 @@ void TcpConnection::forceClose()
   // 然后又再关闭一次，forceCloseInLoop 是不会执行的，而是直接进入析构函数
   // 此时，对象已经关闭了，但是状态已经被改为 kDisconnecting  析构函数中的 assert 会触发
   if (state_ != kDisconnected && state_.exchange(kDisconnecting) != kDisconnected) {
-    loop_->queueInLoop([this]
+    loop_->queueInLoop([this, self = shared_from_this()]
                        { 
                         this->forceCloseInLoop();
                        });
@@ -240,7 +344,7 @@ void TcpConnection::forceCloseInLoop()
 
 void TcpConnection::stopRead()
 {
-  loop_->runInLoop([this]
+  loop_->runInLoop([this, self = shared_from_this()]
                    {
                       if (channel_->isReading())
                       {
@@ -251,11 +355,15 @@ void TcpConnection::stopRead()
 
 void TcpConnection::startRead()
 {
-  loop_->runInLoop([this]
+  loop_->runInLoop([this, self = shared_from_this()]
                     {
                       if (!channel_->isReading())
                       {
                       channel_->enableRead();
+                      // 边沿触发时, 暂停期间到达的数据不会再产生事件;
+                      // 完成式 IO 暂停前已经收到的数据还在输入缓冲区里
+                      if (channel_->edgeTriggered() || completionIo_)
+                        scheduleRead();
                       }
                     });
 }
@@ -264,8 +372,17 @@ void TcpConnection::handleRead()
 {
   loop_->assertInLoopThread();
   assert(state_ != kDisconnected);
+  if (completionIo_) {
+    handleReadCompletion();
+    return;
+  }
+  if (channel_->edgeTriggered()) {
+    handleReadEdge();
+    releaseInputBuffer();
+    return;
+  }
   int savedErrno;
-  ssize_t n = inputBuffer_->readFd(cfd_, &savedErrno);
+  ssize_t n = inputBuffer_.readFd(cfd_, &savedErrno);
   if (n == -1) 
   {
     errno = savedErrno;
@@ -278,36 +395,172 @@ void TcpConnection::handleRead()
   }
   else 
   {
-    messageCallback_(shared_from_this(), *inputBuffer_);
+    messageCallback_(shared_from_this(), inputBuffer_);
+    releaseInputBuffer();
   }
 }
 
+void TcpConnection::handleReadEdge()
+{
+  size_t total = 0;
+  while (true) {
+    int savedErrno;
+    ssize_t n = inputBuffer_.readFd(cfd_, &savedErrno);
+    if (n > 0) 
+    {
+      total += static_cast<size_t>(n);
+      messageCallback_(shared_from_this(), inputBuffer_);
+      // 回调里可能暂停了读, 或者关闭了连接
+      if (state_ == kDisconnected || !channel_->isReading())
+        return;
+      if (total >= kEdgeReadBudget) {
+        scheduleRead();
+        return;
+      }
+    }
+    else if (n == 0) 
+    {
+      handleClose();
+      return;
+    }
+    else if (savedErrno == EINTR) 
+    {
+      continue;
+    }
+    else 
+    {
+      if (savedErrno != EAGAIN && savedErrno != EWOULDBLOCK) {
+        errno = savedErrno;
+        SYSERR("TcpConnection::read()");
+        handleError();
+      }
+      return;
+    }
+  }
+}
+
+/// @brief: 完成式 IO 的数据已经由 handleRecv 放进了输入缓冲区, 这里只处理
+///         暂停读的期间收到的数据和 EOF 都留到 startRead() 之后
+void TcpConnection::handleReadCompletion()
+{
+  if (!channel_->isReading())
+    return;
+  if (inputBuffer_.readableBytes() > 0) {
+    messageCallback_(shared_from_this(), inputBuffer_);
+    releaseInputBuffer();
+    if (state_ == kDisconnected || !channel_->isReading())
+      return;
+  }
+  if (recvError_ > 0) {
+    errno = recvError_;
+    SYSERR("TcpConnection::recv()");
+    handleError();
+    handleClose();
+  }
+  else if (recvError_ == kRecvEof) {
+    handleClose();
+  }
+}
+
+/// @brief: 在 Poller::poll() 中调用, 只缓冲, 之后 Poller 调用 handleRead 处理
+void TcpConnection::handleRecv(const char* data, ssize_t n)
+{
+  if (n > 0)
+    inputBuffer_.append(data, static_cast<size_t>(n));
+  else
+    recvError_ = n == 0 ? kRecvEof : static_cast<int>(-n);
+}
+
+/// @brief: Poller 提交 sendmsg 之前调用, 直接把输出缓冲区的 slab 交给内核,
+///         完成之前不能取走这些数据, append 不会移动它们
+int TcpConnection::prepareSend(struct iovec* iov, int maxIov)
+{
+  assert(!sendInFlight_);
+  int iovcnt = outputBuffer_.peekIov(iov, maxIov);
+  sendInFlight_ = iovcnt > 0;
+  return iovcnt;
+}
+
+/// @brief: 和 handleWrite 对应, 连接关闭之后也会调用 (Poller 保证连接对象还在)
+void TcpConnection::handleSendComplete(ssize_t n)
+{
+  sendInFlight_ = false;
+  if (state_ == kDisconnected) {
+    outputBuffer_.retrieveAll();
+    return;
+  }
+  if (n < 0) {
+    // 对端已经关闭, 剩下的数据不发了, recv 会收到同样的错误并关闭连接
+    errno = static_cast<int>(-n);
+    SYSERR("TcpConnection::send()");
+    outputBuffer_.retrieveAll();
+    channel_->disableWrite();
+    return;
+  }
+
+  outputBuffer_.retrieve(static_cast<size_t>(n));
+  if (outputBuffer_.readableBytes() > 0) {
+    // 仍然关注 EPOLLOUT, 重新放进 Poller 的待提交列表, 下一次提交剩下的数据
+    channel_->enableWrite();
+    return;
+  }
+  channel_->disableWrite();
+  if (writeCompleteCallback_)
+  {
+    loop_->queueInLoop([this, self = shared_from_this()]
+                       {
+                         this->writeCompleteCallback_(self);
+                       });
+  }
+  if (state_ == kDisconnecting)
+    shutdownInLoop();
+}
+
+/// @brief: 边沿触发时没有读到 EAGAIN 就不会再有事件, 放到 pending task 里下一轮继续读,
+///         有 pending task 时 epoll_wait 不会阻塞, 其他连接的事件也能在这之前处理
+void TcpConnection::scheduleRead()
+{
+  std::weak_ptr<TcpConnection> weak = shared_from_this();
+  loop_->queueInLoop([weak]
+                     {
+                       auto conn = weak.lock();
+                       if (conn && conn->state_ != kDisconnected && conn->channel_->isReading())
+                         conn->handleRead();
+                     });
+}
+
 void TcpConnection::handleWrite()
 {
   if (state_ == kDisconnected) 
   {
     WARN("TcpConnection::handleWrite() disconnected, "
-          "give up writing %lu bytes", outputBuffer_->readableBytes());
+          "give up writing %lu bytes", outputBuffer_.readableBytes());
     return;
   }
 
-  assert(outputBuffer_->readableBytes() > 0);
+  assert(outputBuffer_.readableBytes() > 0);
   assert(channel_->isWriting());
-  ssize_t n = ::write(cfd_, outputBuffer_->peek(), outputBuffer_->readableBytes());
-  if (n == -1) 
+  ssize_t n;
+  int savedErrno = 0;
+  // 边沿触发时要写到 EAGAIN 或者写完为止
+  do {
+    n = outputBuffer_.writeFd(cfd_, &savedErrno);
+  } while (n > 0 && channel_->edgeTriggered() && outputBuffer_.readableBytes() > 0);
+
+  if (n == -1 && savedErrno != EAGAIN && savedErrno != EWOULDBLOCK) 
   {
+    errno = savedErrno;
     SYSERR("TcpConnection::write()");
   }
   else 
   {
-    outputBuffer_->retrieve(static_cast<size_t>(n));
-    if (outputBuffer_->readableBytes() == 0) {
+    if (outputBuffer_.readableBytes() == 0) {
       channel_->disableWrite();
       if (writeCompleteCallback_) 
       {
-        loop_->queueInLoop([this]
+        loop_->queueInLoop([this, self = shared_from_this()]
                            { 
-                             this->writeCompleteCallback_(this->shared_from_this());
+                             this->writeCompleteCallback_(self);
                            });
       }
 
@@ -324,9 +577,22 @@ void TcpConnection::handleClose()
   loop_->assertInLoopThread();
   assert(state_ .exchange(kDisconnected) <= kDisconnecting);
   loop_->removeChannel(channel_.get());
+  // slab 要在 loop 线程中归还, 连接对象可能在其他线程中析构
+  inputBuffer_.retrieveAll();
+  inputBuffer_.release();
+  // 内核还在发送时要等到 handleSendComplete 再释放
+  if (!sendInFlight_)
+    outputBuffer_.retrieveAll();
   closeCallback_(this->shared_from_this());
 }
 
+/// @brief: 读进来的数据都处理完了, 把存储还给 pool
+void TcpConnection::releaseInputBuffer()
+{
+  if (inputBuffer_.readableBytes() == 0 && inputBuffer_.capacity() > 0)
+    inputBuffer_.release();
+}
+
 void TcpConnection::handleError()
 {
   int err;
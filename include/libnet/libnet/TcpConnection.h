@@ -5,10 +5,13 @@
 #include <libnet/Callbacks.h>
 #include <libnet/Channel.h>
 #include <libnet/Buffer.h>
+#include <libnet/ChainBuffer.h>
+#include <libnet/Timestamp.h>
 
 #include <string_view>
 #include <string>
 #include <atomic>
+#include <any>
 
 namespace net
 {
@@ -34,10 +37,21 @@ public:
   void setHighWaterMarkCallback(HighWaterMarkCallback&& cb, size_t mark) { highWaterMarkCallback_ = std::move(cb); highWaterMark_ = mark; }
   void setCloseCallBack(CloseCallback&& cb)                              { closeCallback_ = std::move(cb); }
 
+  // 边沿触发: 每次可读时读到 EAGAIN 为止, 单次最多读 kEdgeReadBudget 字节, 剩下的留到下一轮循环,
+  // 避免一个高带宽的连接饿死同一个 loop 上的其他连接. 需要在 connectEstablished() 之前设置
+  void setEdgeTriggered(bool on);
+  // SO_BUSY_POLL: 没有数据时 recv 在网卡队列上忙等一段时间, 而不是等中断.
+  // 超过 net.core.busy_read 需要 CAP_NET_ADMIN, 失败返回 false
+  bool setBusyPoll(Microsecond budget);
+  // TCP_NODELAY: 关闭 Nagle, 小的回应不等之前发出的数据被确认就发送.
+  // 不关闭时, 请求-回应的连接上一次 send 没有凑满一个 MSS 的尾部要等对端的延迟确认 (约 40ms)
+  bool setTcpNoDelay(bool on);
   void connectEstablished();
   bool connected()    const;
   bool disconnected() const;
 
+  EventLoop* getLoop() const { return loop_; }
+
   const InetAddress& local() const { return *local_; }
   const InetAddress& peer()  const { return *peer_; }
   std::string name()         const { return peer_->toIpPort() + " -> " + local_->toIpPort(); }
@@ -45,6 +59,9 @@ public:
   void send(std::string_view data);
   void send(const char* data, size_t len);
   void send(Buffer& buffer);
+  // loop 线程中, 调用者直接把消息写进 getMutableOutputBuffer() 的末尾, 省去临时缓冲区和一次复制,
+  // 之后调用 sendAppended() 发送新追加的 len 个字节; 只能在 connected() 时使用
+  void sendAppended(size_t len);
   void shutdown();
   void forceClose();
 
@@ -53,16 +70,33 @@ public:
   bool isReading() // not thread safe
   { return channel_->isReading(); };
 
-  const Buffer& inputBuffer()  const { return *inputBuffer_; }
-  const Buffer& outputBuffer() const { return *outputBuffer_; }
+  // 两个缓冲区的存储都来自 loop 的 SlabPool, 数据取完之后归还, 空闲的连接不占用缓冲区
+  const Buffer&      inputBuffer()  const { return inputBuffer_; }
+  const ChainBuffer& outputBuffer() const { return outputBuffer_; }
+  // 暂停读之后, 上层协议需要处理已经读进来的数据, not thread safe
+  Buffer* getMutableInputBuffer()     { return &inputBuffer_; }
+  // 配合 sendAppended() 使用, not thread safe
+  ChainBuffer* getMutableOutputBuffer() { return &outputBuffer_; }
+
+  // 上层协议附加在连接上的状态, not thread safe
+  void setContext(const std::any& context) { context_ = context; }
+  const std::any& getContext() const      { return context_; }
+  std::any* getMutableContext()            { return &context_; }
 
 private:
   enum State { kConnecting, kConnected, kDisconnecting, kDisconnected};
 
   void handleRead();
+  void handleReadEdge();
+  void handleReadCompletion();
+  void handleRecv(const char* data, ssize_t n);
+  int  prepareSend(struct iovec* iov, int maxIov);
+  void handleSendComplete(ssize_t n);
+  void scheduleRead();
   void handleWrite();
   void handleClose();
   void handleError();
+  void releaseInputBuffer();
 
   void sendInLoop(const char* data, size_t len);
   void sendInLoop(const std::string& message);
@@ -75,14 +109,19 @@ private:
   std::unique_ptr<Channel>      channel_;
   std::unique_ptr<InetAddress>  local_;
   std::unique_ptr<InetAddress>  peer_;
-  std::unique_ptr<Buffer>       inputBuffer_;
-  std::unique_ptr<Buffer>       outputBuffer_;
+  Buffer                        inputBuffer_;
+  ChainBuffer                   outputBuffer_;
 
   MessageCallback          messageCallback_;
   CloseCallback            closeCallback_;
   WriteCompleteCallback    writeCompleteCallback_;
   HighWaterMarkCallback    highWaterMarkCallback_;
   size_t                   highWaterMark_;
+  // 完成式 IO (EventLoop::completionIo()): 数据由 Poller 收发, 不调用 read/write
+  bool                     completionIo_;
+  bool                     sendInFlight_; // 内核正在发送输出缓冲区开头的数据, 不能释放
+  int                      recvError_;    // 收到的 EOF (-1) 或者 errno, 在 handleRead 中处理
+  std::any                 context_;
 };
 
 }
@@ -1,7 +1,12 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <libnet/Logger.h>
+#include <libnet/CpuAffinity.h>
 #include <libnet/TcpConnection.h>
 #include <libnet/TcpServerSingle.h>
 #include <libnet/EventLoop.h>
+#include <libnet/Watchdog.h>
 #include <libnet/TcpServer.h>
 
 using namespace net;
@@ -9,6 +14,14 @@ using namespace net;
 TcpServer::TcpServer(EventLoop* loop, const InetAddress& local)
 : baseLoop_(loop),
   numThreads_(1),
+  loadBalance_(kReusePort),
+  incomingCpu_(false),
+  edgeTriggered_(false),
+  tcpNoDelay_(true),
+  busyPoll_(Microsecond::zero()),
+  instrumented_(false),
+  stallThreshold_(Microsecond::zero()),
+  nextLoop_(0),
   started_(false),
   local_(local),
   threadInitCallback_(defaultThreadInitCallback),
@@ -25,6 +38,8 @@ TcpServer::~TcpServer()
       loop->quit();
   for (auto& thread: threads_)
     thread->join();
+  // 其他 loop 已经在线程退出前 unwatch(), baseLoop 还没有析构
+  watchdog_.reset();
   TRACE("~TcpServer()");
 }
 
@@ -37,6 +52,82 @@ void TcpServer::setNumThread(size_t n)
   eventLoops_.resize(n);
 }
 
+void TcpServer::setCpuAffinity(const std::vector<int>& cpus)
+{
+  assert(!started_);
+  cpus_ = cpus;
+}
+
+void TcpServer::setLoadBalance(LoadBalance lb)
+{
+  assert(!started_);
+  loadBalance_ = lb;
+}
+
+void TcpServer::setIncomingCpu(bool on)
+{
+  assert(!started_);
+  incomingCpu_ = on;
+}
+
+void TcpServer::setEdgeTriggered(bool on)
+{
+  assert(!started_);
+  edgeTriggered_ = on;
+}
+
+void TcpServer::setTcpNoDelay(bool on)
+{
+  assert(!started_);
+  tcpNoDelay_ = on;
+}
+
+void TcpServer::setBusyPoll(Microsecond budget)
+{
+  assert(!started_);
+  busyPoll_ = budget;
+}
+
+void TcpServer::setInstrumented(bool on)
+{
+  assert(!started_);
+  instrumented_ = on;
+}
+
+void TcpServer::setStallThreshold(Microsecond threshold)
+{
+  assert(!started_);
+  stallThreshold_ = threshold;
+  if (threshold > Microsecond::zero())
+    instrumented_ = true;
+}
+
+std::vector<LoopLoad> TcpServer::loopLoads()
+{
+  std::vector<LoopLoad> loads;
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto server: servers_) {
+    if (server != nullptr)
+      loads.push_back(server->load());
+    else
+      loads.push_back(LoopLoad{0, 0, 0, 0, 0, 0, 0});
+  }
+  return loads;
+}
+
+std::vector<LoopLatency> TcpServer::loopLatencies()
+{
+  std::vector<LoopLatency> latencies;
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto server: servers_) {
+    if (server != nullptr)
+      latencies.push_back(server->latency());
+    else
+      latencies.push_back(LoopLatency{});
+  }
+  return latencies;
+}
+
 void TcpServer::start()
 {
   if (started_.exchange(true))
@@ -53,10 +144,27 @@ void TcpServer::startInLoop()
   INFO("TcpServer::start() %s with %lu eventLoop thread(s)",
       local_.toIpPort().c_str(), numThreads_);
 
+  if (incomingCpu_ && cpus_.empty()) {
+    WARN("TcpServer::setIncomingCpu() ignored without cpu affinity");
+    incomingCpu_ = false;
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    servers_.assign(numThreads_, nullptr);
+  }
+  if (stallThreshold_ > Microsecond::zero()) {
+    watchdog_ = std::make_unique<Watchdog>(stallThreshold_);
+    watchdog_->watch(baseLoop_);
+  }
+
+  pinThread(0);
   baseServer_ = std::make_unique<TcpServerSingle>(baseLoop_, local_);
-  baseServer_->setConnectionCallback(connectionCallback_);
-  baseServer_->setMessageCallback(messageCallback_);
-  baseServer_->setWriteCompleteCallback(writeCompleteCallback_);
+  setupServer(*baseServer_, 0);
+  if (loadBalance_ != kReusePort && numThreads_ > 1)
+    baseServer_->setNewConnectionCallback([this](int connfd, const InetAddress& local, const InetAddress& peer)
+                                          {
+                                            this->dispatchConnection(connfd, local, peer);
+                                          });
 
   threadInitCallback_(0);
   baseServer_->start();
@@ -77,21 +185,111 @@ void TcpServer::startInLoop()
 
 void TcpServer::runInThread(size_t index)
 {
-  EventLoop loop;
-  TcpServerSingle server(&loop, local_);
+  pinThread(index);
 
-  server.setConnectionCallback(connectionCallback_);
-  server.setMessageCallback(messageCallback_);
-  server.setWriteCompleteCallback(writeCompleteCallback_);
+  EventLoop loop;
+  // 只有 kReusePort 时每个 loop 都监听, 否则连接都由 baseLoop 分配过来
+  TcpServerSingle server(&loop, local_, loadBalance_ == kReusePort);
+  setupServer(server, index);
 
   {
     std::lock_guard<std::mutex> guard(mutex_);
     eventLoops_[index] = &loop;
+    servers_[index] = &server;
     cond_.notify_one();
   }
+  if (watchdog_)
+    watchdog_->watch(&loop);
 
   threadInitCallback_(index);
   server.start();
   loop.loop();
+  if (watchdog_)
+    watchdog_->unwatch(&loop);
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    servers_[index] = nullptr;
+  }
   eventLoops_[index] = nullptr;
 }
+
+void TcpServer::setupServer(TcpServerSingle& server, size_t index)
+{
+  server.setConnectionCallback(connectionCallback_);
+  server.setMessageCallback(messageCallback_);
+  server.setWriteCompleteCallback(writeCompleteCallback_);
+  server.setEdgeTriggered(edgeTriggered_);
+  server.setTcpNoDelay(tcpNoDelay_);
+  server.setBusyPoll(busyPoll_);
+  server.setInstrumented(instrumented_);
+  if (incomingCpu_ && loadBalance_ == kReusePort)
+    server.setIncomingCpu(cpus_[index % cpus_.size()]);
+  if (index == 0) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    servers_[0] = &server;
+  }
+}
+
+/// @brief: 在 baseLoop 中调用, 把 baseLoop 的 acceptor 接收的连接分配给某个 loop
+void TcpServer::dispatchConnection(int connfd, const InetAddress& local, const InetAddress& peer)
+{
+  baseLoop_->assertInLoopThread();
+  TcpServerSingle* server;
+  {
+    // 退出时其他 loop 的 server 会被置空
+    std::lock_guard<std::mutex> guard(mutex_);
+    server = servers_[pickLoop(connfd)];
+  }
+  if (server != nullptr)
+    server->assignConnection(connfd, local, peer);
+  else
+    ::close(connfd);
+}
+
+/// @brief: 调用时持有 mutex_
+size_t TcpServer::pickLoop(int connfd)
+{
+  size_t n = servers_.size();
+
+  if (incomingCpu_) {
+    // 连接的数据包到达的 CPU, 交给绑定在这个 CPU 上的 loop, 收包和处理在同一个 CPU 上
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (::getsockopt(connfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0) {
+      for (size_t i = 0; i < n; i++) {
+        if (cpus_[i % cpus_.size()] == cpu)
+          return i;
+      }
+    }
+  }
+
+  if (loadBalance_ == kLeastConnections) {
+    // 从 nextLoop_ 开始找, 连接数相同时也能轮流分配
+    size_t best = nextLoop_ % n;
+    size_t min = SIZE_MAX;
+    for (size_t i = 0; i < n && min > 0; i++) {
+      size_t index = (nextLoop_ + i) % n;
+      if (servers_[index] == nullptr)
+        continue;
+      size_t count = servers_[index]->numConnections();
+      if (count < min) {
+        min = count;
+        best = index;
+      }
+    }
+    nextLoop_ = best + 1;
+    return best;
+  }
+
+  return nextLoop_++ % n;
+}
+
+void TcpServer::pinThread(size_t index)
+{
+  if (cpus_.empty())
+    return;
+  int cpu = cpus_[index % cpus_.size()];
+  if (pinThisThread(cpu))
+    INFO("EventLoop thread #%lu pinned to cpu %d (node %d)",
+         index, cpu, numaNodeOfCpu(cpu));
+}
@@ -15,10 +15,19 @@ namespace net
 {
 
 class EventLoopThread;
+class Watchdog;
 class TcpServerSingle;
 class EventLoop;
 class InetAddress;
 
+// 新连接分配到 loop 的方式
+enum LoadBalance
+{
+  kReusePort,        // 每个 loop 一个 SO_REUSEPORT 的监听 socket, 由内核按四元组的哈希分配
+  kRoundRobin,       // baseLoop 上只有一个 acceptor, 轮流分配给各个 loop
+  kLeastConnections, // baseLoop 上只有一个 acceptor, 分配给当前连接数最少的 loop
+};
+
 class TcpServer: noncopyable
 {
 public:
@@ -31,6 +40,37 @@ public:
   // except the baseLoop thread
   void start();
 
+  // loop #i is pinned to cpus[i % cpus.size()] before it allocates anything,
+  // so its connections and buffers live on the same NUMA node.
+  // loop #0 is the baseLoop, i.e. the thread calling start()
+  void setCpuAffinity(const std::vector<int>& cpus);
+
+  // default kReusePort
+  void setLoadBalance(LoadBalance lb);
+  // requires setCpuAffinity().
+  // kReusePort: each listening socket sets SO_INCOMING_CPU to its loop's cpu.
+  // otherwise: a connection goes to the loop pinned to the cpu its packets
+  // arrive on, if there is one, before falling back to the balance strategy.
+  void setIncomingCpu(bool on);
+  // edge-triggered epoll for connections: read until EAGAIN with a
+  // per-event budget, write until EAGAIN. default level-triggered
+  void setEdgeTriggered(bool on);
+  // TCP_NODELAY on accepted connections, see TcpConnection::setTcpNoDelay().
+  // default on: request/response traffic should not wait for delayed acks
+  void setTcpNoDelay(bool on);
+  // busy-poll each loop for `budget` after it handled events or tasks instead of
+  // blocking, and set SO_BUSY_POLL on connections. trades CPU for latency. default 0 (off)
+  void setBusyPoll(Microsecond budget);
+  // per-phase histograms for each loop (poll/events/timers/tasks), see
+  // EventLoop::setInstrumented(). costs two clock reads per callback. default off
+  void setInstrumented(bool on);
+  // log the stack of any callback that blocks a loop longer than `threshold`,
+  // see Watchdog. implies setInstrumented(true). default 0 (off)
+  void setStallThreshold(Microsecond threshold);
+  // thread safe, one entry per loop
+  std::vector<LoopLoad> loopLoads();
+  std::vector<LoopLatency> loopLatencies();
+
   void setThreadInitCallback(const ThreadInitCallback& cb)        { threadInitCallback_ = cb;    }
   void setConnectionCallback(const ConnectionCallback& cb)        { connectionCallback_ = cb;    }
   void setMessageCallback(const MessageCallback& cb)              { messageCallback_ = cb;       }
@@ -38,17 +78,33 @@ public:
 private:
   void startInLoop();
   void runInThread(size_t index);
+  void pinThread(size_t index);
+  void setupServer(TcpServerSingle& server, size_t index);
+  void dispatchConnection(int connfd, const InetAddress& local, const InetAddress& peer);
+  size_t pickLoop(int connfd);
 
   using ThreadPtr          = std::unique_ptr<std::thread> ;
   using ThreadPtrList      = std::vector<ThreadPtr>;
   using TcpServerSinglePtr = std::unique_ptr<TcpServerSingle>;
   using EventLoopList      = std::vector<EventLoop*>;
+  using ServerList         = std::vector<TcpServerSingle*>;
 
   EventLoop*              baseLoop_;
   TcpServerSinglePtr      baseServer_;
   ThreadPtrList           threads_;
   EventLoopList           eventLoops_;
+  ServerList              servers_;
   size_t                  numThreads_;
+  std::vector<int>        cpus_;
+  LoadBalance             loadBalance_;
+  bool                    incomingCpu_;
+  bool                    edgeTriggered_;
+  bool                    tcpNoDelay_;
+  Microsecond             busyPoll_;
+  bool                    instrumented_;
+  Microsecond             stallThreshold_;
+  std::unique_ptr<Watchdog> watchdog_;
+  size_t                  nextLoop_;     // round robin 的下一个位置, 只在 baseLoop 中使用
   std::atomic<bool>       started_;
   InetAddress             local_;
   std::mutex              mutex_;
@@ -5,19 +5,86 @@
 
 using namespace net;
 
-TcpServerSingle::TcpServerSingle(EventLoop* loop, const InetAddress& local)
+TcpServerSingle::TcpServerSingle(EventLoop* loop, const InetAddress& local, bool withAcceptor)
 : loop_(loop),
-  acceptor_(std::make_unique<Acceptor>(loop, local))
+  acceptor_(withAcceptor ? std::make_unique<Acceptor>(loop, local) : nullptr),
+  edgeTriggered_(false),
+  tcpNoDelay_(true),
+  busyPollSocket_(false),
+  numConnections_(0),
+  numAccepted_(0),
+  numMessages_(0)
 {
-  acceptor_->setNewConnectionCallback([this](auto connfd, auto loc, auto peer)
-                                      { 
-                                        this->newConnection(connfd, loc, peer);
-                                      });
+  if (acceptor_)
+    acceptor_->setNewConnectionCallback([this](auto connfd, auto loc, auto peer)
+                                        { 
+                                          this->numConnections_++;
+                                          this->numAccepted_++;
+                                          this->newConnection(connfd, loc, peer);
+                                        });
+}
+
+void TcpServerSingle::setNewConnectionCallback(const NewConnectionCallback& cb)
+{
+  assert(acceptor_);
+  acceptor_->setNewConnectionCallback(cb);
+}
+
+void TcpServerSingle::setIncomingCpu(int cpu)
+{
+  if (acceptor_)
+    acceptor_->setIncomingCpu(cpu);
+}
+
+void TcpServerSingle::setBusyPoll(Microsecond budget)
+{
+  loop_->setBusyPoll(budget);
+  busyPollSocket_ = budget > Microsecond::zero();
+}
+
+void TcpServerSingle::setInstrumented(bool on)
+{
+  loop_->setInstrumented(on);
 }
 
 void TcpServerSingle::start()
 {
-  acceptor_->listen();
+  if (acceptor_)
+    acceptor_->listen();
+}
+
+void TcpServerSingle::assignConnection(int connfd,
+                                       const InetAddress& local,
+                                       const InetAddress& peer)
+{
+  // 在分配的时候就计数, 否则 least-connections 在连接建立之前会把一批连接都分给同一个 loop
+  numConnections_++;
+  numAccepted_++;
+  loop_->runInLoop([this, connfd, local, peer]
+                   {
+                     this->newConnection(connfd, local, peer);
+                   });
+}
+
+LoopLoad TcpServerSingle::load() const
+{
+  return { numConnections_.load(std::memory_order_relaxed),
+           numAccepted_.load(std::memory_order_relaxed),
+           numMessages_.load(std::memory_order_relaxed),
+           loop_->numTimers(),
+           loop_->slabPool()->numInUse(),
+           loop_->slabPool()->numFree(),
+           loop_->pendingTasksHighWater() };
+}
+
+LoopLatency TcpServerSingle::latency() const
+{
+  return { loop_->iterationLatency().snapshot(),
+           loop_->wakeupLatency().snapshot(),
+           loop_->pollLatency().snapshot(),
+           loop_->eventsLatency().snapshot(),
+           loop_->timersLatency().snapshot(),
+           loop_->tasksLatency().snapshot() };
 }
 
 void TcpServerSingle::newConnection(int connfd,
@@ -28,13 +95,23 @@ void TcpServerSingle::newConnection(int connfd,
   auto connPtr = std::make_shared<TcpConnection>(loop_, connfd, local, peer);
   connections_.insert(connPtr);
 
-  connPtr->setMessageCallback(messageCallback_);
+  connPtr->setMessageCallback([this](const TcpConnectionPtr& conn, Buffer& buffer)
+                              {
+                                // 只有这个 loop 写, relaxed 就够了
+                                this->numMessages_.fetch_add(1, std::memory_order_relaxed);
+                                this->messageCallback_(conn, buffer);
+                              });
   connPtr->setWriteCompleteCallback(writeCompleteCallback_);
   connPtr->setCloseCallBack([this](const TcpConnectionPtr& connptr)
                             {
                               this->closeConnection(connptr);
                             });
 
+  connPtr->setEdgeTriggered(edgeTriggered_);
+  if (tcpNoDelay_)
+    connPtr->setTcpNoDelay(true);
+  if (busyPollSocket_ && !connPtr->setBusyPoll(loop_->busyPoll()))
+    busyPollSocket_ = false;
   connPtr->connectEstablished();
   connectionCallback_(connPtr); 
 }
@@ -44,5 +121,8 @@ void TcpServerSingle::closeConnection(const TcpConnectionPtr& connPtr)
   loop_->assertInLoopThread();
   size_t ret = connections_.erase(connPtr);
   assert(ret == 1);(void)ret;
+  // 和 TcpClient 一样, 断开时也回调, 用户在这里释放连接的资源; 之后连接才不再计数
+  connectionCallback_(connPtr);
+  numConnections_--;
 }
 
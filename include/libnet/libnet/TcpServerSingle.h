@@ -2,22 +2,68 @@
 
 #include <unordered_set>
 #include <memory>
+#include <atomic>
 
 #include <libnet/Callbacks.h>
 #include <libnet/Acceptor.h>
+#include <libnet/Histogram.h>
+#include <libnet/Timestamp.h>
 
 namespace net
 {
 
 class EventLoop;
+
+// 一个 loop 的负载, 任意线程都可以读
+struct LoopLoad
+{
+  size_t   connections; // 当前的连接数, 包括已经分配给这个 loop 但是还没有建立的连接
+  uint64_t accepted;    // 累计分配给这个 loop 的连接数
+  uint64_t messages;    // 累计的读事件数
+  size_t   timers;      // 当前的定时器数
+  size_t   slabsInUse;  // 连接缓冲区正在使用的 slab 数, 每个 SlabPool::kSlabSize 字节
+  size_t   slabsFree;   // SlabPool 缓存的空闲 slab 数
+  size_t   pendingTasksHighWater; // 任务队列出现过的最大长度
+};
+
+// 一个 loop 的延迟统计, 单位 ns, 见 EventLoop::iterationLatency()
+// 只有 EventLoop::setInstrumented(true) 时才有数据
+struct LoopLatency
+{
+  HistogramSnapshot iteration;
+  HistogramSnapshot wakeup;
+  HistogramSnapshot poll;
+  HistogramSnapshot events;
+  HistogramSnapshot timers;
+  HistogramSnapshot tasks;
+};
+
 class TcpServerSingle : noncopyable {
 public:
-  TcpServerSingle(EventLoop *loop, const InetAddress &local);
+  // withAcceptor == false 时不监听, 连接由其他 loop 的 acceptor 通过 assignConnection() 分配过来
+  TcpServerSingle(EventLoop *loop, const InetAddress &local, bool withAcceptor = true);
 
   void setConnectionCallback(const ConnectionCallback &cb)       { connectionCallback_    = cb; }
   void setMessageCallback(const MessageCallback &cb)             { messageCallback_       = cb; }
   void setWriteCompleteCallback(const WriteCompleteCallback &cb) { writeCompleteCallback_ = cb; }
+  // 替换 acceptor 默认的处理, 用来把连接分配给其他 loop
+  void setNewConnectionCallback(const NewConnectionCallback &cb);
+  void setEdgeTriggered(bool on)                                 { edgeTriggered_         = on; }
+  void setTcpNoDelay(bool on)                                    { tcpNoDelay_            = on; }
+  // 用自己的 acceptor 接收连接时才有效, 让内核把在 cpu 上收到的连接优先交给这个监听 socket
+  void setIncomingCpu(int cpu);
+  // loop 忙轮询 budget 时间, 同时给之后的连接设置 SO_BUSY_POLL, 在 loop 线程中调用
+  void setBusyPoll(Microsecond budget);
+  // 打开 loop 的分阶段统计, 在 loop 线程中调用
+  void setInstrumented(bool on);
   void start();
+
+  // 线程安全, 把一个已经 accept 的连接交给这个 loop
+  void assignConnection(int connfd, const InetAddress &local, const InetAddress &peer);
+  LoopLoad load() const;
+  LoopLatency latency() const;
+  size_t numConnections() const { return numConnections_.load(std::memory_order_relaxed); }
+
 private:
   void newConnection(int connfd, const InetAddress &local, const InetAddress &peer);
   void closeConnection(const TcpConnectionPtr &conn);
@@ -27,6 +73,12 @@ private:
   EventLoop*                 loop_;
   std::unique_ptr<Acceptor>  acceptor_;
   ConnectionSet              connections_;         // 一个服务器的所有连接对象
+  bool                       edgeTriggered_;
+  bool                       tcpNoDelay_;
+  bool                       busyPollSocket_;      // SO_BUSY_POLL 失败一次之后不再设置
+  std::atomic<size_t>        numConnections_;
+  std::atomic<uint64_t>      numAccepted_;
+  std::atomic<uint64_t>      numMessages_;
   ConnectionCallback         connectionCallback_;  // 新连接到来时候的回调函数
   MessageCallback            messageCallback_;     
   WriteCompleteCallback      writeCompleteCallback_;
@@ -1,14 +1,28 @@
 #include <assert.h>
 
 #include <libnet/Logger.h>
+#include <libnet/MemoryCounter.h>
+#include <libnet/Profiler.h>
 #include <libnet/ThreadPool.h>
 
 using namespace net;
 
+namespace
+{
+
+// 排队等待执行的任务
+MemoryCounter taskMemory("pool_task");
+
+}
+
 ThreadPool::ThreadPool(size_t numThread, size_t maxQueueSize, const ThreadInitCallback& cb)
-        : maxQueueSize_(maxQueueSize),
+        : numQueued_(0),
+          maxQueueSize_(maxQueueSize),
           running_(true),
-          threadInitCallback_(cb)
+          threadInitCallback_(cb),
+          policy_(kWeightedFair),
+          weights_{16, 4, 1},
+          credits_{0, 0, 0}
 {
     assert(maxQueueSize > 0);
     for (size_t i = 1; i <= numThread; ++i) {
@@ -22,12 +36,20 @@ ThreadPool::~ThreadPool()
 {
     if (running_)
         stop();
+    // 停止之后没有执行的任务随队列一起析构
+    taskMemory.sub(numQueued_ * sizeof(Task), static_cast<int64_t>(numQueued_));
     TRACE("~ThreadPool()");
 }
 
-void ThreadPool::runTask(const Task& task)
+void ThreadPool::runTask(const Task& task, Priority priority)
+{
+    runTask(Task(task), priority);
+}
+
+void ThreadPool::runTask(Task&& task, Priority priority)
 {
     assert(running_);
+    assert(priority < kNumPriorities);
 
     if (threads_.empty())
     {
@@ -36,29 +58,29 @@ void ThreadPool::runTask(const Task& task)
     else
     {
         std::unique_lock<std::mutex> lock(mutex_);
-        while (taskQueue_.size() >= maxQueueSize_)
+        auto& queue = taskQueues_[priority];
+        while (queue.size() >= maxQueueSize_)
             notFull_.wait(lock);
-        taskQueue_.push_back(task);
+        queue.push_back(std::move(task));
+        numQueued_++;
+        taskMemory.add(sizeof(Task));
         notEmpty_.notify_one();
     }
 }
 
-void ThreadPool::runTask(Task&& task)
+void ThreadPool::setSchedulePolicy(SchedulePolicy policy)
 {
-    assert(running_);
+    std::lock_guard<std::mutex> guard(mutex_);
+    policy_ = policy;
+}
 
-    if (threads_.empty())
-    {
-        task();
-    }
-    else
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        while (taskQueue_.size() >= maxQueueSize_)
-            notFull_.wait(lock);
-        taskQueue_.push_back(std::move(task));
-        notEmpty_.notify_one();
-    }
+void ThreadPool::setWeights(uint32_t high, uint32_t normal, uint32_t low)
+{
+    assert(high > 0 && normal > 0 && low > 0);
+    std::lock_guard<std::mutex> guard(mutex_);
+    weights_[kPriorityHigh]   = high;
+    weights_[kPriorityNormal] = normal;
+    weights_[kPriorityLow]    = low;
 }
 
 void ThreadPool::stop()
@@ -73,27 +95,76 @@ void ThreadPool::stop()
         thread->join();
 }
 
+size_t ThreadPool::queueSize() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return numQueued_;
+}
+
+size_t ThreadPool::queueSize(Priority priority) const
+{
+    assert(priority < kNumPriorities);
+    std::lock_guard<std::mutex> guard(mutex_);
+    return taskQueues_[priority].size();
+}
+
 void ThreadPool::runInThread(size_t index)
 {
     if (threadInitCallback_)
         threadInitCallback_(index);
+    Profiler::instance().registerThread();
     while (running_) {
         if (Task task = take())
             task();
     }
+    Profiler::instance().unregisterThread();
 }
 
 Task ThreadPool::take()
 {
     std::unique_lock<std::mutex> lock(mutex_);
-    while (taskQueue_.empty() && running_)
+    while (numQueued_ == 0 && running_)
         notEmpty_.wait(lock);
 
     Task task;
-    if (!taskQueue_.empty()) {
-        task = taskQueue_.front();
-        taskQueue_.pop_front();
-        notFull_.notify_one();
+    if (numQueued_ > 0) {
+        auto& queue = taskQueues_[pickQueue()];
+        // 不同优先级的生产者等在同一个条件变量上
+        if (queue.size() == maxQueueSize_)
+            notFull_.notify_all();
+        task = std::move(queue.front());
+        queue.pop_front();
+        numQueued_--;
+        taskMemory.sub(sizeof(Task));
     }
     return task;
+}
+
+/// @brief: 选择下一个任务所在的队列, 调用时持有锁, 并且至少有一个任务
+///         kWeightedFair 使用 smooth weighted round robin (nginx upstream 的算法):
+///         每次所有非空队列的当前权重加上各自的权重, 选当前权重最大的, 再减去非空队列的权重之和,
+///         这样在任意一段时间内各级队列被选中的次数和权重成正比, 并且是均匀交错的
+size_t ThreadPool::pickQueue()
+{
+    if (policy_ == kStrictPriority) {
+        for (size_t i = 0; i < kNumPriorities; i++) {
+            if (!taskQueues_[i].empty())
+                return i;
+        }
+        assert(false && "no task queued");
+    }
+
+    size_t best = kNumPriorities;
+    int64_t total = 0;
+    for (size_t i = 0; i < kNumPriorities; i++) {
+        if (taskQueues_[i].empty())
+            continue;
+        credits_[i] += weights_[i];
+        total += weights_[i];
+        if (best == kNumPriorities || credits_[i] > credits_[best])
+            best = i;
+    }
+    assert(best != kNumPriorities);
+    credits_[best] -= total;
+    return best;
 }
\ No newline at end of file
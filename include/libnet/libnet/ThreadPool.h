@@ -13,6 +13,22 @@
 namespace net
 {
 
+// 任务的优先级, 数值越小越优先
+enum Priority
+{
+    kPriorityHigh,
+    kPriorityNormal,
+    kPriorityLow,
+    kNumPriorities,
+};
+
+// 多级队列的调度策略
+enum SchedulePolicy
+{
+    kStrictPriority, // 总是先执行高优先级的任务, 低优先级的任务可能饿死
+    kWeightedFair,   // 按权重轮流从各级队列取任务, 高优先级不会排在低优先级的突发之后, 低优先级也不会饿死
+};
+
 class ThreadPool: noncopyable
 {
 public:
@@ -22,27 +38,41 @@ public:
                const ThreadInitCallback& cb = nullptr);
     ~ThreadPool();
 
-    void runTask(const Task& task);
-    void runTask(Task&& task);
+    // 每一级队列的长度上限都是 maxQueueSize, 低优先级的队列满了不会阻塞高优先级的任务
+    void runTask(const Task& task, Priority priority = kPriorityNormal);
+    void runTask(Task&& task, Priority priority = kPriorityNormal);
     void stop();
     size_t numThreads() const
     { return threads_.size(); }
+    // 排队等待执行的任务数, 不包括正在执行的
+    size_t queueSize() const;
+    size_t queueSize(Priority priority) const;
+
+    // 默认是 kWeightedFair, 权重 high:normal:low = 16:4:1
+    void setSchedulePolicy(SchedulePolicy policy);
+    void setWeights(uint32_t high, uint32_t normal, uint32_t low);
 
 private:
     void runInThread(size_t index);
     Task take();
+    size_t pickQueue();
 
     using ThreadPtr  = std::unique_ptr<std::thread> ;
     using ThreadList = std::vector<ThreadPtr>       ;
 
     ThreadList threads_;
-    std::mutex mutex_;
+    mutable std::mutex mutex_;
     std::condition_variable notEmpty_;
     std::condition_variable notFull_;
-    std::deque<Task> taskQueue_;
+    std::deque<Task> taskQueues_[kNumPriorities];
+    size_t numQueued_;
     const size_t maxQueueSize_;
     std::atomic_bool running_;
     ThreadInitCallback threadInitCallback_;
+
+    SchedulePolicy policy_;
+    int64_t weights_[kNumPriorities];
+    int64_t credits_[kNumPriorities]; // smooth weighted round robin 的当前权重
 };
 
 }
@@ -5,6 +5,7 @@
 
 #include <libnet/Logger.h>
 #include <libnet/EventLoop.h>
+#include <libnet/MemoryCounter.h>
 #include <libnet/TimerQueue.h>
 
 using namespace net;
@@ -12,6 +13,14 @@ using namespace net;
 namespace
 {
 
+MemoryCounter timerMemory("timer");
+
+void deleteTimer(Timer* timer)
+{
+  delete timer;
+  timerMemory.sub(sizeof(Timer));
+}
+
 int timerfdCreate()
 {
   int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
@@ -31,7 +40,7 @@ void timerfdRead(int fd)
 struct timespec durationFromNow(Timestamp when)
 {
   struct timespec ret;
-  Microsecond ns = std::chrono::duration_cast<Microsecond>((when - clock::now()));
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when - clock::now());
   if (ns < 1ms) ns = 1ms;
 
   ret.tv_sec = static_cast<time_t>(ns.count() / std::nano::den);
@@ -55,7 +64,8 @@ void timerfdSet(int fd, Timestamp when)
 TimerQueue::TimerQueue(EventLoop *loop)
 : loop_(loop),
   timerfd_(timerfdCreate()),
-  timerChannel_(loop, timerfd_)
+  timerChannel_(loop, timerfd_),
+  numTimers_(0)
 {
   loop_->assertInLoopThread();
   timerChannel_.setReadCallback([this]{handleRead();});
@@ -65,17 +75,19 @@ TimerQueue::TimerQueue(EventLoop *loop)
 TimerQueue::~TimerQueue()
 {
   for (auto& p: timers_)
-    delete p.second;
+    deleteTimer(p.second);
   ::close(timerfd_);
 }
 
 Timer* TimerQueue::addTimer(TimerCallback cb, Timestamp when, Microsecond interval)
 {
   Timer* timer = new Timer(std::move(cb), when, interval);
+  timerMemory.add(sizeof(Timer));
   loop_->runInLoop([=]
                   {
                     auto ret = timers_.insert({when, timer});
                     assert(ret.second);
+                    numTimers_.store(timers_.size(), std::memory_order_relaxed);
                     // 改变了最早的超时时间，就需要重新设置
                     if (timers_.begin() == ret.first)
                       timerfdSet(timerfd_, when);
@@ -89,7 +101,8 @@ void TimerQueue::cancelTimer(Timer* timer)
                   {
                     timer->cancel();
                     timers_.erase({timer->when(), timer});
-                    delete timer;
+                    numTimers_.store(timers_.size(), std::memory_order_relaxed);
+                    deleteTimer(timer);
                   });
 }
 
@@ -117,10 +130,11 @@ void TimerQueue::handleRead()
     }
     else
     {
-      delete timer;
+      deleteTimer(timer);
     } 
   }
 
+  numTimers_.store(timers_.size(), std::memory_order_relaxed);
   if (!timers_.empty())
     timerfdSet(timerfd_, timers_.begin()->first);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <set>
 
@@ -19,14 +20,21 @@ public:
 
   Timer*  addTimer(TimerCallback cb, Timestamp when, Microsecond interval);
   void    cancelTimer(Timer* timer);
+  // 任意线程可读, 已经 addTimer() 但是还没有插入的定时器不算
+  size_t  numTimers() const { return numTimers_.load(std::memory_order_relaxed); }
+  // EventLoop 用来区分定时器和 IO 事件
+  int     fd() const { return timerfd_; }
+
+  // 到最早的定时器的毫秒数 (向上取整), 没有定时器时返回 -1, 即一直等待
+  int64_t nextTimeout() const
+  {
+    if(timers_.empty())
+      return -1;
 
-  int64_t nextTimeout() const 
-  { 
-    if(timers_.empty()) 
-      return 0;
-      
     auto interval = timers_.begin()->first - clock::now();
-    return std::chrono::duration_cast<Millisecond>(interval).count();
+    if (interval <= interval.zero())
+      return 0;
+    return std::chrono::ceil<Millisecond>(interval).count();
   }
 
 private:
@@ -40,6 +48,7 @@ private:
   const int  timerfd_;
   Channel    timerChannel_;
   TimerList  timers_;
+  std::atomic<size_t> numTimers_; // timers_.size()
 };
 
 }
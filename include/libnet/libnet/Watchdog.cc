@@ -0,0 +1,182 @@
+#include <assert.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "Logger.h"
+#include "EventLoop.h"
+#include "Watchdog.h"
+
+using namespace net;
+
+namespace
+{
+
+const int kMaxFrames = 64;
+
+// 一次只有一个 Watchdog 线程请求调用栈, captureMutex 保护
+struct StackCapture
+{
+  std::atomic<int> depth{-1};
+  void*            frames[kMaxFrames];
+};
+
+StackCapture capture;
+std::mutex   captureMutex;
+
+int stackSignal()
+{
+  return SIGRTMIN + 1;
+}
+
+// 在 loop 线程中执行
+void captureStack(int)
+{
+  int savedErrno = errno;
+  int depth = ::backtrace(capture.frames, kMaxFrames);
+  capture.depth.store(depth, std::memory_order_release);
+  errno = savedErrno;
+}
+
+void installHandler()
+{
+  static std::once_flag once;
+  std::call_once(once, []
+  {
+    // backtrace() 第一次调用时会加载 libgcc, 不能发生在信号处理函数里
+    void* frames[1];
+    ::backtrace(frames, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = captureStack;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (::sigaction(stackSignal(), &sa, nullptr) == -1)
+      SYSERR("Watchdog sigaction()");
+  });
+}
+
+int64_t steadyNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "binary(_ZN3net...+0x1a) [0x...]" 中的函数名换成 demangle 之后的
+std::string demangle(const char* symbol)
+{
+  std::string line(symbol);
+  auto begin = line.find('(');
+  auto end = line.find('+', begin);
+  if (begin == std::string::npos || end == std::string::npos || end == begin + 1)
+    return line;
+
+  std::string mangled = line.substr(begin + 1, end - begin - 1);
+  int status = 0;
+  char* name = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+  if (status == 0 && name != nullptr)
+    line.replace(begin + 1, end - begin - 1, name);
+  free(name);
+  return line;
+}
+
+} // unnamed-namespace
+
+Watchdog::Watchdog(Microsecond threshold)
+: threshold_(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count()),
+  numStalls_(0),
+  quit_(false)
+{
+  assert(threshold_ > 0);
+  installHandler();
+  thread_ = std::thread([this]{ run(); });
+}
+
+Watchdog::~Watchdog()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+}
+
+void Watchdog::watch(EventLoop* loop)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.push_back({loop, 0});
+}
+
+/// @brief: 返回之后后台线程不会再访问这个 loop
+void Watchdog::unwatch(EventLoop* loop)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [loop](const Entry& e) { return e.loop == loop; }),
+                 entries_.end());
+}
+
+void Watchdog::run()
+{
+  auto interval = std::chrono::nanoseconds(std::max<int64_t>(threshold_ / 2, 1000000));
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!quit_) {
+    cond_.wait_for(lock, interval);
+    int64_t now = steadyNow();
+    for (auto& entry: entries_)
+      check(entry, now);
+  }
+}
+
+/// @brief: 持有 mutex_ 时调用, 所以等待调用栈期间 loop 不会被 unwatch()
+void Watchdog::check(Entry& entry, int64_t now)
+{
+  EventLoop* loop = entry.loop;
+  int64_t started = loop->callbackStartedAt();
+  if (started == 0 || started == entry.reported || now - started < threshold_)
+    return;
+  entry.reported = started;
+  numStalls_.fetch_add(1, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> guard(captureMutex);
+  capture.depth.store(-1, std::memory_order_relaxed);
+  int err = ::pthread_kill(loop->pthreadId(), stackSignal());
+  if (err != 0) {
+    errno = err;
+    SYSERR("Watchdog pthread_kill()");
+    return;
+  }
+  // 最多等 100ms, loop 线程在内核中不可中断地阻塞时收不到信号
+  int depth = -1;
+  for (int i = 0; i < 100 && depth < 0; i++) {
+    std::this_thread::sleep_for(1ms);
+    depth = capture.depth.load(std::memory_order_acquire);
+  }
+
+  long ms = static_cast<long>((steadyNow() - started) / 1000000);
+  if (depth < 0) {
+    WARN("EventLoop %p: callback blocked the loop for %ld ms, stack not captured", loop, ms);
+    return;
+  }
+  if (loop->callbackStartedAt() != started) {
+    WARN("EventLoop %p: callback blocked the loop for %ld ms, finished before stack was captured", loop, ms);
+    return;
+  }
+
+  WARN("EventLoop %p: callback blocked the loop for %ld ms, stack:", loop, ms);
+  char** symbols = ::backtrace_symbols(capture.frames, depth);
+  if (symbols == nullptr)
+    return;
+  // 跳过信号处理函数自己和信号的跳板
+  for (int i = 2; i < depth; i++)
+    WARN("    #%d %s", i - 2, demangle(symbols[i]).c_str());
+  free(symbols);
+}
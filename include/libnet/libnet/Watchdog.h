@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libnet/Timestamp.h>
+#include <libnet/noncopyable.h>
+
+namespace net
+{
+
+class EventLoop;
+
+/// @brief: 检测阻塞 EventLoop 的回调. 后台线程每隔 threshold / 2 检查一次被监视的 loop,
+///         某个回调执行超过 threshold 时, 用信号让 loop 线程记录自己的调用栈, 再在后台线程里
+///         符号化并用 WARN 打印, 同一个回调只报告一次
+///         只能看到 setInstrumented(true) 的 loop 的回调; 函数名需要用 -rdynamic 链接
+///         loop 线程在回调中的系统调用可能因为信号返回 EINTR
+class Watchdog: noncopyable
+{
+public:
+  explicit Watchdog(Microsecond threshold);
+  ~Watchdog();
+
+  // 任意线程都可以调用, loop 析构之前必须 unwatch()
+  void watch(EventLoop* loop);
+  void unwatch(EventLoop* loop);
+
+  // 累计检测到的阻塞次数
+  uint64_t numStalls() const { return numStalls_.load(std::memory_order_relaxed); }
+
+private:
+  struct Entry
+  {
+    EventLoop* loop;
+    int64_t    reported; // 已经报告过的回调的开始时间
+  };
+
+  void run();
+  void check(Entry& entry, int64_t now);
+
+  const int64_t         threshold_; // ns
+  std::atomic<uint64_t> numStalls_;
+  bool                  quit_;
+  std::vector<Entry>    entries_;
+  std::mutex            mutex_;
+  std::condition_variable cond_;
+  std::thread           thread_;
+};
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <libnet/noncopyable.h>
+
+namespace net
+{
+
+/// @brief: Chase-Lev 无锁双端队列, 元素是指针
+///         只有拥有者线程可以 push/pop (队尾, LIFO), 其他线程只能 steal (队首, FIFO)
+///         内存序参考 Lê, Pop, Cohen, Nardelli, "Correct and Efficient Work-Stealing
+///         for Weak Memory Models" (PPoPP 2013)
+///         扩容后旧的数组可能还在被 steal 读取, 所以留到析构时再释放, 最多浪费一倍的空间
+template <typename T>
+class WorkStealingDeque: noncopyable
+{
+    static_assert(std::is_pointer<T>::value, "element must be pointer");
+
+public:
+    explicit
+    WorkStealingDeque(int64_t capacity = 256)
+    : top_(0),
+      bottom_(0)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+        arrays_.emplace_back(new Array(capacity));
+        array_.store(arrays_.back().get(), std::memory_order_relaxed);
+    }
+
+    /// @brief: 只能由拥有者线程调用
+    void push(T x)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array* a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            arrays_.emplace_back(a->grow(b, t));
+            a = arrays_.back().get();
+            array_.store(a, std::memory_order_release);
+        }
+        a->put(b, x);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /// @brief: 只能由拥有者线程调用, 队列为空时返回 nullptr
+    T pop()
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        T x = nullptr;
+        if (t <= b) {
+            x = a->get(b);
+            if (t == b) {
+                // 最后一个元素, 和 steal 竞争
+                if (!top_.compare_exchange_strong(t, t + 1,
+                                                  std::memory_order_seq_cst,
+                                                  std::memory_order_relaxed))
+                    x = nullptr;
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    /// @brief: 任意线程都可以调用, 队列为空或者竞争失败时返回 nullptr
+    T steal()
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t < b) {
+            Array* a = array_.load(std::memory_order_acquire);
+            T x = a->get(t);
+            if (!top_.compare_exchange_strong(t, t + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed))
+                return nullptr;
+            return x;
+        }
+        return nullptr;
+    }
+
+    /// @brief: 近似值, 只用于判断是否还有任务和监控
+    int64_t size() const
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    bool empty() const
+    { return size() == 0; }
+
+private:
+    struct Array
+    {
+        explicit
+        Array(int64_t cap)
+        : capacity(cap),
+          mask(cap - 1),
+          buffer(new std::atomic<T>[static_cast<size_t>(cap)])
+        { }
+
+        T get(int64_t i) const
+        { return buffer[i & mask].load(std::memory_order_relaxed); }
+
+        void put(int64_t i, T x)
+        { buffer[i & mask].store(x, std::memory_order_relaxed); }
+
+        Array* grow(int64_t b, int64_t t) const
+        {
+            Array* a = new Array(capacity * 2);
+            for (int64_t i = t; i != b; i++)
+                a->put(i, get(i));
+            return a;
+        }
+
+        const int64_t capacity;
+        const int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> buffer;
+    };
+
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> arrays_; // 只有拥有者线程修改
+};
+
+}
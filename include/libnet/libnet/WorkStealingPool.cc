@@ -0,0 +1,217 @@
+#include <assert.h>
+
+#include <libnet/Logger.h>
+#include <libnet/MemoryCounter.h>
+#include <libnet/Profiler.h>
+#include <libnet/WorkStealingPool.h>
+
+using namespace net;
+
+namespace
+{
+
+// 提交之后还没有执行完的任务
+MemoryCounter taskMemory("stealing_pool_task");
+
+void deleteTask(Task* task)
+{
+    delete task;
+    taskMemory.sub(sizeof(Task));
+}
+
+// 当前线程所属的线程池和下标, 用来把工作线程里提交的任务放进本地队列
+thread_local WorkStealingPool* t_pool = nullptr;
+thread_local size_t t_index = 0;
+
+// 睡眠之前自旋的轮数, 每一轮都会重新找一遍任务
+const int kSpinRounds = 64;
+
+uint64_t xorshift(uint64_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+}
+
+WorkStealingPool::WorkStealingPool(size_t numThread, const ThreadInitCallback& cb)
+        : numInjected_(0),
+          numParked_(0),
+          running_(true),
+          threadInitCallback_(cb)
+{
+    for (size_t i = 0; i < numThread; ++i) {
+        workers_.emplace_back(new Worker);
+        workers_.back()->seed = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+    // 所有的 Worker 构造完成之后才能启动线程, 否则偷取时会访问到正在构造的 vector
+    for (size_t i = 0; i < numThread; ++i) {
+        threads_.emplace_back(new std::thread([this, i](){runInThread(i);}));
+    }
+    TRACE("WorkStealingPool() numThreads %lu", numThread);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    if (running_)
+        stop();
+    // 停止之后没有执行的任务直接丢弃
+    for (auto& worker: workers_) {
+        while (Task* task = worker->deque.pop())
+            deleteTask(task);
+    }
+    for (Task* task: injected_)
+        deleteTask(task);
+    TRACE("~WorkStealingPool()");
+}
+
+void WorkStealingPool::runTask(const Task& task)
+{
+    runTask(Task(task));
+}
+
+void WorkStealingPool::runTask(Task&& task)
+{
+    assert(running_);
+
+    if (threads_.empty()) {
+        task();
+        return;
+    }
+
+    Task* t = new Task(std::move(task));
+    taskMemory.add(sizeof(Task));
+    if (t_pool == this) {
+        workers_[t_index]->deque.push(t);
+    }
+    else {
+        std::lock_guard<std::mutex> guard(injectMutex_);
+        injected_.push_back(t);
+        numInjected_++;
+    }
+    wakeUp();
+}
+
+void WorkStealingPool::stop()
+{
+    assert(running_);
+    running_ = false;
+    {
+        std::lock_guard<std::mutex> guard(parkMutex_);
+        parkCond_.notify_all();
+    }
+    for (auto& thread: threads_)
+        thread->join();
+}
+
+void WorkStealingPool::runInThread(size_t index)
+{
+    t_pool = this;
+    t_index = index;
+    // 和 ThreadPool 一致, 回调的下标从 1 开始
+    if (threadInitCallback_)
+        threadInitCallback_(index + 1);
+    Profiler::instance().registerThread();
+
+    while (running_) {
+        Task* task = nullptr;
+        for (int i = 0; i < kSpinRounds && running_; i++) {
+            task = findTask(index);
+            if (task != nullptr)
+                break;
+            std::this_thread::yield();
+        }
+        if (task != nullptr) {
+            (*task)();
+            deleteTask(task);
+        }
+        else {
+            park();
+        }
+    }
+    Profiler::instance().unregisterThread();
+    t_pool = nullptr;
+}
+
+Task* WorkStealingPool::findTask(size_t index)
+{
+    Task* task = workers_[index]->deque.pop();
+    if (task == nullptr)
+        task = takeInjected();
+    if (task == nullptr)
+        task = stealFrom(index);
+    return task;
+}
+
+/// @brief: 从随机的位置开始, 依次尝试偷其他工作线程的任务
+Task* WorkStealingPool::stealFrom(size_t index)
+{
+    size_t n = workers_.size();
+    if (n <= 1)
+        return nullptr;
+    size_t start = xorshift(workers_[index]->seed) % n;
+    for (size_t i = 0; i < n; i++) {
+        size_t victim = (start + i) % n;
+        if (victim == index)
+            continue;
+        if (Task* task = workers_[victim]->deque.steal())
+            return task;
+    }
+    return nullptr;
+}
+
+Task* WorkStealingPool::takeInjected()
+{
+    if (numInjected_.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> guard(injectMutex_);
+    if (injected_.empty())
+        return nullptr;
+    Task* task = injected_.front();
+    injected_.pop_front();
+    numInjected_--;
+    return task;
+}
+
+bool WorkStealingPool::hasTask() const
+{
+    if (numInjected_.load() > 0)
+        return true;
+    for (auto& worker: workers_) {
+        if (!worker->deque.empty())
+            return true;
+    }
+    return false;
+}
+
+size_t WorkStealingPool::localQueueSize() const
+{
+    size_t n = 0;
+    for (auto& worker: workers_)
+        n += static_cast<size_t>(worker->deque.size());
+    return n;
+}
+
+/// @brief: 提交任务之后调用, 只有存在睡眠的线程时才需要加锁
+///         提交方先写队列再读 numParked_, 睡眠方先写 numParked_ 再读队列,
+///         两边都是 seq_cst, 至少有一方能看到对方的写入, 所以不会丢失唤醒
+void WorkStealingPool::wakeUp()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (numParked_.load() > 0) {
+        std::lock_guard<std::mutex> guard(parkMutex_);
+        parkCond_.notify_one();
+    }
+}
+
+void WorkStealingPool::park()
+{
+    std::unique_lock<std::mutex> lock(parkMutex_);
+    numParked_++;
+    // 持有锁之后再检查一次, 这期间提交的任务的 notify 会等到 wait 之后
+    if (running_ && !hasTask())
+        parkCond_.wait(lock);
+    numParked_--;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <deque>
+
+#include <libnet/noncopyable.h>
+#include <libnet/Callbacks.h>
+#include <libnet/WorkStealingDeque.h>
+
+namespace net
+{
+
+/// @brief: work-stealing 线程池, 和 ThreadPool 的接口一致, 但是没有优先级
+///         每个工作线程有自己的 Chase-Lev 队列, 工作线程里提交的任务直接进本地队列,
+///         其他线程 (比如 IO 线程) 提交的任务进一个共享的注入队列
+///         工作线程按 本地队列 -> 注入队列 -> 随机偷其他线程 的顺序找任务,
+///         找不到时先自旋一会儿, 再睡在条件变量上
+///         注入队列没有长度上限, 背压由上层的 admission control 负责
+class WorkStealingPool: noncopyable
+{
+public:
+    explicit
+    WorkStealingPool(size_t numThread,
+                     const ThreadInitCallback& cb = nullptr);
+    ~WorkStealingPool();
+
+    void runTask(const Task& task);
+    void runTask(Task&& task);
+    void stop();
+    size_t numThreads() const
+    { return threads_.size(); }
+
+    // 近似值, 只用于监控: 所有工作线程本地队列的长度之和, 以及注入队列的长度
+    size_t localQueueSize() const;
+    size_t injectedSize() const
+    { return numInjected_.load(std::memory_order_relaxed); }
+
+private:
+    struct Worker
+    {
+        WorkStealingDeque<Task*> deque;
+        uint64_t seed; // xorshift 的状态, 用来选择偷取的对象
+    };
+
+    void runInThread(size_t index);
+    Task* findTask(size_t index);
+    Task* stealFrom(size_t index);
+    Task* takeInjected();
+    bool hasTask() const;
+    void wakeUp();
+    void park();
+
+    using ThreadPtr  = std::unique_ptr<std::thread>;
+    using ThreadList = std::vector<ThreadPtr>      ;
+    using WorkerPtr  = std::unique_ptr<Worker>     ;
+
+    ThreadList threads_;
+    std::vector<WorkerPtr> workers_;
+
+    std::mutex injectMutex_;
+    std::deque<Task*> injected_;
+    std::atomic<size_t> numInjected_;
+
+    std::mutex parkMutex_;
+    std::condition_variable parkCond_;
+    std::atomic<size_t> numParked_;
+
+    std::atomic_bool running_;
+    ThreadInitCallback threadInitCallback_;
+};
+
+}
@@ -0,0 +1,141 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <libnet/CountDownLatch.h>
+#include <libnet/WorkStealingDeque.h>
+#include <libnet/WorkStealingPool.h>
+
+using namespace net;
+
+namespace
+{
+
+int failures = 0;
+
+// 不依赖测试框架, 失败时打印位置并在 main 中返回非零
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+const size_t kItems   = 200000;
+const size_t kThieves = 3;
+const int    kRounds  = 5;
+
+/// @brief: 拥有者线程 push 并不时 pop, 同时几个线程一直 steal,
+///         每个元素是计数数组中的一个位置, 最后每个位置都应该恰好被取走一次
+///         初始容量很小, 让 push 在 steal 进行中反复扩容
+void testDequeStress()
+{
+    for (int round = 0; round < kRounds; round++) {
+        WorkStealingDeque<std::atomic<int>*> deque(2);
+        std::unique_ptr<std::atomic<int>[]> taken(new std::atomic<int>[kItems]);
+        for (size_t i = 0; i < kItems; i++)
+            taken[i].store(0, std::memory_order_relaxed);
+
+        std::atomic<bool> done(false);
+        std::atomic<size_t> stolen(0);
+        std::vector<std::thread> thieves;
+        for (size_t i = 0; i < kThieves; i++) {
+            thieves.emplace_back([&]() {
+                size_t n = 0;
+                for (;;) {
+                    auto x = deque.steal();
+                    if (x != nullptr) {
+                        x->fetch_add(1, std::memory_order_relaxed);
+                        n++;
+                    }
+                    // done 之后拥有者不再 push, 还要把剩下的偷完
+                    else if (done.load(std::memory_order_acquire) && deque.empty())
+                        break;
+                }
+                stolen.fetch_add(n);
+            });
+        }
+
+        size_t popped = 0;
+        for (size_t i = 0; i < kItems; i++) {
+            deque.push(&taken[i]);
+            // 每 push 三个 pop 一个, 队列在空和非空之间来回变化, pop 经常和 steal 争最后一个元素
+            if (i % 3 == 2) {
+                auto x = deque.pop();
+                if (x != nullptr) {
+                    x->fetch_add(1, std::memory_order_relaxed);
+                    popped++;
+                }
+            }
+        }
+        // 拥有者和小偷一起清空队列
+        for (auto x = deque.pop(); x != nullptr; x = deque.pop()) {
+            x->fetch_add(1, std::memory_order_relaxed);
+            popped++;
+        }
+        done.store(true, std::memory_order_release);
+        for (auto& t: thieves)
+            t.join();
+
+        size_t lost = 0, duplicated = 0;
+        for (size_t i = 0; i < kItems; i++) {
+            int n = taken[i].load(std::memory_order_relaxed);
+            if (n == 0)
+                lost++;
+            else if (n > 1)
+                duplicated++;
+        }
+        CHECK(lost == 0);
+        CHECK(duplicated == 0);
+        CHECK(popped + stolen.load() == kItems);
+        CHECK(deque.empty());
+    }
+}
+
+/// @brief: 外部线程提交的任务进注入队列, 任务里再提交的任务进工作线程的本地队列,
+///         空闲的工作线程从别的线程偷, 每个任务都应该恰好执行一次
+void testPoolRunsEveryTask()
+{
+    const size_t kOuter = 2000;
+    const size_t kInner = 16;
+
+    std::unique_ptr<std::atomic<int>[]> ran(new std::atomic<int>[kOuter * kInner]);
+    for (size_t i = 0; i < kOuter * kInner; i++)
+        ran[i].store(0, std::memory_order_relaxed);
+
+    CountDownLatch latch(static_cast<int>(kOuter * kInner));
+    {
+        WorkStealingPool pool(4);
+        for (size_t i = 0; i < kOuter; i++) {
+            pool.runTask([&, i]() {
+                for (size_t j = 0; j < kInner; j++) {
+                    pool.runTask([&, i, j]() {
+                        ran[i * kInner + j].fetch_add(1, std::memory_order_relaxed);
+                        latch.count();
+                    });
+                }
+            });
+        }
+        latch.wait();
+    }
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < kOuter * kInner; i++)
+        if (ran[i].load(std::memory_order_relaxed) != 1)
+            wrong++;
+    CHECK(wrong == 0);
+}
+
+}
+
+int main()
+{
+    testDequeStress();
+    testPoolRunsEveryTask();
+    if (failures == 0)
+        printf("all tests passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,349 @@
+/// @brief: 把 setLogBinary(1) 写出的二进制日志还原成和文本日志相同的格式
+///         log_decode [file...], 没有参数时读标准输入; 记录的格式见 Logger.c
+///         文本行 (以数字开头, 例如打开二进制日志之前写的) 原样输出
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+const uint8_t kDefinition = 1;
+const uint8_t kLog        = 2;
+
+const char* kKindStr[] = {
+  "[TRACE]", "[DEBUG]", "[INFO] ", "[WARN] ", "[ERROR]", "[FATAL]", "[SYSER]", "[SYSFA]"
+};
+const int kKindSysErr = 6;
+
+struct Site
+{
+  int         kind;
+  uint32_t    line;
+  std::string file;
+  std::string fmt;
+  std::string types;
+};
+
+class Reader
+{
+public:
+  Reader(const std::string& data, size_t pos)
+  : data_(data), pos_(pos)
+  {}
+
+  template <typename T>
+  bool read(T& value)
+  {
+    if (pos_ + sizeof(T) > data_.size())
+      return false;
+    memcpy(&value, data_.data() + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  bool readString(std::string& str)
+  {
+    uint16_t len;
+    if (!read(len) || pos_ + len > data_.size())
+      return false;
+    str.assign(data_, pos_, len);
+    pos_ += len;
+    return true;
+  }
+
+  bool skip(size_t n)
+  {
+    if (pos_ + n > data_.size())
+      return false;
+    pos_ += n;
+    return true;
+  }
+
+  size_t pos() const { return pos_; }
+
+private:
+  const std::string& data_;
+  size_t             pos_;
+};
+
+// 按 Logger.c 中 parse_types() 相同的规则切出一个转换说明, 返回它的结尾
+size_t specEnd(const std::string& fmt, size_t i)
+{
+  i++; // '%'
+  while (i < fmt.size() && strchr("-+ #0'", fmt[i]) != nullptr && fmt[i] != '\0')
+    i++;
+  if (i < fmt.size() && fmt[i] == '*')
+    i++;
+  while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9')
+    i++;
+  if (i < fmt.size() && fmt[i] == '.') {
+    i++;
+    if (i < fmt.size() && fmt[i] == '*')
+      i++;
+    while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9')
+      i++;
+  }
+  while (i < fmt.size() && strchr("hlLzjt", fmt[i]) != nullptr)
+    i++;
+  return i < fmt.size() ? i + 1 : i;
+}
+
+// 取出一个参数并用 spec 格式化
+bool formatArg(Reader& args, char type, const std::string& spec, const std::vector<int>& stars, std::string& out)
+{
+  char buf[1024];
+  int n = 0;
+  int a = stars.size() > 0 ? stars[0] : 0;
+  int b = stars.size() > 1 ? stars[1] : 0;
+  const char* f = spec.c_str();
+
+#define FORMAT(value) \
+  n = stars.size() == 0 ? snprintf(buf, sizeof buf, f, value) : \
+      stars.size() == 1 ? snprintf(buf, sizeof buf, f, a, value) : \
+                          snprintf(buf, sizeof buf, f, a, b, value)
+
+  // 整数按原来的长度修饰符转换回去, 让 printf 按正确的类型读取
+  bool wide = spec.find_first_of("lzjt") != std::string::npos;
+  switch (type) {
+    case 'i': { int v;      if (!args.read(v)) return false; FORMAT(v); break; }
+    case 'u': { unsigned v; if (!args.read(v)) return false; FORMAT(v); break; }
+    case 'l': {
+      long v;
+      if (!args.read(v)) return false;
+      if (wide) FORMAT(v); else FORMAT(static_cast<int>(v));
+      break;
+    }
+    case 'd': { double v;   if (!args.read(v)) return false; FORMAT(v); break; }
+    case 'D': {
+      double v;
+      if (!args.read(v)) return false;
+      FORMAT(static_cast<long double>(v));
+      break;
+    }
+    case 'p': {
+      uint64_t v;
+      if (!args.read(v)) return false;
+      FORMAT(reinterpret_cast<void*>(static_cast<uintptr_t>(v)));
+      break;
+    }
+    case 's': {
+      std::string v;
+      if (!args.readString(v)) return false;
+      FORMAT(v.c_str());
+      break;
+    }
+    default:
+      return false;
+  }
+#undef FORMAT
+  if (n > 0)
+    out.append(buf, std::min(static_cast<size_t>(n), sizeof buf - 1));
+  return true;
+}
+
+bool formatMessage(const Site& site, Reader& args, std::string& out)
+{
+  size_t t = 0;
+  const std::string& fmt = site.fmt;
+  for (size_t i = 0; i < fmt.size(); ) {
+    if (fmt[i] != '%') {
+      out.push_back(fmt[i++]);
+      continue;
+    }
+    if (i + 1 < fmt.size() && fmt[i + 1] == '%') {
+      out.push_back('%');
+      i += 2;
+      continue;
+    }
+    size_t end = specEnd(fmt, i);
+    std::string spec = fmt.substr(i, end - i);
+    i = end;
+
+    // '*' 的宽度和精度在 types 里是单独的 'i'
+    std::vector<int> stars;
+    for (char c: spec) {
+      if (c != '*')
+        continue;
+      int v;
+      if (t >= site.types.size() || !args.read(v))
+        return false;
+      stars.push_back(v);
+      t++;
+    }
+    if (t >= site.types.size() || !formatArg(args, site.types[t++], spec, stars, out))
+      return false;
+  }
+  // log_sys() 的错误信息
+  if (site.kind >= kKindSysErr) {
+    std::string err;
+    if (!args.readString(err))
+      return false;
+    out.append(": ").append(err);
+  }
+  return true;
+}
+
+std::string timestamp(int64_t usec)
+{
+  time_t seconds = static_cast<time_t>(usec / 1000000);
+  struct tm tm_time;
+  gmtime_r(&seconds, &tm_time);
+  char buf[64];
+  snprintf(buf, sizeof buf, "%4d%02d%02d %02d:%02d:%02d.%06ld",
+           tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
+           tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec,
+           static_cast<long>(usec % 1000000));
+  return buf;
+}
+
+std::string basename(const std::string& file)
+{
+  auto pos = file.rfind('/');
+  return pos == std::string::npos ? file : file.substr(pos + 1);
+}
+
+size_t skipLine(const std::string& data, size_t pos)
+{
+  auto end = data.find('\n', pos);
+  return end == std::string::npos ? data.size() : end + 1;
+}
+
+// 第一遍: 收集所有的定义, 异步日志中定义可能在使用它的记录之后
+bool readDefinitions(const std::string& data, std::unordered_map<uint32_t, Site>& sites)
+{
+  size_t pos = 0;
+  while (pos < data.size()) {
+    uint8_t type = static_cast<uint8_t>(data[pos]);
+    if (type >= '0' && type <= '9') {
+      pos = skipLine(data, pos);
+      continue;
+    }
+    Reader r(data, pos + 1);
+    uint32_t id;
+    if (type == kDefinition) {
+      Site site;
+      uint8_t kind, ntypes;
+      if (!r.read(id) || !r.read(kind) || !r.read(site.line) ||
+          !r.readString(site.file) || !r.readString(site.fmt) || !r.read(ntypes))
+        break;
+      site.kind = kind < 8 ? kind : 0;
+      site.types.resize(ntypes);
+      for (auto& c: site.types)
+        if (!r.read(c))
+          return false;
+      sites.emplace(id, std::move(site));
+    }
+    else if (type == kLog) {
+      int32_t pid;
+      int64_t usec;
+      uint16_t len;
+      if (!r.read(id) || !r.read(pid) || !r.read(usec) || !r.read(len) || !r.skip(len))
+        break;
+    }
+    else {
+      fprintf(stderr, "log_decode: bad record type %u at offset %zu\n", type, pos);
+      return false;
+    }
+    pos = r.pos();
+  }
+  return true;
+}
+
+// 第二遍: 输出文本
+void decode(const std::string& data, const std::unordered_map<uint32_t, Site>& sites)
+{
+  size_t pos = 0;
+  std::string line;
+  while (pos < data.size()) {
+    uint8_t type = static_cast<uint8_t>(data[pos]);
+    if (type >= '0' && type <= '9') {
+      size_t end = skipLine(data, pos);
+      fwrite(data.data() + pos, 1, end - pos, stdout);
+      pos = end;
+      continue;
+    }
+    Reader r(data, pos + 1);
+    uint32_t id;
+    if (type == kDefinition) {
+      uint8_t kind, ntypes;
+      uint32_t lineno;
+      std::string file, fmt;
+      if (!r.read(id) || !r.read(kind) || !r.read(lineno) ||
+          !r.readString(file) || !r.readString(fmt) || !r.read(ntypes) || !r.skip(ntypes))
+        break;
+      pos = r.pos();
+      continue;
+    }
+    if (type != kLog)
+      break;
+
+    int32_t pid;
+    int64_t usec;
+    uint16_t len;
+    if (!r.read(id) || !r.read(pid) || !r.read(usec) || !r.read(len))
+      break;
+    size_t next = r.pos() + len;
+    if (next > data.size())
+      break;
+
+    auto it = sites.find(id);
+    line = timestamp(usec);
+    if (it == sites.end()) {
+      line.append(" [").append(std::to_string(pid)).append("] ");
+      line.append("<unknown format id ").append(std::to_string(id)).append(">\n");
+    }
+    else {
+      auto& site = it->second;
+      line.append(" [").append(std::to_string(pid)).append("] ");
+      line.append(kKindStr[site.kind]).append(" ");
+      if (!formatMessage(site, r, line))
+        line.append("<bad arguments>");
+      line.append(" - ").append(basename(site.file)).append(":").append(std::to_string(site.line)).append("\n");
+    }
+    fwrite(line.data(), 1, line.size(), stdout);
+    pos = next;
+  }
+  if (pos < data.size())
+    fprintf(stderr, "log_decode: %zu trailing byte(s) at offset %zu not decoded\n", data.size() - pos, pos);
+}
+
+bool decodeStream(std::istream& in)
+{
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::unordered_map<uint32_t, Site> sites;
+  if (!readDefinitions(data, sites))
+    return false;
+  decode(data, sites);
+  return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  if (argc == 1)
+    return decodeStream(std::cin) ? 0 : 1;
+
+  int ret = 0;
+  for (int i = 1; i < argc; i++) {
+    std::ifstream in(argv[i], std::ios::binary);
+    if (!in) {
+      fprintf(stderr, "log_decode: cannot open %s\n", argv[i]);
+      ret = 1;
+      continue;
+    }
+    if (!decodeStream(in))
+      ret = 1;
+  }
+  return ret;
+}
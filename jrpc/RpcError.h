@@ -11,6 +11,7 @@ namespace jrpc
   XX(METHOD_NOT_FOUND, -32601,"Method not found") \
   XX(INVALID_PARAMS, -32602, "Invalid params")    \
   XX(INTERNAL_ERROR, -32603, "Internal error")    \
+  XX(DEADLINE_EXCEEDED, -32000, "Deadline exceeded") \
 
 enum Error
 {
@@ -19,6 +20,12 @@ enum Error
 #undef GEN_ERRNO
 };
 
+const int kNumRpcErrors = 0
+#define COUNT_ERRNO(e, c, s) + 1
+    ERROR_MAP(COUNT_ERRNO)
+#undef COUNT_ERRNO
+    ;
+
 class RpcError
 {
 public:
@@ -37,6 +44,9 @@ public:
     int32_t asCode() const
     { return errorCode[err_]; }
 
+    Error asErrno() const
+    { return err_; }
+
 private:
     const Error err_;
 
@@ -48,6 +58,7 @@ private:
             case -32601: return RPC_METHOD_NOT_FOUND;
             case -32602: return RPC_INVALID_PARAMS;
             case -32603: return RPC_INTERNAL_ERROR;
+            case -32000: return RPC_DEADLINE_EXCEEDED;
             default: assert(false && "bad error code");
         }
     }
@@ -0,0 +1,115 @@
+#include <random>
+
+#include <jrpc/Trace.h>
+
+using namespace jrpc;
+
+namespace
+{
+
+const char kHex[] = "0123456789abcdef";
+
+// 每个线程一个生成器, 不需要加锁; id 不能是 0
+uint64_t randomId()
+{
+    thread_local std::mt19937_64 engine(std::random_device{}());
+    uint64_t id;
+    do {
+        id = engine();
+    } while (id == 0);
+    return id;
+}
+
+void appendHex(std::string& out, uint64_t value)
+{
+    for (int shift = 60; shift >= 0; shift -= 4)
+        out.push_back(kHex[(value >> shift) & 0xf]);
+}
+
+int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1; // W3C 只允许小写
+}
+
+bool parseHex(std::string_view str, uint64_t& value)
+{
+    value = 0;
+    for (char c: str) {
+        int d = hexDigit(c);
+        if (d < 0)
+            return false;
+        value = (value << 4) | static_cast<uint64_t>(d);
+    }
+    return true;
+}
+
+}
+
+std::string TraceContext::traceId() const
+{
+    std::string result;
+    result.reserve(32);
+    appendHex(result, traceIdHigh);
+    appendHex(result, traceIdLow);
+    return result;
+}
+
+std::string TraceContext::traceparent() const
+{
+    std::string result;
+    result.reserve(55);
+    result.append("00-");
+    appendHex(result, traceIdHigh);
+    appendHex(result, traceIdLow);
+    result.push_back('-');
+    appendHex(result, spanId);
+    result.append(sampled ? "-01" : "-00");
+    return result;
+}
+
+TraceContext TraceContext::root(bool sampled)
+{
+    TraceContext ctx;
+    ctx.traceIdHigh = randomId();
+    ctx.traceIdLow = randomId();
+    ctx.spanId = randomId();
+    ctx.sampled = sampled;
+    return ctx;
+}
+
+/// @brief: 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01
+///         版本 00 的长度固定是 55; 未知的更高版本只要前缀符合格式也接受
+bool TraceContext::parse(std::string_view str, TraceContext& upstream)
+{
+    if (str.size() < 55 || str[2] != '-' || str[35] != '-' || str[52] != '-')
+        return false;
+    uint64_t version, flags;
+    if (!parseHex(str.substr(0, 2), version) || version == 0xff)
+        return false;
+    if (version == 0 && str.size() != 55)
+        return false;
+    if (version != 0 && str.size() > 55 && str[55] != '-')
+        return false;
+
+    TraceContext ctx;
+    if (!parseHex(str.substr(3, 16), ctx.traceIdHigh) ||
+        !parseHex(str.substr(19, 16), ctx.traceIdLow) ||
+        !parseHex(str.substr(36, 16), ctx.spanId) ||
+        !parseHex(str.substr(53, 2), flags))
+        return false;
+    ctx.sampled = (flags & 0x01) != 0;
+    if (!ctx.valid())
+        return false;
+    upstream = ctx;
+    return true;
+}
+
+TraceContext TraceContext::child() const
+{
+    TraceContext ctx = *this;
+    ctx.parentId = spanId;
+    ctx.spanId = randomId();
+    return ctx;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace jrpc
+{
+
+/// @brief: 分布式追踪的上下文, 在请求信封中以 W3C Trace Context 的 traceparent 格式传播:
+///         "traceparent": "00-[trace-id, 32 hex]-[parent-id, 16 hex]-[flags, 2 hex]"
+///         flags 的最低位表示这个 trace 被采样, 链路上的每个服务都记录自己的 span
+///         服务器为每个带 traceparent 的请求创建一个子 span, 处理函数通过 UserDoneCallback::trace()
+///         取得它, 再传给下游调用的 client stub, 下游的 span 就以它为 parent
+struct TraceContext
+{
+    uint64_t traceIdHigh = 0;
+    uint64_t traceIdLow  = 0;
+    uint64_t spanId      = 0;  // 向下游传播时作为 parent-id
+    uint64_t parentId    = 0;  // 上游的 span, 0 表示根
+    bool     sampled     = false;
+
+    bool valid() const
+    { return (traceIdHigh | traceIdLow) != 0 && spanId != 0; }
+
+    std::string traceId() const;     // 32 位十六进制
+    std::string traceparent() const; // 传给下游的 traceparent, 要求 valid()
+
+    // 开始一个新的 trace
+    static TraceContext root(bool sampled);
+
+    /// @brief: 解析 traceparent, 得到上游的上下文 (spanId 是上游的 span)
+    ///         格式不对, 或者 trace-id/parent-id 全为 0 时返回 false
+    static bool parse(std::string_view traceparent, TraceContext& upstream);
+
+    // 同一个 trace 中以自己为 parent 的新 span
+    TraceContext child() const;
+};
+
+}
@@ -2,6 +2,8 @@
 #include <cppJson/StringWriteStream.h>
 #include <cppJson/Writer.h>
 
+#include <libnet/MemoryCounter.h>
+
 #include <jrpc/client/BaseClient.h>
 #include <jrpc/Exception.h>
 
@@ -10,7 +12,45 @@ using namespace jrpc;
 namespace
 {
 
-const size_t kMaxMessageLen = 65536;
+const size_t kMaxMessageLen = 100 * 1024 * 1024; // 和服务器一致
+const size_t kHighWatermark = 65536;
+// 多路复用时每个流的窗口, 用掉一半之后归还
+const size_t kStreamWindow  = 256 * 1024;
+
+// 等待回应的调用: 哈希表的节点 (下一个指针 + 键值), 不包括回调捕获的状态
+net::MemoryCounter callMemory("client_call");
+const size_t kCallBytes = sizeof(void*) + sizeof(std::pair<const int64_t, ResponseCallback>);
+
+// 格式: 内容长度 + crlf + 内容 + crlf, 长度包括末尾的 crlf
+std::string encodeMessage(json::Value& message)
+{
+    json::StringWriteStream os;
+    json::Writer writer(os);
+    message.writeTo(writer);
+
+    return std::to_string(os.get().length() + 2)
+              .append("\r\n")
+              .append(os.get())
+              .append("\r\n");
+}
+
+void sendMessage(const TcpConnectionPtr& conn, json::Value& message)
+{
+    conn->send(encodeMessage(message));
+}
+
+/// @brief: 在 IO 线程中, 输出缓冲区低于高水位时唤醒暂停的上传
+void resumeUploads(SendFlow& flow)
+{
+    std::vector<Task> resumers;
+    {
+        std::lock_guard<std::mutex> guard(flow.mutex);
+        flow.writable = true;
+        resumers.swap(flow.resumers);
+    }
+    for (auto& resume: resumers)
+        resume();
+}
 
 json::Value& findValue(json::Value &value, const char *key, json::ValueType type)
 {
@@ -36,32 +76,136 @@ json::Value& findValue(json::Value& value, const char* key, json::ValueType type
 
 } // unnamed-namespace
 
+BaseClient::~BaseClient()
+{
+    callMemory.sub(callbacks_.size() * kCallBytes, static_cast<int64_t>(callbacks_.size()));
+}
+
 void BaseClient::sendCall(const TcpConnectionPtr& conn, json::Value& call, const ResponseCallback& cb)
 {
     // remember callback when recv response
     call.addMember("id", id_);
     callbacks_[id_] = cb;
+    callMemory.add(kCallBytes);
+
+    if (timeout_ > 0ms) {
+        call.addMember("timeout", static_cast<int64_t>(timeout_.count()));
+        timers_[id_] = loop_->runAfter(timeout_, [this, id = id_]{ this->onTimeout(id); });
+    }
     id_++;
 
     sendRequest(conn, call);
 }
 
+void BaseClient::sendCall(const TcpConnectionPtr& conn,
+                          json::Value& call,
+                          const ResponseCallback& cb,
+                          const ChunkCallback& onChunk)
+{
+    chunkCallbacks_[id_] = onChunk;
+    sendCall(conn, call, cb);
+}
+
 void BaseClient::sendNotify(const TcpConnectionPtr& conn, json::Value& notify)
 {
     sendRequest(conn, notify);
 }
 
+UploadWriterPtr BaseClient::sendUpload(const TcpConnectionPtr& conn,
+                                       json::Value& call,
+                                       const ResponseCallback& cb)
+{
+    auto writer = std::make_shared<UploadWriter>(conn, id_, flow_);
+    sendCall(conn, call, cb);
+    return writer;
+}
+
 void BaseClient::sendRequest(const TcpConnectionPtr& conn, json::Value& request)
 {
-    json::StringWriteStream os;
-    json::Writer writer(os);
-    request.writeTo(writer);
+    sendMessage(conn, request);
+}
+
+/// @brief: 上传的流量控制和连接的高水位绑定, 每个连接一个新的 SendFlow
+void BaseClient::onConnection(const TcpConnectionPtr& conn)
+{
+    if (!conn->connected())
+        return;
+
+    // 开启多路复用, 大的回应分帧交错发送
+    streams_.clear();
+    if (multiplexing_)
+        conn->send(frameHeader(0, kFrameSettings, kStreamWindow));
+
+    flow_ = std::make_shared<SendFlow>();
+    auto flow = flow_;
+    conn->setHighWaterMarkCallback([flow](const TcpConnectionPtr& connp, size_t)
+                                   {
+                                        {
+                                            std::lock_guard<std::mutex> guard(flow->mutex);
+                                            flow->writable = false;
+                                        }
+                                        connp->setWriteCompleteCallback([flow](const TcpConnectionPtr&)
+                                        {
+                                            resumeUploads(*flow);
+                                        });
+                                        // 回调是排队执行的, 安装之前输出缓冲区可能已经发完了 (io_uring 一次 sendmsg 能发很多),
+                                        // 不会再有写完回调
+                                        if (connp->outputBuffer().readableBytes() == 0)
+                                            resumeUploads(*flow);
+                                   }, 
+                                   kHighWatermark);
+}
 
-    auto message = std::to_string(os.get().length() + 2)
-                    .append("\r\n")
-                    .append(os.get())
-                    .append("\r\n");
-    conn->send(message);
+bool UploadWriter::write(json::Value chunk, const Task& resume)
+{
+    if (!conn_->connected())
+        return false;
+
+    json::Value frame(json::TYPE_OBJECT);
+    frame.addMember("jsonrpc", "2.0");
+    frame.addMember("chunk", std::move(chunk));
+    frame.addMember("id", id_);
+    auto message = encodeMessage(frame);
+
+    auto loop = conn_->getLoop();
+    bool inLoop = loop->isInLoopThread();
+    if (inLoop) {
+        conn_->send(message);
+    }
+    else {
+        // 先计数再入队; 排队的分块全部进入输出缓冲区之后, 如果没有到高水位,
+        // 写完回调不会被安装, 由最后一个发送唤醒暂停的上传
+        flow_->queuedBytes.fetch_add(message.size());
+        loop->queueInLoop([conn = conn_, flow = flow_, message = std::move(message)]
+                          {
+                            if (conn->connected())
+                                conn->send(message);
+                            if (flow->queuedBytes.fetch_sub(message.size()) == message.size() &&
+                                conn->connected() &&
+                                conn->outputBuffer().readableBytes() < kHighWatermark)
+                                resumeUploads(*flow);
+                          });
+    }
+
+    // 在锁内读取计数, 和 resumeUploads() 取走 resumers 互斥, 不会错过唤醒
+    std::lock_guard<std::mutex> guard(flow_->mutex);
+    bool below = inLoop
+               ? flow_->writable && conn_->outputBuffer().readableBytes() < kHighWatermark
+               : flow_->writable && flow_->queuedBytes.load() < kHighWatermark;
+    if (below)
+        return true;
+    if (resume)
+        flow_->resumers.push_back(resume);
+    return false;
+}
+
+void UploadWriter::end()
+{
+    json::Value frame(json::TYPE_OBJECT);
+    frame.addMember("jsonrpc", "2.0");
+    frame.addMember("end", true);
+    frame.addMember("id", id_);
+    sendMessage(conn_, frame);
 }
 
 
@@ -69,20 +213,20 @@ void BaseClient::onMessage(const TcpConnectionPtr& conn, Buffer& buffer)
 {
     try 
     {
-        handleMessage(buffer);
+        handleMessage(conn, buffer);
     }
     catch (ResponseException& e) 
     {
         ERROR("response error: %s", e.what());
         if (e.hasId()) {
             // fixme: should we?
-            callbacks_.erase(e.Id());
+            finishCall(e.Id());
         }
     }
 }
 
 // 接受到服务器回应的结果
-void BaseClient::handleMessage(Buffer& buffer)
+void BaseClient::handleMessage(const TcpConnectionPtr& conn, Buffer& buffer)
 {
     while (true) 
     {
@@ -90,6 +234,13 @@ void BaseClient::handleMessage(Buffer& buffer)
         if (crlf == nullptr)
             break;
 
+        // 多路复用的数据帧
+        if (*buffer.peek() == '@') {
+            if (!handleFrame(conn, buffer, crlf))
+                break;
+            continue;
+        }
+
         size_t headerLen = crlf - buffer.peek() + 2;
 
         json::Document header;
@@ -105,9 +256,9 @@ void BaseClient::handleMessage(Buffer& buffer)
         if (bodyLen >= kMaxMessageLen)
             throw ResponseException("message is too long");
 
+        // 消息还没有收完整, 等下一次可读事件
         if (buffer.readableBytes() < headerLen + bodyLen) 
-            throw ResponseException("response body lack");
-        
+            break;
 
         buffer.retrieve(headerLen);
         auto json = buffer.retrieveAsString(bodyLen);
@@ -115,6 +266,49 @@ void BaseClient::handleMessage(Buffer& buffer)
     }
 }
 
+/// @brief: @[stream] [M|E|F] [len]\r\n[payload]\r\n
+///          拼接成完整的消息之后和普通消息一样处理
+/// @return: 帧还没有收完整返回 false
+bool BaseClient::handleFrame(const TcpConnectionPtr& conn, Buffer& buffer, const char* crlf)
+{
+    FrameHeader header;
+    if (!parseFrameHeader(buffer.peek(), crlf, header) || 
+        header.value < 2 ||
+        header.type == kFrameSettings ||
+        header.type == kFrameWindow)
+    {
+        buffer.retrieveUntil(crlf + 2);
+        throw ResponseException("invalid frame");
+    }
+
+    size_t headerLen = crlf - buffer.peek() + 2;
+    if (buffer.readableBytes() < headerLen + header.value)
+        return false;
+
+    buffer.retrieve(headerLen);
+    size_t len = header.value - 2;
+    auto& stream = streams_[header.stream];
+    stream.message.append(buffer.peek(), len);
+    buffer.retrieve(header.value);
+
+    // 归还窗口
+    stream.consumed += len;
+    if (header.type != kFrameFinal && stream.consumed >= kStreamWindow / 2) {
+        conn->send(frameHeader(header.stream, kFrameWindow, stream.consumed));
+        stream.consumed = 0;
+    }
+
+    if (header.type == kFrameMore)
+        return true;
+
+    std::string json;
+    json.swap(stream.message);
+    if (header.type == kFrameFinal)
+        streams_.erase(header.stream);
+    handleResponse(json);
+    return true;
+}
+
 void BaseClient::handleResponse(std::string& json)
 {
     json::Document response;
@@ -152,22 +346,64 @@ void BaseClient::handleSingleResponse(json::Value& response)
         return;
     }
 
+    // 流式回应的分块, 调用还没有结束
+    auto chunk = response.findMember("chunk");
+    if (chunk != response.memberEnd()) {
+        auto cit = chunkCallbacks_.find(id);
+        if (cit == chunkCallbacks_.end())
+            throw ResponseException("unexpected chunk for non-stream call", id);
+        cit->second(chunk->value);
+        return;
+    }
+    auto cb = std::move(it->second);
+    finishCall(id);
+
     auto result = response.findMember("result");
     if (result != response.memberEnd()) {
-        it->second(result->value, false, false);
+        cb(result->value, false, false);
     }
     else {
         auto error = response.findMember("error");
         assert(error != response.memberEnd());
-        it->second(error->value, true, false);
+        // 服务器在出队时发现请求已经过期
+        auto code = error->value.findMember("code");
+        bool expired = code != error->value.memberEnd() &&
+                       code->value.isInt32() &&
+                       code->value.getInt32() == RpcError(RPC_DEADLINE_EXCEEDED).asCode();
+        cb(error->value, true, expired);
+    }
+}
+
+void BaseClient::onTimeout(int64_t id)
+{
+    auto it = callbacks_.find(id);
+    assert(it != callbacks_.end());
+
+    auto cb = std::move(it->second);
+    timers_.erase(id); // 已经触发了, 不需要取消
+    finishCall(id);
+
+    json::Value null;
+    cb(null, true, true);
+}
+
+void BaseClient::finishCall(int64_t id)
+{
+    if (callbacks_.erase(id) > 0)
+        callMemory.sub(kCallBytes);
+    chunkCallbacks_.erase(id);
+
+    auto it = timers_.find(id);
+    if (it != timers_.end()) {
+        loop_->cancelTimer(it->second);
+        timers_.erase(it);
     }
-    callbacks_.erase(it);
 }
 
 void BaseClient::validateResponse(json::Value& response)
 {
     if (response.getSize() != 3) {
-        throw ResponseException("response should have exactly 3 field(jsonrpc, error/result, id)");
+        throw ResponseException("response should have exactly 3 field(jsonrpc, error/result/chunk, id)");
     }
 
     auto id = findValue(response, "id", json::TYPE_INT32).getInt32();
@@ -178,7 +414,8 @@ void BaseClient::validateResponse(json::Value& response)
         throw ResponseException("unknown json rpc version", id);
     }
 
-    if (response.findMember("result") != response.memberEnd())
+    if (response.findMember("result") != response.memberEnd() ||
+        response.findMember("chunk") != response.memberEnd())
         return;
 
     findValue(response, "error", json::TYPE_OBJECT, id);
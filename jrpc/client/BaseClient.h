@@ -1,6 +1,10 @@
 #pragma once 
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include <cppJson/Value.h>
 #include <jrpc/util.h>
@@ -9,45 +13,143 @@ namespace jrpc
 {
 
 using ResponseCallback = std::function<void(json::Value&, bool isError, bool isTimeout)>;
+using ChunkCallback    = std::function<void(json::Value& chunk)>; // 流式回应的分块
+
+/// @brief: 连接输出缓冲区的流量控制状态, IO 线程和上传数据的线程共享
+struct SendFlow: noncopyable
+{
+    std::mutex        mutex;
+    bool              writable = true; // 输出缓冲区是否低于高水位
+    std::vector<Task> resumers;        // 等待输出缓冲区写完的上传
+    // 其他线程交给 IO 线程, 还没有进入输出缓冲区的字节, 在入队之前增加;
+    // 高水位回调在这些发送之后才执行, 在那之前上传的线程只能靠它看到自己堆积的分块
+    std::atomic<size_t> queuedBytes{0};
+};
+
+using SendFlowPtr = std::shared_ptr<SendFlow>;
+
+/// @brief: 上传请求的写端, 分块发送 {"jsonrpc":"2.0","chunk":[chunk],"id":[id]},
+///         最后发送 {"jsonrpc":"2.0","end":true,"id":[id]}
+class UploadWriter: noncopyable
+{
+public:
+    UploadWriter(const TcpConnectionPtr& conn, int64_t id, const SendFlowPtr& flow)
+    : conn_(conn),
+      id_(id),
+      flow_(flow)
+    {}
+
+    /// @brief: 发送一个分块, 线程安全
+    /// @return: 返回 false 表示连接的输出缓冲区已经超过高水位, 应该停止写入,
+    ///          等输出缓冲区写完之后, @c resume 会在 IO 线程中被回调一次;
+    ///          连接已断开时也返回 false, 此时 @c resume 不会被回调
+    bool write(json::Value chunk, const Task& resume = nullptr);
+
+    /// @brief: 结束上传, 之后服务器才会回应
+    void end();
+
+private:
+    TcpConnectionPtr conn_;
+    int64_t          id_;
+    SendFlowPtr      flow_;
+};
+
+using UploadWriterPtr = std::shared_ptr<UploadWriter>;
 
 class BaseClient: noncopyable
 {
 public:
     BaseClient(EventLoop* loop, const InetAddress& serverAddress)
     : id_(0),
+      loop_(loop),
+      timeout_(0),
+      multiplexing_(false),
+      flow_(std::make_shared<SendFlow>()),
       client_(loop, serverAddress)
     {
         client_.setMessageCallback([this](const auto& connptr, auto& buffer)
                                     { 
                                         this->onMessage(connptr, buffer);
                                     });
+        setConnectionCallback(nullptr);
     }
 
+    ~BaseClient();
+
     void start() { client_.start(); }
 
+    /// @brief: 之后的每个调用都带上 "timeout" 字段, 服务器丢弃过期的请求;
+    ///         超时之后回调 ResponseCallback(null, true, true), 迟到的回应被忽略
+    ///         0 表示不超时
+    void setTimeout(net::Millisecond timeout) { timeout_ = timeout; }
+
+    /// @brief: 连接建立时发送 settings 帧 "@0 S [window]", 服务器把大的回应分帧交错发送, 默认关闭
+    ///         只有支持多路复用的服务器才能打开, 之前版本的服务器把帧当作错误的长度头并断开连接
+    ///         在 start() 之前设置
+    void setMultiplexing(bool on) { multiplexing_ = on; }
+
+    /// @brief: TCP_NODELAY, 默认打开, 在 start() 之前设置
+    void setTcpNoDelay(bool on) { client_.setTcpNoDelay(on); }
+
     void setConnectionCallback(const ConnectionCallback& cb)
     {
-        client_.setConnectionCallback(cb);
+        client_.setConnectionCallback([this, cb](const TcpConnectionPtr& conn)
+                                      {
+                                        this->onConnection(conn);
+                                        if (cb)
+                                            cb(conn);
+                                      });
     }
 
     void sendCall(const TcpConnectionPtr& conn, json::Value& call, const ResponseCallback& cb);
+    // 流式回应的调用, 分块到达时回调 onChunk, 最后回调 cb
+    void sendCall(const TcpConnectionPtr& conn, 
+                  json::Value& call, 
+                  const ResponseCallback& cb,
+                  const ChunkCallback& onChunk);
+
+    // 上传的调用, 先发送 call, 数据通过返回的 UploadWriter 分块发送
+    UploadWriterPtr sendUpload(const TcpConnectionPtr& conn,
+                               json::Value& call,
+                               const ResponseCallback& cb);
 
     void sendNotify(const TcpConnectionPtr& conn, json::Value& notify);
 
 private:
+    void onConnection(const TcpConnectionPtr& conn);
     void onMessage(const TcpConnectionPtr& conn, Buffer& buffer);
-    void handleMessage(Buffer& buffer);
+    void handleMessage(const TcpConnectionPtr& conn, Buffer& buffer);
+    bool handleFrame(const TcpConnectionPtr& conn, Buffer& buffer, const char* crlf);
     void handleResponse(std::string& json);
     void handleSingleResponse(json::Value& response);
     void validateResponse(json::Value& response);
     void sendRequest(const TcpConnectionPtr& conn, json::Value& request);
+    void onTimeout(int64_t id);
+    void finishCall(int64_t id);
 
 private:
-    using Callback = std::unordered_map<int64_t, ResponseCallback>;
+    using Callback      = std::unordered_map<int64_t, ResponseCallback>;
+    using ChunkCallbacks = std::unordered_map<int64_t, ChunkCallback>;
+    using Timers         = std::unordered_map<int64_t, net::Timer*>;
+
+    // 多路复用的流: 正在拼接的消息, 以及还没有归还给服务器的窗口
+    struct InboundStream
+    {
+        std::string message;
+        size_t      consumed = 0;
+    };
+    using InboundStreams = std::unordered_map<uint32_t, InboundStream>;
 
-    int64_t   id_;
-    Callback  callbacks_;
-    TcpClient client_;
+    int64_t          id_;
+    EventLoop*       loop_;
+    net::Millisecond timeout_;
+    bool             multiplexing_;
+    Callback         callbacks_;
+    ChunkCallbacks   chunkCallbacks_;
+    Timers           timers_;
+    InboundStreams   streams_;
+    SendFlowPtr      flow_;
+    TcpClient        client_;
 };
 
 
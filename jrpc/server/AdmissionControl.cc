@@ -0,0 +1,161 @@
+#include <jrpc/server/AdmissionControl.h>
+
+using namespace jrpc;
+
+void AdmissionTicket::release()
+{
+    if (released_.exchange(true))
+        return;
+    control_.release(conn_.lock(), admission_, bytes_);
+}
+
+AdmissionTicketPtr AdmissionControl::admit(const TcpConnectionPtr& conn,
+                                           const ConnectionAdmissionPtr& admission,
+                                           size_t bytes,
+                                           size_t exempt)
+{
+    {
+        std::lock_guard<std::mutex> guard(admission->mutex);
+        if (admission->inflight >= maxInflight_ + exempt) {
+            admission->inflightPaused = true;
+            conn->stopRead();
+            return nullptr;
+        }
+    }
+
+    if (!tryAcquire(bytes)) {
+        waitMemory(conn, admission);
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(admission->mutex);
+        admission->inflight++;
+    }
+    return std::make_shared<AdmissionTicket>(*this, conn, admission, bytes);
+}
+
+bool AdmissionControl::paused(const ConnectionAdmissionPtr& admission) const
+{
+    std::lock_guard<std::mutex> guard(admission->mutex);
+    return admission->inflightPaused || admission->memoryPaused;
+}
+
+void AdmissionControl::chargeOutput(size_t bytes)
+{
+    used_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void AdmissionControl::bufferOutput(const ConnectionAdmissionPtr& admission, size_t bytes)
+{
+    admission->bufferedOutput += bytes;
+}
+
+void AdmissionControl::dropOutput(size_t bytes)
+{
+    releaseMemory(bytes);
+}
+
+/// @brief: StreamMux 去掉了消息的长度头, 又加上了帧头, 所以 @c unwritten 不一定小于 bufferedOutput;
+///         这时先不释放, 全部写完时 unwritten 为 0, 剩下的一次释放
+void AdmissionControl::releaseOutput(const ConnectionAdmissionPtr& admission, size_t unwritten)
+{
+    if (admission->bufferedOutput <= unwritten)
+        return;
+    size_t bytes = admission->bufferedOutput - unwritten;
+    admission->bufferedOutput = unwritten;
+    releaseMemory(bytes);
+}
+
+void AdmissionControl::chargeUpload(size_t bytes)
+{
+    used_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void AdmissionControl::releaseUpload(size_t bytes)
+{
+    releaseMemory(bytes);
+}
+
+void AdmissionControl::release(const TcpConnectionPtr& conn,
+                               const ConnectionAdmissionPtr& admission,
+                               size_t bytes)
+{
+    releaseMemory(bytes);
+
+    bool resume = false;
+    {
+        std::lock_guard<std::mutex> guard(admission->mutex);
+        assert(admission->inflight > 0);
+        admission->inflight--;
+        if (admission->inflightPaused && admission->inflight < maxInflight_) {
+            admission->inflightPaused = false;
+            resume = true;
+        }
+    }
+    if (resume && conn != nullptr && resumeCallback_)
+        resumeCallback_(conn);
+}
+
+/// @brief: 没有在途的请求时总是放行, 否则一个超过预算的请求永远不会被处理
+bool AdmissionControl::tryAcquire(size_t bytes)
+{
+    size_t used = used_.load(std::memory_order_relaxed);
+    do {
+        if (used != 0 && used + bytes > budget_)
+            return false;
+    } while (!used_.compare_exchange_weak(used, used + bytes));
+    return true;
+}
+
+void AdmissionControl::releaseMemory(size_t bytes)
+{
+    assert(used_ >= bytes);
+    used_.fetch_sub(bytes, std::memory_order_relaxed);
+    if (waiting_.load(std::memory_order_relaxed) > 0 && canResume())
+        resumeWaiting();
+}
+
+void AdmissionControl::waitMemory(const TcpConnectionPtr& conn, const ConnectionAdmissionPtr& admission)
+{
+    conn->stopRead();
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        {
+            std::lock_guard<std::mutex> guard2(admission->mutex);
+            admission->memoryPaused = true;
+        }
+        waiters_.emplace_back(conn, admission);
+        waiting_ = waiters_.size();
+    }
+    // 加入等待队列之前内存可能已经全部释放了, 之后不会再有 release 唤醒我们
+    if (used_.load(std::memory_order_relaxed) == 0)
+        resumeWaiting();
+}
+
+// 降到预算的 3/4 以下再恢复, 避免在边界上反复暂停和恢复
+bool AdmissionControl::canResume() const
+{
+    size_t used = used_.load(std::memory_order_relaxed);
+    return used == 0 || used <= budget_ / 4 * 3;
+}
+
+void AdmissionControl::resumeWaiting()
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        waiters.swap(waiters_);
+        waiting_ = 0;
+    }
+
+    for (auto& waiter: waiters) {
+        {
+            std::lock_guard<std::mutex> guard(waiter.second->mutex);
+            waiter.second->memoryPaused = false;
+        }
+        auto conn = waiter.first.lock();
+        if (conn != nullptr && resumeCallback_)
+            resumeCallback_(conn);
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <jrpc/util.h>
+
+namespace jrpc
+{
+
+/// @brief: 一个连接的准入状态, IO 线程和回应的线程共享
+struct ConnectionAdmission: noncopyable
+{
+    std::mutex          mutex;
+    size_t              inflight = 0;           // 正在处理的请求数
+    bool                inflightPaused = false; // 因为在途请求数暂停读
+    bool                memoryPaused = false;   // 因为全局内存预算暂停读
+    size_t              bufferedOutput = 0;     // 计入预算, 已经进入输出缓冲区或者 StreamMux 的回应字节数, 只在 IO 线程访问
+};
+
+using ConnectionAdmissionPtr = std::shared_ptr<ConnectionAdmission>;
+
+class AdmissionControl;
+
+/// @brief: 一个请求占用的资源, 回应发出时释放;
+///         回调被丢弃 (notify, 上传的分块, 处理函数没有回应) 时由析构函数释放
+class AdmissionTicket: noncopyable
+{
+public:
+    AdmissionTicket(AdmissionControl& control,
+                    const TcpConnectionPtr& conn,
+                    const ConnectionAdmissionPtr& admission,
+                    size_t bytes)
+    : control_(control),
+      conn_(conn),
+      admission_(admission),
+      bytes_(bytes),
+      released_(false)
+    {}
+
+    ~AdmissionTicket()
+    { release(); }
+
+    // thread safe, 只有第一次调用有效
+    void release();
+
+private:
+    AdmissionControl&            control_;
+    std::weak_ptr<TcpConnection> conn_;
+    ConnectionAdmissionPtr       admission_;
+    size_t                       bytes_;
+    std::atomic_bool             released_;
+};
+
+using AdmissionTicketPtr = std::shared_ptr<AdmissionTicket>;
+
+/// @brief: 准入控制
+///         1. 每个连接正在处理的请求数有上限
+///         2. 全局的内存预算, 包括正在处理的请求体和还没有写完的回应
+///         超过任意一个限制就暂停读这个连接, 资源释放之后由 ResumeCallback 恢复,
+///         过载时请求在内核的接收缓冲区和 TCP 窗口中排队, 而不是耗尽服务器的内存
+class AdmissionControl: noncopyable
+{
+public:
+    using ResumeCallback = std::function<void(const TcpConnectionPtr&)>;
+
+    static const size_t kDefaultMaxInflight  = 256;
+    static const size_t kDefaultMemoryBudget = 512 * 1024 * 1024; // 512M
+
+    AdmissionControl()
+    : maxInflight_(kDefaultMaxInflight),
+      budget_(kDefaultMemoryBudget),
+      used_(0),
+      waiting_(0)
+    {}
+
+    void setMaxInflightPerConnection(size_t n)
+    { assert(n > 0); maxInflight_ = n; }
+
+    void setMemoryBudget(size_t bytes)
+    { assert(bytes > 0); budget_ = bytes; }
+
+    // 在任意线程回调
+    void setResumeCallback(const ResumeCallback& cb)
+    { resumeCallback_ = cb; }
+
+    size_t usedBytes() const
+    { return used_.load(std::memory_order_relaxed); }
+
+    /// @brief: IO 线程中, 开始读一个请求之前调用
+    ///         @c exempt 是不计入在途请求数的请求 (正在上传的请求)
+    /// @return: 超过限制时返回 nullptr, 并且暂停读这个连接
+    AdmissionTicketPtr admit(const TcpConnectionPtr& conn,
+                             const ConnectionAdmissionPtr& admission,
+                             size_t bytes,
+                             size_t exempt);
+
+    bool paused(const ConnectionAdmissionPtr& admission) const;
+
+    /// @brief: 回应的生命期: 交给 IO 线程之前计入预算 (任意线程), 在 IO 线程中进入输出缓冲区,
+    ///         写出之后释放; 连接已经断开时在 IO 线程中直接丢弃
+    void chargeOutput(size_t bytes);
+    void bufferOutput(const ConnectionAdmissionPtr& admission, size_t bytes);
+    void dropOutput(size_t bytes);
+    /// @brief: IO 线程中, 写完回调或者连接断开时调用, @c unwritten 是输出缓冲区和 StreamMux 中还没有写出的字节,
+    ///         只释放已经写出的部分
+    void releaseOutput(const ConnectionAdmissionPtr& admission, size_t unwritten);
+
+    /// @brief: 上传的分块在处理函数认领之前缓存在服务器中, 同样计入预算 (IO 线程);
+    ///         交付给处理函数或者连接断开时释放 (任意线程)
+    void chargeUpload(size_t bytes);
+    void releaseUpload(size_t bytes);
+
+private:
+    friend class AdmissionTicket;
+
+    void release(const TcpConnectionPtr& conn,
+                 const ConnectionAdmissionPtr& admission,
+                 size_t bytes);
+    bool tryAcquire(size_t bytes);
+    void releaseMemory(size_t bytes);
+    void waitMemory(const TcpConnectionPtr& conn, const ConnectionAdmissionPtr& admission);
+    bool canResume() const;
+    void resumeWaiting();
+
+    using Waiter = std::pair<std::weak_ptr<TcpConnection>, ConnectionAdmissionPtr>;
+
+    std::atomic<size_t> maxInflight_;
+    std::atomic<size_t> budget_;
+    std::atomic<size_t> used_;
+    std::atomic<size_t> waiting_; // waiters_.size(), 释放内存时不用加锁检查
+    ResumeCallback      resumeCallback_;
+    std::mutex          mutex_;
+    std::vector<Waiter> waiters_;
+};
+
+}
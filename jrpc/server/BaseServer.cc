@@ -1,10 +1,16 @@
 #include <cppJson/Document.h>
 #include <cppJson/Writer.h>
-#include <cppJson/StringWriteStream.h>
 
 #include <jrpc/Exception.h>
 #include <jrpc/server/BaseServer.h>
 #include <jrpc/server/RpcServer.h>
+#include <jrpc/server/StreamMux.h>
+#include <jrpc/server/AdmissionControl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
 
 using namespace jrpc;
 
@@ -14,11 +20,173 @@ namespace
 const size_t kHighWatermark = 65536;
 const size_t kMaxMessageLen = 100 * 1024 * 1024; // 100M
 
+// 长度头 "xxx\r\n" 预留的空间, 10 位十进制加上 crlf
+// 消息体写完之后右对齐填入, 没有用到的位置跳过或者填空格, 长度头是一个 JSON 数字, 前面的空白会被忽略
+const size_t kHeaderWidth = 12;
+
+// 成功回应的固定前缀, 之后紧跟 result 和 id
+const std::string_view kResultPrefix = R"({"jsonrpc":"2.0","result":)";
+const std::string_view kChunkPrefix  = R"({"jsonrpc":"2.0","chunk":)";
+const std::string_view kIdPrefix     = R"(,"id":)";
+
+/// @brief: 让 json::Writer 直接写入连接的输出缓冲区, 省去中间的缓冲区
+///         直接写最后一个 slab 的剩余空间, 写满了再向缓冲区要下一块; 写完之前要调用 flush()
+class ChainWriteStream: noncopyable
+{
+public:
+    explicit ChainWriteStream(net::ChainBuffer& buffer)
+    : buffer_(buffer),
+      begin_(nullptr),
+      cur_(nullptr),
+      end_(nullptr)
+    { }
+
+    ~ChainWriteStream()
+    { flush(); }
+
+    void put(char c)
+    {
+        if (cur_ == end_)
+            next();
+        *cur_++ = c;
+    }
+
+    void put(std::string_view str)
+    {
+        while (!str.empty()) {
+            if (cur_ == end_)
+                next();
+            size_t n = std::min(str.size(), static_cast<size_t>(end_ - cur_));
+            ::memcpy(cur_, str.data(), n);
+            cur_ += n;
+            str.remove_prefix(n);
+        }
+    }
+
+    /// @brief: 把写入的字节计入缓冲区
+    void flush()
+    {
+        if (cur_ != begin_)
+            buffer_.hasWritten(static_cast<size_t>(cur_ - begin_));
+        begin_ = cur_;
+    }
+
+private:
+    void next()
+    {
+        flush();
+        size_t room;
+        begin_ = cur_ = buffer_.beginWrite(&room);
+        end_ = begin_ + room;
+    }
+
+    net::ChainBuffer& buffer_;
+    char*             begin_;
+    char*             cur_;
+    char*             end_;
+};
+
+/// @brief: 在 IO 线程之外构造消息, 整个消息只构造一次, 之后移动给 IO 线程
+class StringWriteStream: noncopyable
+{
+public:
+    explicit StringWriteStream(std::string& str)
+    : str_(str)
+    { }
+
+    void put(char c)
+    { str_.push_back(c); }
+
+    void put(std::string_view str)
+    { str_.append(str.data(), str.length()); }
+
+private:
+    std::string& str_;
+};
+
+std::string lengthHeader(size_t len)
+{
+    return std::to_string(len).append("\r\n");
+}
+
+/// @brief: 格式: 内容长度 + crlf + 内容 + crlf, 长度包括末尾的 crlf
+/// @return: 追加的字节数
+template <typename Body>
+size_t appendMessage(net::ChainBuffer& output, const Body& body)
+{
+    size_t before = output.readableBytes();
+    size_t header = output.reserve(kHeaderWidth);
+    ChainWriteStream os(output);
+    body(os);
+    os.put("\r\n");
+    os.flush();
+    output.fillReserved(header, kHeaderWidth,
+                        lengthHeader(output.readableBytes() - header - kHeaderWidth), ' ');
+    return output.readableBytes() - before;
+}
+
+/// @brief: 同 appendMessage(), 消息从 *begin 开始, 之前是长度头没有用到的空格
+template <typename Body>
+std::string makeMessage(const Body& body, size_t* begin)
+{
+    std::string message(kHeaderWidth, ' ');
+    StringWriteStream os(message);
+    body(os);
+    os.put("\r\n");
+    auto header = lengthHeader(message.size() - kHeaderWidth);
+    *begin = kHeaderWidth - header.size();
+    message.replace(*begin, header.size(), header);
+    return message;
+}
+
+/// @brief: 写入一个完整的消息体 [prefix][value],"id":[id]}
+///         信封是固定的字节, 只有 value 和 id 需要序列化
+template <typename Stream>
+void writeEnvelope(Stream& os,
+                   std::string_view prefix,
+                   const json::Value& value,
+                   const json::Value& id)
+{
+    os.put(prefix);
+    {
+        json::Writer writer(os);
+        value.writeTo(writer);
+    }
+    os.put(kIdPrefix);
+    {
+        json::Writer writer(os);
+        id.writeTo(writer);
+    }
+    os.put('}');
+}
+
+const ConnectionStatePtr& getState(const TcpConnectionPtr& connptr)
+{
+    return std::any_cast<const ConnectionStatePtr&>(connptr->getContext());
+}
+
 }
 
 namespace jrpc
 {
 
+/// @brief: 每个连接的状态, 保存在 TcpConnection 的 context 中
+///         IO 线程和 worker 线程 (流式回应) 共享, 所以需要加锁
+struct ConnectionState: noncopyable
+{
+    std::mutex        mutex;
+    bool              writable = true; // 输出缓冲区是否低于高水位
+    // 其他线程交给 IO 线程, 还没有进入输出缓冲区或者 StreamMux 的字节, 在入队之前增加
+    // writable 由 IO 线程的高水位回调设置, 在那之前其他线程只能靠它看到自己堆积的消息
+    std::atomic<size_t> queuedBytes{0};
+    std::vector<Task> resumers;        // 等待输出缓冲区写完的流式回应
+    UploadTablePtr    uploads;         // 正在进行的上传, 缓存的分块计入准入控制
+    StreamMux         mux;                                       // 多路复用的流, 只在 IO 线程访问
+
+    ConnectionAdmissionPtr admission = std::make_shared<ConnectionAdmission>();
+    AdmissionTicketPtr     ticket; // 已经准入, 但是消息体还没有收完整的请求, 只在 IO 线程访问
+};
+
 // 目前只能传入 RpcServer 
 template class BaseServer<RpcServer>; 
 
@@ -30,6 +198,11 @@ BaseServer<ProtocolServer>::BaseServer(EventLoop *loop, const InetAddress& liste
 {
     server_.setConnectionCallback([this](const auto& connptr){ this->onConnection(connptr); });
     server_.setMessageCallback([this](const auto& connptr, auto& buffer){ this->onMessage(connptr, buffer);});
+    admission_.setResumeCallback([this](const TcpConnectionPtr& connptr)
+                                 {
+                                    // 总是排队, 避免在 handleMessage 中重入
+                                    connptr->getLoop()->queueInLoop([this, connptr]{ this->onResume(connptr); });
+                                 });
 }
 
 template <typename ProtocolServer>
@@ -38,6 +211,11 @@ void BaseServer<ProtocolServer>::onConnection(const TcpConnectionPtr& connptr)
     if (connptr->connected()) 
     {
         DEBUG("connection %s is [up]", connptr->peer().toIpPort().c_str());
+        auto state = std::make_shared<ConnectionState>();
+        state->uploads = std::make_shared<UploadTable>([this](size_t bytes){ admission_.chargeUpload(bytes); },
+                                                       [this](size_t bytes){ admission_.releaseUpload(bytes); });
+        connptr->setContext(state);
+        connptr->setWriteCompleteCallback([this](const auto& connp){ this->onWriteComplete(connp); });
         connptr->setHighWaterMarkCallback([this](const auto& connp, size_t mark)
                                           { 
                                             this->onHighWatermark(connp, mark); 
@@ -47,6 +225,11 @@ void BaseServer<ProtocolServer>::onConnection(const TcpConnectionPtr& connptr)
     else 
     {
         DEBUG("connection %s is [down]", connptr->peer().toIpPort().c_str());
+        auto& state = getState(connptr);
+        state->uploads->clear();
+        state->ticket.reset();
+        // 还在 IO 线程队列中的回应发现连接断开, 各自释放
+        admission_.releaseOutput(state->admission, 0);
     }
 }
 
@@ -82,16 +265,69 @@ void BaseServer<ProtocolServer>::onHighWatermark(const TcpConnectionPtr& connptr
           connptr->peer().toIpPort().c_str(), 
           mark);
 
-    connptr->setWriteCompleteCallback([this](const auto& connp){ this->onWriteComplete(connp); });
+    {
+        auto& state = getState(connptr);
+        std::lock_guard<std::mutex> guard(state->mutex);
+        state->writable = false;
+    }
     connptr->stopRead();
 }
 
 template <typename ProtocolServer>
 void BaseServer<ProtocolServer>::onWriteComplete(const TcpConnectionPtr& connptr)
 {
-    DEBUG("connection %s write complete",
-         connptr->peer().toIpPort().c_str());
-    connptr->startRead();
+    TRACE("connection %s write complete",
+          connptr->peer().toIpPort().c_str());
+
+    auto& state = getState(connptr);
+    // 写完回调是排队执行的, 之后的发送可能已经进入了输出缓冲区
+    admission_.releaseOutput(state->admission,
+                             state->mux.queuedBytes() + connptr->outputBuffer().readableBytes());
+    // 多路复用的流发送下一轮
+    state->mux.onWriteComplete(connptr);
+
+    // 唤醒因为高水位而暂停的流式回应
+    std::vector<Task> resumers;
+    bool paused;
+    {
+        std::lock_guard<std::mutex> guard(state->mutex);
+        paused = !state->writable;
+        state->writable = true;
+        resumers.swap(state->resumers);
+    }
+    if (paused)
+        updateReading(connptr);
+    for (auto& resume: resumers)
+        resume();
+}
+
+/// @brief: 准入控制释放了资源, 在 IO 线程中恢复读, 并处理暂停之前已经读进来的数据
+template <typename ProtocolServer>
+void BaseServer<ProtocolServer>::onResume(const TcpConnectionPtr& connptr)
+{
+    if (!connptr->connected())
+        return;
+
+    DEBUG("connection %s resume",
+          connptr->peer().toIpPort().c_str());
+    updateReading(connptr);
+    onMessage(connptr, *connptr->getMutableInputBuffer());
+}
+
+/// @brief: 只有输出缓冲区低于高水位, 并且准入控制没有暂停时才读
+template <typename ProtocolServer>
+void BaseServer<ProtocolServer>::updateReading(const TcpConnectionPtr& connptr)
+{
+    auto& state = getState(connptr);
+    bool writable;
+    {
+        std::lock_guard<std::mutex> guard(state->mutex);
+        writable = state->writable;
+    }
+    if (writable && !admission_.paused(state->admission))
+        connptr->startRead();
+    else
+        connptr->stopRead();
 }
 
 /** @brief: 这是一个Rpc服务，因此在处理可读事件需要处理的是和rpc有关的任务
@@ -115,6 +351,13 @@ void BaseServer<ProtocolServer>::handleMessage(const TcpConnectionPtr& connptr,
             break;
         }
 
+        // 多路复用的控制帧
+        if (*buffer.peek() == '@') {
+            handleFrame(connptr, buffer.peek(), crlf);
+            buffer.retrieveUntil(crlf + 2);
+            continue;
+        }
+
         // 报头长度
         size_t headerLen = crlf - buffer.peek() + 2;
 
@@ -131,61 +374,227 @@ void BaseServer<ProtocolServer>::handleMessage(const TcpConnectionPtr& connptr,
         if (jsonLen >= kMaxMessageLen)
             throw RequestException(RPC_INVALID_REQUEST, "message is too long");
 
+        // 准入控制在等待消息体之前, 超过限制就暂停读, 不让消息体堆积在输入缓冲区中
+        auto& state = getState(connptr);
+        if (state->ticket == nullptr) {
+            state->ticket = admission_.admit(connptr, 
+                                             state->admission, 
+                                             jsonLen, 
+                                             state->uploads->active());
+            if (state->ticket == nullptr) {
+                DEBUG("connection %s pause, %lu bytes in use",
+                      connptr->peer().toIpPort().c_str(),
+                      admission_.usedBytes());
+                break;
+            }
+        }
+
         if (buffer.readableBytes() < headerLen + jsonLen)
             break;
 
         buffer.retrieve(headerLen);
         // 消息体
         auto json = buffer.retrieveAsString(jsonLen);
-        /// @brief: RpcServer::handleRequest(const std::string& json, const RpcDoneCallback& done)
+        auto ticket = std::move(state->ticket);
+        /// @brief: RpcServer::handleRequest(const std::string& json, RpcDoneCallback& done)
         /// @param: 第二个参数 lambda 表达式类型是 @c RpcDoneCallback，等处理完此次客户端的请求，再调用的
         ///          将此次结果，返回给客户端。
         //           格式： 此次数据包的总长度 + clrf + 内容 + clrf
-        convert().handleRequest(json, 
-                                [connptr, this](json::Value response) 
+        //           回应发出之后释放准入的资源
+        RpcDoneCallback done([connptr, ticket, this](json::Value response) 
+                             {
+                                if (!response.isNull()) 
                                 {
-                                    if (!response.isNull()) 
-                                    {
-                                        // 等处理完毕，再发送回应客户端的函数
-                                        sendResponse(connptr, response);
-                                        TRACE("BaseServer::handleMessage() %s request success",
-                                              connptr->peer().toIpPort().c_str());
-                                    }
-                                    else {
-                                        TRACE("BaseServer::handleMessage() %s notify success",
-                                              connptr->peer().toIpPort().c_str());
-                                    }
-                                });
+                                    // 等处理完毕，再发送回应客户端的函数
+                                    sendResponse(connptr, response);
+                                    TRACE("BaseServer::handleMessage() %s request success",
+                                          connptr->peer().toIpPort().c_str());
+                                }
+                                else {
+                                    TRACE("BaseServer::handleMessage() %s notify success",
+                                          connptr->peer().toIpPort().c_str());
+                                }
+                                ticket->release();
+                             },
+                             [connptr, ticket, this](const json::Value& id, const json::Value& result)
+                             {
+                                sendResult(connptr, id, result);
+                                TRACE("BaseServer::handleMessage() %s request success",
+                                      connptr->peer().toIpPort().c_str());
+                                ticket->release();
+                             },
+                             [connptr, state, this](const json::Value& id, 
+                                                    const json::Value& chunk,
+                                                    const Task& resume)
+                             {
+                                return sendChunk(connptr, state, id, chunk, resume);
+                             },
+                             state->uploads);
+        ticket.reset(); // 现在只有 done 持有
+        convert().handleRequest(json, done);
+    }
+}
+
+/// @brief: @0 S [window] 开启多路复用, @[stream] W [n] 窗口更新
+template <typename ProtocolServer>
+void BaseServer<ProtocolServer>::handleFrame(const TcpConnectionPtr& connptr,
+                                             const char* begin,
+                                             const char* crlf)
+{
+    FrameHeader header;
+    if (!parseFrameHeader(begin, crlf, header))
+        throw RequestException(RPC_INVALID_REQUEST, "invalid frame");
+
+    auto& mux = getState(connptr)->mux;
+    switch (header.type) {
+        case kFrameSettings:
+            if (header.stream != 0 || header.value == 0)
+                throw RequestException(RPC_INVALID_REQUEST, "invalid settings frame");
+            mux.enable(header.value);
+            break;
+        case kFrameWindow:
+            mux.windowUpdate(connptr, header.stream, header.value);
+            break;
+        default:
+            throw RequestException(RPC_INVALID_REQUEST, "unexpected frame from client");
     }
 }
 
 template <typename ProtocolServer>
 json::Value BaseServer<ProtocolServer>::wrapException(RequestException& e)
 {
-    json::Value response(json::TYPE_OBJECT);
-    response.addMember("jsonrpc", "2.0");
-    auto& value = response.addMember("error", json::TYPE_OBJECT);
-    value.addMember("code", e.err().asCode());
-    value.addMember("message", e.err().asString());
-    value.addMember("data", e.detail());
-    response.addMember("id", e.id());
-    return response;
+    return errorResponse(e.err(), e.id(), e.detail());
 }
 
 template <typename ProtocolServer>
 void BaseServer<ProtocolServer>::sendResponse(const TcpConnectionPtr& connptr, const json::Value& response)
 {
-    json::StringWriteStream os;
-    json::Writer writer(os);
-    response.writeTo(writer);
-
-    // 长度:内容长度 + clrf 两个字节长度
-    // 内容
-    auto message = std::to_string(os.get().length() + 2)
-                                 .append("\r\n")
-                                 .append(os.get())
-                                 .append("\r\n");
-    connptr->send(message);
+    // 批量请求的回应没有 id, 也不需要和别的消息保持顺序
+    const json::Value* id = nullptr;
+    if (response.isObject()) {
+        auto it = response.findMember("id");
+        if (it != response.memberEnd())
+            id = &it->value;
+    }
+    sendMessage(connptr, getState(connptr), id, [&](auto& os)
+                {
+                    json::Writer writer(os);
+                    response.writeTo(writer);
+                });
+}
+
+/// @brief: IO 线程中并且没有开启多路复用时, 消息直接序列化进连接的输出缓冲区;
+///         否则构造一次消息, 交给 deliver()
+template <typename ProtocolServer>
+template <typename Body>
+void BaseServer<ProtocolServer>::sendMessage(const TcpConnectionPtr& connptr,
+                                             const ConnectionStatePtr& state,
+                                             const json::Value* id,
+                                             const Body& body)
+{
+    if (connptr->getLoop()->isInLoopThread() && !state->mux.enabled()) {
+        // 连接已经断开, 丢弃回应
+        if (!connptr->connected())
+            return;
+        size_t bytes = appendMessage(*connptr->getMutableOutputBuffer(), body);
+        admission_.chargeOutput(bytes);
+        admission_.bufferOutput(state->admission, bytes);
+        connptr->sendAppended(bytes);
+        return;
+    }
+
+    size_t begin;
+    auto message = makeMessage(body, &begin);
+    deliver(connptr, state, id, std::move(message), begin);
+}
+
+/// @brief: 没有开启多路复用时直接发送;
+///         开启之后, 消息交给 IO 线程中的 StreamMux, 大的消息分帧发送
+///         StreamMux 自己找长度头的结尾, 所以交给它的是包括空格在内的整个 @c message
+template <typename ProtocolServer>
+void BaseServer<ProtocolServer>::deliver(const TcpConnectionPtr& connptr,
+                                         const ConnectionStatePtr& state,
+                                         const json::Value* id,
+                                         std::string message,
+                                         size_t begin)
+{
+    size_t bytes = message.size() - begin;
+    auto key = id != nullptr ? idKey(*id) : std::string();
+    auto loop = connptr->getLoop();
+    if (loop->isInLoopThread()) {
+        // 连接已经断开, 丢弃回应
+        if (!connptr->connected())
+            return;
+        admission_.chargeOutput(bytes);
+        admission_.bufferOutput(state->admission, bytes);
+        if (!state->mux.enabled() || !state->mux.send(connptr, key, message))
+            connptr->send(std::string_view(message).substr(begin));
+        return;
+    }
+
+    // 先计数再入队, 之后 IO 线程把消息放进输出缓冲区 (可能触发高水位回调) 再减去
+    // 排队中的消息也占用内存, 同样计入准入控制的预算
+    admission_.chargeOutput(bytes);
+    state->queuedBytes.fetch_add(bytes);
+    loop->queueInLoop([this, connptr, state, key = std::move(key), bytes, begin,
+                       message = std::move(message)]() mutable
+                      {
+                        if (connptr->connected()) {
+                            admission_.bufferOutput(state->admission, bytes);
+                            if (!state->mux.enabled() || !state->mux.send(connptr, key, message))
+                                connptr->send(std::string_view(message).substr(begin));
+                        }
+                        else {
+                            admission_.dropOutput(bytes);
+                        }
+                        state->queuedBytes.fetch_sub(bytes);
+                      });
+}
+
+/// @brief: 成功回应的快速路径 {"jsonrpc":"2.0","result":[result],"id":[id]}
+template <typename ProtocolServer>
+void BaseServer<ProtocolServer>::sendResult(const TcpConnectionPtr& connptr,
+                                            const json::Value& id,
+                                            const json::Value& result)
+{
+    sendMessage(connptr, getState(connptr), &id, [&](auto& os)
+                {
+                    writeEnvelope(os, kResultPrefix, result, id);
+                });
+}
+
+/// @brief: 流式回应的一个分块 {"jsonrpc":"2.0","chunk":[chunk],"id":[id]}
+///         流量控制和连接的高水位绑定: 还没有写到 socket 的字节超过高水位之后返回 false,
+///         等输出缓冲区写完 (onWriteComplete) 再回调 resume
+///         还没有写出的字节包括: 其他线程排队中的消息, StreamMux 中的帧, 输出缓冲区;
+///         输出缓冲区只能在 IO 线程中读取, 其他线程看高水位回调设置的 writable
+template <typename ProtocolServer>
+bool BaseServer<ProtocolServer>::sendChunk(const TcpConnectionPtr& connptr,
+                                           const ConnectionStatePtr& state,
+                                           const json::Value& id,
+                                           const json::Value& chunk,
+                                           const Task& resume)
+{
+    if (!connptr->connected())
+        return false;
+
+    sendMessage(connptr, state, &id, [&](auto& os)
+                {
+                    writeEnvelope(os, kChunkPrefix, chunk, id);
+                });
+
+    // 多路复用时大的分块排在 StreamMux 中, 不会进入输出缓冲区, 也要算进高水位
+    // 在锁内读取计数: onWriteComplete 在同一把锁内取走 resumers, 排队的消息写完之后一定还有一次
+    std::lock_guard<std::mutex> guard(state->mutex);
+    size_t pending = state->queuedBytes.load() + state->mux.queuedBytes();
+    bool below = connptr->getLoop()->isInLoopThread()
+               ? pending + connptr->outputBuffer().readableBytes() < kHighWatermark
+               : state->writable && pending < kHighWatermark;
+    if (below)
+        return true;
+    if (resume)
+        state->resumers.push_back(resume);
+    return false;
 }
 
 template <typename ProtocolServer>
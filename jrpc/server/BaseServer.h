@@ -4,12 +4,16 @@
 
 #include <jrpc/RpcError.h>
 #include <jrpc/util.h>
+#include <jrpc/server/AdmissionControl.h>
 
 namespace jrpc
 {
 
 class RequestException;
 
+struct ConnectionState;
+using ConnectionStatePtr = std::shared_ptr<ConnectionState>;
+
 /**
  * 让子类作基类的模板参数，即CRTP技术
  * 
@@ -20,9 +24,25 @@ class BaseServer: noncopyable
 {
 public:
     void setNumThread(size_t n) { server_.setNumThread(n); }
+    void setCpuAffinity(const std::vector<int>& cpus) { server_.setCpuAffinity(cpus); }
+    void setLoadBalance(net::LoadBalance lb)          { server_.setLoadBalance(lb); }
+    void setIncomingCpu(bool on)                      { server_.setIncomingCpu(on); }
+    void setEdgeTriggered(bool on)                    { server_.setEdgeTriggered(on); }
+    void setTcpNoDelay(bool on)                       { server_.setTcpNoDelay(on); }
+    void setBusyPoll(net::Microsecond budget)         { server_.setBusyPoll(budget); }
+    void setInstrumented(bool on)                     { server_.setInstrumented(on); }
+    void setStallThreshold(net::Microsecond threshold) { server_.setStallThreshold(threshold); }
+    std::vector<net::LoopLoad> loopLoads()            { return server_.loopLoads(); }
+    std::vector<net::LoopLatency> loopLatencies()     { return server_.loopLatencies(); }
 
     void start() { server_.start(); }
 
+    // 准入控制, 在 start() 之前设置
+    void setMaxInflightPerConnection(size_t n) { admission_.setMaxInflightPerConnection(n); }
+    void setMemoryBudget(size_t bytes)         { admission_.setMemoryBudget(bytes); }
+    // 已经接受但是还没有回应的请求占用的字节数
+    size_t admittedBytes() const               { return admission_.usedBytes(); }
+
 protected:
     BaseServer(EventLoop* loop, const InetAddress& listen);
     ~BaseServer() = default;
@@ -33,10 +53,31 @@ private:
     void onMessage(const TcpConnectionPtr& conn, Buffer& buffer);
     void onHighWatermark(const TcpConnectionPtr& conn, size_t mark);
     void onWriteComplete(const TcpConnectionPtr& conn);
+    void onResume(const TcpConnectionPtr& conn);
+    void updateReading(const TcpConnectionPtr& conn);
 
     void handleMessage(const TcpConnectionPtr& conn, Buffer& buffer);
+    void handleFrame(const TcpConnectionPtr& conn, const char* begin, const char* crlf);
     // 写函数
     void sendResponse(const TcpConnectionPtr& conn, const json::Value& response);
+    void sendResult(const TcpConnectionPtr& conn, const json::Value& id, const json::Value& result);
+    bool sendChunk(const TcpConnectionPtr& conn, 
+                   const ConnectionStatePtr& state,
+                   const json::Value& id, 
+                   const json::Value& chunk, 
+                   const Task& resume);
+    // body(os) 用 json::Writer 写出消息体, @c id 为空表示不需要和别的消息保持顺序
+    template <typename Body>
+    void sendMessage(const TcpConnectionPtr& conn,
+                     const ConnectionStatePtr& state,
+                     const json::Value* id,
+                     const Body& body);
+    // message 从 begin 开始是完整的消息
+    void deliver(const TcpConnectionPtr& conn,
+                 const ConnectionStatePtr& state,
+                 const json::Value* id,
+                 std::string message,
+                 size_t begin);
 
     // 基类转化为子类
     ProtocolServer& convert();
@@ -46,7 +87,8 @@ protected:
     json::Value wrapException(RequestException& e);
 
 private:
-    TcpServer server_;
+    AdmissionControl admission_;
+    TcpServer        server_;
 };
 
 
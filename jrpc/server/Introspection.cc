@@ -0,0 +1,716 @@
+#include <libnet/MemoryCounter.h>
+#include <libnet/SlabPool.h>
+
+#include <cppJson/Allocator.h>
+
+#include <jrpc/Exception.h>
+#include <jrpc/server/Introspection.h>
+#include <jrpc/server/RpcServer.h>
+
+using namespace jrpc;
+
+namespace
+{
+
+const char* typeName(json::ValueType type)
+{
+    switch (type) {
+        case json::TYPE_NULL:   return "null";
+        case json::TYPE_BOOL:   return "bool";
+        case json::TYPE_INT32:  return "int32";
+        case json::TYPE_INT64:  return "int64";
+        case json::TYPE_DOUBLE: return "double";
+        case json::TYPE_STRING: return "string";
+        case json::TYPE_ARRAY:  return "array";
+        case json::TYPE_OBJECT: return "object";
+    }
+    return "unknown";
+}
+
+json::Value makeInt(uint64_t value)
+{
+    return json::Value(static_cast<int64_t>(value));
+}
+
+// 一个或一组 ThreadPool 的线程数和每一级队列的长度, 按 NUMA 节点分组时是所有组的合计
+struct PoolLoad
+{
+    size_t threads = 0, queued = 0, high = 0, normal = 0, low = 0;
+
+    void add(const ThreadPool& pool)
+    {
+        threads += pool.numThreads();
+        queued += pool.queueSize();
+        high += pool.queueSize(kPriorityHigh);
+        normal += pool.queueSize(kPriorityNormal);
+        low += pool.queueSize(kPriorityLow);
+    }
+
+    json::Value toJson() const
+    {
+        json::Value value(json::TYPE_OBJECT);
+        value.addMember(json::Value("threads"), makeInt(threads));
+        value.addMember(json::Value("queued"), makeInt(queued));
+        value.addMember(json::Value("queued_high"), makeInt(high));
+        value.addMember(json::Value("queued_normal"), makeInt(normal));
+        value.addMember(json::Value("queued_low"), makeInt(low));
+        return value;
+    }
+};
+
+// WorkStealingPool 没有优先级, 队列分成工作线程的本地队列和注入队列, 都是近似值
+struct StealingPoolLoad
+{
+    size_t threads = 0, local = 0, injected = 0;
+
+    void add(const WorkStealingPool& pool)
+    {
+        threads += pool.numThreads();
+        local += pool.localQueueSize();
+        injected += pool.injectedSize();
+    }
+
+    json::Value toJson() const
+    {
+        json::Value value(json::TYPE_OBJECT);
+        value.addMember(json::Value("threads"), makeInt(threads));
+        value.addMember(json::Value("queued"), makeInt(local + injected));
+        value.addMember(json::Value("queued_local"), makeInt(local));
+        value.addMember(json::Value("queued_injected"), makeInt(injected));
+        return value;
+    }
+};
+
+template <typename Procedure>
+json::Value describe(std::string_view name, const char* type, const Procedure& procedure)
+{
+    json::Value params(json::TYPE_OBJECT);
+    for (auto& param: procedure.params())
+        params.addMember(json::Value(param.paramName), json::Value(typeName(param.paramType)));
+
+    json::Value method(json::TYPE_OBJECT);
+    method.addMember("name", name);
+    method.addMember("type", type);
+    method.addMember("params", params);
+    return method;
+}
+
+// 各阶段的延迟, 单位 ns
+json::Value histogram(const net::HistogramSnapshot& h)
+{
+    json::Value value(json::TYPE_OBJECT);
+    value.addMember(json::Value("count"), makeInt(h.count));
+    value.addMember(json::Value("mean"),  makeInt(h.count == 0 ? 0 : h.sum / h.count));
+    value.addMember(json::Value("p50"),   makeInt(h.percentile(50)));
+    value.addMember(json::Value("p90"),   makeInt(h.percentile(90)));
+    value.addMember(json::Value("p99"),   makeInt(h.percentile(99)));
+    value.addMember(json::Value("p999"),  makeInt(h.percentile(99.9)));
+    value.addMember(json::Value("max"),   makeInt(h.max));
+    return value;
+}
+
+// Prometheus 文本格式 0.0.4
+class PrometheusWriter
+{
+public:
+    void header(const char* name, const char* type, const char* help)
+    {
+        out_.append("# HELP ").append(name).append(1, ' ').append(help).append(1, '\n');
+        out_.append("# TYPE ").append(name).append(1, ' ').append(type).append(1, '\n');
+    }
+
+    // labels 是已经格式化的 `key="value",...`, 可以为空
+    void sample(const char* name, const std::string& labels, double value)
+    {
+        char buf[32];
+        snprintf(buf, sizeof buf, "%.9g", value);
+        out_.append(name);
+        if (!labels.empty())
+            out_.append(1, '{').append(labels).append(1, '}');
+        out_.append(1, ' ').append(buf).append(1, '\n');
+    }
+
+    void sample(const char* name, const std::string& labels, uint64_t value)
+    { sample(name, labels, static_cast<double>(value)); }
+
+    std::string take()
+    { return std::move(out_); }
+
+private:
+    std::string out_;
+};
+
+std::string label(const char* key, std::string_view value)
+{
+    std::string result(key);
+    result.append("=\"");
+    // 方法名来自 spec.json, 只需要转义这几个字符
+    for (char c: value) {
+        if (c == '\\' || c == '"')
+            result.append(1, '\\').append(1, c);
+        else if (c == '\n')
+            result.append("\\n");
+        else
+            result.append(1, c);
+    }
+    result.append(1, '"');
+    return result;
+}
+
+std::string label(const char* key, size_t value)
+{
+    return label(key, std::to_string(value));
+}
+
+std::string join(const std::string& lhs, const std::string& rhs)
+{
+    return lhs + ',' + rhs;
+}
+
+const double kNanosecond = 1e-9;
+
+// 参数可以是 {"format":"prometheus"} 或者 ["prometheus"], 没有参数时是 "json"
+std::string_view formatParam(json::Value& request)
+{
+    auto& id = request["id"];
+    auto params = request.findMember("params");
+    if (params == request.memberEnd())
+        return "json";
+
+    auto& value = params->value;
+    json::Value* format = nullptr;
+    if (value.isObject()) {
+        auto it = value.findMember("format");
+        if (it != value.memberEnd() && value.getSize() == 1)
+            format = &it->value;
+    }
+    else if (value.isArray() && value.getSize() == 1) {
+        format = &value[0];
+    }
+
+    if (format == nullptr || !format->isString())
+        throw RequestException(RPC_INVALID_PARAMS, id, "expect params {\"format\": \"json\" | \"prometheus\"}");
+    auto result = format->getStringView();
+    if (result != "json" && result != "prometheus")
+        throw RequestException(RPC_INVALID_PARAMS, id, "unknown format");
+    return result;
+}
+
+void expectNoParams(json::Value& request)
+{
+    if (request.findMember("params") != request.memberEnd())
+        throw RequestException(RPC_INVALID_PARAMS, request["id"], "method takes no params");
+}
+
+const size_t kDefaultTraceLimit = 100;
+
+// 参数 {"limit":n, "trace_id":"32 hex"}, 两个都可以省略
+void traceParams(json::Value& request, size_t& limit, std::string_view& traceId)
+{
+    auto& id = request["id"];
+    limit = kDefaultTraceLimit;
+    auto params = request.findMember("params");
+    if (params == request.memberEnd())
+        return;
+    if (!params->value.isObject())
+        throw RequestException(RPC_INVALID_PARAMS, id, "expect params {\"limit\": n, \"trace_id\": \"...\"}");
+
+    for (auto& member: params->value.getObject()) {
+        auto key = member.key.getStringView();
+        auto& value = member.value;
+        if (key == "limit" && (value.isInt32() || value.isInt64()) && value.getInt64() > 0)
+            limit = static_cast<size_t>(value.getInt64());
+        else if (key == "trace_id" && value.isString())
+            traceId = value.getStringView();
+        else
+            throw RequestException(RPC_INVALID_PARAMS, id, "expect params {\"limit\": n, \"trace_id\": \"...\"}");
+    }
+}
+
+const int kDefaultProfileHz = 99; // 和 perf 相同, 避免和定时任务同步
+
+// 参数 {"action":"dump"|"start"|"stop"|"reset", "hz":n}, 没有参数时是 "dump"
+std::string_view profileParams(json::Value& request, int& hz)
+{
+    auto& id = request["id"];
+    std::string_view action = "dump";
+    hz = kDefaultProfileHz;
+    auto params = request.findMember("params");
+    if (params == request.memberEnd())
+        return action;
+    if (!params->value.isObject())
+        throw RequestException(RPC_INVALID_PARAMS, id, "expect params {\"action\": \"...\", \"hz\": n}");
+
+    for (auto& member: params->value.getObject()) {
+        auto key = member.key.getStringView();
+        auto& value = member.value;
+        if (key == "action" && value.isString())
+            action = value.getStringView();
+        else if (key == "hz" && value.isInt32() && value.getInt32() > 0 && value.getInt32() <= 10000)
+            hz = value.getInt32();
+        else
+            throw RequestException(RPC_INVALID_PARAMS, id, "expect params {\"action\": \"...\", \"hz\": n}");
+    }
+    if (action != "dump" && action != "start" && action != "stop" && action != "reset")
+        throw RequestException(RPC_INVALID_PARAMS, id, "unknown action");
+    return action;
+}
+
+const size_t kDefaultMemorySites = 20;
+
+// 参数 {"sites":n}, 可以省略
+size_t memoryParams(json::Value& request)
+{
+    auto params = request.findMember("params");
+    if (params == request.memberEnd())
+        return kDefaultMemorySites;
+    auto& value = params->value;
+    if (!value.isObject() || value.getSize() != 1)
+        throw RequestException(RPC_INVALID_PARAMS, request["id"], "expect params {\"sites\": n}");
+    auto sites = value.findMember("sites");
+    if (sites == value.memberEnd() || !sites->value.isInt32() || sites->value.getInt32() < 0)
+        throw RequestException(RPC_INVALID_PARAMS, request["id"], "expect params {\"sites\": n}");
+    return static_cast<size_t>(sites->value.getInt32());
+}
+
+std::string hex16(uint64_t value)
+{
+    char buf[17];
+    snprintf(buf, sizeof buf, "%016lx", static_cast<unsigned long>(value));
+    return buf;
+}
+
+}
+
+json::Value Introspection::call(std::string_view method, json::Value& request)
+{
+    if (method == "rpc.methods") {
+        expectNoParams(request);
+        return methods();
+    }
+    if (method == "rpc.stats") {
+        if (formatParam(request) == "prometheus")
+            return json::Value(prometheus());
+        return stats();
+    }
+    if (method == "rpc.connections") {
+        expectNoParams(request);
+        return connections();
+    }
+    if (method == "rpc.traces") {
+        size_t limit;
+        std::string_view traceId;
+        traceParams(request, limit, traceId);
+        return traces(limit, traceId);
+    }
+    if (method == "rpc.profile") {
+        int hz;
+        auto action = profileParams(request, hz);
+        if (action != "dump" && !server_.profilingEnabled_)
+            throw RequestException(RPC_INVALID_REQUEST, request["id"], "profiling is not enabled on this server");
+        return profile(action, hz);
+    }
+    if (method == "rpc.memory")
+        return memory(memoryParams(request));
+    throw RequestException(RPC_METHOD_NOT_FOUND, request["id"], "internal method not found");
+}
+
+json::Value Introspection::methods() const
+{
+    json::Value result(json::TYPE_ARRAY);
+    for (auto& [serviceName, service]: server_.services_) {
+        std::string prefix(serviceName);
+        prefix.append(1, '.');
+        service->forEachMethod([&](std::string_view methodName, const ProcedureReturn& procedure, const MethodStats&)
+                               {
+                                   result.addValue(describe(prefix + std::string(methodName), "call", procedure));
+                               });
+        service->forEachNotify([&](std::string_view methodName, const ProcedureNotify& procedure)
+                               {
+                                   result.addValue(describe(prefix + std::string(methodName), "notify", procedure));
+                               });
+    }
+    return result;
+}
+
+/**
+ *  {
+ *    "methods": {"Echo.Echo": {"calls":..,"inflight":..,"errors":{"-32000":..},
+ *                              "queue_ns":{..},"handler_ns":{..},"serialize_ns":{..}}},
+ *    "loops":   [{"connections":..,"accepted":..,"messages":..,"timers":..,
+ *                 "buffer_bytes":..,"free_buffer_bytes":..,"pending_tasks_high_water":..,
+ *                 "iteration_ns":{..},"wakeup_ns":{..},"poll_ns":{..},"events_ns":{..},"timers_ns":{..},"tasks_ns":{..}}],
+ *    "pool":    {"threads":..,"queued":..,"queued_high":..,"queued_normal":..,"queued_low":..} 或 null,
+ *    "stealing_pool":   {"threads":..,"queued":..,"queued_local":..,"queued_injected":..} 或 null,
+ *    "dedicated_pools": {"Echo.Echo": 和 "pool" 或 "stealing_pool" 相同的格式},
+ *    "memory":  {"admitted_bytes":..,"buffer_bytes":..}
+ *  }
+*/
+json::Value Introspection::stats() const
+{
+    json::Value methods(json::TYPE_OBJECT);
+    for (auto& [name, s]: server_.methodStats()) {
+        json::Value errors(json::TYPE_OBJECT);
+        for (int i = 0; i < kNumRpcErrors; i++) {
+            if (s.errors[i] == 0)
+                continue;
+            auto code = std::to_string(RpcError(static_cast<Error>(i)).asCode());
+            errors.addMember(json::Value(code), makeInt(s.errors[i]));
+        }
+        json::Value method(json::TYPE_OBJECT);
+        method.addMember(json::Value("calls"), makeInt(s.calls));
+        method.addMember(json::Value("inflight"), json::Value(s.inflight));
+        method.addMember("errors", errors);
+        method.addMember(json::Value("queue_ns"), histogram(s.queue));
+        method.addMember(json::Value("handler_ns"), histogram(s.handler));
+        method.addMember(json::Value("serialize_ns"), histogram(s.serialize));
+        methods.addMember(json::Value(name), std::move(method));
+    }
+
+    auto loads = server_.loopLoads();
+    auto latencies = server_.loopLatencies();
+    size_t bufferBytes = 0;
+    json::Value loops(json::TYPE_ARRAY);
+    for (size_t i = 0; i < loads.size(); i++) {
+        auto& load = loads[i];
+        bufferBytes += load.slabsInUse * net::SlabPool::kSlabSize;
+        json::Value loop(json::TYPE_OBJECT);
+        loop.addMember(json::Value("connections"), makeInt(load.connections));
+        loop.addMember(json::Value("accepted"), makeInt(load.accepted));
+        loop.addMember(json::Value("messages"), makeInt(load.messages));
+        loop.addMember(json::Value("timers"), makeInt(load.timers));
+        loop.addMember(json::Value("buffer_bytes"), makeInt(load.slabsInUse * net::SlabPool::kSlabSize));
+        loop.addMember(json::Value("free_buffer_bytes"), makeInt(load.slabsFree * net::SlabPool::kSlabSize));
+        loop.addMember(json::Value("pending_tasks_high_water"), makeInt(load.pendingTasksHighWater));
+        // setInstrumented() 打开时才有
+        if (i < latencies.size() && latencies[i].poll.count > 0) {
+            auto& latency = latencies[i];
+            loop.addMember(json::Value("iteration_ns"), histogram(latency.iteration));
+            loop.addMember(json::Value("wakeup_ns"), histogram(latency.wakeup));
+            loop.addMember(json::Value("poll_ns"), histogram(latency.poll));
+            loop.addMember(json::Value("events_ns"), histogram(latency.events));
+            loop.addMember(json::Value("timers_ns"), histogram(latency.timers));
+            loop.addMember(json::Value("tasks_ns"), histogram(latency.tasks));
+        }
+        loops.addValue(std::move(loop));
+    }
+
+    // 共享的线程池还没有创建时是 null
+    json::Value pool(json::TYPE_NULL);
+    if (!server_.workers_.empty()) {
+        PoolLoad load;
+        for (auto& workers: server_.workers_)
+            load.add(*workers);
+        pool = load.toJson();
+    }
+    json::Value stealingPool(json::TYPE_NULL);
+    if (!server_.stealingWorkers_.empty()) {
+        StealingPoolLoad load;
+        for (auto& workers: server_.stealingWorkers_)
+            load.add(*workers);
+        stealingPool = load.toJson();
+    }
+    json::Value dedicatedPools(json::TYPE_OBJECT);
+    for (auto& [method, workers]: server_.dedicatedWorkers_) {
+        PoolLoad load;
+        load.add(*workers);
+        dedicatedPools.addMember(json::Value(method), load.toJson());
+    }
+    for (auto& [method, workers]: server_.dedicatedStealingWorkers_) {
+        StealingPoolLoad load;
+        load.add(*workers);
+        dedicatedPools.addMember(json::Value(method), load.toJson());
+    }
+
+    json::Value memory(json::TYPE_OBJECT);
+    memory.addMember(json::Value("admitted_bytes"), makeInt(server_.admittedBytes()));
+    memory.addMember(json::Value("buffer_bytes"), makeInt(bufferBytes));
+
+    json::Value result(json::TYPE_OBJECT);
+    result.addMember("methods", methods);
+    result.addMember("loops", loops);
+    result.addMember("pool", pool);
+    result.addMember("stealing_pool", stealingPool);
+    result.addMember("dedicated_pools", dedicatedPools);
+    result.addMember("memory", memory);
+    return result;
+}
+
+json::Value Introspection::connections() const
+{
+    size_t totalConnections = 0;
+    uint64_t totalAccepted = 0;
+    size_t totalBytes = 0;
+    json::Value loops(json::TYPE_ARRAY);
+    for (auto& load: server_.loopLoads()) {
+        size_t bytes = load.slabsInUse * net::SlabPool::kSlabSize;
+        totalConnections += load.connections;
+        totalAccepted += load.accepted;
+        totalBytes += bytes;
+
+        json::Value loop(json::TYPE_OBJECT);
+        loop.addMember(json::Value("connections"), makeInt(load.connections));
+        loop.addMember(json::Value("accepted"), makeInt(load.accepted));
+        loop.addMember(json::Value("timers"), makeInt(load.timers));
+        loop.addMember(json::Value("buffer_bytes"), makeInt(bytes));
+        loops.addValue(std::move(loop));
+    }
+
+    json::Value result(json::TYPE_OBJECT);
+    result.addMember(json::Value("connections"), makeInt(totalConnections));
+    result.addMember(json::Value("accepted"), makeInt(totalAccepted));
+    result.addMember(json::Value("buffer_bytes"), makeInt(totalBytes));
+    result.addMember("loops", loops);
+    return result;
+}
+
+/**
+ *  {
+ *    "sample_rate": .., "recorded": .., "capacity": ..,
+ *    "spans": [{"trace_id":"..","span_id":"..","parent_id":"..","method":"Echo.Echo","start_us":..,
+ *               "queue_ns":..,"handler_ns":..,"serialize_ns":..,"error":0}]
+ *  }
+ *  parent_id 是上游的 span, 这个服务器开始的 trace 没有 parent_id
+*/
+json::Value Introspection::traces(size_t limit, std::string_view traceId) const
+{
+    auto& tracer = server_.tracer_;
+    json::Value spans(json::TYPE_ARRAY);
+    for (auto& record: tracer.recent(limit, traceId)) {
+        json::Value span(json::TYPE_OBJECT);
+        span.addMember(json::Value("trace_id"), json::Value(record.trace.traceId()));
+        span.addMember(json::Value("span_id"), json::Value(hex16(record.trace.spanId)));
+        if (record.trace.parentId != 0)
+            span.addMember(json::Value("parent_id"), json::Value(hex16(record.trace.parentId)));
+        span.addMember(json::Value("method"), json::Value(record.method));
+        span.addMember(json::Value("start_us"), json::Value(record.startUs));
+        span.addMember(json::Value("queue_ns"), json::Value(record.queue));
+        span.addMember(json::Value("handler_ns"), json::Value(record.handler));
+        span.addMember(json::Value("serialize_ns"), json::Value(record.serialize));
+        span.addMember(json::Value("error"), json::Value(record.error));
+        spans.addValue(std::move(span));
+    }
+
+    json::Value result(json::TYPE_OBJECT);
+    result.addMember(json::Value("sample_rate"), json::Value(tracer.sampleRate()));
+    result.addMember(json::Value("recorded"), makeInt(tracer.numRecorded()));
+    result.addMember(json::Value("capacity"), makeInt(tracer.capacity()));
+    result.addMember("spans", spans);
+    return result;
+}
+
+/**
+ *  {"running":..,"hz":..,"samples":..,"dropped":..,"folded":"Echo.Echo;main;...;leaf 12\n..."}
+ *  start 失败 (已经在运行) 时 "started" 为 false; folded 只在 dump 时返回,
+ *  jq -r .result.folded | flamegraph.pl > cpu.svg
+*/
+json::Value Introspection::profile(std::string_view action, int hz) const
+{
+    auto& profiler = net::Profiler::instance();
+    json::Value result(json::TYPE_OBJECT);
+    if (action == "start")
+        result.addMember(json::Value("started"), json::Value(profiler.start(hz)));
+    else if (action == "stop")
+        profiler.stop();
+    else if (action == "reset")
+        profiler.reset();
+
+    result.addMember(json::Value("running"), json::Value(profiler.running()));
+    result.addMember(json::Value("hz"), json::Value(static_cast<int32_t>(profiler.hz())));
+    result.addMember(json::Value("samples"), makeInt(profiler.numSamples()));
+    result.addMember(json::Value("dropped"), makeInt(profiler.numDropped()));
+    if (action == "dump")
+        result.addMember(json::Value("folded"), json::Value(profiler.folded()));
+    return result;
+}
+
+/**
+ *  {
+ *    "subsystems": {"buffer":{"bytes":..,"objects":..}, "timer":{..}, ...},
+ *    "json": {"bytes":..,"blocks":..,"allocations":..},
+ *    "allocation_tracking": false,
+ *    "json_sites": [{"bytes":..,"blocks":..,"allocations":..,"stack":["json::Value::addMember(..)", ...]}]
+ *  }
+ *  子系统的计数是整个进程的, 包括同一个进程里的客户端; json_sites 只在打开调试模式时返回
+*/
+json::Value Introspection::memory(size_t sites) const
+{
+    json::Value subsystems(json::TYPE_OBJECT);
+    net::MemoryCounter::forEach([&](const net::MemoryCounter& counter)
+    {
+        json::Value value(json::TYPE_OBJECT);
+        value.addMember(json::Value("bytes"), json::Value(counter.bytes()));
+        value.addMember(json::Value("objects"), json::Value(counter.objects()));
+        subsystems.addMember(json::Value(counter.name()), std::move(value));
+    });
+
+    auto usage = json::memoryUsage();
+    json::Value dom(json::TYPE_OBJECT);
+    dom.addMember(json::Value("bytes"), json::Value(usage.bytes));
+    dom.addMember(json::Value("blocks"), json::Value(usage.blocks));
+    dom.addMember(json::Value("allocations"), makeInt(usage.allocations));
+
+    json::Value result(json::TYPE_OBJECT);
+    result.addMember("subsystems", subsystems);
+    result.addMember("json", dom);
+    result.addMember(json::Value("allocation_tracking"), json::Value(json::allocationTracking()));
+    if (json::allocationTracking()) {
+        json::Value array(json::TYPE_ARRAY);
+        for (auto& site: json::allocationSites(sites)) {
+            json::Value stack(json::TYPE_ARRAY);
+            for (auto& frame: site.stack)
+                stack.addValue(json::Value(frame));
+
+            json::Value value(json::TYPE_OBJECT);
+            value.addMember(json::Value("bytes"), json::Value(site.bytes));
+            value.addMember(json::Value("blocks"), json::Value(site.blocks));
+            value.addMember(json::Value("allocations"), makeInt(site.allocations));
+            value.addMember("stack", stack);
+            array.addValue(std::move(value));
+        }
+        result.addMember("json_sites", array);
+    }
+    return result;
+}
+
+std::string Introspection::prometheus() const
+{
+    PrometheusWriter out;
+    auto stats = server_.methodStats();
+
+    out.header("jrpc_method_calls_total", "counter", "Finished calls, including failed ones.");
+    for (auto& [name, s]: stats)
+        out.sample("jrpc_method_calls_total", label("method", name), s.calls);
+
+    out.header("jrpc_method_errors_total", "counter", "Failed calls by JSON-RPC error code.");
+    for (auto& [name, s]: stats) {
+        for (int i = 0; i < kNumRpcErrors; i++) {
+            auto code = std::to_string(RpcError(static_cast<Error>(i)).asCode());
+            out.sample("jrpc_method_errors_total", join(label("method", name), label("code", code)), s.errors[i]);
+        }
+    }
+
+    out.header("jrpc_method_inflight", "gauge", "Dispatched calls without a response yet.");
+    for (auto& [name, s]: stats)
+        out.sample("jrpc_method_inflight", label("method", name), static_cast<double>(s.inflight));
+
+    out.header("jrpc_method_latency_seconds", "summary", "Per-phase call latency: queue, handler, serialize.");
+    for (auto& [name, s]: stats) {
+        const std::pair<const char*, const net::HistogramSnapshot*> phases[] = {
+            { "queue", &s.queue }, { "handler", &s.handler }, { "serialize", &s.serialize }
+        };
+        for (auto& [phase, h]: phases) {
+            auto labels = join(label("method", name), label("phase", phase));
+            for (double q: { 0.5, 0.9, 0.99, 0.999 }) {
+                char quantile[16];
+                snprintf(quantile, sizeof quantile, "%g", q);
+                out.sample("jrpc_method_latency_seconds",
+                           join(labels, label("quantile", quantile)),
+                           static_cast<double>(h->percentile(q * 100)) * kNanosecond);
+            }
+            out.sample("jrpc_method_latency_seconds_sum", labels, static_cast<double>(h->sum) * kNanosecond);
+            out.sample("jrpc_method_latency_seconds_count", labels, h->count);
+        }
+    }
+
+    auto loads = server_.loopLoads();
+    auto latencies = server_.loopLatencies();
+
+    out.header("jrpc_loop_connections", "gauge", "Open connections per IO loop.");
+    for (size_t i = 0; i < loads.size(); i++)
+        out.sample("jrpc_loop_connections", label("loop", i), loads[i].connections);
+    out.header("jrpc_loop_accepted_total", "counter", "Connections assigned to the IO loop.");
+    for (size_t i = 0; i < loads.size(); i++)
+        out.sample("jrpc_loop_accepted_total", label("loop", i), loads[i].accepted);
+    out.header("jrpc_loop_messages_total", "counter", "Read events handled by the IO loop.");
+    for (size_t i = 0; i < loads.size(); i++)
+        out.sample("jrpc_loop_messages_total", label("loop", i), loads[i].messages);
+    out.header("jrpc_loop_timers", "gauge", "Pending timers per IO loop.");
+    for (size_t i = 0; i < loads.size(); i++)
+        out.sample("jrpc_loop_timers", label("loop", i), loads[i].timers);
+    out.header("jrpc_loop_buffer_bytes", "gauge", "Connection buffer memory in use per IO loop.");
+    for (size_t i = 0; i < loads.size(); i++)
+        out.sample("jrpc_loop_buffer_bytes", label("loop", i), loads[i].slabsInUse * net::SlabPool::kSlabSize);
+
+    out.header("jrpc_loop_pending_tasks_high_water", "gauge", "Longest task queue seen by the IO loop.");
+    for (size_t i = 0; i < loads.size(); i++)
+        out.sample("jrpc_loop_pending_tasks_high_water", label("loop", i), loads[i].pendingTasksHighWater);
+
+    out.header("jrpc_loop_iteration_seconds", "summary", "Time spent handling one epoll_wait batch.");
+    for (size_t i = 0; i < latencies.size(); i++) {
+        auto& h = latencies[i].iteration;
+        // setInstrumented() 打开时才有
+        if (h.count == 0)
+            continue;
+        auto labels = label("loop", i);
+        for (double q: { 0.5, 0.99 }) {
+            char quantile[16];
+            snprintf(quantile, sizeof quantile, "%g", q);
+            out.sample("jrpc_loop_iteration_seconds",
+                       join(labels, label("quantile", quantile)),
+                       static_cast<double>(h.percentile(q * 100)) * kNanosecond);
+        }
+        out.sample("jrpc_loop_iteration_seconds_sum", labels, static_cast<double>(h.sum) * kNanosecond);
+        out.sample("jrpc_loop_iteration_seconds_count", labels, h.count);
+    }
+
+    if (!server_.workers_.empty()) {
+        PoolLoad load;
+        for (auto& workers: server_.workers_)
+            load.add(*workers);
+        out.header("jrpc_pool_threads", "gauge", "Worker pool threads.");
+        out.sample("jrpc_pool_threads", "", load.threads);
+        out.header("jrpc_pool_queued_tasks", "gauge", "Tasks waiting in the worker pool by priority.");
+        out.sample("jrpc_pool_queued_tasks", label("priority", "high"), load.high);
+        out.sample("jrpc_pool_queued_tasks", label("priority", "normal"), load.normal);
+        out.sample("jrpc_pool_queued_tasks", label("priority", "low"), load.low);
+    }
+
+    if (!server_.stealingWorkers_.empty()) {
+        StealingPoolLoad load;
+        for (auto& workers: server_.stealingWorkers_)
+            load.add(*workers);
+        out.header("jrpc_stealing_pool_threads", "gauge", "Work-stealing pool threads.");
+        out.sample("jrpc_stealing_pool_threads", "", load.threads);
+        out.header("jrpc_stealing_pool_queued_tasks", "gauge",
+                   "Approximate tasks waiting in the work-stealing pool, per-worker deques and injection queue.");
+        out.sample("jrpc_stealing_pool_queued_tasks", label("queue", "local"), load.local);
+        out.sample("jrpc_stealing_pool_queued_tasks", label("queue", "injected"), load.injected);
+    }
+
+    // 独占的线程池: ThreadPool 按优先级, WorkStealingPool 按 local / injected 区分队列
+    if (!server_.dedicatedWorkers_.empty() || !server_.dedicatedStealingWorkers_.empty()) {
+        out.header("jrpc_method_pool_threads", "gauge", "Threads of the pool dedicated to a method.");
+        for (auto& [method, workers]: server_.dedicatedWorkers_)
+            out.sample("jrpc_method_pool_threads", label("method", method), workers->numThreads());
+        for (auto& [method, workers]: server_.dedicatedStealingWorkers_)
+            out.sample("jrpc_method_pool_threads", label("method", method), workers->numThreads());
+        out.header("jrpc_method_pool_queued_tasks", "gauge", "Tasks waiting in the pool dedicated to a method.");
+        for (auto& [method, workers]: server_.dedicatedWorkers_) {
+            PoolLoad load;
+            load.add(*workers);
+            auto labels = label("method", method);
+            out.sample("jrpc_method_pool_queued_tasks", join(labels, label("queue", "high")), load.high);
+            out.sample("jrpc_method_pool_queued_tasks", join(labels, label("queue", "normal")), load.normal);
+            out.sample("jrpc_method_pool_queued_tasks", join(labels, label("queue", "low")), load.low);
+        }
+        for (auto& [method, workers]: server_.dedicatedStealingWorkers_) {
+            StealingPoolLoad load;
+            load.add(*workers);
+            auto labels = label("method", method);
+            out.sample("jrpc_method_pool_queued_tasks", join(labels, label("queue", "local")), load.local);
+            out.sample("jrpc_method_pool_queued_tasks", join(labels, label("queue", "injected")), load.injected);
+        }
+    }
+
+    out.header("jrpc_admission_used_bytes", "gauge", "Request bytes admitted and not yet answered.");
+    out.sample("jrpc_admission_used_bytes", "", server_.admittedBytes());
+
+    out.header("jrpc_memory_bytes", "gauge", "Estimated memory held by each subsystem, JSON DOM included.");
+    net::MemoryCounter::forEach([&](const net::MemoryCounter& counter)
+    {
+        out.sample("jrpc_memory_bytes", label("subsystem", counter.name()), static_cast<double>(counter.bytes()));
+    });
+    out.sample("jrpc_memory_bytes", label("subsystem", "json"), static_cast<double>(json::memoryUsage().bytes));
+    return out.take();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <cppJson/Value.h>
+
+#include <jrpc/util.h>
+
+namespace jrpc
+{
+
+class RpcServer;
+
+/// @brief: 服务器内置的 "rpc." 方法, 读取运行中的服务器的状态, 在 IO 线程中直接回应
+///         rpc.methods:     所有方法的名字, 类型 (call/notify) 和参数
+///         rpc.stats:       每个方法的调用统计, 每个 loop 的连接/定时器/缓冲区/延迟,
+///                          线程池的队列长度和准入控制的内存;
+///                          参数 {"format":"prometheus"} 时返回 Prometheus 文本格式的字符串
+///         rpc.connections: 每个 loop 的连接数和缓冲区内存, 比 rpc.stats 便宜
+///         rpc.traces:      最近被采样的 span, 从新到旧; 参数 {"limit":n, "trace_id":"..."} 都是可选的,
+///                          用同一个 trace_id 查询链路上的每个服务, 就能看出延迟花在哪一跳的哪个阶段
+///         rpc.profile:     CPU profiler 的状态和 folded 格式的调用栈, 每个栈以正在执行的方法名开头;
+///                          参数 {"action":"start","hz":n} / {"action":"stop"} / {"action":"reset"}
+///                          需要 RpcServer::setProfilingEnabled(true)
+///         rpc.memory:      每个子系统 (缓冲区, 定时器, 线程池队列, 客户端等待的调用) 和 JSON DOM 占用的内存;
+///                          json::setAllocationTracking(true) 之后还返回占用最多的分配点, 参数 {"sites":n} 可选
+///         读取都是原子变量和直方图的快照, 不会阻塞其他线程, 可以每秒抓取
+class Introspection: noncopyable
+{
+public:
+    static constexpr std::string_view kPrefix = "rpc.";
+
+    explicit Introspection(RpcServer& server)
+    : server_(server)
+    {}
+
+    static bool isInternal(std::string_view method)
+    { return method.substr(0, kPrefix.size()) == kPrefix; }
+
+    /// @brief: 调用内置方法, 找不到方法或者参数不对时抛出 RequestException
+    json::Value call(std::string_view method, json::Value& request);
+
+    json::Value methods() const;
+    json::Value stats() const;
+    json::Value connections() const;
+    json::Value traces(size_t limit, std::string_view traceId) const;
+    json::Value profile(std::string_view action, int hz) const;
+    json::Value memory(size_t sites) const;
+    std::string prometheus() const;
+
+private:
+    RpcServer& server_;
+};
+
+}
@@ -0,0 +1,73 @@
+#include <jrpc/server/MethodStats.h>
+
+using namespace jrpc;
+
+namespace
+{
+
+std::atomic<size_t> nextShard(0);
+
+// 线程第一次记录时轮流分配分片, 线程数不超过 kNumShards 时互不共享
+size_t shardIndex()
+{
+    thread_local size_t index = nextShard.fetch_add(1, std::memory_order_relaxed) % MethodStats::kNumShards;
+    return index;
+}
+
+uint64_t nonNegative(int64_t value)
+{
+    return value < 0 ? 0 : static_cast<uint64_t>(value);
+}
+
+}
+
+const size_t MethodStats::kNumShards;
+
+uint64_t MethodStatsSnapshot::totalErrors() const
+{
+    uint64_t total = 0;
+    for (auto n: errors)
+        total += n;
+    return total;
+}
+
+MethodStats::Shard& MethodStats::shard()
+{
+    return shards_[shardIndex()];
+}
+
+void MethodStats::end(int64_t queue, int64_t handler, int64_t serialize)
+{
+    auto& s = shard();
+    s.calls.fetch_add(1, std::memory_order_relaxed);
+    s.inflight.fetch_sub(1, std::memory_order_relaxed);
+    s.queue.record(nonNegative(queue));
+    s.handler.record(nonNegative(handler));
+    s.serialize.record(nonNegative(serialize));
+}
+
+void MethodStats::fail(RpcError err)
+{
+    auto& s = shard();
+    s.calls.fetch_add(1, std::memory_order_relaxed);
+    s.errors[err.asErrno()].fetch_add(1, std::memory_order_relaxed);
+    s.inflight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+MethodStatsSnapshot MethodStats::snapshot() const
+{
+    MethodStatsSnapshot result;
+    for (auto& s: shards_) {
+        result.calls += s.calls.load(std::memory_order_relaxed);
+        for (int i = 0; i < kNumRpcErrors; i++)
+            result.errors[i] += s.errors[i].load(std::memory_order_relaxed);
+        result.inflight += s.inflight.load(std::memory_order_relaxed);
+        result.queue.merge(s.queue.snapshot());
+        result.handler.merge(s.handler.snapshot());
+        result.serialize.merge(s.serialize.snapshot());
+    }
+    // 读取各个分片不是同时的, 可能短暂地看到负数
+    if (result.inflight < 0)
+        result.inflight = 0;
+    return result;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include <libnet/Histogram.h>
+#include <libnet/noncopyable.h>
+
+#include <jrpc/RpcError.h>
+
+namespace jrpc
+{
+
+/// @brief: MethodStats 在某一时刻的拷贝, 所有分片已经合并, 时间单位 ns
+struct MethodStatsSnapshot
+{
+    uint64_t               calls = 0;               // 已经结束的调用, 包括出错的
+    uint64_t               errors[kNumRpcErrors] = {}; // 以 RpcError 为下标
+    int64_t                inflight = 0;            // 已经分派但是还没有回应的调用
+    net::HistogramSnapshot queue;                   // 收到请求到处理函数开始执行, 包括在线程池中排队
+    net::HistogramSnapshot handler;                 // 处理函数开始执行到调用 UserDoneCallback
+    net::HistogramSnapshot serialize;               // 序列化回应并交给连接的输出缓冲区
+
+    uint64_t totalErrors() const;
+};
+
+/// @brief: 一个方法的调用统计, 由 RpcService 为每个有回应的方法创建
+///         热路径上只写当前线程对应的分片 (relaxed 原子操作), 线程之间不共享 cache line,
+///         读取时再合并所有分片, 所以 snapshot() 比记录慢得多, 只用于监控
+class MethodStats: net::noncopyable
+{
+public:
+    static const size_t kNumShards = 8;
+
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 请求分派给处理函数之前调用
+    void begin()
+    { shard().inflight.fetch_add(1, std::memory_order_relaxed); }
+
+    // 成功回应之后调用, 参数是各阶段的耗时
+    void end(int64_t queue, int64_t handler, int64_t serialize);
+
+    // 出错结束 (参数错误, 在队列中过期等), 不记录延迟
+    void fail(RpcError err);
+
+    MethodStatsSnapshot snapshot() const;
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> errors[kNumRpcErrors] = {};
+        std::atomic<int64_t>  inflight{0}; // 开始和结束可能在不同的分片, 单个分片可以是负数
+        net::Histogram        queue;
+        net::Histogram        handler;
+        net::Histogram        serialize;
+    };
+
+    Shard& shard();
+
+    Shard shards_[kNumShards];
+};
+
+}
@@ -84,9 +84,12 @@ bool Procedure<Func>::validateGeneric(json::Value& request) const
 
 template <>
 void Procedure<ProcedureReturnCallback>::invoke(json::Value& request,
-                                                const RpcDoneCallback& done)
+                                                RpcDoneCallback& done)
 {
     validateRequest(request);
+    // 在线程池中执行的方法由 stub 在工作线程中用同一个名字重新设置标签
+    done.attachMethod(name_.c_str());
+    ProfileScope profile(name_.c_str());
     // 这个是任务完成的回调函数
     // 这个 callback_ 实际上就是 echoserver 中的 EchoStub
     callback_(request, done);
@@ -96,5 +99,6 @@ template <>
 void Procedure<ProcedureNotifyCallback>::invoke(json::Value& request)
 {
     validateRequest(request);
+    ProfileScope profile(name_.c_str());
     callback_(request); // request 从请求变成了 response
 }
\ No newline at end of file
@@ -13,6 +13,18 @@ template <typename Func>
 class Procedure: noncopyable
 {
 public:
+    // 参数包含：参数名，参数类型
+    struct Param
+    {
+        Param(std::string_view paramName_, json::ValueType paramType_) 
+        : paramName(paramName_),
+          paramType(paramType_)
+        {}
+
+        std::string_view paramName;
+        json::ValueType  paramType;
+    };
+
     template<typename... ParamNameAndTypes>
     explicit Procedure(Func&& callback, ParamNameAndTypes&&... nameAndTypes)
     : callback_(std::forward<Func>(callback))
@@ -26,10 +38,21 @@ public:
     }
 
     // procedure call
-    void invoke(json::Value& request, const RpcDoneCallback& done);
+    void invoke(json::Value& request, RpcDoneCallback& done);
     // procedure notify
     void invoke(json::Value& request);
 
+    // spec.json 中声明的参数, 用于 rpc.methods
+    const std::vector<Param>& params() const
+    { return params_; }
+
+    // "Service.Method", 加入 RpcServer 时设置, 执行时作为 profiler 的标签
+    void setName(std::string name)
+    { name_ = std::move(name); }
+
+    const std::string& name() const
+    { return name_; }
+
 private:
     template<typename Name, typename Type, typename... ParamNameAndTypes>
     void initProcedure(Name paramName, Type parmType, ParamNameAndTypes &&... nameAndTypes)
@@ -53,24 +76,12 @@ private:
     void validateRequest(json::Value& request) const;
     bool validateGeneric(json::Value& request) const;
 
-private:
-    // 参数包含：参数名，参数类型
-    struct Param
-    {
-        Param(std::string_view paramName_, json::ValueType paramType_) 
-        : paramName(paramName_),
-          paramType(paramType_)
-        {}
-
-        std::string_view paramName;
-        json::ValueType  paramType;
-    };
-
 private:
     // 一个可执行程序的返回时的回调函数
     // 这个函数的参数
     Func callback_;
     std::vector<Param> params_;
+    std::string name_;
 };
 
 
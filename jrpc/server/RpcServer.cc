@@ -1,5 +1,7 @@
 #include <cppJson/Document.h>
 
+#include <libnet/CpuAffinity.h>
+
 #include <jrpc/Exception.h>
 #include <jrpc/server/RpcService.h>
 #include <jrpc/server/RpcServer.h>
@@ -71,6 +73,14 @@ bool isNotify(const json::Value& request)
     return request.findMember("id") == request.memberEnd();
 }
 
+// 上传的分块或者结束帧, 没有 method
+bool isUploadFrame(const json::Value& request)
+{
+    return request.findMember("method") == request.memberEnd() &&
+           (request.findMember("chunk") != request.memberEnd() ||
+            request.findMember("end") != request.memberEnd());
+}
+
 bool hasParams(const json::Value& request)
 {
     return request.findMember("params") != request.memberEnd();
@@ -119,9 +129,106 @@ private:
 
 void RpcServer::addService(std::string_view serviceName, RpcService *service)
 {
+    assert(serviceName != "rpc" && "service name is reserved for internal methods");
     assert(services_.find(serviceName) == services_.end());
+    service->setServiceName(serviceName);
     services_.emplace(serviceName, service);
 }
+
+void RpcServer::setWorkerThreads(size_t n, const ThreadInitCallback& cb)
+{
+    assert(workers_.empty() && stealingWorkers_.empty() && "worker pool already created");
+    numWorkers_ = n;
+    workerInitCallback_ = cb;
+}
+
+void RpcServer::setNumaLocalWorkers(bool on)
+{
+    assert(workers_.empty() && stealingWorkers_.empty() && "worker pool already created");
+    numaLocalWorkers_ = on;
+}
+
+/// @brief: 按节点把进程允许使用的 CPU 分组, 没有 CPU 的节点不分配 worker
+void RpcServer::initWorkerGroups()
+{
+    if (!workerCpus_.empty())
+        return;
+
+    int numNodes = numaLocalWorkers_ ? net::numNumaNodes() : 1;
+    if (numNodes > 1) {
+        auto allowed = net::availableCpus();
+        nodeToWorkers_.assign(static_cast<size_t>(numNodes), 0);
+        for (int node = 0; node < numNodes; node++) {
+            std::vector<int> cpus;
+            for (int cpu: net::cpusOfNode(node)) {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                    cpus.push_back(cpu);
+            }
+            if (cpus.empty())
+                continue;
+            nodeToWorkers_[static_cast<size_t>(node)] = workerCpus_.size();
+            workerCpus_.push_back(std::move(cpus));
+        }
+    }
+    // 不按节点划分, 或者只有一个节点有可用的 CPU 时, 所有 worker 是一组, 不绑定 CPU
+    if (workerCpus_.size() <= 1) {
+        workerCpus_.assign(1, std::vector<int>());
+        nodeToWorkers_.clear();
+    }
+}
+
+ThreadInitCallback RpcServer::workerGroupInitCallback(size_t group) const
+{
+    auto& cpus = workerCpus_[group];
+    if (cpus.empty())
+        return workerInitCallback_;
+    return net::pinToCpus(cpus, workerInitCallback_);
+}
+
+/// @brief: 调用线程所在节点的那一组, IO 线程绑定了 CPU 时结果是固定的
+size_t RpcServer::localWorkerGroup() const
+{
+    if (nodeToWorkers_.empty())
+        return 0;
+    auto node = static_cast<size_t>(net::currentNumaNode());
+    return node < nodeToWorkers_.size() ? nodeToWorkers_[node] : 0;
+}
+
+/// @brief: 第一次调用在 stub 的构造函数里, 这时候服务还没有启动, 所有的线程池在这时创建,
+///         之后 IO 线程只读, 不需要加锁
+ThreadPool& RpcServer::workerPool()
+{
+    if (workers_.empty()) {
+        initWorkerGroups();
+        size_t perGroup = std::max<size_t>(1, numWorkers_ / workerCpus_.size());
+        for (size_t i = 0; i < workerCpus_.size(); i++)
+            workers_.push_back(std::make_unique<ThreadPool>(perGroup, 65536,
+                                                            workerGroupInitCallback(i)));
+    }
+    return *workers_[localWorkerGroup()];
+}
+
+WorkStealingPool& RpcServer::stealingPool()
+{
+    if (stealingWorkers_.empty()) {
+        initWorkerGroups();
+        size_t perGroup = std::max<size_t>(1, numWorkers_ / workerCpus_.size());
+        for (size_t i = 0; i < workerCpus_.size(); i++)
+            stealingWorkers_.push_back(std::make_unique<WorkStealingPool>(perGroup,
+                                                                          workerGroupInitCallback(i)));
+    }
+    return *stealingWorkers_[localWorkerGroup()];
+}
+void RpcServer::registerPool(std::string_view method, ThreadPool* pool)
+{
+    dedicatedWorkers_.emplace_back(method, pool);
+}
+
+void RpcServer::registerPool(std::string_view method, WorkStealingPool* pool)
+{
+    dedicatedStealingWorkers_.emplace_back(method, pool);
+}
+
 /// @brief: 这个是处理客户端的请求
 ///          因此，需要对得到的 json 进行解析
 /**
@@ -132,7 +239,7 @@ void RpcServer::addService(std::string_view serviceName, RpcService *service)
                 \"id\":0
             }\r\n"
 */
-void RpcServer::handleRequest(const std::string& json, const RpcDoneCallback& done)
+void RpcServer::handleRequest(const std::string& json, RpcDoneCallback& done)
 {
     json::Document request;
     json::ParseError err = request.parse(json);
@@ -141,7 +248,9 @@ void RpcServer::handleRequest(const std::string& json, const RpcDoneCallback& do
 
     switch (request.getType()) {
         case json::TYPE_OBJECT:
-            if (isNotify(request))
+            if (isUploadFrame(request))
+                handleUploadFrame(request, json.size(), done);
+            else if (isNotify(request))
                 handleSingleNotify(request);
             else
                 handleSingleRequest(request, done);
@@ -154,15 +263,39 @@ void RpcServer::handleRequest(const std::string& json, const RpcDoneCallback& do
     }
 }
 
-void RpcServer::handleSingleRequest(json::Value& request, const RpcDoneCallback& done)
+std::map<std::string, MethodStatsSnapshot> RpcServer::methodStats() const
+{
+    std::map<std::string, MethodStatsSnapshot> result;
+    for (auto& [serviceName, service]: services_) {
+        service->forEachMethod([&, serviceName = serviceName](std::string_view methodName,
+                                                              const ProcedureReturn&,
+                                                              const MethodStats& stats)
+                               {
+                                   std::string name(serviceName);
+                                   name.append(1, '.').append(methodName);
+                                   result.emplace(std::move(name), stats.snapshot());
+                               });
+    }
+    return result;
+}
+
+void RpcServer::handleSingleRequest(json::Value& request, RpcDoneCallback& done)
 {
+    int64_t receivedAt = MethodStats::now();
     validateRequest(request);
 
     auto& id = request["id"];
     // "method: xxx.add"
     auto methodName = request["method"].getStringView();
-    auto pos = methodName.find('.');
 
+    // rpc.stats 等内置方法直接在 IO 线程回应
+    if (Introspection::isInternal(methodName)) {
+        auto result = introspection_.call(methodName, request);
+        UserDoneCallback(request, done)(std::move(result));
+        return;
+    }
+
+    auto pos = methodName.find('.');
     if (pos == std::string_view::npos)
         throw RequestException(RPC_INVALID_REQUEST, id, "missing service name in method");
 
@@ -178,9 +311,18 @@ void RpcServer::handleSingleRequest(json::Value& request, const RpcDoneCallback&
     if (methodName.length() == 0)
         throw RequestException(RPC_INVALID_REQUEST, id, "missing method name in method");
 
+    // 上游的 traceparent 格式不对时按 W3C 的规定忽略, 当作没有上游
+    TraceContext upstream;
+    auto traceparent = request.findMember("traceparent");
+    bool hasUpstream = traceparent != request.memberEnd() &&
+                       TraceContext::parse(traceparent->value.getStringView(), upstream);
+    auto trace = tracer_.start(hasUpstream ? &upstream : nullptr);
+    if (trace.valid())
+        done.attachTrace(trace, trace.sampled ? &tracer_ : nullptr);
+
     auto& service = it->second;
     // 下面才开始调用请求的函数
-    service->callProcedureReturn(methodName, request, done);
+    service->callProcedureReturn(methodName, request, done, receivedAt);
 }
 
 void RpcServer::handleBatchRequests(json::Value& requests, const RpcDoneCallback& done)
@@ -207,11 +349,12 @@ void RpcServer::handleBatchRequests(json::Value& requests, const RpcDoneCallback
             }
             else 
             {
-                handleSingleRequest(request, 
-                                    [=](json::Value response) mutable 
-                                    {
-                                      responses.addResponse(response);
-                                    });
+                // 每个子请求有自己的回调, 分派时在上面设置统计和追踪
+                RpcDoneCallback single([=](json::Value response) mutable
+                                       {
+                                         responses.addResponse(response);
+                                       });
+                handleSingleRequest(request, single);
             }
         }
     }
@@ -247,6 +390,42 @@ void RpcServer::handleSingleNotify(json::Value& request)
     service->callProcedureNotify(methodName, request);
 }
 
+/**
+ *  {"jsonrpc":"2.0","chunk":[chunk],"id":0}
+ *  {"jsonrpc":"2.0","end":true,"id":0}
+ *  和 notify 一样没有回应, 出错只记录日志
+*/
+void RpcServer::handleUploadFrame(json::Value& request, size_t bytes, const RpcDoneCallback& done)
+{
+    auto& uploads = done.uploads();
+    if (uploads == nullptr)
+        throw NotifyException(RPC_INVALID_REQUEST, "upload frame is not allowed in batch request");
+
+    auto& version = findValue<json::TYPE_STRING>(request, "jsonrpc");
+    if (version.getStringView() != "2.0")
+        throw NotifyException(RPC_INVALID_REQUEST, "jsonrpc version is unknown/unsupported");
+
+    auto& id = findValue<json::TYPE_STRING, json::TYPE_NULL, json::TYPE_INT32, json::TYPE_INT64>(request, "id");
+
+    // jsonrpc, chunk/end, id
+    if (request.getSize() != 3)
+        throw NotifyException(RPC_INVALID_REQUEST, "unexpected field");
+
+    // 给从不调用的 id 发分块的客户端会让服务器一直缓存下去, 超过上限时断开连接
+    auto chunk = request.findMember("chunk");
+    if (chunk != request.memberEnd()) {
+        auto stream = uploads->find(id);
+        if (stream == nullptr || !stream->pushChunk(std::move(chunk->value), bytes))
+            throw RequestException(RPC_INVALID_REQUEST, id, "too many unclaimed upload chunks");
+    }
+    else {
+        auto stream = uploads->end(id);
+        if (stream == nullptr)
+            throw RequestException(RPC_INVALID_REQUEST, id, "too many unclaimed uploads");
+        stream->pushEnd();
+    }
+}
+
 /**
  *  {"jsonrpc":"2.0","method":"Arithmetic.Add","params":{"lhs":10.0,"rhs":3.0},"id":0}
 */
@@ -262,13 +441,30 @@ void RpcServer::validateRequest(json::Value& request)
                                id, 
                                "jsonrpc version is unknown/unsupported");
 
-    auto& method = findValue<json::TYPE_STRING>(request, id, "method");
-    if (method.getStringView() == "rpc.") // internal use
-        throw RequestException(RPC_METHOD_NOT_FOUND,
-                               id, "method name is internal use");
+    findValue<json::TYPE_STRING>(request, id, "method");
+
+    // 可选的超时 (毫秒), 换算成绝对的截止时间 (微秒)
+    bool hasTimeout = false;
+    auto timeout = request.findMember("timeout");
+    if (timeout != request.memberEnd()) {
+        checkValueType<json::TYPE_INT32, json::TYPE_INT64>(timeout->value.getType(), id);
+        int64_t ms = timeout->value.getInt64();
+        if (ms <= 0)
+            throw RequestException(RPC_INVALID_REQUEST, id, "timeout should be positive");
+        timeout->value.setInt64(nowMicroseconds() + ms * 1000);
+        hasTimeout = true;
+    }
+
+    // 可选的分布式追踪上下文, 内容在 handleSingleRequest 中解析
+    bool hasTraceparent = false;
+    auto traceparent = request.findMember("traceparent");
+    if (traceparent != request.memberEnd()) {
+        checkValueType<json::TYPE_STRING>(traceparent->value.getType(), id);
+        hasTraceparent = true;
+    }
 
-    // jsonrpc, method, id, params
-    size_t nMembers = 3u + hasParams(request);
+    // jsonrpc, method, id, params, timeout, traceparent
+    size_t nMembers = 3u + hasParams(request) + hasTimeout + hasTraceparent;
 
     if (request.getSize() != nMembers)
         throw RequestException(RPC_INVALID_REQUEST, id, "unexpected field");
@@ -281,7 +477,7 @@ void RpcServer::validateNotify(json::Value& request)
         throw NotifyException(RPC_INVALID_REQUEST, "jsonrpc version is unknown/unsupported");
 
     auto& method = findValue<json::TYPE_STRING>(request, "method");
-    if (method.getStringView() == "rpc.") // internal use
+    if (Introspection::isInternal(method.getStringView())) // 内置方法都有回应
         throw NotifyException(RPC_METHOD_NOT_FOUND, "method name is internal use");
 
     // jsonrpc, method, params, no id
@@ -1,13 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <map>
 #include <memory>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <cppJson/Value.h>
 
 #include <jrpc/util.h>
 #include <jrpc/server/RpcService.h>
 #include <jrpc/server/BaseServer.h>
+#include <jrpc/server/Introspection.h>
+#include <jrpc/server/TraceRecorder.h>
 
 namespace jrpc
 {
@@ -23,27 +31,84 @@ class RpcServer: public BaseServer<RpcServer>
 {
 public:
     RpcServer(EventLoop* loop, const InetAddress& listen)
-    : BaseServer(loop, listen)
+    : BaseServer(loop, listen),
+      numWorkers_(std::max(1u, std::thread::hardware_concurrency())),
+      introspection_(*this)
     {}
 
     ~RpcServer() = default;
 
-    // used by user stub
+    // used by user stub, "rpc" 是内置方法的前缀, 不能用作服务名
     void addService(std::string_view serviceName, RpcService* service);
 
+    // spec.json 中 "execution": "pool" 的方法共享的线程池, 第一次使用时创建,
+    // 所以要在创建 service 之前设置, 默认的线程数是 CPU 的个数
+    // 声明了 "pool": "stealing" 的方法共享 stealingPool(), 线程数和初始化回调相同
+    void setWorkerThreads(size_t n, const ThreadInitCallback& cb = nullptr);
+
+    // 每个 NUMA 节点一组 worker, 线程绑定在节点的 CPU 上, 线程数平均分给各个节点;
+    // IO 线程把请求交给它所在节点的那一组, 请求的处理和连接的 IO 在同一个 socket 上,
+    // 配合 setCpuAffinity() 使用. 初始化回调在绑定之后调用, 不应该再绑定 CPU
+    // 只有一个节点时和不开启一样, 要在创建 service 之前设置
+    void setNumaLocalWorkers(bool on);
+
+    // 返回调用线程所在节点的线程池, stub 在 IO 线程上提交任务时调用
+    ThreadPool& workerPool();
+    WorkStealingPool& stealingPool();
+
+    // "execution": "dedicated" 的方法独占的线程池属于 stub, stub 在构造函数里登记,
+    // rpc.stats 和 Prometheus 输出按方法报告它们的线程数和队列长度; 要在服务启动之前登记
+    void registerPool(std::string_view method, ThreadPool* pool);
+    void registerPool(std::string_view method, WorkStealingPool* pool);
+
     // 真正用来处理请求的函数
-    void handleRequest(const std::string& json, const RpcDoneCallback& done);
+    void handleRequest(const std::string& json, RpcDoneCallback& done);
+
+    // 每个方法的调用统计, 键是 "Service.Method", 任意线程都可以调用
+    std::map<std::string, MethodStatsSnapshot> methodStats() const;
+
+    // 没有 traceparent 的请求开始新 trace 的概率, 默认 0; 被采样的 span 通过 rpc.traces 读取
+    void setTraceSampleRate(double rate)
+    { tracer_.setSampleRate(rate); }
+
+    // 允许客户端通过 rpc.profile 启动和停止进程内的 CPU profiler (net::Profiler), 默认不允许;
+    // 在代码中直接调用 net::Profiler::instance().start() 不受影响
+    void setProfilingEnabled(bool enabled)
+    { profilingEnabled_ = enabled; }
 
 private:
-    void handleSingleRequest(json::Value& request,  const RpcDoneCallback& done);
+    friend class Introspection;
+
+    void handleSingleRequest(json::Value& request, RpcDoneCallback& done);
     void handleBatchRequests(json::Value& requests, const RpcDoneCallback& done);
     void handleSingleNotify(json::Value& request);
+    /// @param: bytes 这个帧的消息长度, 分块被缓存时计入准入控制
+    void handleUploadFrame(json::Value& request, size_t bytes, const RpcDoneCallback& done);
 
     void validateRequest(json::Value& request);
     void validateNotify(json::Value& request);
     
     std::unordered_map<std::string_view, std::unique_ptr<RpcService>> services_;
-    
+
+    void initWorkerGroups();
+    size_t localWorkerGroup() const;
+    ThreadInitCallback workerGroupInitCallback(size_t group) const;
+
+    size_t numWorkers_;
+    ThreadInitCallback workerInitCallback_;
+    bool numaLocalWorkers_ = false;
+    // 每组 worker 绑定的 CPU, 以及 NUMA 节点 -> 组的下标, 不按节点划分时只有一组, 不绑定
+    std::vector<std::vector<int>> workerCpus_;
+    std::vector<size_t> nodeToWorkers_;
+    std::vector<std::unique_ptr<ThreadPool>> workers_;
+    std::vector<std::unique_ptr<WorkStealingPool>> stealingWorkers_;
+    // 独占的线程池, 键是 "Service.Method", 不拥有
+    std::vector<std::pair<std::string, ThreadPool*>> dedicatedWorkers_;
+    std::vector<std::pair<std::string, WorkStealingPool*>> dedicatedStealingWorkers_;
+
+    TraceRecorder tracer_;
+    std::atomic<bool> profilingEnabled_{false};
+    Introspection introspection_;
 };
 
 }
@@ -5,7 +5,8 @@ using namespace jrpc;
 
 void RpcService::callProcedureReturn(std::string_view methodName,
                                      json::Value& request,
-                                     const RpcDoneCallback& done)
+                                     RpcDoneCallback& done,
+                                     int64_t receivedAt)
 {
     auto it = procedureReturn_.find(methodName);
     if (it == procedureReturn_.end()) {
@@ -13,10 +14,32 @@ void RpcService::callProcedureReturn(std::string_view methodName,
                                request["id"],
                                "method not found");
     }
+
+    auto& stats = *it->second.stats;
+    stats.begin();
+    done.attachStats(&stats, receivedAt);
     // 服务method 的执行函数
-    it->second->invoke(request, done);
+    try {
+        it->second.procedure->invoke(request, done);
+    }
+    catch (RequestException& e) {
+        // 参数不匹配等错误, 处理函数不会回应
+        stats.fail(e.err());
+        done.recordSpan(request, MethodStats::now() - receivedAt, 0, 0, e.err().asCode());
+        throw;
+    }
 };
 
+void RpcService::setServiceName(std::string_view serviceName)
+{
+    std::string prefix(serviceName);
+    prefix.append(1, '.');
+    for (auto& [name, method]: procedureReturn_)
+        method.procedure->setName(prefix + std::string(name));
+    for (auto& [name, procedure]: procedureNotfiy_)
+        procedure->setName(prefix + std::string(name));
+}
+
 void RpcService::callProcedureNotify(std::string_view methodName, json::Value& request)
 {
     auto it = procedureNotfiy_.find(methodName);
@@ -6,6 +6,7 @@
 
 #include <cppJson/Value.h>
 #include <jrpc/server/Procedure.h>
+#include <jrpc/server/MethodStats.h>
 
 namespace jrpc
 {
@@ -17,7 +18,9 @@ public:
     void addProcedureReturn(std::string_view methodName, ProcedureReturn* p)
     {
         assert(procedureReturn_.find(methodName) == procedureReturn_.end());
-        procedureReturn_.emplace(methodName, p);
+        procedureReturn_.emplace(methodName, 
+                                 MethodReturn{std::unique_ptr<ProcedureReturn>(p), 
+                                              std::make_unique<MethodStats>()});
     }
 
     void addProcedureNotify(std::string_view methodName, ProcedureNotify *p)
@@ -26,16 +29,43 @@ public:
         procedureNotfiy_.emplace(methodName, p);
     }
 
+    /// @param: receivedAt 服务器开始处理这个请求的时刻, MethodStats::now()
     void callProcedureReturn(std::string_view methodName,
                              json::Value& request,
-                             const RpcDoneCallback& done);
+                             RpcDoneCallback& done,
+                             int64_t receivedAt);
 
     void callProcedureNotify(std::string_view methodName, 
                              json::Value& request);
 
+    /// @brief: 加入 RpcServer 时调用, 给每个方法设置完整的名字 "Service.Method"
+    void setServiceName(std::string_view serviceName);
+
+    /// @brief: 对每个有回应的方法调用 func(methodName, const ProcedureReturn&, const MethodStats&)
+    template <typename Func>
+    void forEachMethod(Func&& func) const
+    {
+        for (auto& [name, method]: procedureReturn_)
+            func(name, *method.procedure, *method.stats);
+    }
+
+    /// @brief: 对每个通知方法调用 func(methodName, const ProcedureNotify&)
+    template <typename Func>
+    void forEachNotify(Func&& func) const
+    {
+        for (auto& [name, procedure]: procedureNotfiy_)
+            func(name, *procedure);
+    }
+
 private:
+    struct MethodReturn
+    {
+        std::unique_ptr<ProcedureReturn> procedure;
+        std::unique_ptr<MethodStats>     stats;
+    };
+
     // 根据函数名 - 函数调用, 建立映射关系
-    std::unordered_map<std::string_view, std::unique_ptr<ProcedureReturn>> procedureReturn_;
+    std::unordered_map<std::string_view, MethodReturn> procedureReturn_;
     std::unordered_map<std::string_view, std::unique_ptr<ProcedureNotify>> procedureNotfiy_;
 };
 
@@ -0,0 +1,121 @@
+#include <assert.h>
+
+#include <algorithm>
+
+#include <jrpc/server/StreamMux.h>
+
+using namespace jrpc;
+
+void StreamMux::enable(size_t window)
+{
+    window_.store(window, std::memory_order_release);
+}
+
+bool StreamMux::send(const TcpConnectionPtr& conn, const std::string& key, std::string& message)
+{
+    auto it = key.empty() ? keys_.end() : keys_.find(key);
+    if (it == keys_.end() && message.length() <= kFrameSize)
+        return false;
+
+    Stream* stream;
+    if (it == keys_.end()) {
+        uint32_t id = nextId_++;
+        stream = &streams_[id];
+        stream->id = id;
+        stream->key = key;
+        stream->window = window_.load(std::memory_order_relaxed);
+        if (!key.empty())
+            keys_.emplace(key, id);
+    }
+    else {
+        stream = &streams_[it->second];
+    }
+
+    // 跳过长度头, 去掉末尾的 crlf
+    size_t begin = message.find("\r\n") + 2;
+    size_t end = message.length() - 2;
+    assert(begin > 2 && begin <= end);
+
+    queued_.fetch_add(end - begin, std::memory_order_relaxed);
+    stream->messages.push_back({ std::move(message), begin, end });
+    schedule(*stream);
+
+    if (!writing_)
+        pump(conn);
+    return true;
+}
+
+void StreamMux::windowUpdate(const TcpConnectionPtr& conn, uint32_t id, size_t increment)
+{
+    auto it = streams_.find(id);
+    // 流已经关闭了
+    if (it == streams_.end())
+        return;
+
+    it->second.window += increment;
+    schedule(it->second);
+
+    if (!writing_)
+        pump(conn);
+}
+
+void StreamMux::onWriteComplete(const TcpConnectionPtr& conn)
+{
+    writing_ = false;
+    if (!ready_.empty())
+        pump(conn);
+}
+
+void StreamMux::schedule(Stream& stream)
+{
+    if (!stream.ready && stream.window > 0 && !stream.messages.empty()) {
+        stream.ready = true;
+        ready_.push_back(stream.id);
+    }
+}
+
+/// @brief: 发送一轮, 每个有窗口的流一帧
+void StreamMux::pump(const TcpConnectionPtr& conn)
+{
+    Buffer buffer;
+    size_t sent = 0;
+
+    for (size_t n = ready_.size(); n > 0; n--) {
+        uint32_t id = ready_.front();
+        ready_.pop_front();
+
+        auto& stream = streams_[id];
+        auto& message = stream.messages.front();
+
+        size_t len = std::min({ kFrameSize, message.end - message.offset, stream.window });
+        bool last = message.offset + len == message.end;
+        bool final = last && stream.messages.size() == 1;
+
+        auto header = frameHeader(id, final ? kFrameFinal : last ? kFrameEnd : kFrameMore, len + 2);
+        buffer.append(header.data(), header.length());
+        buffer.append(message.data.data() + message.offset, len);
+        buffer.append("\r\n", 2);
+
+        sent += len;
+        stream.window -= len;
+        message.offset += len;
+        stream.ready = false;
+
+        if (last)
+            stream.messages.pop_front();
+        if (final) {
+            if (!stream.key.empty())
+                keys_.erase(stream.key);
+            streams_.erase(id);
+            continue;
+        }
+        // 窗口用完的流等窗口更新帧
+        schedule(stream);
+    }
+
+    queued_.fetch_sub(sent, std::memory_order_relaxed);
+    if (buffer.readableBytes() > 0) {
+        writing_ = true;
+        conn->send(buffer);
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include <jrpc/util.h>
+
+namespace jrpc
+{
+
+/// @brief: 一个连接上的逻辑流, 类似 http/2
+///         大的消息被切成不超过 kFrameSize 的帧, 各个流轮流发送, 每一轮每个流最多一帧,
+///         等这一轮写完 (onWriteComplete) 再发下一轮, 所以小的回应不会排在几 MB 的回应之后
+///         每个流有自己的窗口, 窗口用完就暂停, 等客户端的窗口更新帧
+///         同一个 id 的消息 (流式回应的分块和最后的结果) 总是在同一个流中, 保证顺序
+///         除了 enabled() 和 queuedBytes(), 只能在 IO 线程中调用
+class StreamMux: noncopyable
+{
+public:
+    static const size_t kFrameSize = 16 * 1024;
+
+    bool enabled() const
+    { return window_.load(std::memory_order_acquire) > 0; }
+
+    /// @brief: 还没有发送的字节数, 用于流式回应的流量控制
+    size_t queuedBytes() const
+    { return queued_.load(std::memory_order_relaxed); }
+
+    /// @brief: 收到客户端的 settings 帧, @c window 是每个流的初始窗口
+    void enable(size_t window);
+
+    /// @brief: @c message 是完整的消息: 长度 + crlf + 内容 + crlf, 分帧发送的只有内容
+    ///         小的消息并且 @c key 没有打开的流时返回 false, 由调用者直接发送;
+    ///         返回 true 时 @c message 已经被移走
+    ///         @c key 为空表示消息不需要和别的消息保持顺序
+    bool send(const TcpConnectionPtr& conn, const std::string& key, std::string& message);
+
+    void windowUpdate(const TcpConnectionPtr& conn, uint32_t stream, size_t increment);
+
+    void onWriteComplete(const TcpConnectionPtr& conn);
+
+private:
+    struct Message
+    {
+        std::string data;
+        size_t      offset; // 下一帧的开始
+        size_t      end;    // 内容的结束, 不包括末尾的 crlf
+    };
+
+    struct Stream
+    {
+        uint32_t            id = 0;
+        std::string         key;
+        size_t              window = 0;
+        bool                ready = false;
+        std::deque<Message> messages;
+    };
+
+    void schedule(Stream& stream);
+    void pump(const TcpConnectionPtr& conn);
+
+    std::atomic<size_t> window_{0};
+    std::atomic<size_t> queued_{0};
+    uint32_t            nextId_ = 1;
+    bool                writing_ = false; // 上一轮的帧还没有写完
+
+    std::unordered_map<uint32_t, Stream>      streams_;
+    std::unordered_map<std::string, uint32_t> keys_;
+    std::deque<uint32_t>                      ready_;
+};
+
+}
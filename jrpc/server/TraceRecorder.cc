@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include <jrpc/server/MethodStats.h>
+#include <jrpc/server/TraceRecorder.h>
+
+using namespace jrpc;
+
+namespace
+{
+
+bool sampleWith(double rate)
+{
+    if (rate <= 0)
+        return false;
+    if (rate >= 1)
+        return true;
+    thread_local std::mt19937_64 engine(std::random_device{}());
+    return std::uniform_real_distribution<double>(0, 1)(engine) < rate;
+}
+
+int64_t wallMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}
+
+TraceRecorder::TraceRecorder(size_t capacity)
+: sampleRate_(0),
+  ring_(capacity),
+  total_(0)
+{
+    assert(capacity > 0);
+}
+
+void TraceRecorder::setSampleRate(double rate)
+{
+    sampleRate_.store(std::clamp(rate, 0.0, 1.0), std::memory_order_relaxed);
+}
+
+TraceContext TraceRecorder::start(const TraceContext* upstream) const
+{
+    if (upstream != nullptr)
+        return upstream->child();
+    if (sampleWith(sampleRate()))
+        return TraceContext::root(true);
+    return TraceContext();
+}
+
+/// @brief: receivedAt 是 MethodStats::now(), 换算成墙上时间, 方便和其他服务器的 span 对齐
+void TraceRecorder::record(const TraceContext& trace, std::string_view method,
+                           int64_t receivedAt, int64_t queue, int64_t handler, int64_t serialize, int error)
+{
+    SpanRecord span;
+    span.trace = trace;
+    size_t n = std::min(method.size(), SpanRecord::kMaxMethod - 1);
+    memcpy(span.method, method.data(), n);
+    span.method[n] = '\0';
+    span.startUs = wallMicroseconds() - (MethodStats::now() - receivedAt) / 1000;
+    span.queue = queue;
+    span.handler = handler;
+    span.serialize = serialize;
+    span.error = error;
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    ring_[total_ % ring_.size()] = span;
+    total_++;
+}
+
+std::vector<SpanRecord> TraceRecorder::recent(size_t limit, std::string_view traceId) const
+{
+    TraceContext filter;
+    bool filtered = !traceId.empty();
+    if (filtered) {
+        // 借用 traceparent 的解析, 非法的 trace-id 不会匹配任何 span
+        std::string traceparent("00-");
+        traceparent.append(traceId).append("-0000000000000001-00");
+        if (!TraceContext::parse(traceparent, filter))
+            return {};
+    }
+
+    std::vector<SpanRecord> result;
+    std::lock_guard<std::mutex> guard(mutex_);
+    size_t n = static_cast<size_t>(std::min<uint64_t>(total_, ring_.size()));
+    for (size_t i = 1; i <= n && result.size() < limit; i++) {
+        auto& span = ring_[(total_ - i) % ring_.size()];
+        if (filtered && (span.trace.traceIdHigh != filter.traceIdHigh ||
+                         span.trace.traceIdLow != filter.traceIdLow))
+            continue;
+        result.push_back(span);
+    }
+    return result;
+}
+
+uint64_t TraceRecorder::numRecorded() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return total_;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include <libnet/noncopyable.h>
+
+#include <jrpc/Trace.h>
+
+namespace jrpc
+{
+
+/// @brief: 一个被采样的调用在这个服务器上的 span, 时间单位 ns, 和 MethodStats 的阶段相同
+struct SpanRecord
+{
+    static const size_t kMaxMethod = 64;
+
+    TraceContext trace;
+    char         method[kMaxMethod]; // 过长时截断, 以 '\0' 结尾
+    int64_t      startUs;            // 收到请求的时刻, 从 Epoch 开始的微秒
+    int64_t      queue;
+    int64_t      handler;
+    int64_t      serialize;
+    int          error;              // JSON-RPC 错误码, 0 表示成功
+};
+
+/// @brief: 最近被采样的 span 的环形缓冲区, 满了之后覆盖最旧的
+///         只有被采样的调用才会记录, 所以用一把锁就够了; 通过 rpc.traces 读取
+class TraceRecorder: net::noncopyable
+{
+public:
+    explicit TraceRecorder(size_t capacity = 4096);
+
+    /// @brief: 没有 traceparent 的请求以 rate 的概率开始一个新的被采样的 trace,
+    ///         0 (默认) 表示只追踪上游已经采样的请求, 任意线程都可以调用
+    void setSampleRate(double rate);
+    double sampleRate() const
+    { return sampleRate_.load(std::memory_order_relaxed); }
+
+    /// @brief: 为请求创建这个服务器上的 span: 有上游时是它的子 span, 否则按采样率开始新的 trace;
+    ///         都不满足时返回无效的上下文, 不追踪
+    TraceContext start(const TraceContext* upstream) const;
+
+    void record(const TraceContext& trace, std::string_view method,
+                int64_t receivedAt, int64_t queue, int64_t handler, int64_t serialize, int error);
+
+    // 从新到旧, 最多 limit 个; traceId 非空时只返回这个 trace 的 span
+    std::vector<SpanRecord> recent(size_t limit, std::string_view traceId = {}) const;
+
+    uint64_t numRecorded() const;
+    size_t capacity() const
+    { return ring_.size(); }
+
+private:
+    std::atomic<double>     sampleRate_;
+    mutable std::mutex      mutex_;
+    std::vector<SpanRecord> ring_;
+    uint64_t                total_; // ring_[total_ % size] 是下一个位置
+};
+
+}
@@ -56,6 +56,27 @@ public:
         cb_ = cb;
     }
 
+    // 之后的调用带上超时, 过期的请求服务器不再执行
+    void setTimeout(net::Millisecond timeout)
+    {
+        client_.setTimeout(timeout);
+    }
+
+    // 大的回应在逻辑流中分帧交错发送, 需要服务器支持, 在 start() 之前设置
+    void setMultiplexing(bool on)
+    {
+        client_.setMultiplexing(on);
+    }
+
+    // TCP_NODELAY, 默认打开, 在 start() 之前设置
+    void setTcpNoDelay(bool on)
+    {
+        client_.setTcpNoDelay(on);
+    }
+
+    // 调用的最后一个参数 trace 可选, 通常是处理函数的 done.trace(),
+    // 或者用 TraceContext::root(true) 开始一个新的 trace
+
     [procedureDefinitions]
     [notifyDefinitions]
 
@@ -81,7 +102,8 @@ std::string procedureDefineTemplate(
         const std::string& paramMembers)
 {
     std::string str = R"(
-void [procedureName]([procedureArgs] const ResponseCallback& cb)
+void [procedureName]([procedureArgs] const ResponseCallback& cb,
+        const TraceContext& trace = TraceContext())
 {
     json::Value params(json::TYPE_OBJECT);
     [paramMembers]
@@ -90,6 +112,8 @@ void [procedureName]([procedureArgs] const ResponseCallback& cb)
     call.addMember("jsonrpc", "2.0");
     call.addMember("method", "[serviceName].[procedureName]");
     call.addMember("params", params);
+    if (trace.valid())
+        call.addMember("traceparent", trace.traceparent());
 
     assert(conn_ != nullptr);
     client_.sendCall(conn_, call, cb);
@@ -102,6 +126,70 @@ void [procedureName]([procedureArgs] const ResponseCallback& cb)
     return str;
 }
 
+// 流式回应: 每个分块回调一次 onChunk, 最后的结果回调 cb
+std::string streamProcedureDefineTemplate(
+        const std::string& serviceName,
+        const std::string& procedureName,
+        const std::string& procedureArgs,
+        const std::string& paramMembers)
+{
+    std::string str = R"(
+void [procedureName]([procedureArgs] const ChunkCallback& onChunk, const ResponseCallback& cb,
+        const TraceContext& trace = TraceContext())
+{
+    json::Value params(json::TYPE_OBJECT);
+    [paramMembers]
+
+    json::Value call(json::TYPE_OBJECT);
+    call.addMember("jsonrpc", "2.0");
+    call.addMember("method", "[serviceName].[procedureName]");
+    call.addMember("params", params);
+    if (trace.valid())
+        call.addMember("traceparent", trace.traceparent());
+
+    assert(conn_ != nullptr);
+    client_.sendCall(conn_, call, cb, onChunk);
+}
+)";
+    replaceAll(str, "[serviceName]", serviceName);
+    replaceAll(str, "[procedureName]", procedureName);
+    replaceAll(str, "[procedureArgs]", procedureArgs);
+    replaceAll(str, "[paramMembers]", paramMembers);
+    return str;
+}
+
+// 上传: 返回的 UploadWriter 用来分块发送数据, end() 之后服务器回应, 回调 cb
+std::string uploadProcedureDefineTemplate(
+        const std::string& serviceName,
+        const std::string& procedureName,
+        const std::string& procedureArgs,
+        const std::string& paramMembers)
+{
+    std::string str = R"(
+UploadWriterPtr [procedureName]([procedureArgs] const ResponseCallback& cb,
+        const TraceContext& trace = TraceContext())
+{
+    json::Value params(json::TYPE_OBJECT);
+    [paramMembers]
+
+    json::Value call(json::TYPE_OBJECT);
+    call.addMember("jsonrpc", "2.0");
+    call.addMember("method", "[serviceName].[procedureName]");
+    call.addMember("params", params);
+    if (trace.valid())
+        call.addMember("traceparent", trace.traceparent());
+
+    assert(conn_ != nullptr);
+    return client_.sendUpload(conn_, call, cb);
+}
+)";
+    replaceAll(str, "[serviceName]", serviceName);
+    replaceAll(str, "[procedureName]", procedureName);
+    replaceAll(str, "[procedureArgs]", procedureArgs);
+    replaceAll(str, "[paramMembers]", paramMembers);
+    return str;
+}
+
 std::string notifyDefineTemplate(const std::string& serviceName,
                                  const std::string& notifyName,
                                  const std::string& notifyArgs,
@@ -197,7 +285,9 @@ std::string ClientStubGenerator::genProcedureDefinitions()
         auto  procedureArgs = genGenericArgs(r, true);
         auto  paramMembers = genGenericParamMembers(r);
 
-        auto str = procedureDefineTemplate(
+        auto define = r.stream ? streamProcedureDefineTemplate :
+                      r.upload ? uploadProcedureDefineTemplate : procedureDefineTemplate;
+        auto str = define(
                 serviceName,
                 procedureName,
                 procedureArgs,
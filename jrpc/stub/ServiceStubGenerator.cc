@@ -38,7 +38,9 @@ std::string serviceStubTemplate(const std::string& userClassName,
                                 const std::string& stubClassName,
                                 const std::string& serviceName,
                                 const std::string& stubProcedureBindings,
-                                const std::string& stubProcedureDefinitions)
+                                const std::string& stubProcedureDefinitions,
+                                const std::string& stubExecutors,
+                                const std::string& stubExecutorInits)
 {
     std::string str =
 R"(
@@ -68,6 +70,7 @@ protected:
         static_assert(std::is_same_v<S, [userClassName]>,
                       "derived class name should be '[userClassName]'");
 
+        [stubExecutorInits]
         auto service = new RpcService;
 
         [stubProcedureBindings]
@@ -85,6 +88,8 @@ private:
     {
         return static_cast<S&>(*this);
     }
+
+    [stubExecutors]
 };
 
 }
@@ -95,6 +100,8 @@ private:
     replaceAll(str, "[serviceName]",                serviceName);
     replaceAll(str, "[stubProcedureBindings]",      stubProcedureBindings);
     replaceAll(str, "[stubProcedureDefinitions]",   stubProcedureDefinitions);
+    replaceAll(str, "[stubExecutors]",              stubExecutors);
+    replaceAll(str, "[stubExecutorInits]",          stubExecutorInits);
     return str;
 }
 
@@ -158,70 +165,126 @@ std::string stubNotifyBindTemplate(const std::string& notifyName,
 /**
  * @paramsFromJsonArray：auto message = params[0].getString();
  * @paramsFromJsonObject：auto message = params["message"].getString();
- * @stubProcedureName：EchoStub
  * @procedureName：Echo
  * @procedureArgs: message
+ * @userCallback: UserDoneCallback(request, done, kPriorityNormal)
  * 
- * 
- * 
- *  void EchoStub(json::Value& request, const RpcDoneCallback& done)
-    {
-        auto& params = request["params"];
+ *      auto& params = request["params"];
 
         if (params.isArray()) {
             auto message = params[0].getString();
 
-            convert().Echo(message,  UserDoneCallback(request, done));
+            convert().Echo(message,  UserDoneCallback(request, done, kPriorityNormal));
         }
         else {
             auto message = params["message"].getString();
 
-            convert().Echo(message,  UserDoneCallback(request, done));
+            convert().Echo(message,  UserDoneCallback(request, done, kPriorityNormal));
         }
-    }
 */
-std::string stubProcedureDefineTemplate(const std::string& paramsFromJsonArray,
-                                        const std::string& paramsFromJsonObject,
-                                        const std::string& stubProcedureName,
-                                        const std::string& procedureName,
-                                        const std::string& procedureArgs)
+std::string stubProcedureBodyTemplate(const std::string& paramsFromJsonArray,
+                                      const std::string& paramsFromJsonObject,
+                                      const std::string& procedureName,
+                                      const std::string& procedureArgs,
+                                      const std::string& userCallback)
 {
    std::string str =
-    R"(void [stubProcedureName](json::Value& request, const RpcDoneCallback& done)
-    {
-        auto& params = request["params"];
+    R"(auto& params = request["params"];
 
         if (params.isArray()) {
             [paramsFromJsonArray]
-            convert().[procedureName]([procedureArgs] UserDoneCallback(request, done));
+            convert().[procedureName]([procedureArgs] [userCallback]);
         }
         else {
             [paramsFromJsonObject]
-            convert().[procedureName]([procedureArgs] UserDoneCallback(request, done));
-        }
-    })";
+            convert().[procedureName]([procedureArgs] [userCallback]);
+        })";
 
     replaceAll(str, "[paramsFromJsonArray]", paramsFromJsonArray);
     replaceAll(str, "[paramsFromJsonObject]", paramsFromJsonObject);
-    replaceAll(str, "[stubProcedureName]", stubProcedureName);
     replaceAll(str, "[procedureName]", procedureName);
     replaceAll(str, "[procedureArgs]", procedureArgs);
+    replaceAll(str, "[userCallback]", userCallback);
     return str;
 }
 
+std::string stubProcedureBodyTemplate(const std::string& procedureName,
+                                      const std::string& userCallback)
+{
+    std::string str = R"(convert().[procedureName]([userCallback]);)";
+
+    replaceAll(str, "[procedureName]", procedureName);
+    replaceAll(str, "[userCallback]", userCallback);
+    return str;
+}
+
+// "execution": "inline", 在 IO 线程上直接调用用户的函数
+/**
+ *  void EchoStub(json::Value& request, const RpcDoneCallback& done)
+    {
+        [body]
+    }
+*/
 std::string stubProcedureDefineTemplate(const std::string& stubProcedureName,
-                                        const std::string& procedureName)
+                                        const std::string& body)
 {
     std::string str =
-R"(
-void [stubProcedureName](json::Value& request, const RpcDoneCallback& done)
-{
-    convert().[procedureName](UserDoneCallback(request, done));
+    R"(void [stubProcedureName](json::Value& request, const RpcDoneCallback& done)
+    {
+        [body]
+    })";
+
+    replaceAll(str, "[stubProcedureName]", stubProcedureName);
+    replaceAll(str, "[body]", body);
+    return str;
 }
-)";
+
+// "execution": "pool" / "dedicated", 在 IO 线程上构造回调 (上传的方法要在这里认领上传流),
+// 再把请求交给线程池, 出队时客户端已经不再等待的请求直接回复超时
+// 请求和回调都移动进任务, 之后 IO 线程不再使用 request, 只有回调里的一次复制
+// WorkStealingPool 没有优先级, 提交任务时不带 priority
+// 共享的线程池每次都向 RpcServer 要, 开启了 setNumaLocalWorkers() 时得到的是 IO 线程所在节点的那一组
+/**
+ * @executor: server_->workerPool() / server_->stealingPool() / (*EchoPool_)
+ *
+ *  void EchoStub(json::Value& request, const RpcDoneCallback& done)
+    {
+        UserDoneCallback cb(request, done, kPriorityNormal);
+        server_->workerPool().runTask([this, request = std::move(request), cb = std::move(cb)]() mutable
+                             {
+                                 ProfileScope profile(cb.method());
+                                 if (cb.rejectIfExpired())
+                                     return;
+                                 [body]
+                             }, kPriorityNormal);
+    }
+*/
+std::string stubProcedureOffloadTemplate(const std::string& stubProcedureName,
+                                         const std::string& userCallbackName,
+                                         const std::string& priority,
+                                         const std::string& executor,
+                                         bool stealing,
+                                         const std::string& body)
+{
+    std::string str =
+    R"(void [stubProcedureName](json::Value& request, const RpcDoneCallback& done)
+    {
+        [userCallbackName] cb(request, done, [priority]);
+        [executor].runTask([this, request = std::move(request), cb = std::move(cb)]() mutable
+                            {
+                                ProfileScope profile(cb.method());
+                                if (cb.rejectIfExpired())
+                                    return;
+                                [body]
+                            }[taskPriority]);
+    })";
 
     replaceAll(str, "[stubProcedureName]", stubProcedureName);
-    replaceAll(str, "[procedureName]", procedureName);
+    replaceAll(str, "[userCallbackName]", userCallbackName);
+    replaceAll(str, "[taskPriority]", stealing ? std::string() : ", " + priority);
+    replaceAll(str, "[priority]", priority);
+    replaceAll(str, "[executor]", executor);
+    replaceAll(str, "[body]", body);
     return str;
 }
 
@@ -323,7 +386,9 @@ std::string ServiceStubGenerator::genStub()
                                stubClassName,
                                serviceName,
                                bindings,
-                               definitions);
+                               definitions,
+                               genStubExecutors(),
+                               genStubExecutorInits());
 }
 
 std::string ServiceStubGenerator::genUserClassName()
@@ -363,27 +428,99 @@ std::string ServiceStubGenerator::genStubProcedureDefinitions()
     for (RpcReturn& r: serviceInfo_.rpcReturn) {
         auto procedureName     = r.name;
         auto stubProcedureName = genStubGenericName(r);
-
+        // 流式回应的方法拿到的是 UserStreamCallback, 上传的方法拿到的是 UserUploadCallback
+        std::string userCallbackName = r.stream ? "UserStreamCallback" :
+                                       r.upload ? "UserUploadCallback" : "UserDoneCallback";
+        // 交给线程池的方法在 IO 线程上先构造好回调
+        auto userCallback = r.execution == kExecInline ?
+                            userCallbackName + "(request, done, " + r.priority + ")" :
+                            std::string("cb");
+
+        std::string body;
         if (r.params.getSize() > 0) {
             auto paramsFromJsonArray  = genParamsFromJsonArray(r);
             auto paramsFromJsonObject = genParamsFromJsonObject(r);
             auto procedureArgs        = genGenericArgs(r);
-            auto define               = stubProcedureDefineTemplate(paramsFromJsonArray,
-                                                                    paramsFromJsonObject,
-                                                                    stubProcedureName,
-                                                                    procedureName,
-                                                                    procedureArgs);
+            body = stubProcedureBodyTemplate(paramsFromJsonArray,
+                                             paramsFromJsonObject,
+                                             procedureName,
+                                             procedureArgs,
+                                             userCallback);
+        }
+        else {
+            body = stubProcedureBodyTemplate(procedureName, userCallback);
+        }
 
-            result.append(define);
-            result.append("\n");
+        if (r.execution == kExecInline) {
+            result.append(stubProcedureDefineTemplate(stubProcedureName, body));
         }
         else {
-            auto define = stubProcedureDefineTemplate(stubProcedureName,procedureName);
+            result.append(stubProcedureOffloadTemplate(stubProcedureName,
+                                                       userCallbackName,
+                                                       r.priority,
+                                                       genExecutor(r),
+                                                       r.stealing,
+                                                       body));
+        }
+        result.append("\n");
+    }
+    return result;
+}
 
-            result.append(define);
-            result.append("\n");
+// 独占的线程池的成员名
+std::string ServiceStubGenerator::genExecutorName(const RpcReturn& r)
+{
+    return r.name + "Pool_";
+}
+
+// 提交任务的线程池表达式
+std::string ServiceStubGenerator::genExecutor(const RpcReturn& r)
+{
+    if (r.execution == kExecDedicated)
+        return "(*" + genExecutorName(r) + ")";
+    return r.stealing ? "server_->stealingPool()" : "server_->workerPool()";
+}
+
+// 线程池成员: 共享的线程池属于 RpcServer, 独占的线程池属于 stub
+std::string ServiceStubGenerator::genStubExecutors()
+{
+    std::string result;
+    bool shared = false;
+    for (RpcReturn& r: serviceInfo_.rpcReturn) {
+        std::string type = r.stealing ? "WorkStealingPool" : "ThreadPool";
+        if (r.execution == kExecPool)
+            shared = true;
+        else if (r.execution == kExecDedicated)
+            result.append("std::unique_ptr<" + type + "> " + genExecutorName(r) + ";\n    ");
+    }
+    if (shared)
+        result.append("RpcServer* server_;\n    ");
+    return result;
+}
+
+// 共享的线程池在服务启动之前创建, 之后 IO 线程只从 RpcServer 读; 独占的线程池也在这时登记
+std::string ServiceStubGenerator::genStubExecutorInits()
+{
+    std::string result;
+    bool shared = false, sharedStealing = false;
+    for (RpcReturn& r: serviceInfo_.rpcReturn) {
+        std::string type = r.stealing ? "WorkStealingPool" : "ThreadPool";
+        if (r.execution == kExecPool)
+            (r.stealing ? sharedStealing : shared) = true;
+        else if (r.execution == kExecDedicated) {
+            // 独占的线程池登记到 RpcServer, rpc.stats 按方法报告它的队列
+            result.append(genExecutorName(r) + " = std::make_unique<" + type + ">(" +
+                          std::to_string(r.threads) + ");\n        ");
+            result.append("server.registerPool(\"" + serviceInfo_.name + "." + r.name + "\", " +
+                          genExecutorName(r) + ".get());\n        ");
         }
     }
+    if (shared || sharedStealing)
+        result.append("server_ = &server;\n        ");
+    if (shared)
+        result.append("server.workerPool();\n        ");
+    if (sharedStealing)
+        result.append("server.stealingPool();\n        ");
     return result;
 }
 
@@ -22,6 +22,10 @@ private:
     std::string genStubProcedureDefinitions();
     std::string genStubNotifyBindings();
     std::string genStubNotifyDefinitions();
+    std::string genStubExecutors();
+    std::string genStubExecutorInits();
+    std::string genExecutorName(const RpcReturn& r);
+    std::string genExecutor(const RpcReturn& r);
 
     template <typename Rpc>
     std::string genStubGenericName(const Rpc& r);
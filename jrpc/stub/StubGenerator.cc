@@ -1,3 +1,5 @@
+#include <stdio.h>
+
 #include <unordered_set>
 
 #include <jrpc/stub/StubGenerator.h>
@@ -67,6 +69,99 @@ void StubGenerator::parseRpc(json::Value& rpc)
     if (hasReturns) {
         validateReturns(returns->value);
     }
+
+    auto stream = rpc.findMember("stream");
+    bool isStream = stream != rpc.memberEnd();
+    if (isStream) {
+        expect(stream->value.isBool(),
+               "rpc stream must be bool");
+        expect(hasReturns,
+               "stream rpc must have returns");
+        isStream = stream->value.getBool();
+    }
+
+    auto upload = rpc.findMember("upload");
+    bool isUpload = upload != rpc.memberEnd();
+    if (isUpload) {
+        expect(upload->value.isBool(),
+               "rpc upload must be bool");
+        expect(hasReturns,
+               "upload rpc must have returns");
+        isUpload = upload->value.getBool();
+        expect(!(isUpload && isStream),
+               "rpc can not be both stream and upload");
+    }
+
+    // 可选的优先级: "high", "normal", "low"
+    std::string priorityName = "kPriorityNormal";
+    auto priority = rpc.findMember("priority");
+    if (priority != rpc.memberEnd()) {
+        expect(priority->value.isString(),
+               "rpc priority must be string");
+        expect(hasReturns,
+               "notify can not have priority");
+        auto level = priority->value.getStringView();
+        if (level == "high")
+            priorityName = "kPriorityHigh";
+        else if (level == "low")
+            priorityName = "kPriorityLow";
+        else
+            expect(level == "normal",
+                   "rpc priority must be 'high', 'normal' or 'low'");
+    }
+
+    // 可选的执行方式: "inline" 在 IO 线程上直接执行, "pool" 交给 RpcServer 共享的线程池,
+    // "dedicated" 交给这个方法独占的线程池, 线程数由 "threads" 指定
+    Execution execution = kExecInline;
+    int threads = 1;
+    auto exec = rpc.findMember("execution");
+    if (exec != rpc.memberEnd()) {
+        expect(exec->value.isString(),
+               "rpc execution must be string");
+        expect(hasReturns,
+               "notify can not have execution");
+        auto mode = exec->value.getStringView();
+        if (mode == "pool")
+            execution = kExecPool;
+        else if (mode == "dedicated")
+            execution = kExecDedicated;
+        else
+            expect(mode == "inline",
+                   "rpc execution must be 'inline', 'pool' or 'dedicated'");
+    }
+    auto numThreads = rpc.findMember("threads");
+    if (numThreads != rpc.memberEnd()) {
+        expect(execution == kExecDedicated,
+               "rpc threads requires dedicated execution");
+        expect(numThreads->value.isInt32() && numThreads->value.getInt32() > 0,
+               "rpc threads must be positive integer");
+        threads = numThreads->value.getInt32();
+    }
+    // 可选的线程池类型: "thread" 是带优先级的 ThreadPool, "stealing" 是没有优先级的 WorkStealingPool
+    bool stealing = false;
+    auto pool = rpc.findMember("pool");
+    if (pool != rpc.memberEnd()) {
+        expect(pool->value.isString(),
+               "rpc pool must be string");
+        expect(execution != kExecInline,
+               "rpc pool requires pool or dedicated execution");
+        auto kind = pool->value.getStringView();
+        if (kind == "stealing")
+            stealing = true;
+        else
+            expect(kind == "thread",
+                   "rpc pool must be 'thread' or 'stealing'");
+    }
+    // 优先级只在提交到 ThreadPool 时生效: WorkStealingPool 没有优先级, 直接拒绝;
+    // inline 的方法在 IO 线程上执行, 只有处理函数自己通过 cb.priority() 提交任务时才用得到, 给出警告
+    if (priority != rpc.memberEnd()) {
+        expect(!stealing,
+               "stealing pool has no priority");
+        if (execution == kExecInline)
+            fprintf(stderr, "warning: %s.%s: priority has no effect on inline execution, "
+                            "only cb.priority() sees it\n",
+                    serviceInfo_.name.c_str(), name->value.getString().c_str());
+    }
     
     // 无参数调用
     // auto (*)(void)
@@ -76,6 +171,12 @@ void StubGenerator::parseRpc(json::Value& rpc)
     // 无返回值 void (*)
     if (hasReturns) {
         RpcReturn r(name->value.getString(), paramsValue, returns->value);
+        r.stream = isStream;
+        r.upload = isUpload;
+        r.priority = priorityName;
+        r.execution = execution;
+        r.stealing = stealing;
+        r.threads = threads;
         serviceInfo_.rpcReturn.push_back(r);
     }
     else {
@@ -21,17 +21,37 @@ public:
     virtual std::string genStubClassName() = 0;
 
 protected:
+    // 方法在哪里执行
+    enum Execution
+    {
+        kExecInline,    // IO 线程
+        kExecPool,      // RpcServer::workerPool()
+        kExecDedicated, // 方法独占的线程池
+    };
+
     struct RpcReturn
     {
         RpcReturn(const std::string& name_, json::Value& params_, json::Value& returns_)
         : name(name_), 
           params(params_),
-          returns(returns_)
+          returns(returns_),
+          stream(false),
+          upload(false),
+          priority("kPriorityNormal"),
+          execution(kExecInline),
+          stealing(false),
+          threads(1)
         { }
 
         std::string name;
         mutable json::Value params;
         mutable json::Value returns;
+        bool stream; // 流式回应, 结果分块返回
+        bool upload; // 流式请求, 除了 params 之外的数据分块上传
+        std::string priority; // 方法的优先级, net::Priority 的枚举名
+        Execution execution;
+        bool stealing; // 线程池是 WorkStealingPool 而不是 ThreadPool
+        int threads; // kExecDedicated 的线程数
     };
 
     struct RpcNotify
@@ -0,0 +1,337 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <future>
+#include <thread>
+
+#include <jrpc/client/BaseClient.h>
+#include <jrpc/server/RpcServer.h>
+#include <jrpc/server/RpcService.h>
+
+using namespace jrpc;
+
+namespace
+{
+
+int failures = 0;
+
+// 不依赖测试框架, 失败时打印位置并在 main 中返回非零
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+const size_t kChunkSize = 1024;
+const int    kMaxWrites = 4096;       // 4MB, 远远超过连接的高水位 (64KB)
+const size_t kHighWatermark = 65536;
+
+/// @brief: 阻塞的原始 socket, 服务器还没有开始监听时重试
+int rawConnect(uint16_t port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    while (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == -1) {
+        ::close(fd);
+        std::this_thread::sleep_for(10ms);
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    }
+    return fd;
+}
+
+/// @brief: 按 长度 + crlf + 消息 + crlf 的格式发送一个消息
+void rawSend(int fd, const std::string& json)
+{
+    auto body = json + "\r\n";
+    auto message = std::to_string(body.size()).append("\r\n").append(body);
+    CHECK(::write(fd, message.data(), message.size()) == static_cast<ssize_t>(message.size()));
+}
+
+/// @brief: 一直读到 @c until 出现或者连接关闭为止
+std::string rawReceive(int fd, std::string_view until)
+{
+    std::string received;
+    char buf[65536];
+    while (received.find(until) == std::string::npos) {
+        ssize_t n = ::read(fd, buf, sizeof buf);
+        if (n <= 0)
+            break;
+        received.append(buf, static_cast<size_t>(n));
+    }
+    return received;
+}
+
+/// @brief: 发送一个请求, 一直读到 @c until 出现为止
+std::string rawCall(uint16_t port, const std::string& json, std::string_view until)
+{
+    int fd = rawConnect(port);
+    rawSend(fd, json);
+    auto received = rawReceive(fd, until);
+    ::close(fd);
+    return received;
+}
+
+/// @brief: 等服务器处理完 rawCall() 关闭的连接再退出 loop, 服务器析构时不能还有连接
+void quitWhenClosed(RpcServer& server, EventLoop& loop)
+{
+    for (;;) {
+        size_t connections = 0;
+        for (auto& load: server.loopLoads())
+            connections += load.connections;
+        if (connections == 0)
+            break;
+        std::this_thread::sleep_for(1ms);
+    }
+    loop.quit();
+}
+
+int rawListen(uint16_t port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    CHECK(::listen(fd, 1) == 0);
+    return fd;
+}
+
+}
+
+/// @brief: 处理函数在线程池中一直写分块, 写完之前 IO 线程不处理任何排队的发送,
+///         高水位回调不会执行, 只有入队时的计数能让 write() 返回 false
+void testStreamWriteFromPoolThread()
+{
+    const uint16_t port = 19877;
+    EventLoop loop;
+    RpcServer server(&loop, InetAddress(port));
+    server.setWorkerThreads(1);
+
+    std::atomic<int> accepted(-1);
+    std::atomic<bool> resumed(false);
+
+    auto service = new RpcService;
+    service->addProcedureReturn("Export", new ProcedureReturn(
+        [&](json::Value& request, const RpcDoneCallback& done)
+        {
+            UserStreamCallback stream(request, done);
+            std::promise<void> written;
+            server.workerPool().runTask([&, stream]
+            {
+                std::string payload(kChunkSize, 'x');
+                int n = 0;
+                while (n < kMaxWrites &&
+                       stream.write(json::Value(payload), [&, stream]{ resumed = true; stream(json::Value("done")); }))
+                    n++;
+                accepted = n;
+                if (n == kMaxWrites)
+                    stream(json::Value("done"));
+                written.set_value();
+            });
+            written.get_future().wait();
+        }));
+    server.addService("Test", service);
+    server.start();
+
+    std::string response;
+    std::thread client([&]
+    {
+        response = rawCall(port, R"({"jsonrpc":"2.0","method":"Test.Export","id":1})", R"("result":"done")");
+        quitWhenClosed(server, loop);
+    });
+    loop.loop();
+    client.join();
+
+    CHECK(accepted > 0);
+    CHECK(accepted < kMaxWrites);
+    CHECK(static_cast<size_t>(accepted) * kChunkSize <= 2 * kHighWatermark);
+    CHECK(resumed);
+    CHECK(response.find(R"("result":"done")") != std::string::npos);
+}
+
+/// @brief: IO 线程先写一个分块 (直接写完, 写完回调排队), 再让线程池写 kBurst 个分块,
+///         它们在写完回调之后执行; 写完回调只能释放已经写出的字节, 排队中的分块仍然计入准入控制的预算
+void testAdmissionCountsQueuedOutput()
+{
+    const uint16_t port = 19879;
+    const int kBurst = 16;
+    EventLoop loop;
+    RpcServer server(&loop, InetAddress(port));
+    server.setWorkerThreads(1);
+
+    std::atomic<size_t> observed(0);
+    auto service = new RpcService;
+    service->addProcedureReturn("Burst", new ProcedureReturn(
+        [&](json::Value& request, const RpcDoneCallback& done)
+        {
+            UserStreamCallback stream(request, done);
+            std::string payload(kChunkSize, 'x');
+            stream.write(json::Value(payload));
+
+            std::promise<void> written;
+            server.workerPool().runTask([&, stream, payload]
+            {
+                for (int i = 0; i < kBurst; i++)
+                    stream.write(json::Value(payload));
+                // 排在所有分块的发送之后, 它们的写完回调之前
+                loop.queueInLoop([&]{ observed = server.admittedBytes(); });
+                written.set_value();
+            });
+            written.get_future().wait();
+            stream(json::Value("done"));
+        }));
+    server.addService("Test", service);
+    server.start();
+
+    std::thread client([&]
+    {
+        rawCall(port, R"({"jsonrpc":"2.0","method":"Test.Burst","id":1})", R"("result":"done")");
+        quitWhenClosed(server, loop);
+    });
+    loop.loop();
+    client.join();
+
+    CHECK(observed >= kBurst * kChunkSize);
+}
+
+/// @brief: 上传的线程一直写分块, 写完之前客户端的 IO 线程被阻塞, 只有入队时的计数能让 write() 返回 false
+///         服务器只接收数据, 读到结束帧之后关闭连接, 客户端看到连接断开再退出
+void testUploadWriteFromOtherThread()
+{
+    const uint16_t port = 19878;
+    int listenfd = rawListen(port);
+    std::thread server([listenfd]
+    {
+        int fd = ::accept(listenfd, nullptr, nullptr);
+        std::string received;
+        char buf[65536];
+        while (received.find(R"("end":true)") == std::string::npos) {
+            ssize_t n = ::read(fd, buf, sizeof buf);
+            if (n <= 0)
+                break;
+            // 只保留末尾, 结束帧可能跨两次读
+            received.append(buf, static_cast<size_t>(n));
+            if (received.size() > 2 * sizeof buf)
+                received.erase(0, received.size() - sizeof buf);
+        }
+        ::close(fd);
+    });
+
+    EventLoop loop;
+    BaseClient client(&loop, InetAddress("127.0.0.1", port));
+    std::promise<TcpConnectionPtr> connected;
+    std::promise<void> disconnected;
+    client.setConnectionCallback([&](const TcpConnectionPtr& conn)
+                                 {
+                                    if (conn->connected())
+                                        connected.set_value(conn);
+                                    else
+                                        disconnected.set_value();
+                                 });
+    client.start();
+
+    std::atomic<int> accepted(-1);
+    bool resumed = false;
+    std::thread uploader([&]
+    {
+        auto conn = connected.get_future().get();
+        std::promise<UploadWriterPtr> created;
+        loop.runInLoop([&]
+        {
+            json::Value call(json::TYPE_OBJECT);
+            call.addMember("jsonrpc", "2.0");
+            call.addMember("method", "Test.Import");
+            created.set_value(client.sendUpload(conn, call, [](json::Value&, bool, bool){}));
+        });
+        auto writer = created.get_future().get();
+
+        std::promise<void> release;
+        auto blocked = release.get_future().share();
+        loop.runInLoop([blocked]{ blocked.wait(); });
+
+        std::promise<void> resume;
+        std::string payload(kChunkSize, 'x');
+        int n = 0;
+        while (n < kMaxWrites && writer->write(json::Value(payload), [&resume]{ resume.set_value(); }))
+            n++;
+        accepted = n;
+        release.set_value();
+
+        resumed = n < kMaxWrites &&
+                  resume.get_future().wait_for(10s) == std::future_status::ready;
+        writer->end();
+        disconnected.get_future().wait();
+        loop.runInLoop([&loop]{ loop.quit(); });
+    });
+    loop.loop();
+    uploader.join();
+    server.join();
+    ::close(listenfd);
+
+    CHECK(accepted > 0);
+    CHECK(accepted < kMaxWrites);
+    CHECK(static_cast<size_t>(accepted) * kChunkSize <= 2 * kHighWatermark);
+    CHECK(resumed);
+}
+
+/// @brief: 客户端给从不调用的 id 发分块, 服务器缓存这些分块并计入准入控制的预算,
+///         未认领的流超过上限时回应错误并关闭连接, 缓存的分块随之释放
+void testUnclaimedUploadsAreBounded()
+{
+    const uint16_t port = 19880;
+    const int kChunks = 8;
+    EventLoop loop;
+    RpcServer server(&loop, InetAddress(port));
+    server.addService("Test", new RpcService);
+    server.start();
+
+    std::atomic<size_t> charged(0);
+    std::string response;
+    std::thread client([&]
+    {
+        int fd = rawConnect(port);
+        std::string payload(kChunkSize, 'x');
+        for (int i = 0; i < kChunks; i++)
+            rawSend(fd, R"({"jsonrpc":"2.0","chunk":")" + payload + R"(","id":0})");
+        // 分块是 IO 线程缓存的, 等它们都计入预算
+        for (int i = 0; i < 1000 && server.admittedBytes() < kChunks * kChunkSize; i++)
+            std::this_thread::sleep_for(1ms);
+        charged = server.admittedBytes();
+
+        for (size_t id = 1; id <= UploadTable::kDefaultMaxUnclaimed; id++)
+            rawSend(fd, R"({"jsonrpc":"2.0","chunk":1,"id":)" + std::to_string(id) + "}");
+        response = rawReceive(fd, "unclaimed");
+        ::close(fd);
+        quitWhenClosed(server, loop);
+    });
+    loop.loop();
+    client.join();
+
+    CHECK(charged >= kChunks * kChunkSize);
+    CHECK(response.find("too many unclaimed uploads") != std::string::npos ||
+          response.find("too many unclaimed upload chunks") != std::string::npos);
+    CHECK(server.admittedBytes() == 0);
+}
+
+int main()
+{
+    testStreamWriteFromPoolThread();
+    testAdmissionCountsQueuedOutput();
+    testUploadWriteFromOtherThread();
+    testUnclaimedUploadsAreBounded();
+    if (failures == 0)
+        printf("all tests passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+#include <jrpc/util.h>
+#include <jrpc/server/MethodStats.h>
+#include <jrpc/server/TraceRecorder.h>
+
+using namespace jrpc;
+
+void RpcDoneCallback::recordSpan(const json::Value& request,
+                                 int64_t queue, int64_t handler, int64_t serialize, int error) const
+{
+    if (tracer_ != nullptr)
+        tracer_->record(trace_, request["method"].getStringView(), receivedAt_,
+                        queue, handler, serialize, error);
+}
+
+UserDoneCallback::UserDoneCallback(json::Value &request,
+                                   const RpcDoneCallback &callback,
+                                   Priority priority)
+: request_(request),
+  callback_(callback),
+  priority_(priority),
+  startedAt_(callback.stats() != nullptr ? MethodStats::now() : 0)
+{ }
+
+void UserDoneCallback::operator()(json::Value &&result) const
+{
+    auto stats = callback_.stats();
+    int64_t doneAt = stats != nullptr ? MethodStats::now() : 0;
+
+    // 快速路径: 不需要构造回应的 json::Value
+    if (callback_.hasResultCallback()) {
+        callback_.sendResult(request_["id"], result);
+    }
+    else {
+        json::Value response(json::TYPE_OBJECT);
+        response.addMember("jsonrpc", "2.0");
+        response.addMember("id", request_["id"]);
+        response.addMember("result", result);
+        // 这个callback_ 才是最后的 回应客户端
+        callback_(response);
+    }
+
+    if (stats != nullptr) {
+        int64_t queue = startedAt_ - callback_.receivedAt();
+        int64_t serialize = MethodStats::now() - doneAt;
+        stats->end(queue, doneAt - startedAt_, serialize);
+        callback_.recordSpan(request_, queue, doneAt - startedAt_, serialize, 0);
+    }
+}
+
+bool UserDoneCallback::rejectIfExpired() const
+{
+    if (!expired()) {
+        if (callback_.stats() != nullptr)
+            startedAt_ = MethodStats::now();
+        return false;
+    }
+    callback_(errorResponse(RPC_DEADLINE_EXCEEDED, request_["id"], "request expired in queue"));
+    if (callback_.stats() != nullptr) {
+        callback_.stats()->fail(RPC_DEADLINE_EXCEEDED);
+        callback_.recordSpan(request_, MethodStats::now() - callback_.receivedAt(), 0, 0,
+                             RpcError(RPC_DEADLINE_EXCEEDED).asCode());
+    }
+    return true;
+}
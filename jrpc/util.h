@@ -1,10 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include <cppJson/Value.h>
 
+#include <jrpc/Exception.h>
+#include <jrpc/Trace.h>
+
 #include <libnet/EventLoop.h>
 #include <libnet/TcpConnection.h>
 #include <libnet/TcpServer.h>
@@ -12,9 +23,11 @@
 #include <libnet/InetAddress.h>
 #include <libnet/Buffer.h>
 #include <libnet/Logger.h>
+#include <libnet/Profiler.h>
 #include <libnet/Callbacks.h>
 #include <libnet/Timestamp.h>
 #include <libnet/ThreadPool.h>
+#include <libnet/WorkStealingPool.h>
 #include <libnet/CountDownLatch.h>
 
 namespace jrpc
@@ -38,31 +51,562 @@ using net::noncopyable;
 using net::Buffer;
 using net::ConnectionCallback;
 using net::ThreadPool;
+using net::WorkStealingPool;
+using net::ThreadInitCallback;
 using net::CountDownLatch;
+using net::Task;
+using net::Priority;
+using net::kPriorityHigh;
+using net::kPriorityNormal;
+using net::kPriorityLow;
+using net::ProfileScope;
 
-using RpcDoneCallback = std::function<void(json::Value response)>; 
+// 服务器端的类型, 只在 util.cc 中用到完整定义
+class MethodStats;
+class TraceRecorder;
 
-class UserDoneCallback
+using RpcResponseCallback = std::function<void(json::Value response)>;
+using RpcResultCallback   = std::function<void(const json::Value& id, const json::Value& result)>;
+using RpcChunkCallback    = std::function<bool(const json::Value& id, const json::Value& chunk, const Task& resume)>;
+
+/// @brief: 把请求的 id 转换成字符串, 用作表的键
+///         id 只可能是 string, int32, int64, null
+inline std::string idKey(const json::Value& id)
+{
+    switch (id.getType()) {
+        case json::TYPE_INT32:
+            return std::to_string(id.getInt32());
+        case json::TYPE_INT64:
+            return std::to_string(id.getInt64());
+        case json::TYPE_STRING:
+            return std::string("\"").append(id.getStringView());
+        default:
+            return "null";
+    }
+}
+
+/// @brief: 错误回应 {"jsonrpc":"2.0","error":{"code":..,"message":..,"data":[detail]},"id":[id]}
+inline json::Value errorResponse(RpcError err, const json::Value& id, const char* detail)
+{
+    json::Value response(json::TYPE_OBJECT);
+    response.addMember("jsonrpc", "2.0");
+    auto& value = response.addMember("error", json::TYPE_OBJECT);
+    value.addMember("code", err.asCode());
+    value.addMember("message", err.asString());
+    value.addMember("data", detail);
+    response.addMember("id", id);
+    return response;
+}
+
+inline int64_t nowMicroseconds()
+{
+    return std::chrono::duration_cast<net::Microsecond>(
+            net::clock::now().time_since_epoch()).count();
+}
+
+/// @brief: 请求信封中可选的 "timeout" 字段, 单位毫秒, 从服务器收到请求开始计算
+///         RpcServer::validateRequest 把它换算成绝对的截止时间 (微秒), 之后的阶段直接比较
+inline bool requestExpired(const json::Value& request)
+{
+    auto deadline = request.findMember("timeout");
+    if (deadline == request.memberEnd())
+        return false;
+    return nowMicroseconds() >= deadline->value.getInt64();
+}
+
+/// @brief: 多路复用的帧以 '@' 开头, 和以长度开头的普通消息区分
+///         数据帧 (服务器 -> 客户端): @[stream] [M|E|F] [len]\r\n[payload]\r\n, len 包括末尾的 crlf
+///             M: 消息还没有结束, E: 消息结束, F: 消息结束并且流关闭
+///         控制帧 (客户端 -> 服务器): @0 S [window]\r\n    开启多路复用, 每个流的初始窗口
+///                                    @[stream] W [n]\r\n  流的窗口增加 n 字节
+struct FrameHeader
+{
+    uint32_t stream;
+    char     type;
+    size_t   value;
+};
+
+const char kFrameMore        = 'M';
+const char kFrameEnd         = 'E';
+const char kFrameFinal       = 'F';
+const char kFrameSettings    = 'S';
+const char kFrameWindow      = 'W';
+
+/// @param: [begin, crlf) 是不包括 crlf 的一行
+inline bool parseFrameHeader(const char* begin, const char* crlf, FrameHeader& header)
+{
+    std::string line(begin, crlf);
+    char end;
+    if (std::sscanf(line.c_str(), "@%u %c %zu%c",
+                    &header.stream, &header.type, &header.value, &end) != 3)
+        return false;
+
+    switch (header.type) {
+        case kFrameMore:
+        case kFrameEnd:
+        case kFrameFinal:
+        case kFrameSettings:
+        case kFrameWindow:
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline std::string frameHeader(uint32_t stream, char type, size_t value)
+{
+    return std::string("@").append(std::to_string(stream))
+                           .append(1, ' ').append(1, type)
+                           .append(1, ' ').append(std::to_string(value))
+                           .append("\r\n");
+}
+
+using UploadChunkCallback  = std::function<void(json::Value& chunk)>;
+using UploadEndCallback    = std::function<void()>;
+using UploadMemoryCallback = std::function<void(size_t bytes)>;
+
+/// @brief: 一个连接上还没有交付给处理函数的分块占用的内存, 连接上所有的 UploadStream 共享
+///         charge/release 把它计入服务器准入控制的预算, limit 是这个连接最多缓存的字节数
+class UploadMemory: noncopyable
 {
 public:
-    UserDoneCallback(json::Value &request, const RpcDoneCallback &callback)
-    : request_(request),
-      callback_(callback)
+    UploadMemory(UploadMemoryCallback charge, UploadMemoryCallback release, size_t limit)
+    : charge_(std::move(charge)),
+      release_(std::move(release)),
+      limit_(limit),
+      pending_(0)
+    {}
+
+    /// @brief: IO 线程中缓存分块之前调用, 超过 limit 时返回 false
+    bool acquire(size_t bytes)
+    {
+        if (pending_.load() + bytes > limit_)
+            return false;
+        pending_ += bytes;
+        if (charge_)
+            charge_(bytes);
+        return true;
+    }
+
+    /// @brief: 分块交付或者丢弃之后调用, 任意线程
+    void release(size_t bytes)
+    {
+        if (bytes == 0)
+            return;
+        assert(pending_ >= bytes);
+        pending_ -= bytes;
+        if (release_)
+            release_(bytes);
+    }
+
+private:
+    UploadMemoryCallback charge_;
+    UploadMemoryCallback release_;
+    const size_t         limit_;
+    std::atomic<size_t>  pending_;
+};
+
+using UploadMemoryPtr = std::shared_ptr<UploadMemory>;
+
+/// @brief: 客户端上传的一个请求流, 分块 {"jsonrpc":"2.0","chunk":[chunk],"id":[id]}
+///         由 IO 线程写入, 交给用户注册的回调; 注册之前到达的分块先缓存起来
+///         回调在锁内串行执行, 保证分块的顺序, 但不一定在同一个线程
+class UploadStream: noncopyable
+{
+public:
+    explicit UploadStream(UploadMemoryPtr memory)
+    : memory_(std::move(memory))
+    {}
+
+    void setCallbacks(UploadChunkCallback onChunk, UploadEndCallback onEnd)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        assert(!ready_);
+        ready_   = true;
+        onChunk_ = std::move(onChunk);
+        onEnd_   = std::move(onEnd);
+
+        for (auto& chunk: pending_)
+            deliver(chunk);
+        releasePending();
+        if (ended_)
+            finish();
+    }
+
+    /// @param: bytes 分块在消息中的长度, 缓存时计入 UploadMemory
+    /// @return: 连接缓存的分块超过限制时返回 false, 分块被丢弃
+    bool pushChunk(json::Value chunk, size_t bytes)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (ready_) {
+            deliver(chunk);
+            return true;
+        }
+        if (!memory_->acquire(bytes))
+            return false;
+        pending_.push_back(std::move(chunk));
+        pendingBytes_ += bytes;
+        return true;
+    }
+
+    void pushEnd()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        ended_ = true;
+        if (ready_)
+            finish();
+    }
+
+    /// @brief: 连接断开, 丢弃缓存的分块和回调
+    ///         回调通常持有 UserUploadCallback, 不释放的话会和流循环引用
+    void close()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        releasePending();
+        onChunk_ = nullptr;
+        onEnd_   = nullptr;
+    }
+
+private:
+    void releasePending()
+    {
+        pending_.clear();
+        memory_->release(pendingBytes_);
+        pendingBytes_ = 0;
+    }
+
+    void finish()
+    {
+        auto onEnd = std::move(onEnd_);
+        onChunk_ = nullptr;
+        onEnd_   = nullptr;
+        if (onEnd)
+            onEnd();
+    }
+
+    void deliver(json::Value& chunk)
+    {
+        if (onChunk_)
+            onChunk_(chunk);
+    }
+
+    std::mutex               mutex_;
+    UploadMemoryPtr          memory_;
+    bool                     ready_ = false;
+    bool                     ended_ = false;
+    std::vector<json::Value> pending_;
+    size_t                   pendingBytes_ = 0;
+    UploadChunkCallback      onChunk_;
+    UploadEndCallback        onEnd_;
+};
+
+using UploadStreamPtr = std::shared_ptr<UploadStream>;
+
+/// @brief: 一个连接上正在进行的上传, 以请求的 id 为键
+///         分块可能比处理函数先到 (处理函数在别的线程注册), 所以两边谁先到谁创建,
+///         两边都到齐 (处理函数已经认领, 并且收到了结束帧) 之后从表中删除
+///         客户端可以给从不调用的 id 发分块, 所以还没有认领的流的个数和缓存的字节数都有上限,
+///         超过上限时 find()/end() 返回 nullptr, 服务器回应错误并关闭连接
+class UploadTable: noncopyable
+{
+public:
+    static const size_t kDefaultMaxUnclaimed    = 256;                 // 和每个连接的在途请求数上限相同
+    static const size_t kDefaultMaxPendingBytes = 100 * 1024 * 1024;   // 和单个消息的长度上限相同
+
+    explicit UploadTable(UploadMemoryCallback charge = nullptr,
+                         UploadMemoryCallback release = nullptr,
+                         size_t maxUnclaimed = kDefaultMaxUnclaimed,
+                         size_t maxPendingBytes = kDefaultMaxPendingBytes)
+    : memory_(std::make_shared<UploadMemory>(std::move(charge), std::move(release), maxPendingBytes)),
+      maxUnclaimed_(maxUnclaimed)
+    {}
+
+    /// @brief: 处理函数认领 id 对应的流
+    UploadStreamPtr claim(const json::Value& id)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto key = idKey(id);
+        auto& entry = entries_[key];
+        auto stream = getStream(entry);
+        entry.claimed = true;
+        if (entry.ended)
+            entries_.erase(key);
+        else
+            active_++;
+        return stream;
+    }
+
+    /// @brief: IO 线程收到 id 对应的分块
+    UploadStreamPtr find(const json::Value& id)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto entry = findOrCreate(idKey(id));
+        if (entry == nullptr)
+            return nullptr;
+        return getStream(*entry);
+    }
+
+    /// @brief: IO 线程收到 id 对应的结束帧
+    UploadStreamPtr end(const json::Value& id)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto key = idKey(id);
+        auto found = findOrCreate(key);
+        if (found == nullptr)
+            return nullptr;
+        auto& entry = *found;
+        auto stream = getStream(entry);
+        entry.ended = true;
+        if (entry.claimed) {
+            entries_.erase(key);
+            active_--;
+        }
+        return stream;
+    }
+
+    /// @brief: 已经认领但是还没有结束的上传数, 它们在等待后续的分块,
+    ///         不计入连接的在途请求数, 否则限流会让上传永远等不到分块
+    size_t active() const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return active_;
+    }
+
+    /// @brief: 连接断开时调用
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto& entry: entries_) {
+            if (entry.second.stream != nullptr)
+                entry.second.stream->close();
+        }
+        entries_.clear();
+        active_ = 0;
+    }
+
+private:
+    struct Entry
+    {
+        UploadStreamPtr stream;
+        bool            claimed = false;
+        bool            ended   = false;
+    };
+
+    const UploadStreamPtr& getStream(Entry& entry)
+    {
+        if (entry.stream == nullptr)
+            entry.stream = std::make_shared<UploadStream>(memory_);
+        return entry.stream;
+    }
+
+    /// @brief: 客户端的帧只能在未认领的流不超过上限时创建新的表项
+    ///         表中除了 active_ 个已经认领的, 其余都是还没有认领的
+    Entry* findOrCreate(const std::string& key)
+    {
+        auto it = entries_.find(key);
+        if (it != entries_.end())
+            return &it->second;
+        if (entries_.size() - active_ >= maxUnclaimed_)
+            return nullptr;
+        return &entries_[key];
+    }
+
+    mutable std::mutex                     mutex_;
+    UploadMemoryPtr                        memory_;
+    const size_t                           maxUnclaimed_;
+    size_t                                 active_ = 0;
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+using UploadTablePtr = std::shared_ptr<UploadTable>;
+
+/// @brief: 回应客户端的回调
+///         response_: 发送一个完整的 json-rpc 回应, 总是存在
+///         result_  : 可选的快速路径, 只需要 id 和 result, 
+///                    回应的信封 {"jsonrpc":"2.0",...} 由服务器直接写入输出缓冲区
+///         chunk_   : 可选, 流式回应的一个分块, 只有单个请求才有, 批量请求没有
+///         uploads_ : 可选, 连接上的上传表, 同样只有单个请求才有
+///         stats_   : 分派到方法时由 RpcService 设置, UserDoneCallback 据此记录调用的统计
+///         trace_   : RpcServer 为请求创建的 span, tracer_ 非空表示被采样, 结束时记录到 tracer_
+///         method_  : 由 Procedure::invoke 设置的 "Service.Method", 和 Procedure 的生命期相同
+///         后三项都由服务器在分派的途中设置, 每个请求有自己的 RpcDoneCallback, 所以分派时传非 const 的引用
+class RpcDoneCallback
+{
+public:
+    // implicit conversion from lambda is OK
+    template <typename Func,
+              typename = std::enable_if_t<!std::is_same_v<std::decay_t<Func>, RpcDoneCallback>>>
+    RpcDoneCallback(Func&& response, 
+                    RpcResultCallback result = nullptr,
+                    RpcChunkCallback chunk = nullptr,
+                    UploadTablePtr uploads = nullptr)
+    : response_(std::forward<Func>(response)),
+      result_(std::move(result)),
+      chunk_(std::move(chunk)),
+      uploads_(std::move(uploads))
     { }
 
-    void operator()(json::Value &&result) const
+    void operator()(json::Value response) const
+    { response_(std::move(response)); }
+
+    bool hasResultCallback() const
+    { return result_ != nullptr; }
+
+    void sendResult(const json::Value& id, const json::Value& result) const
+    {
+        assert(hasResultCallback());
+        result_(id, result);
+    }
+
+    bool hasChunkCallback() const
+    { return chunk_ != nullptr; }
+
+    bool sendChunk(const json::Value& id, const json::Value& chunk, const Task& resume) const
+    {
+        assert(hasChunkCallback());
+        return chunk_(id, chunk, resume);
+    }
+
+    const UploadTablePtr& uploads() const
+    { return uploads_; }
+
+    /// @brief: 在复制给 UserDoneCallback 之前设置, 避免为了统计多复制一次回调
+    void attachStats(MethodStats* stats, int64_t receivedAt)
+    {
+        stats_ = stats;
+        receivedAt_ = receivedAt;
+    }
+
+    MethodStats* stats() const
+    { return stats_; }
+
+    int64_t receivedAt() const
+    { return receivedAt_; }
+
+    /// @brief: 和 attachStats() 一样在复制之前设置
+    void attachTrace(const TraceContext& trace, TraceRecorder* tracer)
     {
-        json::Value response(json::TYPE_OBJECT);
-        response.addMember("jsonrpc", "2.0");
-        response.addMember("id", request_["id"]);
-        response.addMember("result", result);
-        // 这个callback_ 才是最后的 回应客户端
-        callback_(response);
+        trace_ = trace;
+        tracer_ = tracer;
     }
 
+    const TraceContext& trace() const
+    { return trace_; }
+
+    void attachMethod(const char* method)
+    { method_ = method; }
+
+    const char* method() const
+    { return method_; }
+
+    /// @brief: 被采样时记录这个请求的 span, error 是 JSON-RPC 错误码, 0 表示成功
+    void recordSpan(const json::Value& request,
+                    int64_t queue, int64_t handler, int64_t serialize, int error) const;
+
 private:
+    RpcResponseCallback    response_;
+    RpcResultCallback      result_;
+    RpcChunkCallback       chunk_;
+    UploadTablePtr         uploads_;
+    MethodStats*           stats_      = nullptr;
+    int64_t                receivedAt_ = 0;     // MethodStats::now()
+    TraceContext           trace_;
+    TraceRecorder*         tracer_     = nullptr;
+    const char*            method_     = nullptr;
+};
+
+class UserDoneCallback
+{
+public:
+    UserDoneCallback(json::Value &request, 
+                     const RpcDoneCallback &callback,
+                     Priority priority = kPriorityNormal);
+
+    void operator()(json::Value &&result) const;
+
+    /// @brief: 这个请求在本服务器上的 span, 请求没有被追踪时 valid() 为 false
+    ///         处理函数调用下游服务时把它传给 client stub, 下游的 span 以它为 parent
+    const TraceContext& trace() const
+    { return callback_.trace(); }
+
+    /// @brief: "Service.Method", 在其他线程中执行处理函数时作为 profiler 的标签
+    const char* method() const
+    { return callback_.method(); }
+
+    /// @brief: spec.json 中声明的方法优先级, 提交到 ThreadPool 时使用
+    ///         pool.runTask(task, done.priority())
+    Priority priority() const
+    { return priority_; }
+
+    /// @brief: 客户端已经不再等待这个回应
+    bool expired() const
+    { return requestExpired(request_); }
+
+    /// @brief: 在线程池等队列中出队时调用, 过期的请求直接回应 RPC_DEADLINE_EXCEEDED,
+    ///         返回 true 表示调用者不应该再执行处理函数
+    ///         出队的时刻也是处理函数开始执行的时刻, 之前的时间都算作排队
+    bool rejectIfExpired() const;
+
+protected:
     mutable json::Value request_;
-    RpcDoneCallback callback_;
+    RpcDoneCallback     callback_;
+    Priority            priority_;
+    mutable int64_t     startedAt_; // 处理函数开始执行的时刻, MethodStats::now()
+};
+
+/// @brief: 流式回应, 处理函数可以多次调用 write() 发送分块, 最后调用 operator() 结束
+///         每个分块都是一个独立的消息 {"jsonrpc":"2.0","chunk":[chunk],"id":[id]},
+///         所以整个结果不需要在内存中构造, 也不受单个消息长度的限制
+class UserStreamCallback: public UserDoneCallback
+{
+public:
+    UserStreamCallback(json::Value &request,
+                       const RpcDoneCallback &callback,
+                       Priority priority = kPriorityNormal)
+    : UserDoneCallback(request, callback, priority)
+    {
+        if (!callback.hasChunkCallback())
+            throw RequestException(RPC_INVALID_REQUEST,
+                                   request["id"],
+                                   "stream method is not allowed in batch request");
+    }
+
+    /// @brief: 发送一个分块, 线程安全
+    /// @return: 返回 false 表示连接的输出缓冲区已经超过高水位, 应该停止写入,
+    ///          等输出缓冲区写完之后, @c resume 会在 IO 线程中被回调一次;
+    ///          连接已断开时也返回 false, 此时 @c resume 不会被回调
+    bool write(json::Value &&chunk, const Task& resume = nullptr) const
+    {
+        return callback_.sendChunk(request_["id"], chunk, resume);
+    }
+};
+
+/// @brief: 上传请求, params 之外的数据由客户端分块发送, 服务器收到一块交付一块,
+///         整个请求不需要在输入缓冲区中攒齐, 也不受单个消息长度的限制
+///         处理函数调用 onUpload() 注册回调, 在 onEnd 中调用 operator() 回应
+class UserUploadCallback: public UserDoneCallback
+{
+public:
+    UserUploadCallback(json::Value &request,
+                       const RpcDoneCallback &callback,
+                       Priority priority = kPriorityNormal)
+    : UserDoneCallback(request, callback, priority)
+    {
+        if (callback.uploads() == nullptr)
+            throw RequestException(RPC_INVALID_REQUEST,
+                                   request["id"],
+                                   "upload method is not allowed in batch request");
+        stream_ = callback.uploads()->claim(request["id"]);
+    }
+
+    /// @brief: 只能调用一次, 之前已经到达的分块会在这里立即交付
+    void onUpload(UploadChunkCallback onChunk, UploadEndCallback onEnd) const
+    {
+        stream_->setCallbacks(std::move(onChunk), std::move(onEnd));
+    }
+
+private:
+    UploadStreamPtr stream_;
 };
 
 }